@@ -0,0 +1,486 @@
+// benchmark.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/app/tinywin.hpp>
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/directory_encryption_engine.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/file_encryption_engine.hpp>
+#include <fcrypt/crypt/job_journal.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <fcrypt/fs/page.hpp>
+#include <winioctl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Note: The benchmark measures the throughput of the library in several matrices and writes
+//       the results as JSON, so two runs (e.g. before and after a change) can be compared by a script.
+//       Usage: benchmark [--output <file>] [--directory <dir>] [--max-size <MiB>] [--min-time <ms>]
+//       If the library is compiled with _FCRYPT_STAGE_STATS (and _FCRYPT_HARDWARE_COUNTERS), the results
+//       of file_encryption_engine also contain the time (and cycles per byte) of every stage.
+
+namespace fcrypt {
+    struct _Bench_options {
+        path output; // empty if the results should be written to the standard output
+        path directory; // the directory for the generated test files
+        uint64_t max_size = 1073741824; // the largest generated file (1 GiB)
+        uint64_t min_time = 500; // the minimum duration of a single measurement (in milliseconds)
+    };
+
+    class _Bench_record { // stores a single result as a JSON object
+    public:
+        explicit _Bench_record(const char* const _Suite) : _Mybody("{\"suite\": \"") {
+            _Mybody += _Suite;
+            _Mybody += '"';
+        }
+
+        void add(const char* const _Name, const char* const _Value) {
+            _Append_name(_Name);
+            _Mybody += '"';
+            _Mybody += _Value;
+            _Mybody += '"';
+        }
+
+        void add(const char* const _Name, const uint64_t _Value) {
+            _Append_name(_Name);
+            _Mybody += ::std::to_string(_Value);
+        }
+
+        void add(const char* const _Name, const double _Value) {
+            char _Buf[64];
+            ::snprintf(_Buf, sizeof(_Buf), "%.3f", _Value);
+            _Append_name(_Name);
+            _Mybody += _Buf;
+        }
+
+        ::std::string str() const {
+            return _Mybody + '}';
+        }
+
+    private:
+        void _Append_name(const char* const _Name) {
+            _Mybody += ", \"";
+            _Mybody += _Name;
+            _Mybody += "\": ";
+        }
+
+        ::std::string _Mybody;
+    };
+
+    struct _Bench_timing {
+        uint64_t iterations = 0;
+        double seconds      = 0.0;
+    };
+
+    // runs _Func until the minimum time elapses, stops early if _Func fails
+    template <class _Fn>
+    _Bench_timing _Measure(const uint64_t _Min_time, _Fn _Func) {
+        using _Clock      = ::std::chrono::steady_clock;
+        const auto _Start = _Clock::now();
+        const auto _Limit = ::std::chrono::milliseconds{_Min_time};
+        _Bench_timing _Result;
+        do {
+            if (!_Func()) {
+                return _Bench_timing{};
+            }
+
+            ++_Result.iterations;
+        } while (_Clock::now() - _Start < _Limit);
+
+        _Result.seconds = ::std::chrono::duration<double>(_Clock::now() - _Start).count();
+        return _Result;
+    }
+
+    // returns the throughput in MB/s
+    double _Throughput(const uint64_t _Bytes_per_iteration, const _Bench_timing& _Timing) noexcept {
+        if (_Timing.seconds <= 0.0) { // the measurement failed
+            return 0.0;
+        }
+
+        return static_cast<double>(_Bytes_per_iteration) * static_cast<double>(_Timing.iterations)
+            / _Timing.seconds / 1000000.0;
+    }
+
+    const char* _Backend_name(const encryption_backend _Backend) noexcept {
+        return _Backend == encryption_backend::botan ? "botan" : "openssl";
+    }
+
+    const char* _Mode_name(const io_mode _Mode) noexcept {
+        return _Mode == io_mode::mapped ? "mapped" : "buffered";
+    }
+
+    // adds the statistics of every stage that has been called
+    void _Add_stage_stats(_Bench_record& _Record, const stage_stats& _Stats) {
+        for (size_t _Idx = 0; _Idx < stage_stats::stage_count; ++_Idx) {
+            const stage _Stage = static_cast<stage>(_Idx);
+            if (_Stats.calls_of(_Stage) == 0) {
+                continue;
+            }
+
+            const ::std::string _Prefix = stage_name(_Stage);
+            _Record.add((_Prefix + "_calls").c_str(), _Stats.calls_of(_Stage));
+            _Record.add((_Prefix + "_ms").c_str(), static_cast<double>(_Stats.nanoseconds_of(_Stage)) / 1000000.0);
+            if (hardware_counters_available()) {
+                _Record.add((_Prefix + "_cycles_per_byte").c_str(), _Stats.cycles_per_byte(_Stage));
+                _Record.add((_Prefix + "_instructions_per_cycle").c_str(), _Stats.instructions_per_cycle(_Stage));
+                _Record.add((_Prefix + "_cache_misses").c_str(), _Stats.cache_misses_of(_Stage));
+            }
+        }
+
+        if (hardware_counters_available()) {
+            _Record.add("page_faults", _Stats.page_faults);
+        }
+    }
+
+    bool _Create_sparse_file(const path& _Target, const uint64_t _Size) noexcept {
+        file _File(_Target, open_mode::create_always);
+        if (!_File.is_open()) {
+            return false;
+        }
+
+        // Note: A sparse file is created instantly and occupies no disk space until it is written,
+        //       so even multi-gigabyte inputs can be generated. Its contents read as zeros.
+        DWORD _Bytes = 0;
+        ::DeviceIoControl(_File.native_handle(), FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &_Bytes, nullptr);
+        return _File.resize(_Size);
+    }
+
+    void _Bench_engines(const _Bench_options& _Options, ::std::vector<::std::string>& _Results) {
+        constexpr size_t _Buffer_sizes[]        = {64, 1024, 4096, 65536, 1048576, 16777216};
+        constexpr encryption_backend _Backends[] = {encryption_backend::openssl, encryption_backend::botan};
+        const key _Key                     = key::generate();
+        const iv _Iv                       = iv::generate();
+        const encryption_backend _Previous = bound_encryption_backend(); // restored after the measurements
+        for (const encryption_backend _Backend : _Backends) {
+            bind_encryption_backend(_Backend);
+            const ::std::unique_ptr<encryption_engine> _Engine(make_encryption_engine(encryption_engine::aes256_gcm));
+            if (!_Engine) { // the backend is not available
+                continue;
+            }
+
+            for (const size_t _Size : _Buffer_sizes) {
+                ::std::vector<byte_t> _Buf(_Size);
+                const _Bench_timing _Encryption = _Measure(_Options.min_time, [&] {
+                    authentication_tag _Tag;
+                    return _Engine->setup_encryption(_Key, _Iv) && _Engine->encrypt(_Buf.data(), _Size, _Buf.data())
+                        && _Engine->complete_encryption(_Tag);
+                });
+                const _Bench_timing _Decryption = _Measure(_Options.min_time, [&] {
+                    authentication_tag _Tag; // the tag never matches, only the cost of the call is measured
+                    const bool _Result = _Engine->setup_decryption(_Key, _Iv)
+                        && _Engine->decrypt(_Buf.data(), _Size, _Buf.data());
+                    _Engine->complete_decryption(_Tag);
+                    return _Result;
+                });
+                _Bench_record _Record("encryption_engine");
+                _Record.add("backend", _Backend_name(_Backend));
+                _Record.add("buffer_size", static_cast<uint64_t>(_Size));
+                _Record.add("encrypt_mbps", _Throughput(_Size, _Encryption));
+                _Record.add("decrypt_mbps", _Throughput(_Size, _Decryption));
+                _Results.push_back(_Record.str());
+            }
+        }
+
+        bind_encryption_backend(_Previous);
+    }
+
+    void _Bench_page_iterator(const _Bench_options& _Options, ::std::vector<::std::string>& _Results) {
+        constexpr uint64_t _Size = 268435456; // 256 MiB
+        const path _Target       = _Options.directory / L"fcrypt_bench_pages.bin";
+        if (!_Create_sparse_file(_Target, _Size)) {
+            return;
+        }
+
+        uint64_t _Pages = 0;
+        {
+            file _File(_Target);
+            page_iterator _Iter(_File);
+            const _Bench_timing _Timing = _Measure(_Options.min_time, [&] {
+                _Iter.reset();
+                _Pages = 0;
+                while (_Iter.next()) {
+                    ++_Pages;
+                }
+
+                return _Pages != 0;
+            });
+            _Bench_record _Record("page_iterator");
+            _Record.add("file_size", _Size);
+            _Record.add("pages", _Pages);
+            _Record.add("read_mbps", _Throughput(_Size, _Timing));
+            _Record.add("ns_per_page", _Timing.iterations != 0 && _Pages != 0
+                ? _Timing.seconds * 1e9 / static_cast<double>(_Timing.iterations * _Pages) : 0.0);
+            _Results.push_back(_Record.str());
+        }
+
+        ::std::error_code _Error;
+        ::std::filesystem::remove(_Target, _Error);
+    }
+
+    void _Bench_file_engine(const _Bench_options& _Options, ::std::vector<::std::string>& _Results) {
+        constexpr uint64_t _File_sizes[] = {0, 4096, 1048576, 67108864, 1073741824, 4294967296};
+        constexpr io_mode _Modes[]       = {io_mode::buffered, io_mode::mapped};
+        const path _Target               = _Options.directory / L"fcrypt_bench_file.bin";
+        const ::std::unique_ptr<encryption_engine> _Engine(make_encryption_engine(encryption_engine::aes256_gcm));
+        if (!_Engine) {
+            return;
+        }
+
+        const key _Key = key::generate();
+        const iv _Iv   = iv::generate();
+        for (const uint64_t _Size : _File_sizes) {
+            if (_Size > _Options.max_size) {
+                continue;
+            }
+
+            for (const io_mode _Mode : _Modes) {
+                if (!_Create_sparse_file(_Target, _Size)) {
+                    return;
+                }
+
+                // Note: Every encryption is followed by a decryption, so each iteration starts with
+                //       the same file. Large files are processed once, small ones are repeated.
+                file _File(_Target);
+                file_encryption_engine _File_engine(_File, _Engine.get(), _Mode);
+                authentication_tag _Tag;
+                _Bench_timing _Encryption;
+                _Bench_timing _Decryption;
+                stage_stats _Stats; // empty if the statistics are disabled
+                const _Bench_timing _Total = _Measure(_Options.min_time, [&] {
+                    using _Clock      = ::std::chrono::steady_clock;
+                    const auto _Start = _Clock::now();
+                    if (!_File_engine.encrypt(_Key, _Iv, _Tag)) {
+                        return false;
+                    }
+
+                    const auto _Middle = _Clock::now();
+                    _Stats += _File_engine.stats();
+                    if (!_File_engine.decrypt(_Key, _Iv, _Tag)) {
+                        return false;
+                    }
+
+                    const auto _End = _Clock::now();
+                    _Stats         += _File_engine.stats();
+                    _Encryption.seconds += ::std::chrono::duration<double>(_Middle - _Start).count();
+                    _Decryption.seconds += ::std::chrono::duration<double>(_End - _Middle).count();
+                    ++_Encryption.iterations;
+                    ++_Decryption.iterations;
+                    return true;
+                });
+                _Bench_record _Record("file_encryption_engine");
+                _Record.add("io_mode", _Mode_name(_Mode));
+                _Record.add("file_size", _Size);
+                _Record.add("iterations", _Total.iterations);
+                _Record.add("encrypt_ms", _Encryption.iterations != 0
+                    ? _Encryption.seconds * 1000.0 / static_cast<double>(_Encryption.iterations) : 0.0);
+                _Record.add("decrypt_ms", _Decryption.iterations != 0
+                    ? _Decryption.seconds * 1000.0 / static_cast<double>(_Decryption.iterations) : 0.0);
+                _Record.add("encrypt_mbps", _Throughput(_Size, _Encryption));
+                _Record.add("decrypt_mbps", _Throughput(_Size, _Decryption));
+                _Add_stage_stats(_Record, _Stats);
+                _Results.push_back(_Record.str());
+            }
+        }
+
+        ::std::error_code _Error;
+        ::std::filesystem::remove(_Target, _Error);
+    }
+
+    void _Bench_directory_journal(const _Bench_options& _Options, ::std::vector<::std::string>& _Results) {
+        constexpr size_t _Small_count  = 1024;
+        constexpr uint64_t _Small_size = 65536; // 64 KiB
+        constexpr size_t _Large_count  = 8;
+        constexpr uint64_t _Large_size = 16777216; // 16 MiB
+        const path _Root               = _Options.directory / L"fcrypt_bench_tree";
+        const path _Journal_path       = _Options.directory / L"fcrypt_bench_tree.journal";
+        ::std::error_code _Error;
+        ::std::filesystem::remove_all(_Root, _Error);
+        if (!::std::filesystem::create_directory(_Root, _Error)) {
+            return;
+        }
+
+        uint64_t _Total_size = 0;
+        size_t _Files        = 0;
+        for (size_t _Idx = 0; _Idx < _Small_count + _Large_count; ++_Idx) {
+            const uint64_t _Size = _Idx < _Small_count ? _Small_size : _Large_size;
+            if (_Size > _Options.max_size) {
+                continue;
+            }
+
+            if (!_Create_sparse_file(_Root / (L"file" + ::std::to_wstring(_Idx) + L".bin"), _Size)) {
+                ::std::filesystem::remove_all(_Root, _Error);
+                return;
+            }
+
+            _Total_size += _Size;
+            ++_Files;
+        }
+
+        // Note: Every iteration encrypts and decrypts the whole tree, once without and once with a job
+        //       journal, so the overhead of the journal (the recorded files and the states written
+        //       before every region) is measured on the same files. Both jobs derive their keys.
+        //       A journaled job writes the files in whole regions instead of pages, so the overhead
+        //       includes the difference between the two ways of writing and may be negative.
+        directory_encryption_engine _Engine(_Root, encryption_engine::aes256_gcm);
+        const auto _Run_job = [&](const bool _Journaled, _Bench_timing& _Timing) {
+            using _Clock = ::std::chrono::steady_clock;
+            ::std::unique_ptr<job_journal> _Journal;
+            if (_Journaled) {
+                _Journal = ::std::make_unique<job_journal>(_Journal_path);
+            }
+
+            const auto _Start = _Clock::now();
+            ::std::vector<file_result> _Job_results = _Engine.encrypt(L"fcrypt benchmark password", nullptr,
+                _Journal.get());
+            bool _Success = _Job_results.size() == _Files;
+            for (const file_result& _Result : _Job_results) {
+                _Success = _Success && _Result.success;
+            }
+
+            if (_Journaled) {
+                _Journal = ::std::make_unique<job_journal>(_Journal_path); // the finished job removes its journal
+            }
+
+            _Job_results = _Engine.decrypt(L"fcrypt benchmark password", nullptr, _Journal.get());
+            _Success     = _Success && _Job_results.size() == _Files;
+            for (const file_result& _Result : _Job_results) {
+                _Success = _Success && _Result.success;
+            }
+
+            _Timing.seconds += ::std::chrono::duration<double>(_Clock::now() - _Start).count();
+            ++_Timing.iterations;
+            return _Success;
+        };
+        _Bench_timing _Plain;
+        _Bench_timing _Journaled;
+        _Bench_timing _Warmup; // the first job fills the sparse files and the cache, so it is not measured
+        if (!_Run_job(false, _Warmup)) {
+            ::std::filesystem::remove_all(_Root, _Error);
+            return;
+        }
+
+        const _Bench_timing _Total = _Measure(_Options.min_time, [&] {
+            return _Run_job(false, _Plain) && _Run_job(true, _Journaled);
+        });
+        const double _Plain_ms = _Plain.iterations != 0
+            ? _Plain.seconds * 1000.0 / static_cast<double>(_Plain.iterations) : 0.0;
+        const double _Journaled_ms = _Journaled.iterations != 0
+            ? _Journaled.seconds * 1000.0 / static_cast<double>(_Journaled.iterations) : 0.0;
+        _Bench_record _Record("directory_journal");
+        _Record.add("files", static_cast<uint64_t>(_Files));
+        _Record.add("tree_size", _Total_size);
+        _Record.add("iterations", _Total.iterations);
+        _Record.add("plain_ms", _Plain_ms);
+        _Record.add("journaled_ms", _Journaled_ms);
+        _Record.add("overhead_percent", _Total.iterations != 0 && _Plain_ms > 0.0
+            ? (_Journaled_ms - _Plain_ms) * 100.0 / _Plain_ms : 0.0);
+        _Results.push_back(_Record.str());
+        ::std::filesystem::remove_all(_Root, _Error);
+        path _Bitmap_path = _Journal_path;
+        _Bitmap_path     += L".bitmap";
+        ::std::filesystem::remove(_Journal_path, _Error); // left only if a job failed
+        ::std::filesystem::remove(_Bitmap_path, _Error);
+    }
+
+    void _Bench_derive_key(const _Bench_options& _Options, ::std::vector<::std::string>& _Results) {
+        constexpr size_t _Rounds = 5;
+        const salt _Salt         = salt::generate();
+        double _Best             = 0.0;
+        double _Total            = 0.0;
+        for (size_t _Round = 0; _Round < _Rounds; ++_Round) {
+            const auto _Start = ::std::chrono::steady_clock::now();
+            const key _Key    = derive_key(L"fcrypt benchmark password", _Salt);
+            const double _Ms  =
+                ::std::chrono::duration<double, ::std::milli>(::std::chrono::steady_clock::now() - _Start).count();
+            if (!_Key.valid()) { // the derivation failed
+                return;
+            }
+
+            _Best   = _Round == 0 ? _Ms : (::std::min)(_Best, _Ms);
+            _Total += _Ms;
+        }
+
+        _Bench_record _Record("derive_key");
+        _Record.add("rounds", static_cast<uint64_t>(_Rounds));
+        _Record.add("best_ms", _Best);
+        _Record.add("mean_ms", _Total / _Rounds);
+        _Results.push_back(_Record.str());
+    }
+
+    bool _Parse_options(const int _Count, wchar_t** const _Args, _Bench_options& _Options) {
+        wchar_t _Temp[MAX_PATH + 1] = {L'\0'};
+        if (::GetTempPathW(MAX_PATH + 1, _Temp) != 0) {
+            _Options.directory = _Temp;
+        }
+
+        for (int _Idx = 1; _Idx < _Count; ++_Idx) {
+            if (_Idx + 1 == _Count) { // every option requires a value
+                return false;
+            }
+
+            const wchar_t* const _Value = _Args[_Idx + 1];
+            if (::wcscmp(_Args[_Idx], L"--output") == 0) {
+                _Options.output = _Value;
+            } else if (::wcscmp(_Args[_Idx], L"--directory") == 0) {
+                _Options.directory = _Value;
+            } else if (::wcscmp(_Args[_Idx], L"--max-size") == 0) {
+                _Options.max_size = ::wcstoull(_Value, nullptr, 10) * 1048576;
+            } else if (::wcscmp(_Args[_Idx], L"--min-time") == 0) {
+                _Options.min_time = ::wcstoull(_Value, nullptr, 10);
+            } else {
+                return false;
+            }
+
+            ++_Idx;
+        }
+
+        return true;
+    }
+
+    bool _Write_results(const _Bench_options& _Options, const ::std::vector<::std::string>& _Results) {
+        ::std::string _Json = "{\n  \"version\": 1,\n  \"min_time_ms\": " + ::std::to_string(_Options.min_time)
+            + ",\n  \"results\": [\n";
+        for (size_t _Idx = 0; _Idx < _Results.size(); ++_Idx) {
+            _Json += "    " + _Results[_Idx] + (_Idx + 1 < _Results.size() ? ",\n" : "\n");
+        }
+
+        _Json += "  ]\n}\n";
+        if (_Options.output.empty()) {
+            return ::fwrite(_Json.data(), 1, _Json.size(), stdout) == _Json.size();
+        }
+
+        file _Output(_Options.output, open_mode::create_always);
+        return _Output.is_open()
+            && _Output.write(byte_string_view{reinterpret_cast<const byte_t*>(_Json.data()), _Json.size()});
+    }
+} // namespace fcrypt
+
+int wmain(int _Count, wchar_t** _Args) {
+    fcrypt::_Bench_options _Options;
+    if (!fcrypt::_Parse_options(_Count, _Args, _Options)) {
+        ::fputws(L"usage: benchmark [--output <file>] [--directory <dir>] [--max-size <MiB>] [--min-time <ms>]\n",
+            stderr);
+        return 1;
+    }
+
+    ::std::vector<::std::string> _Results;
+    fcrypt::_Bench_engines(_Options, _Results);
+    fcrypt::_Bench_page_iterator(_Options, _Results);
+    fcrypt::_Bench_file_engine(_Options, _Results);
+    fcrypt::_Bench_directory_journal(_Options, _Results);
+    fcrypt::_Bench_derive_key(_Options, _Results);
+    return fcrypt::_Write_results(_Options, _Results) ? 0 : 1;
+}
\ No newline at end of file
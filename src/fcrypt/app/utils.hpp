@@ -108,6 +108,25 @@ namespace fcrypt {
         byte_t _Mydata[_Size];
     };
 
+    template <class _Ty>
+    inline void _Store_little_endian(byte_t* const _Bytes, const _Ty _Value) noexcept {
+        static_assert(::std::is_unsigned_v<_Ty>, "unsigned integer required");
+        for (size_t _Idx = 0; _Idx < sizeof(_Ty); ++_Idx) {
+            _Bytes[_Idx] = static_cast<byte_t>(_Value >> (_Idx * 8));
+        }
+    }
+
+    template <class _Ty>
+    inline _Ty _Load_little_endian(const byte_t* const _Bytes) noexcept {
+        static_assert(::std::is_unsigned_v<_Ty>, "unsigned integer required");
+        _Ty _Result = 0;
+        for (size_t _Idx = 0; _Idx < sizeof(_Ty); ++_Idx) {
+            _Result |= static_cast<_Ty>(static_cast<_Ty>(_Bytes[_Idx]) << (_Idx * 8));
+        }
+
+        return _Result;
+    }
+
     template <class _Ty>
     constexpr bool _Has_bits(const _Ty _Bitmask, const _Ty _Bits) noexcept {
         return (_Bitmask & _Bits) != _Ty{0};
@@ -0,0 +1,210 @@
+// batch_encryption_engine.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/batch_encryption_engine.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+
+namespace fcrypt {
+    batch_write_observer::batch_write_observer() noexcept {}
+
+    batch_write_observer::~batch_write_observer() noexcept {}
+
+    batch_encryption_engine::batch_encryption_engine(const encryption_engine::id _Id)
+        : _Myid(_Id), _Myeng(make_encryption_engine(_Id)), _Mylanes() {}
+
+    batch_encryption_engine::~batch_encryption_engine() noexcept {}
+
+    bool batch_encryption_engine::valid() const noexcept {
+        return _Myeng != nullptr;
+    }
+
+    bool batch_encryption_engine::accepts(const uint64_t _Size) noexcept {
+        return _Size <= max_file_size;
+    }
+
+    bool batch_encryption_engine::_Read_lane(
+        _Lane& _Current, const path& _Target, const uint64_t _Max_size) {
+        _Current._File = ::std::make_unique<file>(_Target);
+        if (!_Current._File->is_open()) {
+            return false;
+        }
+
+        const uint64_t _Size = _Current._File->size();
+        if (_Size > _Max_size) { // the file is too large for the batch
+            return false;
+        }
+
+        _Current._Size = static_cast<size_t>(_Size);
+        _Current._Buf.resize(_Current._Size + metadata::size); // reserve space for the metadata
+        if (_Current._Size == 0) { // nothing to read, do nothing
+            return true;
+        }
+
+        _Stage_timer _Timer(stage::read, _Current._Size);
+        return _Current._File->read(_Current._Buf.data(), _Current._Size) == _Current._Size;
+    }
+
+    bool batch_encryption_engine::_Write_lane(_Lane& _Current, const size_t _Count) noexcept {
+        file& _File = *_Current._File;
+        if (_File.size() == 0) { // seek() fails on empty files
+            if (!_File.seek_for_append()) {
+                return false;
+            }
+        } else {
+            if (!_File.seek(0)) {
+                return false;
+            }
+        }
+
+        _Stage_timer _Timer(stage::write, _Count);
+        return _File.write(byte_string_view{_Current._Buf.data(), _Count});
+    }
+
+    void batch_encryption_engine::_Release_lane(_Lane& _Current) noexcept {
+        if (!_Current._Buf.empty()) {
+            _Scrub_memory(_Current._Buf.data(), _Current._Buf.size());
+            _Current._Buf.clear();
+        }
+
+        _Current._File.reset();
+        _Current._Size = 0;
+    }
+
+    bool batch_encryption_engine::_Encrypt_lane(
+        _Lane& _Current, const key& _Key, const salt& _Salt) noexcept {
+        metadata& _Meta = _Current._Meta;
+        _Meta.generate(); // every file must get its own IV
+        _Meta.get_salt()                 = _Salt;
+        _Meta.get_encryption_engine_id() = _Myid;
+        if (!_Myeng->setup_encryption(_Key, _Meta.get_iv())) {
+            return false;
+        }
+
+        _Stage_timer _Timer(stage::cipher, _Current._Size);
+        byte_t* const _Data = _Current._Buf.data();
+        if (!_Myeng->encrypt(_Data, _Current._Size, _Data)) {
+            return false;
+        }
+
+        if (!_Myeng->complete_encryption(_Meta.get_tag())) {
+            return false;
+        }
+
+        return _Meta.save(_Data + _Current._Size, metadata::size);
+    }
+
+    bool batch_encryption_engine::_Decrypt_lane(_Lane& _Current, const key& _Key) noexcept {
+        metadata& _Meta     = _Current._Meta;
+        byte_t* const _Data = _Current._Buf.data();
+        if (!_Meta.extract(_Data, _Current._Size)) {
+            return false;
+        }
+
+        if (_Meta.get_encryption_engine_id() != _Myid) { // encrypted by another engine
+            return false;
+        }
+
+        _Current._Size -= metadata::size; // the rest of the buffer contains the ciphertext
+        _Stage_timer _Timer(stage::cipher, _Current._Size);
+        if (!_Myeng->setup_decryption(_Key, _Meta.get_iv())) {
+            return false;
+        }
+
+        if (!_Myeng->decrypt(_Data, _Current._Size, _Data)) {
+            return false;
+        }
+
+        // Note: Unlike file_encryption_engine, the file remains untouched if the tag does not match,
+        //       because the plaintext is written back only after a successful verification.
+        return _Myeng->complete_decryption(_Meta.get_tag());
+    }
+
+    ::std::vector<bool> batch_encryption_engine::encrypt(const ::std::vector<path>& _Files, const key& _Key,
+        const salt& _Salt, batch_write_observer* const _Observer) {
+        ::std::vector<bool> _Results(_Files.size(), false);
+        if (!_Myeng) {
+            return _Results;
+        }
+
+        for (size_t _First = 0; _First < _Files.size(); _First += lanes) {
+            const size_t _Count = _Min(lanes, _Files.size() - _First);
+            for (size_t _Idx = 0; _Idx < _Count; ++_Idx) { // read the whole group
+                _Mylanes[_Idx]._Success = _Read_lane(
+                    _Mylanes[_Idx], _Files[_First + _Idx], max_file_size);
+            }
+
+            for (size_t _Idx = 0; _Idx < _Count; ++_Idx) { // encrypt the whole group
+                _Lane& _Current = _Mylanes[_Idx];
+                if (_Current._Success) {
+                    _Current._Success = _Encrypt_lane(_Current, _Key, _Salt);
+                }
+            }
+
+            if (_Observer) { // the observer sees the whole group before any file is written
+                batch_write _Writes[lanes];
+                size_t _Written = 0;
+                for (size_t _Idx = 0; _Idx < _Count; ++_Idx) {
+                    _Lane& _Current = _Mylanes[_Idx];
+                    if (_Current._Success) {
+                        _Writes[_Written++] = batch_write{
+                            _First + _Idx, &_Current._Meta.get_iv(), _Current._Buf.data(), _Current._Size};
+                    }
+                }
+
+                if (_Written != 0 && !_Observer->on_write(_Writes, _Written)) {
+                    for (size_t _Idx = 0; _Idx < _Count; ++_Idx) {
+                        _Mylanes[_Idx]._Success = false;
+                    }
+                }
+            }
+
+            for (size_t _Idx = 0; _Idx < _Count; ++_Idx) { // write back the whole group
+                _Lane& _Current = _Mylanes[_Idx];
+                if (_Current._Success) {
+                    _Results[_First + _Idx] = _Write_lane(_Current, _Current._Size + metadata::size);
+                }
+
+                _Release_lane(_Current);
+            }
+        }
+
+        return _Results;
+    }
+
+    ::std::vector<bool> batch_encryption_engine::decrypt(
+        const ::std::vector<path>& _Files, const key& _Key) {
+        ::std::vector<bool> _Results(_Files.size(), false);
+        if (!_Myeng) {
+            return _Results;
+        }
+
+        for (size_t _First = 0; _First < _Files.size(); _First += lanes) {
+            const size_t _Count = _Min(lanes, _Files.size() - _First);
+            for (size_t _Idx = 0; _Idx < _Count; ++_Idx) { // read the whole group
+                _Mylanes[_Idx]._Success = _Read_lane(
+                    _Mylanes[_Idx], _Files[_First + _Idx], max_file_size + metadata::size);
+            }
+
+            for (size_t _Idx = 0; _Idx < _Count; ++_Idx) { // decrypt the whole group
+                _Lane& _Current = _Mylanes[_Idx];
+                if (_Current._Success) {
+                    _Current._Success = _Decrypt_lane(_Current, _Key);
+                }
+            }
+
+            for (size_t _Idx = 0; _Idx < _Count; ++_Idx) { // write back the whole group
+                _Lane& _Current = _Mylanes[_Idx];
+                if (_Current._Success) {
+                    _Results[_First + _Idx] = _Write_lane(_Current, _Current._Size)
+                        && _Current._File->resize(static_cast<uint64_t>(_Current._Size));
+                }
+
+                _Release_lane(_Current);
+            }
+        }
+
+        return _Results;
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,95 @@
+// batch_encryption_engine.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_BATCH_ENCRYPTION_ENGINE_HPP_
+#define _FCRYPT_CRYPT_BATCH_ENCRYPTION_ENGINE_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/file_encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace fcrypt {
+    // Note: Small files cannot keep the cipher busy, their cost is dominated by the per-file setup,
+    //       the page loop and the separate metadata write. The batch engine reuses one engine for
+    //       all files, processes them in groups of "lanes" files, and reads and writes every file
+    //       with a single call (the metadata is written together with the data).
+
+    struct batch_write { // a file that is about to be written back by the batch
+        size_t file = 0; // the position of the file in the batch
+        const iv* file_iv = nullptr;
+        const byte_t* data = nullptr; // the encrypted data (without the metadata)
+        size_t size = 0;
+    };
+
+    class __declspec(novtable) batch_write_observer { // base class for all batch write observers
+    public:
+        batch_write_observer() noexcept;
+        virtual ~batch_write_observer() noexcept;
+
+        // called before a group is written back, nothing is written if it returns false
+        virtual bool on_write(const batch_write* const _Writes, const size_t _Count) noexcept = 0;
+    };
+
+    class batch_encryption_engine { // encrypts many small files with a shared key
+    public:
+        explicit batch_encryption_engine(const encryption_engine::id _Id);
+        ~batch_encryption_engine() noexcept;
+
+        batch_encryption_engine(const batch_encryption_engine&) = delete;
+        batch_encryption_engine& operator=(const batch_encryption_engine&) = delete;
+
+        static constexpr size_t lanes           = 8; // number of files processed in a single group
+        static constexpr uint64_t max_file_size = 1048576; // 1 MiB, larger files are not accepted
+
+        // checks if the engine is ready to use
+        bool valid() const noexcept;
+
+        // checks if a file of the specified size can be processed by the batch
+        static bool accepts(const uint64_t _Size) noexcept;
+
+        // tries to encrypt the files, returns the per-file results, _Observer (if any) sees every group
+        ::std::vector<bool> encrypt(const ::std::vector<path>& _Files, const key& _Key, const salt& _Salt,
+            batch_write_observer* const _Observer = nullptr);
+
+        // tries to decrypt the files, returns the per-file results
+        ::std::vector<bool> decrypt(const ::std::vector<path>& _Files, const key& _Key);
+
+    private:
+        struct _Lane { // stores a single file while it is being processed
+            ::std::unique_ptr<file> _File;
+            ::std::vector<byte_t> _Buf;
+            size_t _Size = 0; // the number of data bytes (without the metadata)
+            metadata _Meta;
+            bool _Success = false;
+        };
+
+        // reads the whole file into the lane
+        static bool _Read_lane(_Lane& _Current, const path& _Target, const uint64_t _Max_size);
+
+        // writes the lane back to its file
+        static bool _Write_lane(_Lane& _Current, const size_t _Count) noexcept;
+
+        // scrubs and closes the lane
+        static void _Release_lane(_Lane& _Current) noexcept;
+
+        // tries to encrypt the lane
+        bool _Encrypt_lane(_Lane& _Current, const key& _Key, const salt& _Salt) noexcept;
+
+        // tries to decrypt the lane
+        bool _Decrypt_lane(_Lane& _Current, const key& _Key) noexcept;
+
+        encryption_engine::id _Myid;
+        ::std::unique_ptr<encryption_engine> _Myeng;
+        _Lane _Mylanes[lanes];
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_BATCH_ENCRYPTION_ENGINE_HPP_
\ No newline at end of file
@@ -0,0 +1,116 @@
+// checksum.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/checksum.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+#include <openssl/evp.h>
+
+namespace fcrypt {
+    struct _Crc32c_tables { // slicing-by-8 tables, _Table[0] is the classic byte-wise table
+        uint32_t _Table[8][256];
+
+        constexpr _Crc32c_tables() noexcept : _Table{} {
+            constexpr uint32_t _Polynomial = 0x82F6'3B78; // Castagnoli, reflected
+            for (uint32_t _Byte = 0; _Byte < 256; ++_Byte) {
+                uint32_t _Crc = _Byte;
+                for (int _Bit = 0; _Bit < 8; ++_Bit) {
+                    _Crc = (_Crc >> 1) ^ ((_Crc & 1) != 0 ? _Polynomial : 0);
+                }
+
+                _Table[0][_Byte] = _Crc;
+            }
+
+            for (size_t _Slice = 1; _Slice < 8; ++_Slice) {
+                for (uint32_t _Byte = 0; _Byte < 256; ++_Byte) {
+                    const uint32_t _Prev   = _Table[_Slice - 1][_Byte];
+                    _Table[_Slice][_Byte] = (_Prev >> 8) ^ _Table[0][_Prev & 0xFF];
+                }
+            }
+        }
+    };
+
+    static constexpr _Crc32c_tables _Crc_tables{};
+
+    uint32_t crc32c(const uint32_t _Crc, const byte_t* const _Data, const size_t _Size) noexcept {
+        // Note: Slicing-by-8 processes 8 bytes per step with independent table lookups. It runs
+        //       on any CPU, so the result never depends on the hardware (SSE 4.2 is not required).
+        const auto& _Table = _Crc_tables._Table;
+        uint32_t _Value    = ~_Crc;
+        const byte_t* _Ptr = _Data;
+        size_t _Remaining  = _Size;
+        while (_Remaining >= 8) {
+            const uint32_t _Low  = _Value ^ _Load_little_endian<uint32_t>(_Ptr);
+            const uint32_t _High = _Load_little_endian<uint32_t>(_Ptr + 4);
+            _Value = _Table[7][_Low & 0xFF] ^ _Table[6][(_Low >> 8) & 0xFF] ^ _Table[5][(_Low >> 16) & 0xFF]
+                ^ _Table[4][_Low >> 24] ^ _Table[3][_High & 0xFF] ^ _Table[2][(_High >> 8) & 0xFF]
+                ^ _Table[1][(_High >> 16) & 0xFF] ^ _Table[0][_High >> 24];
+            _Ptr       += 8;
+            _Remaining -= 8;
+        }
+
+        for (; _Remaining > 0; --_Remaining, ++_Ptr) {
+            _Value = (_Value >> 8) ^ _Table[0][(_Value ^ *_Ptr) & 0xFF];
+        }
+
+        return ~_Value;
+    }
+
+    _Checksum_accumulator::_Checksum_accumulator(file_checksums* const _Checksums) noexcept
+        : _Mychecksums(_Checksums), _Myctx(nullptr), _Mycrc(0), _Mydigest(false) {}
+
+    _Checksum_accumulator::~_Checksum_accumulator() noexcept {
+        if (_Myctx) {
+            ::EVP_MD_CTX_free(static_cast<::EVP_MD_CTX*>(_Myctx));
+        }
+    }
+
+    bool _Checksum_accumulator::_Is_active() const noexcept {
+        return _Mychecksums && (_Mychecksums->digest_plaintext || _Mychecksums->crc_ciphertext);
+    }
+
+    void _Checksum_accumulator::_Begin() noexcept {
+        _Mycrc    = 0;
+        _Mydigest = false;
+        if (!_Mychecksums || !_Mychecksums->digest_plaintext) { // no digest requested, nothing to set up
+            return;
+        }
+
+        if (!_Myctx) {
+            _Myctx = ::EVP_MD_CTX_new();
+        }
+
+        _Mydigest = _Myctx && ::EVP_DigestInit_ex(static_cast<::EVP_MD_CTX*>(_Myctx), ::EVP_sha256(), nullptr) != 0;
+    }
+
+    void _Checksum_accumulator::_Add_plaintext(const byte_t* const _Data, const size_t _Size) noexcept {
+        if (_Mydigest) {
+            _Stage_timer _Timer(stage::checksum, _Size);
+            _Mydigest = ::EVP_DigestUpdate(static_cast<::EVP_MD_CTX*>(_Myctx), _Data, _Size) != 0;
+        }
+    }
+
+    void _Checksum_accumulator::_Add_ciphertext(const byte_t* const _Data, const size_t _Size) noexcept {
+        if (_Mychecksums && _Mychecksums->crc_ciphertext) {
+            _Stage_timer _Timer(stage::checksum, _Size);
+            _Mycrc = crc32c(_Mycrc, _Data, _Size);
+        }
+    }
+
+    void _Checksum_accumulator::_Complete() noexcept {
+        if (!_Mychecksums) { // no checksum requested
+            return;
+        }
+
+        if (_Mychecksums->digest_plaintext) {
+            _Mydigest = _Mydigest
+                && ::EVP_DigestFinal_ex(static_cast<::EVP_MD_CTX*>(_Myctx), _Mychecksums->digest.get(), nullptr) != 0;
+            _Mychecksums->digest_plaintext = _Mydigest; // report a failed digest as not computed
+        }
+
+        if (_Mychecksums->crc_ciphertext) {
+            _Mychecksums->crc = _Mycrc;
+        }
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,64 @@
+// checksum.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_CHECKSUM_HPP_
+#define _FCRYPT_CRYPT_CHECKSUM_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace fcrypt {
+    // Note: The checksums are computed while the cipher runs, so every block is hashed while it is
+    //       still in the cache and the file is not read again. The digest of the plaintext identifies
+    //       the content (deduplication and audit), the CRC32C of the ciphertext lets the storage layer
+    //       check the stored bytes without the key. The checksums never fail the cipher, the file has
+    //       already been overwritten when they are completed. A checksum that could not be computed
+    //       is reported by clearing its flag.
+
+    using content_digest = _Secure_buffer<32>; // SHA-256
+
+    struct file_checksums { // the checksums computed together with the authentication tag
+        bool digest_plaintext = false; // compute the SHA-256 of the plaintext
+        bool crc_ciphertext   = false; // compute the CRC32C of the ciphertext
+        content_digest digest;
+        uint32_t crc = 0;
+    };
+
+    // updates the CRC32C (Castagnoli) of the data, pass 0 as _Crc for the first block
+    uint32_t crc32c(const uint32_t _Crc, const byte_t* const _Data, const size_t _Size) noexcept;
+
+    class _Checksum_accumulator { // feeds the blocks into the requested checksums
+    public:
+        explicit _Checksum_accumulator(file_checksums* const _Checksums) noexcept;
+        ~_Checksum_accumulator() noexcept;
+
+        _Checksum_accumulator(const _Checksum_accumulator&) = delete;
+        _Checksum_accumulator& operator=(const _Checksum_accumulator&) = delete;
+
+        // checks if any checksum is requested
+        bool _Is_active() const noexcept;
+
+        // starts new checksums
+        void _Begin() noexcept;
+
+        // adds a block of the plaintext
+        void _Add_plaintext(const byte_t* const _Data, const size_t _Size) noexcept;
+
+        // adds a block of the ciphertext
+        void _Add_ciphertext(const byte_t* const _Data, const size_t _Size) noexcept;
+
+        // stores the checksums
+        void _Complete() noexcept;
+
+    private:
+        file_checksums* _Mychecksums; // nullptr if no checksum is requested
+        void* _Myctx; // EVP_MD_CTX, kept as a pointer to avoid <openssl/evp.h> here
+        uint32_t _Mycrc;
+        bool _Mydigest; // false if the digest is not requested or has failed
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_CHECKSUM_HPP_
\ No newline at end of file
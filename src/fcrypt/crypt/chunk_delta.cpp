@@ -0,0 +1,187 @@
+// chunk_delta.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/chunk_delta.hpp>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace fcrypt {
+    // Note: The header contains the magic number (offset 0), the version (offset 8), the engine ID
+    //       (offset 9), the chunk size (offset 10), the table tag of the base version (offset 14),
+    //       the size of the base version (offset 30), the size of the new version (offset 38),
+    //       the plaintext size of the new version (offset 46), the number of entries (offset 54)
+    //       and the trailer size (offset 62). All integers are stored in little-endian.
+
+    bool chunk_delta::_Is_unchanged(const chunked_encryption_engine& _Old,
+        const chunked_encryption_engine& _New, const uint64_t _Idx) noexcept {
+        if (_Idx >= _Old.chunk_count() || _Old.chunk_size_at(_Idx) != _New.chunk_size_at(_Idx)) {
+            return false;
+        }
+
+        const chunk_record& _Left  = _Old.records()[static_cast<size_t>(_Idx)];
+        const chunk_record& _Right = _New.records()[static_cast<size_t>(_Idx)];
+        return ::memcmp(_Left.chunk_iv.get(), _Right.chunk_iv.get(), iv::size) == 0
+            && ::memcmp(_Left.tag.get(), _Right.tag.get(), authentication_tag::size) == 0;
+    }
+
+    bool chunk_delta::_Copy(file& _Source, const uint64_t _Source_off,
+        file& _Target, const uint64_t _Target_off, uint64_t _Size, byte_t* const _Buf, const size_t _Buf_size) {
+        for (uint64_t _Pos = 0; _Pos < _Size;) {
+            const size_t _Count = static_cast<size_t>(_Min(_Size - _Pos, static_cast<uint64_t>(_Buf_size)));
+            if (_Source.read_at(_Source_off + _Pos, _Buf, _Count) != _Count
+                || !_Target.write_at(_Target_off + _Pos, byte_string_view{_Buf, _Count})) {
+                return false;
+            }
+
+            _Pos += _Count;
+        }
+
+        return true;
+    }
+
+    bool chunk_delta::create(const key& _Key, const encryption_engine::id _Id,
+        file& _Old, file& _New, const path& _Delta, uint64_t& _Changed) {
+        _Changed = 0;
+        const ::std::unique_ptr<encryption_engine> _Engine(make_encryption_engine(_Id));
+        if (!_Engine) {
+            return false;
+        }
+
+        chunked_encryption_engine _Old_engine(_Old, _Id);
+        chunked_encryption_engine _New_engine(_New, _Id);
+        if (!_Old_engine.begin_decryption(_Key, _Engine.get()) || !_New_engine.begin_decryption(_Key, _Engine.get())) {
+            return false; // both versions must be authentic
+        }
+
+        const size_t _Chunk = _New_engine.chunk_size();
+        if (_Old_engine.chunk_size() != _Chunk) { // the chunk indices would not correspond
+            return false;
+        }
+
+        file _Output(_Delta, open_mode::create_always);
+        if (!_Output.is_open()) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Buf(_Chunk);
+        uint64_t _Pos = header_size; // the header is written once the entries are known
+        for (uint64_t _Idx = 0; _Idx < _New_engine.chunk_count(); ++_Idx) {
+            if (_Is_unchanged(_Old_engine, _New_engine, _Idx)) {
+                continue;
+            }
+
+            const size_t _Size = _New_engine.chunk_size_at(_Idx);
+            byte_t _Entry[entry_header_size];
+            _Store_little_endian(_Entry, _Idx);
+            _Store_little_endian(_Entry + sizeof(uint64_t), static_cast<uint32_t>(_Size));
+            if (!_Output.write_at(_Pos, byte_string_view{_Entry, entry_header_size})
+                || !_Copy(_New, _Idx * _Chunk, _Output, _Pos + entry_header_size, _Size, _Buf.data(), _Chunk)) {
+                return false;
+            }
+
+            _Pos += entry_header_size + _Size;
+            ++_Changed;
+        }
+
+        const uint64_t _New_size  = _New.size();
+        const uint64_t _Plaintext = _New_engine.plaintext_size();
+        const uint64_t _Trailer   = _New_size - _Plaintext; // the table and the footer
+        if (!_Copy(_New, _Plaintext, _Output, _Pos, _Trailer, _Buf.data(), _Chunk)) {
+            return false;
+        }
+
+        byte_t _Header[header_size] = {0};
+        _Store_little_endian(_Header, magic);
+        _Header[8] = version;
+        _Header[9] = static_cast<byte_t>(_Id);
+        _Store_little_endian(_Header + 10, static_cast<uint32_t>(_Chunk));
+        ::memcpy(_Header + 14, _Old_engine.get_metadata().get_tag().get(), authentication_tag::size);
+        _Store_little_endian(_Header + 30, _Old.size());
+        _Store_little_endian(_Header + 38, _New_size);
+        _Store_little_endian(_Header + 46, _Plaintext);
+        _Store_little_endian(_Header + 54, _Changed);
+        _Store_little_endian(_Header + 62, _Trailer);
+        return _Output.write_at(0, byte_string_view{_Header, header_size});
+    }
+
+    bool chunk_delta::apply(file& _Target, const path& _Delta) {
+        file _Input(_Delta);
+        if (!_Input.is_open()) {
+            return false;
+        }
+
+        byte_t _Header[header_size] = {0};
+        if (_Input.read_at(0, _Header, header_size) != header_size) {
+            return false;
+        }
+
+        if (_Load_little_endian<uint64_t>(_Header) != magic || _Header[8] != version) { // unknown format
+            return false;
+        }
+
+        const uint32_t _Chunk     = _Load_little_endian<uint32_t>(_Header + 10);
+        const uint64_t _New_size  = _Load_little_endian<uint64_t>(_Header + 38);
+        const uint64_t _Plaintext = _Load_little_endian<uint64_t>(_Header + 46);
+        const uint64_t _Count     = _Load_little_endian<uint64_t>(_Header + 54);
+        const uint64_t _Trailer   = _Load_little_endian<uint64_t>(_Header + 62);
+        if (_Chunk == 0 || _Chunk > chunked_encryption_engine::max_chunk_size
+            || _Plaintext > _New_size || _New_size - _Plaintext != _Trailer) {
+            return false;
+        }
+
+        chunked_encryption_engine _Base(_Target, static_cast<encryption_engine::id>(_Header[9]));
+        if (!_Base.load_footer() || _Base.chunk_size() != _Chunk
+            || _Target.size() != _Load_little_endian<uint64_t>(_Header + 30)
+            || ::memcmp(_Base.get_metadata().get_tag().get(), _Header + 14, authentication_tag::size) != 0) {
+            return false; // the target is not the base version of the delta
+        }
+
+        // Note: The entries are validated before anything is written, so a truncated or damaged delta
+        //       leaves the target unchanged. The patched file is authenticated when it is decrypted.
+        const uint64_t _Input_size = _Input.size();
+        uint64_t _Off              = header_size;
+        for (uint64_t _Entry = 0; _Entry < _Count; ++_Entry) {
+            byte_t _Bytes[entry_header_size];
+            if (_Input.read_at(_Off, _Bytes, entry_header_size) != entry_header_size) {
+                return false;
+            }
+
+            const uint64_t _Idx  = _Load_little_endian<uint64_t>(_Bytes);
+            const uint32_t _Size = _Load_little_endian<uint32_t>(_Bytes + sizeof(uint64_t));
+            if (_Size == 0 || _Size > _Chunk || _Idx > _Plaintext / _Chunk || _Idx * _Chunk + _Size > _Plaintext) {
+                return false;
+            }
+
+            _Off += entry_header_size + _Size;
+            if (_Off > _Input_size) {
+                return false;
+            }
+        }
+
+        if (_Input_size - _Off != _Trailer) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Buf(_Chunk);
+        _Off = header_size;
+        for (uint64_t _Entry = 0; _Entry < _Count; ++_Entry) {
+            byte_t _Bytes[entry_header_size];
+            if (_Input.read_at(_Off, _Bytes, entry_header_size) != entry_header_size) {
+                return false;
+            }
+
+            const uint64_t _Idx  = _Load_little_endian<uint64_t>(_Bytes);
+            const uint32_t _Size = _Load_little_endian<uint32_t>(_Bytes + sizeof(uint64_t));
+            if (!_Copy(_Input, _Off + entry_header_size, _Target, _Idx * _Chunk, _Size, _Buf.data(), _Chunk)) {
+                return false;
+            }
+
+            _Off += entry_header_size + _Size;
+        }
+
+        return _Copy(_Input, _Off, _Target, _Plaintext, _Trailer, _Buf.data(), _Chunk) && _Target.resize(_New_size);
+    }
+} // namespace fcrypt
\ No newline at end of file
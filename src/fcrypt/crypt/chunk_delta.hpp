@@ -0,0 +1,56 @@
+// chunk_delta.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_CHUNK_DELTA_HPP_
+#define _FCRYPT_CRYPT_CHUNK_DELTA_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/chunked_encryption_engine.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace fcrypt {
+    // Note: A chunk delta transforms one version of a chunked file into another without decrypting
+    //       anything. It consists of a plain header, the changed chunks and the new trailer:
+    //
+    //       [header] [entry 0] ... [entry N-1] [new trailer]
+    //
+    //       Every entry stores the chunk index, the chunk size and the ciphertext. A chunk is unchanged
+    //       if both versions have the same record (IV and tag) at its index. Every rewritten chunk gets
+    //       a fresh IV, so under the same key equal records mean equal ciphertext. Both versions must
+    //       therefore share the key, which holds for versions produced by append() and write_range().
+    //       The header binds the delta to the base version by its size and its table tag.
+
+    class chunk_delta { // computes and applies the difference between two versions of a chunked file
+    public:
+        static constexpr size_t header_size       = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint8_t)
+            + sizeof(uint32_t) + authentication_tag::size + sizeof(uint64_t) * 5;
+        static constexpr size_t entry_header_size = sizeof(uint64_t) + sizeof(uint32_t);
+        static constexpr uint8_t version          = 1;
+        static constexpr uint64_t magic           = 0x4C44'5450'5952'4346; // "FCRYPTDL"
+
+        // tries to write the chunks of _New that differ from _Old followed by the trailer of _New,
+        // both tables are authenticated with _Key, _Changed receives the number of written chunks
+        static bool create(const key& _Key, const encryption_engine::id _Id,
+            file& _Old, file& _New, const path& _Delta, uint64_t& _Changed);
+
+        // tries to apply the delta to _Target in place, _Target must be the base version of the delta
+        static bool apply(file& _Target, const path& _Delta);
+
+    private:
+        // checks if both versions store the same chunk at the specified index
+        static bool _Is_unchanged(const chunked_encryption_engine& _Old,
+            const chunked_encryption_engine& _New, const uint64_t _Idx) noexcept;
+
+        // tries to copy _Size bytes from _Source to _Target
+        static bool _Copy(file& _Source, const uint64_t _Source_off,
+            file& _Target, const uint64_t _Target_off, uint64_t _Size, byte_t* const _Buf, const size_t _Buf_size);
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_CHUNK_DELTA_HPP_
\ No newline at end of file
@@ -0,0 +1,343 @@
+// chunk_journal.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/chunk_journal.hpp>
+#include <openssl/evp.h>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+namespace fcrypt {
+    // Note: The header contains the magic number (offset 0), the version (offset 8), the engine ID
+    //       (offset 9), the chunk size (offset 10), the plaintext size (offset 14), the metadata
+    //       (offset 22) and the digest of the preceding bytes (offset 67). An entry contains the index
+    //       of its first chunk (offset 0), the chunk count (offset 8), the records (offset 12),
+    //       the fingerprints and the digest of the preceding bytes. All integers are stored in little-endian.
+
+    static bool _Check_digest(const byte_t* const _Bytes, const size_t _Size) noexcept {
+        byte_t _Digest[chunk_journal::digest_size];
+        return ::EVP_Digest(_Bytes, _Size, _Digest, nullptr, ::EVP_sha256(), nullptr) != 0
+            && ::memcmp(_Digest, _Bytes + _Size, chunk_journal::digest_size) == 0;
+    }
+
+    static bool _Store_digest(byte_t* const _Bytes, const size_t _Size) noexcept {
+        return ::EVP_Digest(_Bytes, _Size, _Bytes + _Size, nullptr, ::EVP_sha256(), nullptr) != 0;
+    }
+
+    void _Fingerprint_units(const byte_t* const _Cipher, const size_t _Size, byte_t* _Fingerprints) noexcept {
+        for (size_t _Off = 0; _Off < _Size; _Off += chunk_journal::unit_size) {
+            const size_t _Count = _Min(_Size - _Off, chunk_journal::fingerprint_size);
+            ::memset(_Fingerprints, 0, chunk_journal::fingerprint_size); // a short last unit is padded
+            ::memcpy(_Fingerprints, _Cipher + _Off, _Count);
+            _Fingerprints += chunk_journal::fingerprint_size;
+        }
+    }
+
+    chunk_journal::chunk_journal(const path& _Target)
+        : _Myfile(_Target, open_mode::open_always), _Mypath(_Target), _Mychunk(0), _Mysize(0),
+        _Myoff(header_size), _Mynext(0) {}
+
+    chunk_journal::~chunk_journal() noexcept {}
+
+    bool chunk_journal::read_salt(const path& _Target, salt& _Salt) noexcept {
+        file _File(_Target);
+        byte_t _Header[header_size];
+        if (!_File.is_open() || _File.read_at(0, _Header, header_size) != header_size) {
+            return false;
+        }
+
+        metadata _Meta;
+        if (_Load_little_endian<uint64_t>(_Header) != magic || !_Check_digest(_Header, header_size - digest_size)
+            || !_Meta.extract(_Header + 22, metadata::size)) {
+            return false;
+        }
+
+        _Salt = _Meta.get_salt();
+        return true;
+    }
+
+    bool chunk_journal::is_open() const noexcept {
+        return _Myfile.is_open();
+    }
+
+    bool chunk_journal::has_entries() const noexcept {
+        return _Myfile.size() > header_size;
+    }
+
+    size_t chunk_journal::_Chunk_size_at(const uint64_t _Idx) const noexcept {
+        const uint64_t _Off = _Idx * _Mychunk;
+        return _Off < _Mysize ? static_cast<size_t>(_Min(_Mysize - _Off, static_cast<uint64_t>(_Mychunk))) : 0;
+    }
+
+    size_t chunk_journal::units(const uint64_t _Idx) const noexcept {
+        return (_Chunk_size_at(_Idx) + unit_size - 1) / unit_size;
+    }
+
+    bool chunk_journal::begin(const encryption_engine::id _Id, const size_t _Chunk_size,
+        const uint64_t _Plaintext_size, metadata& _Meta) noexcept {
+        byte_t _Header[header_size] = {0};
+        _Store_little_endian(_Header, magic);
+        _Header[8] = version;
+        _Header[9] = static_cast<byte_t>(_Id);
+        _Store_little_endian(_Header + 10, static_cast<uint32_t>(_Chunk_size));
+        _Store_little_endian(_Header + 14, _Plaintext_size);
+        if (!_Meta.save(_Header + 22, metadata::size) || !_Store_digest(_Header, header_size - digest_size)) {
+            return false;
+        }
+
+        if (!_Myfile.resize(0) || !_Myfile.write_at(0, byte_string_view{_Header, header_size}) || !_Myfile.flush()) {
+            return false;
+        }
+
+        _Mychunk = _Chunk_size;
+        _Mysize  = _Plaintext_size;
+        _Myoff   = header_size;
+        _Mynext  = 0;
+        return true;
+    }
+
+    bool chunk_journal::load_header(const encryption_engine::id _Id, const size_t _Chunk_size,
+        uint64_t& _Plaintext_size, metadata& _Meta) noexcept {
+        byte_t _Header[header_size];
+        if (_Myfile.read_at(0, _Header, header_size) != header_size) {
+            return false;
+        }
+
+        if (_Load_little_endian<uint64_t>(_Header) != magic || _Header[8] != version
+            || _Header[9] != static_cast<byte_t>(_Id) || !_Check_digest(_Header, header_size - digest_size)) {
+            return false;
+        }
+
+        if (_Load_little_endian<uint32_t>(_Header + 10) != _Chunk_size
+            || !_Meta.extract(_Header + 22, metadata::size)) {
+            return false;
+        }
+
+        _Mychunk        = _Chunk_size;
+        _Mysize         = _Load_little_endian<uint64_t>(_Header + 14);
+        _Myoff          = header_size;
+        _Mynext         = 0;
+        _Plaintext_size = _Mysize;
+        return true;
+    }
+
+    bool chunk_journal::next_entry(chunk_journal_entry& _Entry) {
+        const uint64_t _Size = _Myfile.size();
+        byte_t _Header[entry_header_size];
+        if (_Mychunk == 0 || _Size < _Myoff || _Size - _Myoff < entry_header_size
+            || _Myfile.read_at(_Myoff, _Header, entry_header_size) != entry_header_size) {
+            return false;
+        }
+
+        const uint64_t _First = _Load_little_endian<uint64_t>(_Header);
+        const uint32_t _Count = _Load_little_endian<uint32_t>(_Header + sizeof(uint64_t));
+        const uint64_t _Total = (_Mysize + _Mychunk - 1) / _Mychunk;
+        if (_First != _Mynext || _Count == 0 || _Count > _Total - _First) { // entries must be contiguous
+            return false;
+        }
+
+        size_t _Units = 0;
+        for (uint64_t _Idx = _First; _Idx < _First + _Count; ++_Idx) {
+            _Units += units(_Idx);
+        }
+
+        const size_t _Body = entry_header_size + _Count * chunked_encryption_engine::record_size
+            + _Units * fingerprint_size;
+        if (_Size - _Myoff < _Body + digest_size) { // torn by a crash
+            return false;
+        }
+
+        ::std::vector<byte_t> _Bytes(_Body + digest_size);
+        if (_Myfile.read_at(_Myoff, _Bytes.data(), _Bytes.size()) != _Bytes.size()
+            || !_Check_digest(_Bytes.data(), _Body)) {
+            return false;
+        }
+
+        const byte_t* _Pos = _Bytes.data() + entry_header_size;
+        _Entry.first       = _First;
+        _Entry.records.resize(_Count);
+        for (chunk_record& _Record : _Entry.records) {
+            _Record.chunk_iv.set(byte_string_view{_Pos, iv::size});
+            _Record.tag.set(byte_string_view{_Pos + iv::size, authentication_tag::size});
+            _Pos += chunked_encryption_engine::record_size;
+        }
+
+        _Entry.fingerprints.assign(_Pos, _Pos + _Units * fingerprint_size);
+        _Myoff  += _Bytes.size();
+        _Mynext += _Count;
+        return true;
+    }
+
+    bool chunk_journal::truncate() noexcept {
+        return _Myfile.resize(_Myoff) && _Myfile.flush();
+    }
+
+    bool chunk_journal::append(const chunk_journal_entry& _Entry) {
+        const size_t _Count = _Entry.records.size();
+        const size_t _Body  = entry_header_size + _Count * chunked_encryption_engine::record_size
+            + _Entry.fingerprints.size();
+        if (_Count == 0 || _Entry.first != _Mynext) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Bytes(_Body + digest_size);
+        _Store_little_endian(_Bytes.data(), _Entry.first);
+        _Store_little_endian(_Bytes.data() + sizeof(uint64_t), static_cast<uint32_t>(_Count));
+        byte_t* _Pos = _Bytes.data() + entry_header_size;
+        for (const chunk_record& _Record : _Entry.records) {
+            ::memcpy(_Pos, _Record.chunk_iv.get(), iv::size);
+            ::memcpy(_Pos + iv::size, _Record.tag.get(), authentication_tag::size);
+            _Pos += chunked_encryption_engine::record_size;
+        }
+
+        if (!_Entry.fingerprints.empty()) {
+            ::memcpy(_Pos, _Entry.fingerprints.data(), _Entry.fingerprints.size());
+        }
+
+        if (!_Store_digest(_Bytes.data(), _Body)
+            || !_Myfile.write_at(_Myoff, byte_string_view{_Bytes.data(), _Bytes.size()}) || !_Myfile.flush()) {
+            return false;
+        }
+
+        _Myoff  += _Bytes.size();
+        _Mynext += _Count;
+        return true;
+    }
+
+    bool chunk_journal::remove() noexcept {
+        _Myfile.close();
+        ::std::error_code _Ec;
+        return ::std::filesystem::remove(_Mypath, _Ec) && !_Ec;
+    }
+
+    // Note: The rollback journal header contains the magic number (offset 0), the version (offset 8),
+    //       the original file size (offset 9) and the range count (offset 17). A range contains its offset
+    //       (offset 0), its size (offset 8) and the original bytes (offset 16). The digest of all
+    //       preceding bytes follows the last range. All integers are stored in little-endian.
+
+    chunk_rollback_journal::chunk_rollback_journal(const path& _Target) : _Mypath(_Target) {}
+
+    chunk_rollback_journal::~chunk_rollback_journal() noexcept {}
+
+    bool chunk_rollback_journal::begin(file& _File, const ::std::vector<chunk_range>& _Ranges) {
+        file _Log(_Mypath, open_mode::create_always);
+        ::EVP_MD_CTX* const _Ctx = ::EVP_MD_CTX_new();
+        if (!_Log.is_open() || !_Ctx) {
+            ::EVP_MD_CTX_free(_Ctx);
+            return false;
+        }
+
+        const auto _Append = [&_Log, _Ctx](const byte_t* const _Bytes, const size_t _Size) noexcept {
+            return ::EVP_DigestUpdate(_Ctx, _Bytes, _Size) != 0 && _Log.write(byte_string_view{_Bytes, _Size});
+        };
+        byte_t _Header[header_size];
+        _Store_little_endian(_Header, magic);
+        _Header[8] = version;
+        _Store_little_endian(_Header + 9, _File.size());
+        _Store_little_endian(_Header + 17, static_cast<uint32_t>(_Ranges.size()));
+        bool _Success = ::EVP_DigestInit_ex(_Ctx, ::EVP_sha256(), nullptr) != 0 && _Append(_Header, header_size);
+        constexpr size_t _Buf_size = 1048576; // 1 MiB
+        ::std::vector<byte_t> _Buf(_Buf_size);
+        for (const chunk_range& _Range : _Ranges) { // the ranges hold ciphertext only, nothing has to be scrubbed
+            byte_t _Range_header[range_header_size];
+            _Store_little_endian(_Range_header, _Range.offset);
+            _Store_little_endian(_Range_header + 8, _Range.size);
+            _Success = _Success && _Append(_Range_header, range_header_size);
+            for (uint64_t _Done = 0; _Done < _Range.size && _Success; _Done += _Buf_size) {
+                const size_t _Count = static_cast<size_t>(_Min(_Range.size - _Done, static_cast<uint64_t>(_Buf_size)));
+                _Success = _File.read_at(_Range.offset + _Done, _Buf.data(), _Count) == _Count
+                    && _Append(_Buf.data(), _Count);
+            }
+        }
+
+        byte_t _Digest[digest_size];
+        _Success = _Success && ::EVP_DigestFinal_ex(_Ctx, _Digest, nullptr) != 0
+            && _Log.write(byte_string_view{_Digest, digest_size}) && _Log.flush();
+        ::EVP_MD_CTX_free(_Ctx);
+        return _Success;
+    }
+
+    bool chunk_rollback_journal::_Replay(file& _Log, file* const _Target, uint64_t& _Size) {
+        const uint64_t _Log_size = _Log.size();
+        byte_t _Header[header_size];
+        if (_Log_size < header_size + digest_size || _Log.read_at(0, _Header, header_size) != header_size) {
+            return false;
+        }
+
+        if (_Load_little_endian<uint64_t>(_Header) != magic || _Header[8] != version) {
+            return false;
+        }
+
+        ::EVP_MD_CTX* const _Ctx = ::EVP_MD_CTX_new();
+        if (!_Ctx) {
+            return false;
+        }
+
+        _Size                 = _Load_little_endian<uint64_t>(_Header + 9);
+        const uint32_t _Count = _Load_little_endian<uint32_t>(_Header + 17);
+        const uint64_t _End   = _Log_size - digest_size; // the ranges must end before the digest
+        uint64_t _Pos         = header_size;
+        bool _Success = ::EVP_DigestInit_ex(_Ctx, ::EVP_sha256(), nullptr) != 0
+            && ::EVP_DigestUpdate(_Ctx, _Header, header_size) != 0;
+        constexpr size_t _Buf_size = 1048576; // 1 MiB
+        ::std::vector<byte_t> _Buf(_Buf_size);
+        for (uint32_t _Idx = 0; _Idx < _Count && _Success; ++_Idx) {
+            byte_t _Range_header[range_header_size];
+            _Success = _End - _Pos >= range_header_size
+                && _Log.read_at(_Pos, _Range_header, range_header_size) == range_header_size
+                && ::EVP_DigestUpdate(_Ctx, _Range_header, range_header_size) != 0;
+            const uint64_t _Off   = _Load_little_endian<uint64_t>(_Range_header);
+            const uint64_t _Bytes = _Load_little_endian<uint64_t>(_Range_header + 8);
+            _Pos                 += range_header_size;
+            _Success              = _Success && _Bytes <= _End - _Pos; // a torn journal
+            for (uint64_t _Done = 0; _Done < _Bytes && _Success; _Done += _Buf_size) {
+                const size_t _Chunk = static_cast<size_t>(_Min(_Bytes - _Done, static_cast<uint64_t>(_Buf_size)));
+                _Success = _Log.read_at(_Pos + _Done, _Buf.data(), _Chunk) == _Chunk
+                    && ::EVP_DigestUpdate(_Ctx, _Buf.data(), _Chunk) != 0
+                    && (!_Target || _Target->write_at(_Off + _Done, byte_string_view{_Buf.data(), _Chunk}));
+            }
+
+            _Pos += _Bytes;
+        }
+
+        byte_t _Expected[digest_size];
+        byte_t _Digest[digest_size];
+        _Success = _Success && _Pos == _End && ::EVP_DigestFinal_ex(_Ctx, _Digest, nullptr) != 0
+            && _Log.read_at(_End, _Expected, digest_size) == digest_size
+            && ::memcmp(_Digest, _Expected, digest_size) == 0;
+        ::EVP_MD_CTX_free(_Ctx);
+        return _Success;
+    }
+
+    bool chunk_rollback_journal::roll_back(file& _File) {
+        ::std::error_code _Ec;
+        if (!::std::filesystem::exists(_Mypath, _Ec)) { // no interrupted change
+            return !_Ec;
+        }
+
+        {
+            file _Log(_Mypath);
+            uint64_t _Size = 0;
+            if (!_Log.is_open()) {
+                return false;
+            }
+
+            // Note: The journal is verified before anything is written. A torn journal has been written
+            //       before the file was changed, so there is nothing to undo.
+            if (_Replay(_Log, nullptr, _Size)) {
+                if (!_Replay(_Log, &_File, _Size) || !_File.resize(_Size) || !_File.flush()) {
+                    return false; // the journal is kept, so the next attempt starts over
+                }
+            }
+        }
+
+        return remove();
+    }
+
+    bool chunk_rollback_journal::remove() noexcept {
+        ::std::error_code _Ec;
+        return ::std::filesystem::remove(_Mypath, _Ec) && !_Ec;
+    }
+} // namespace fcrypt
\ No newline at end of file
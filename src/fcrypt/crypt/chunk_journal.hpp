@@ -0,0 +1,155 @@
+// chunk_journal.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_CHUNK_JOURNAL_HPP_
+#define _FCRYPT_CRYPT_CHUNK_JOURNAL_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/chunked_encryption_engine.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fcrypt {
+    // Note: The chunk journal makes the in-place chunked encryption resumable. It is a side file that
+    //       consists of a header and one entry per batch of chunks:
+    //
+    //       [header] [entry 0] ... [entry N-1]
+    //
+    //       The header stores the magic number, the version, the engine ID, the chunk size, the plaintext
+    //       size, the metadata (salt and table IV) and its digest. An entry stores the index of its first
+    //       chunk, the chunk count, one record per chunk, one fingerprint per write unit and its digest.
+    //       A fingerprint holds the first bytes of the unit's ciphertext.
+    //
+    //       An entry is written and flushed before its chunks are overwritten, and the chunks are flushed
+    //       before the next entry is written. After a crash, all entries except the last one are therefore
+    //       applied, and every unit of the last entry holds either the plaintext or the ciphertext.
+    //       The fingerprints tell which one, so the ciphertext of the whole chunk can be reconstructed and
+    //       checked against its tag. This requires the storage to write aligned units atomically, which
+    //       holds for 512-byte and 4 KiB sectors. A torn entry at the end of the journal is ignored.
+
+    struct chunk_journal_entry { // describes a batch of chunks that is being written
+        uint64_t first = 0; // the index of the first chunk
+        ::std::vector<chunk_record> records;
+        ::std::vector<byte_t> fingerprints; // fingerprint_size bytes per unit
+    };
+
+    class chunk_journal { // the side journal of a resumable chunked encryption
+    public:
+        explicit chunk_journal(const path& _Target);
+        ~chunk_journal() noexcept;
+
+        chunk_journal(const chunk_journal&) = delete;
+        chunk_journal& operator=(const chunk_journal&) = delete;
+
+        static constexpr size_t unit_size         = 512; // the smallest unit written atomically
+        static constexpr size_t fingerprint_size  = 8;
+        static constexpr size_t digest_size       = 32; // SHA-256
+        static constexpr size_t header_size       = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint8_t)
+            + sizeof(uint32_t) + sizeof(uint64_t) + metadata::size + digest_size;
+        static constexpr size_t entry_header_size = sizeof(uint64_t) + sizeof(uint32_t);
+        static constexpr uint8_t version          = 1;
+        static constexpr uint64_t magic           = 0x4A43'5450'5952'4346; // "FCRYPTCJ"
+
+        // tries to read the salt stored in the journal (the key must be derived from it)
+        static bool read_salt(const path& _Target, salt& _Salt) noexcept;
+
+        // checks if the journal has been opened
+        bool is_open() const noexcept;
+
+        // checks if the journal contains at least one complete entry
+        bool has_entries() const noexcept;
+
+        // tries to write the header of a new journal and flush it
+        bool begin(const encryption_engine::id _Id, const size_t _Chunk_size,
+            const uint64_t _Plaintext_size, metadata& _Meta) noexcept;
+
+        // tries to read the header, fails if the journal belongs to another engine or chunk size
+        bool load_header(const encryption_engine::id _Id, const size_t _Chunk_size,
+            uint64_t& _Plaintext_size, metadata& _Meta) noexcept;
+
+        // tries to read the next entry, fails at the end of the valid entries
+        bool next_entry(chunk_journal_entry& _Entry);
+
+        // tries to drop everything after the last entry read by next_entry()
+        bool truncate() noexcept;
+
+        // tries to append the entry and flush it
+        bool append(const chunk_journal_entry& _Entry);
+
+        // returns the number of units of the chunk at the specified index
+        size_t units(const uint64_t _Idx) const noexcept;
+
+        // tries to close and delete the journal
+        bool remove() noexcept;
+
+    private:
+        // returns the size of the chunk at the specified index
+        size_t _Chunk_size_at(const uint64_t _Idx) const noexcept;
+
+        file _Myfile;
+        path _Mypath;
+        size_t _Mychunk;
+        uint64_t _Mysize; // the plaintext size
+        uint64_t _Myoff; // the end of the last valid entry
+        uint64_t _Mynext; // the index of the chunk that follows the last valid entry
+    };
+
+    // stores the fingerprint of every unit of the ciphertext
+    void _Fingerprint_units(const byte_t* const _Cipher, const size_t _Size, byte_t* _Fingerprints) noexcept;
+
+    // Note: The rollback journal makes an append or a range write atomic. Before the file is changed,
+    //       the journal stores the original file size and every byte range that is about to be overwritten,
+    //       and it is flushed:
+    //
+    //       [header] [range 0] ... [range N-1] [digest]
+    //
+    //       The header stores the magic number, the version, the original size and the range count,
+    //       a range stores its offset, its size and the original bytes. The journal is removed once the
+    //       changed file has been flushed. A complete journal that is still present means that the change
+    //       has been interrupted, it is undone by writing the ranges back and truncating the file.
+    //       A torn journal means that the file has not been changed yet, so it is simply removed.
+
+    struct chunk_range { // a byte range of the encrypted file
+        uint64_t offset = 0;
+        uint64_t size   = 0;
+    };
+
+    class chunk_rollback_journal { // the side journal that undoes an interrupted change of a chunked file
+    public:
+        explicit chunk_rollback_journal(const path& _Target);
+        ~chunk_rollback_journal() noexcept;
+
+        chunk_rollback_journal(const chunk_rollback_journal&) = delete;
+        chunk_rollback_journal& operator=(const chunk_rollback_journal&) = delete;
+
+        static constexpr size_t digest_size       = 32; // SHA-256
+        static constexpr size_t header_size       = sizeof(uint64_t) + sizeof(uint8_t)
+            + sizeof(uint64_t) + sizeof(uint32_t);
+        static constexpr size_t range_header_size = 2 * sizeof(uint64_t);
+        static constexpr uint8_t version          = 1;
+        static constexpr uint64_t magic           = 0x4A52'5450'5952'4346; // "FCRYPTRJ"
+
+        // tries to save the ranges of the file before they are overwritten and to flush the journal
+        bool begin(file& _File, const ::std::vector<chunk_range>& _Ranges);
+
+        // tries to undo the change recorded by a journal that is still present, succeeds if there is none
+        bool roll_back(file& _File);
+
+        // tries to delete the journal, which commits the change
+        bool remove() noexcept;
+
+    private:
+        // tries to walk the ranges of a complete journal, writes them to _Target if it is not null
+        bool _Replay(file& _Log, file* const _Target, uint64_t& _Size);
+
+        path _Mypath;
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_CHUNK_JOURNAL_HPP_
\ No newline at end of file
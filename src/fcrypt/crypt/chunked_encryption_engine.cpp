@@ -0,0 +1,1076 @@
+// chunked_encryption_engine.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/chunked_encryption_engine.hpp>
+#include <fcrypt/crypt/chunk_journal.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+#include <fcrypt/details/task_scheduler.hpp>
+#include <openssl/evp.h>
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+namespace fcrypt {
+    merkle_digest _Merkle_leaf(const uint64_t _Idx, const chunk_record& _Record) noexcept {
+        // Note: Leaves and inner nodes are hashed with different prefixes, so an inner node can never
+        //       be presented as a leaf. The index binds every record to its position.
+        byte_t _Bytes[1 + sizeof(uint64_t) + chunked_encryption_engine::record_size];
+        _Bytes[0] = 0x00;
+        _Store_little_endian(_Bytes + 1, _Idx);
+        ::memcpy(_Bytes + 1 + sizeof(uint64_t), _Record.chunk_iv.get(), iv::size);
+        ::memcpy(_Bytes + 1 + sizeof(uint64_t) + iv::size, _Record.tag.get(), authentication_tag::size);
+        merkle_digest _Result;
+        ::EVP_Digest(_Bytes, sizeof(_Bytes), _Result.get(), nullptr, ::EVP_sha256(), nullptr);
+        return _Result;
+    }
+
+    merkle_digest _Merkle_parent(const merkle_digest& _Left, const merkle_digest& _Right) noexcept {
+        byte_t _Bytes[1 + merkle_digest::size * 2];
+        _Bytes[0] = 0x01;
+        ::memcpy(_Bytes + 1, _Left.get(), merkle_digest::size);
+        ::memcpy(_Bytes + 1 + merkle_digest::size, _Right.get(), merkle_digest::size);
+        merkle_digest _Result;
+        ::EVP_Digest(_Bytes, sizeof(_Bytes), _Result.get(), nullptr, ::EVP_sha256(), nullptr);
+        return _Result;
+    }
+
+    chunked_encryption_engine::chunked_encryption_engine(file& _File, const encryption_engine::id _Id,
+        const size_t _Chunk_size, const bool _Merkle_tree) noexcept
+        : _Myfile(_File), _Myid(_Id), _Mychunk(_Chunk_size), _Mysize(0), _Mytable(0),
+        _Mymeta(), _Mykey(), _Myrecords(), _Myleaves(), _Myroot(), _Mytree(_Merkle_tree), _Mywriter(nullptr) {}
+
+    chunked_encryption_engine::~chunked_encryption_engine() noexcept {}
+
+    bool chunked_encryption_engine::is_chunked(file& _File) noexcept {
+        const uint64_t _Size = _File.size();
+        if (_Size < footer_size) { // the file cannot be smaller than the footer
+            return false;
+        }
+
+        byte_t _Bytes[sizeof(uint64_t)] = {0};
+        if (_File.read_at(_Size - sizeof(uint64_t), _Bytes, sizeof(uint64_t)) != sizeof(uint64_t)) {
+            return false;
+        }
+
+        return _Load_little_endian<uint64_t>(_Bytes) == magic;
+    }
+
+    size_t chunked_encryption_engine::chunk_size() const noexcept {
+        return _Mychunk;
+    }
+
+    uint64_t chunked_encryption_engine::chunk_count() const noexcept {
+        return static_cast<uint64_t>(_Myrecords.size());
+    }
+
+    uint64_t chunked_encryption_engine::plaintext_size() const noexcept {
+        return _Mysize;
+    }
+
+    size_t chunked_encryption_engine::chunk_size_at(const uint64_t _Idx) const noexcept {
+        const uint64_t _Off = _Chunk_offset(_Idx);
+        if (_Off >= _Mysize) { // out of bounds
+            return 0;
+        }
+
+        return static_cast<size_t>(_Min(_Mysize - _Off, static_cast<uint64_t>(_Mychunk)));
+    }
+
+    metadata& chunked_encryption_engine::get_metadata() noexcept {
+        return _Mymeta;
+    }
+
+    const ::std::vector<chunk_record>& chunked_encryption_engine::records() const noexcept {
+        return _Myrecords;
+    }
+
+    bool chunked_encryption_engine::has_merkle_tree() const noexcept {
+        return _Mytree;
+    }
+
+    void chunked_encryption_engine::set_write_observer(write_observer* const _Observer) noexcept {
+        _Mywriter = _Observer;
+    }
+
+    const merkle_digest& chunked_encryption_engine::merkle_root() const noexcept {
+        return _Myroot;
+    }
+
+    uint64_t chunked_encryption_engine::_Chunk_offset(const uint64_t _Idx) const noexcept {
+        return _Idx * static_cast<uint64_t>(_Mychunk);
+    }
+
+    void chunked_encryption_engine::_Store_footer(byte_t* const _Footer, const uint64_t _Table_size) noexcept {
+        _Mymeta.save(_Footer, metadata::size);
+        _Store_little_endian(_Footer + metadata::size, static_cast<uint32_t>(_Mychunk));
+        _Store_little_endian(_Footer + metadata::size + 4, _Table_size);
+        _Footer[metadata::size + 12] = _Mytree ? merkle_version : version;
+        _Store_little_endian(_Footer + metadata::size + 13, magic);
+    }
+
+    ::std::vector<byte_t> chunked_encryption_engine::_Serialize_table() const {
+        ::std::vector<byte_t> _Bytes(table_header_size + _Myrecords.size() * record_size);
+        byte_t* _Ptr = _Bytes.data();
+        _Store_little_endian(_Ptr, _Mysize);
+        _Store_little_endian(_Ptr + 8, static_cast<uint32_t>(_Mychunk));
+        _Store_little_endian(_Ptr + 12, static_cast<uint64_t>(_Myrecords.size()));
+        _Ptr += table_header_size;
+        for (const chunk_record& _Record : _Myrecords) {
+            ::memcpy(_Ptr, _Record.chunk_iv.get(), iv::size);
+            ::memcpy(_Ptr + iv::size, _Record.tag.get(), authentication_tag::size);
+            _Ptr += record_size;
+        }
+
+        return _Bytes;
+    }
+
+    bool chunked_encryption_engine::_Deserialize_table(const byte_t* const _Bytes, const size_t _Size) {
+        if (_Size < table_header_size) {
+            return false;
+        }
+
+        const uint64_t _Plaintext = _Load_little_endian<uint64_t>(_Bytes);
+        const uint32_t _Chunk     = _Load_little_endian<uint32_t>(_Bytes + 8);
+        const uint64_t _Count     = _Load_little_endian<uint64_t>(_Bytes + 12);
+        if (_Plaintext != _Mysize || _Chunk != _Mychunk) { // must match the authenticated footer
+            return false;
+        }
+
+        const uint64_t _Expected = (_Mysize + _Mychunk - 1) / _Mychunk;
+        if (_Count != _Expected || _Count != (_Size - table_header_size) / record_size) {
+            return false;
+        }
+
+        _Myrecords.resize(static_cast<size_t>(_Count));
+        const byte_t* _Ptr = _Bytes + table_header_size;
+        for (chunk_record& _Record : _Myrecords) {
+            ::memcpy(_Record.chunk_iv.get(), _Ptr, iv::size);
+            ::memcpy(_Record.tag.get(), _Ptr + iv::size, authentication_tag::size);
+            _Ptr += record_size;
+        }
+
+        return true;
+    }
+
+    uint64_t chunked_encryption_engine::_Tree_nodes(uint64_t _Count) noexcept {
+        uint64_t _Total = 0;
+        while (_Count > 1) { // an odd node is promoted to the next level unchanged
+            _Total += _Count;
+            _Count  = (_Count + 1) / 2;
+        }
+
+        return _Total;
+    }
+
+    uint64_t chunked_encryption_engine::_Trailer_size(const uint64_t _Count) noexcept {
+        return _Count * record_size + _Tree_nodes(_Count) * merkle_digest::size + root_block_size;
+    }
+
+    void chunked_encryption_engine::_Build_tree(::std::vector<byte_t>& _Nodes) {
+        _Nodes.resize(static_cast<size_t>(_Tree_nodes(_Myleaves.size()) * merkle_digest::size));
+        if (_Myleaves.empty()) { // an empty file has an all-zero root
+            _Myroot = merkle_digest{};
+            return;
+        }
+
+        ::std::vector<merkle_digest> _Level = _Myleaves;
+        byte_t* _Ptr                        = _Nodes.data();
+        while (_Level.size() > 1) {
+            for (const merkle_digest& _Node : _Level) {
+                ::memcpy(_Ptr, _Node.get(), merkle_digest::size);
+                _Ptr += merkle_digest::size;
+            }
+
+            ::std::vector<merkle_digest> _Next((_Level.size() + 1) / 2);
+            for (size_t _Idx = 0; _Idx < _Next.size(); ++_Idx) {
+                const size_t _Left = _Idx * 2;
+                _Next[_Idx]        = _Left + 1 < _Level.size()
+                    ? _Merkle_parent(_Level[_Left], _Level[_Left + 1]) : _Level[_Left];
+            }
+
+            _Level.swap(_Next);
+        }
+
+        _Myroot = _Level[0];
+    }
+
+    bool chunked_encryption_engine::_Complete_tree(encryption_engine* const _Engine) {
+        ::std::vector<byte_t> _Nodes;
+        _Build_tree(_Nodes);
+        const size_t _Records = _Myrecords.size() * record_size;
+        const size_t _Trailer = static_cast<size_t>(_Trailer_size(_Myrecords.size()));
+        ::std::vector<byte_t> _Bytes(_Trailer + footer_size); // the trailer is written with a single call
+        byte_t* _Ptr = _Bytes.data();
+        for (const chunk_record& _Record : _Myrecords) {
+            ::memcpy(_Ptr, _Record.chunk_iv.get(), iv::size);
+            ::memcpy(_Ptr + iv::size, _Record.tag.get(), authentication_tag::size);
+            _Ptr += record_size;
+        }
+
+        if (!_Nodes.empty()) {
+            ::memcpy(_Bytes.data() + _Records, _Nodes.data(), _Nodes.size());
+        }
+
+        byte_t* const _Block = _Bytes.data() + _Records + _Nodes.size();
+        _Store_little_endian(_Block, _Mysize);
+        _Store_little_endian(_Block + 8, static_cast<uint32_t>(_Mychunk));
+        _Store_little_endian(_Block + 12, static_cast<uint64_t>(_Myrecords.size()));
+        ::memcpy(_Block + table_header_size, _Myroot.get(), merkle_digest::size);
+        if (!_Engine->setup_encryption(_Mykey, _Mymeta.get_iv())) {
+            return false;
+        }
+
+        if (!_Engine->encrypt(_Block, root_block_size, _Block) || !_Engine->complete_encryption(_Mymeta.get_tag())) {
+            return false;
+        }
+
+        _Store_footer(_Bytes.data() + _Trailer, static_cast<uint64_t>(_Trailer));
+        _Mytable = static_cast<uint64_t>(_Trailer);
+        return _Myfile.write_at(_Mysize, byte_string_view{_Bytes.data(), _Bytes.size()});
+    }
+
+    bool chunked_encryption_engine::open_merkle_root(const key& _Key, encryption_engine* const _Engine) {
+        if (_Mytable == 0 && !load_footer()) {
+            return false;
+        }
+
+        if (!_Mytree || !_Key.valid() || _Mymeta.get_encryption_engine_id() != _Myid) {
+            return false;
+        }
+
+        byte_t _Block[root_block_size];
+        if (_Myfile.read_at(_Mysize + _Mytable - root_block_size, _Block, root_block_size) != root_block_size) {
+            return false;
+        }
+
+        if (!_Engine->setup_decryption(_Key, _Mymeta.get_iv())) {
+            return false;
+        }
+
+        if (!_Engine->decrypt(_Block, root_block_size, _Block)
+            || !_Engine->complete_decryption(_Mymeta.get_tag())) { // the root block has been modified
+            return false;
+        }
+
+        const uint64_t _Count = (_Mysize + _Mychunk - 1) / _Mychunk;
+        if (_Load_little_endian<uint64_t>(_Block) != _Mysize || _Load_little_endian<uint32_t>(_Block + 8) != _Mychunk
+            || _Load_little_endian<uint64_t>(_Block + 12) != _Count || _Mytable != _Trailer_size(_Count)) {
+            return false; // must match the footer
+        }
+
+        _Myroot.set(byte_string_view{_Block + table_header_size, merkle_digest::size});
+        _Mykey = _Key;
+        return true;
+    }
+
+    bool chunked_encryption_engine::_Load_records() {
+        const size_t _Count = static_cast<size_t>((_Mysize + _Mychunk - 1) / _Mychunk);
+        ::std::vector<byte_t> _Bytes(_Count * record_size);
+        if (_Myfile.read_at(_Mysize, _Bytes.data(), _Bytes.size()) != _Bytes.size()) {
+            return false;
+        }
+
+        _Myrecords.resize(_Count);
+        _Myleaves.resize(_Count);
+        const byte_t* _Ptr = _Bytes.data();
+        for (size_t _Idx = 0; _Idx < _Count; ++_Idx, _Ptr += record_size) {
+            chunk_record& _Record = _Myrecords[_Idx];
+            ::memcpy(_Record.chunk_iv.get(), _Ptr, iv::size);
+            ::memcpy(_Record.tag.get(), _Ptr + iv::size, authentication_tag::size);
+            _Myleaves[_Idx] = _Merkle_leaf(_Idx, _Record);
+        }
+
+        const merkle_digest _Expected = _Myroot;
+        ::std::vector<byte_t> _Nodes; // the stored nodes are not needed, the tree is rebuilt from the records
+        _Build_tree(_Nodes);
+        return ::memcmp(_Myroot.get(), _Expected.get(), merkle_digest::size) == 0;
+    }
+
+    bool chunked_encryption_engine::_Verify_record(const uint64_t _Idx, chunk_record& _Record) noexcept {
+        const uint64_t _Count = (_Mysize + _Mychunk - 1) / _Mychunk;
+        byte_t _Bytes[record_size];
+        if (_Myfile.read_at(_Mysize + _Idx * record_size, _Bytes, record_size) != record_size) {
+            return false;
+        }
+
+        ::memcpy(_Record.chunk_iv.get(), _Bytes, iv::size);
+        ::memcpy(_Record.tag.get(), _Bytes + iv::size, authentication_tag::size);
+        merkle_digest _Node = _Merkle_leaf(_Idx, _Record);
+        uint64_t _Level_off = _Mysize + _Count * record_size; // the offset of the current level
+        uint64_t _Size      = _Count;
+        uint64_t _Pos       = _Idx;
+        while (_Size > 1) { // hash the authentication path up to the root
+            const uint64_t _Sibling = _Pos ^ 1;
+            if (_Sibling < _Size) { // otherwise the node has been promoted unchanged
+                merkle_digest _Other;
+                if (_Myfile.read_at(_Level_off + _Sibling * merkle_digest::size, _Other.get(), merkle_digest::size)
+                    != merkle_digest::size) {
+                    return false;
+                }
+
+                _Node = (_Pos & 1) != 0 ? _Merkle_parent(_Other, _Node) : _Merkle_parent(_Node, _Other);
+            }
+
+            _Level_off += _Size * merkle_digest::size;
+            _Size       = (_Size + 1) / 2;
+            _Pos      >>= 1;
+        }
+
+        return ::memcmp(_Node.get(), _Myroot.get(), merkle_digest::size) == 0;
+    }
+
+    bool chunked_encryption_engine::verify_range(const key& _Key, const uint64_t _First, const uint64_t _Count,
+        encryption_engine* const _Engine, byte_t* const _Buf) {
+        if (_Mytable == 0 && !load_footer()) {
+            return false;
+        }
+
+        if (_Mytree ? !open_merkle_root(_Key, _Engine) : !begin_decryption(_Key, _Engine)) {
+            return false;
+        }
+
+        const uint64_t _Total = (_Mysize + _Mychunk - 1) / _Mychunk;
+        if (_First > _Total || _Count > _Total - _First) { // out of bounds
+            return false;
+        }
+
+        for (uint64_t _Idx = _First; _Idx < _First + _Count; ++_Idx) {
+            chunk_record _Record;
+            if (_Mytree) {
+                if (!_Verify_record(_Idx, _Record)) {
+                    return false;
+                }
+            } else {
+                _Record = _Myrecords[static_cast<size_t>(_Idx)];
+            }
+
+            const size_t _Size = chunk_size_at(_Idx);
+            bool _Valid        = _Myfile.read_at(_Chunk_offset(_Idx), _Buf, _Size) == _Size
+                && _Engine->setup_decryption(_Mykey, _Record.chunk_iv) && _Engine->decrypt(_Buf, _Size, _Buf)
+                && _Engine->complete_decryption(_Record.tag);
+            _Scrub_memory(_Buf, _Size); // the plaintext is not needed
+            if (!_Valid) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool chunked_encryption_engine::begin_encryption(const key& _Key, const salt& _Salt) {
+        if (_Mychunk == 0 || _Mychunk > max_chunk_size || !_Key.valid()) {
+            return false;
+        }
+
+        _Mysize  = _Myfile.size();
+        _Mytable = 0;
+        _Mykey   = _Key;
+        _Mymeta.generate(); // the metadata's IV is used for the chunk table
+        _Mymeta.get_salt()                 = _Salt;
+        _Mymeta.get_encryption_engine_id() = _Myid;
+        _Myrecords.clear();
+        _Myrecords.resize(static_cast<size_t>((_Mysize + _Mychunk - 1) / _Mychunk));
+        _Myleaves.clear();
+        if (_Mytree) { // the leaves are hashed as the chunks are encrypted
+            _Myleaves.resize(_Myrecords.size());
+        }
+
+        return true;
+    }
+
+    bool chunked_encryption_engine::_Encrypt_in_memory(
+        const uint64_t _Idx, const size_t _Count, encryption_engine* const _Engine, byte_t* const _Buf) noexcept {
+        {
+            _Stage_timer _Timer(stage::read, _Count);
+            if (_Myfile.read_at(_Chunk_offset(_Idx), _Buf, _Count) != _Count) {
+                return false;
+            }
+        }
+
+        chunk_record& _Record = _Myrecords[static_cast<size_t>(_Idx)];
+        _Record.chunk_iv      = iv::generate(); // every chunk must get its own IV
+        {
+            _Stage_timer _Timer(stage::cipher, _Count);
+            if (!_Engine->setup_encryption(_Mykey, _Record.chunk_iv) || !_Engine->encrypt(_Buf, _Count, _Buf)
+                || !_Engine->complete_encryption(_Record.tag)) {
+                return false;
+            }
+        }
+
+        if (_Mytree) { // the record is final, hash it while it is still in cache
+            _Myleaves[static_cast<size_t>(_Idx)] = _Merkle_leaf(_Idx, _Record);
+        }
+
+        return true;
+    }
+
+    bool chunked_encryption_engine::encrypt_chunk(
+        const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) noexcept {
+        if (_Idx >= _Myrecords.size()) { // out of bounds
+            return false;
+        }
+
+        const size_t _Count = chunk_size_at(_Idx);
+        if (!_Encrypt_in_memory(_Idx, _Count, _Engine, _Buf)) {
+            return false;
+        }
+
+        _Stage_timer _Timer(stage::write, _Count);
+        return _Myfile.write_at(_Chunk_offset(_Idx), byte_string_view{_Buf, _Count});
+    }
+
+    bool chunked_encryption_engine::complete_encryption(encryption_engine* const _Engine) {
+        if (_Mytree) {
+            return _Complete_tree(_Engine);
+        }
+
+        ::std::vector<byte_t> _Bytes = _Serialize_table();
+        const size_t _Table_size     = _Bytes.size();
+        {
+            _Stage_timer _Timer(stage::cipher, _Table_size);
+            if (!_Engine->setup_encryption(_Mykey, _Mymeta.get_iv())
+                || !_Engine->encrypt(_Bytes.data(), _Table_size, _Bytes.data())
+                || !_Engine->complete_encryption(_Mymeta.get_tag())) {
+                return false;
+            }
+        }
+
+        _Bytes.resize(_Table_size + footer_size); // the footer is written together with the table
+        _Store_footer(_Bytes.data() + _Table_size, static_cast<uint64_t>(_Table_size));
+        _Mytable = static_cast<uint64_t>(_Table_size);
+        _Stage_timer _Timer(stage::write, _Bytes.size());
+        return _Myfile.write_at(_Mysize, byte_string_view{_Bytes.data(), _Bytes.size()});
+    }
+
+    bool chunked_encryption_engine::load_footer() noexcept {
+        const uint64_t _Size = _Myfile.size();
+        if (_Size < footer_size) { // the file cannot be smaller than the footer
+            return false;
+        }
+
+        byte_t _Footer[footer_size] = {0};
+        if (_Myfile.read_at(_Size - footer_size, _Footer, footer_size) != footer_size) {
+            return false;
+        }
+
+        const uint8_t _Version = _Footer[metadata::size + 12];
+        if ((_Version != version && _Version != merkle_version)
+            || _Load_little_endian<uint64_t>(_Footer + metadata::size + 13) != magic) { // unknown format
+            return false;
+        }
+
+        const uint32_t _Chunk = _Load_little_endian<uint32_t>(_Footer + metadata::size);
+        const uint64_t _Table = _Load_little_endian<uint64_t>(_Footer + metadata::size + 4);
+        if (_Chunk == 0 || _Chunk > max_chunk_size || _Table > _Size - footer_size) {
+            return false;
+        }
+
+        if (_Version == version) { // the whole table is sealed
+            if (_Table < table_header_size || (_Table - table_header_size) % record_size != 0) {
+                return false;
+            }
+        } else if (_Table < root_block_size) { // the root block is checked by open_merkle_root()
+            return false;
+        }
+
+        _Mymeta.extract(_Footer, metadata::size);
+        _Mychunk = _Chunk;
+        _Mytable = _Table;
+        _Mysize  = _Size - footer_size - _Table;
+        _Mytree  = _Version == merkle_version;
+        return true;
+    }
+
+    bool chunked_encryption_engine::begin_decryption(const key& _Key, encryption_engine* const _Engine) {
+        if (_Mytable == 0 && !load_footer()) {
+            return false;
+        }
+
+        if (_Mytree) { // the records are authenticated by the root
+            return open_merkle_root(_Key, _Engine) && _Load_records();
+        }
+
+        if (!_Key.valid() || _Mymeta.get_encryption_engine_id() != _Myid) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Bytes(static_cast<size_t>(_Mytable));
+        if (_Myfile.read_at(_Mysize, _Bytes.data(), _Bytes.size()) != _Bytes.size()) {
+            return false;
+        }
+
+        if (!_Engine->setup_decryption(_Key, _Mymeta.get_iv())) {
+            return false;
+        }
+
+        if (!_Engine->decrypt(_Bytes.data(), _Bytes.size(), _Bytes.data())
+            || !_Engine->complete_decryption(_Mymeta.get_tag())) { // the table has been modified
+            return false;
+        }
+
+        _Mykey = _Key;
+        return _Deserialize_table(_Bytes.data(), _Bytes.size());
+    }
+
+    bool chunked_encryption_engine::verify_chunk(
+        const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) noexcept {
+        if (_Idx >= _Myrecords.size()) { // out of bounds
+            return false;
+        }
+
+        const size_t _Count = chunk_size_at(_Idx);
+        if (!_Open_chunk(_Idx, _Count, _Engine, _Buf)) {
+            return false;
+        }
+
+        _Scrub_memory(_Buf, _Count); // the plaintext is not needed
+        return true;
+    }
+
+    bool chunked_encryption_engine::decrypt_chunk(
+        const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) noexcept {
+        if (_Idx >= _Myrecords.size()) { // out of bounds
+            return false;
+        }
+
+        const uint64_t _Off = _Chunk_offset(_Idx);
+        const size_t _Count = chunk_size_at(_Idx);
+        {
+            _Stage_timer _Timer(stage::read, _Count);
+            if (_Myfile.read_at(_Off, _Buf, _Count) != _Count) {
+                return false;
+            }
+        }
+
+        chunk_record& _Record = _Myrecords[static_cast<size_t>(_Idx)];
+        {
+            _Stage_timer _Timer(stage::cipher, _Count);
+            if (!_Engine->setup_decryption(_Mykey, _Record.chunk_iv)) {
+                return false;
+            }
+
+            if (!_Engine->decrypt(_Buf, _Count, _Buf) || !_Engine->complete_decryption(_Record.tag)) {
+                _Scrub_memory(_Buf, _Count); // never leave unauthenticated plaintext behind
+                return false;
+            }
+        }
+
+        if (_Mywriter && !_Mywriter->on_write(_Off, _Buf, _Count)) {
+            _Scrub_memory(_Buf, _Count);
+            return false;
+        }
+
+        _Stage_timer _Timer(stage::write, _Count);
+        return _Myfile.write_at(_Off, byte_string_view{_Buf, _Count});
+    }
+
+    bool chunked_encryption_engine::complete_decryption() noexcept {
+        _Mytable = 0;
+        return _Myfile.resize(_Mysize);
+    }
+
+    bool chunked_encryption_engine::_Open_chunk(
+        const uint64_t _Idx, const size_t _Count, encryption_engine* const _Engine, byte_t* const _Buf) noexcept {
+        const chunk_record& _Record = _Myrecords[static_cast<size_t>(_Idx)];
+        {
+            _Stage_timer _Timer(stage::read, _Count);
+            if (_Myfile.read_at(_Chunk_offset(_Idx), _Buf, _Count) != _Count) {
+                return false;
+            }
+        }
+
+        _Stage_timer _Timer(stage::cipher, _Count);
+        authentication_tag _Tag = _Record.tag;
+        if (!_Engine->setup_decryption(_Mykey, _Record.chunk_iv) || !_Engine->decrypt(_Buf, _Count, _Buf)
+            || !_Engine->complete_decryption(_Tag)) {
+            _Scrub_memory(_Buf, _Count); // never leave unauthenticated plaintext behind
+            return false;
+        }
+
+        return true;
+    }
+
+    bool chunked_encryption_engine::_Seal_chunk(
+        const uint64_t _Idx, const size_t _Count, encryption_engine* const _Engine, byte_t* const _Buf) noexcept {
+        // Note: A resealed chunk gets a fresh IV, an IV must never be reused with the same key.
+        chunk_record& _Record = _Myrecords[static_cast<size_t>(_Idx)];
+        _Record.chunk_iv      = iv::generate();
+        {
+            _Stage_timer _Timer(stage::cipher, _Count);
+            if (!_Engine->setup_encryption(_Mykey, _Record.chunk_iv) || !_Engine->encrypt(_Buf, _Count, _Buf)
+                || !_Engine->complete_encryption(_Record.tag)) {
+                return false;
+            }
+        }
+
+        if (_Mytree) { // only the path of this leaf changes, the tree is rebuilt by _Reseal_table()
+            _Myleaves[static_cast<size_t>(_Idx)] = _Merkle_leaf(_Idx, _Record);
+        }
+
+        _Stage_timer _Timer(stage::write, _Count);
+        return _Myfile.write_at(_Chunk_offset(_Idx), byte_string_view{_Buf, _Count});
+    }
+
+    bool chunked_encryption_engine::_Extend(const byte_string_view _Bytes, encryption_engine* const _Engine) {
+        ::std::vector<byte_t> _Buf(_Mychunk);
+        uint64_t _Idx = _Mysize / _Mychunk; // the first chunk to be written
+        size_t _Used  = static_cast<size_t>(_Mysize % _Mychunk); // the plaintext bytes already in that chunk
+        if (_Used != 0 && !_Open_chunk(_Idx, _Used, _Engine, _Buf.data())) { // the last chunk must be resealed
+            return false;
+        }
+
+        _Mysize += static_cast<uint64_t>(_Bytes.size());
+        _Myrecords.resize(static_cast<size_t>((_Mysize + _Mychunk - 1) / _Mychunk));
+        if (_Mytree) {
+            _Myleaves.resize(_Myrecords.size());
+        }
+
+        bool _Success = true;
+        for (size_t _Pos = 0; _Idx < _Myrecords.size() && _Success; ++_Idx, _Used = 0) {
+            const size_t _Count = _Min(_Mychunk - _Used, _Bytes.size() - _Pos);
+            ::memcpy(_Buf.data() + _Used, _Bytes.data() + _Pos, _Count);
+            _Pos    += _Count;
+            _Success = _Seal_chunk(_Idx, _Used + _Count, _Engine, _Buf.data());
+        }
+
+        _Scrub_memory(_Buf.data(), _Buf.size());
+        return _Success && _Reseal_table(_Engine);
+    }
+
+    bool chunked_encryption_engine::_Reseal_table(encryption_engine* const _Engine) {
+        _Mymeta.get_iv() = iv::generate(); // the table changes, so it must be sealed with a new IV
+        return complete_encryption(_Engine);
+    }
+
+    bool chunked_encryption_engine::_Commit(chunk_rollback_journal& _Log, const bool _Success) {
+        if (_Success && _Myfile.flush()) { // the new chunks and the new table are durable
+            return _Log.remove();
+        }
+
+        _Log.roll_back(_Myfile); // if this fails too, the journal is kept for recover()
+        _Mytable = 0; // the state in memory describes the undone change, the footer must be loaded again
+        return false;
+    }
+
+    bool chunked_encryption_engine::recover(const path& _Journal) {
+        chunk_rollback_journal _Log(_Journal);
+        if (!_Log.roll_back(_Myfile)) {
+            return false;
+        }
+
+        _Mytable = 0; // the file may have been restored, the footer must be loaded again
+        return true;
+    }
+
+    bool chunked_encryption_engine::append(const key& _Key, const byte_string_view _Bytes,
+        encryption_engine* const _Engine, const path& _Journal) {
+        if (!recover(_Journal) || !begin_decryption(_Key, _Engine)) { // the table must be authentic
+            return false;
+        }
+
+        if (_Bytes.empty()) { // nothing to append, do nothing
+            return true;
+        }
+
+        // Note: The last partial chunk is resealed and the trailer is overwritten, everything else is new.
+        const uint64_t _First = _Mysize - _Mysize % _Mychunk;
+        chunk_rollback_journal _Log(_Journal);
+        if (!_Log.begin(_Myfile, {chunk_range{_First, _Myfile.size() - _First}})) {
+            return false;
+        }
+
+        return _Commit(_Log, _Extend(_Bytes, _Engine));
+    }
+
+    bool chunked_encryption_engine::write_range(const key& _Key, const uint64_t _Off,
+        const byte_string_view _Bytes, encryption_engine* const _Engine, const path& _Journal) {
+        if (!recover(_Journal) || !begin_decryption(_Key, _Engine)) { // the table must be authentic
+            return false;
+        }
+
+        if (_Off > _Mysize) { // the range must not leave a gap
+            return false;
+        }
+
+        if (_Bytes.empty()) { // nothing to write, do nothing
+            return true;
+        }
+
+        // Note: The journal saves the touched chunks and the trailer. A range that extends the file
+        //       also reseals the last partial chunk, which then becomes a part of the saved trailer.
+        const size_t _Inside = static_cast<size_t>(_Min(static_cast<uint64_t>(_Bytes.size()), _Mysize - _Off));
+        const uint64_t _Tail = _Inside < _Bytes.size() ? _Mysize - _Mysize % _Mychunk : _Mysize;
+        ::std::vector<chunk_range> _Ranges;
+        uint64_t _Saved = _Tail; // the first byte of the last saved range
+        if (_Inside != 0) {
+            const uint64_t _First = _Chunk_offset(_Off / _Mychunk);
+            const uint64_t _Last  = (_Off + _Inside - 1) / _Mychunk;
+            const uint64_t _End   = _Chunk_offset(_Last) + chunk_size_at(_Last);
+            if (_End < _Tail) {
+                _Ranges.push_back(chunk_range{_First, _End - _First});
+            } else { // the chunks reach the trailer, a single range covers both
+                _Saved = _First;
+            }
+        }
+
+        _Ranges.push_back(chunk_range{_Saved, _Myfile.size() - _Saved});
+        chunk_rollback_journal _Log(_Journal);
+        if (!_Log.begin(_Myfile, _Ranges)) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Buf(_Mychunk);
+        bool _Success = true;
+        size_t _Pos   = 0; // the number of bytes from _Bytes already written
+        while (_Pos < _Inside && _Success) {
+            const uint64_t _Target = _Off + _Pos;
+            const uint64_t _Idx    = _Target / _Mychunk;
+            const size_t _Begin    = static_cast<size_t>(_Target % _Mychunk); // the first changed byte
+            const size_t _Size     = chunk_size_at(_Idx);
+            const size_t _Count    = _Min(_Size - _Begin, _Inside - _Pos);
+            if (_Begin != 0 || _Count != _Size) { // partially changed chunk, the rest must be preserved
+                if (!_Open_chunk(_Idx, _Size, _Engine, _Buf.data())) {
+                    _Success = false;
+                    break;
+                }
+            }
+
+            ::memcpy(_Buf.data() + _Begin, _Bytes.data() + _Pos, _Count);
+            _Success = _Seal_chunk(_Idx, _Size, _Engine, _Buf.data());
+            _Pos    += _Count;
+        }
+
+        _Scrub_memory(_Buf.data(), _Buf.size());
+        if (_Success) { // the rest extends the file, the table is resealed by _Extend()
+            _Success = _Pos < _Bytes.size()
+                ? _Extend(byte_string_view{_Bytes.data() + _Pos, _Bytes.size() - _Pos}, _Engine)
+                : _Reseal_table(_Engine);
+        }
+
+        return _Commit(_Log, _Success);
+    }
+
+    template <class _Fn>
+    bool chunked_encryption_engine::_Process_chunks(const size_t _Threads, _Fn _Func) {
+        const uint64_t _Count = chunk_count();
+        if (_Count == 0) { // nothing to process, do nothing
+            return true;
+        }
+
+        struct _Worker_state { // every worker needs its own engine, buffer and statistics
+            ::std::unique_ptr<encryption_engine> _Engine;
+            ::std::vector<byte_t> _Buf;
+            stage_stats _Stats;
+        };
+
+        const uint64_t _Requested = static_cast<uint64_t>(_Threads != 0 ? _Threads : 1);
+        const size_t _Workers     = static_cast<size_t>(_Min(_Requested, _Count));
+        ::std::vector<_Worker_state> _States(_Workers);
+        for (_Worker_state& _State : _States) {
+            _State._Engine.reset(make_encryption_engine(_Myid));
+            if (!_State._Engine) {
+                return false;
+            }
+
+            _State._Buf.resize(_Mychunk);
+        }
+
+        ::std::atomic<bool> _Success{true};
+        if (_Workers == 1) { // no need to start any threads
+            for (uint64_t _Idx = 0; _Idx < _Count && _Success; ++_Idx) {
+                _Success = _Func(_Idx, _States[0]._Engine.get(), _States[0]._Buf.data());
+            }
+        } else {
+            _Task_scheduler _Scheduler(_Workers);
+            _Scheduler._Submit_range(0, _Count, ::std::make_shared<const _Task_scheduler::_Range_task>(
+                [&](const uint64_t _Idx, const size_t _Worker) {
+                    _Worker_state& _State = _States[_Worker];
+                    _Stage_snapshot _Snapshot(_State._Stats);
+                    if (_Success.load(::std::memory_order_relaxed)
+                        && !_Func(_Idx, _State._Engine.get(), _State._Buf.data())) {
+                        _Success = false;
+                    }
+                }));
+            _Scheduler._Wait();
+        }
+
+        for (_Worker_state& _State : _States) {
+            _Scrub_memory(_State._Buf.data(), _State._Buf.size());
+            _Thread_stage_stats() += _State._Stats; // a snapshot taken by the caller covers the workers too
+        }
+
+        return _Success;
+    }
+
+    bool chunked_encryption_engine::encrypt(const key& _Key, const salt& _Salt, const size_t _Threads) {
+        if (!begin_encryption(_Key, _Salt)) {
+            return false;
+        }
+
+        const bool _Result = _Process_chunks(_Threads,
+            [this](const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) {
+                return encrypt_chunk(_Idx, _Engine, _Buf);
+            });
+        if (!_Result) {
+            return false;
+        }
+
+        const ::std::unique_ptr<encryption_engine> _Engine(make_encryption_engine(_Myid));
+        return _Engine && complete_encryption(_Engine.get());
+    }
+
+    bool chunked_encryption_engine::decrypt(const key& _Key, const size_t _Threads) {
+        const ::std::unique_ptr<encryption_engine> _Engine(make_encryption_engine(_Myid));
+        if (!_Engine || !begin_decryption(_Key, _Engine.get())) {
+            return false;
+        }
+
+        // Note: Nothing is written until every chunk has been verified, so a damaged chunk leaves
+        //       the whole file encrypted. Each chunk is decrypted twice, the price of that guarantee.
+        const bool _Authentic = _Process_chunks(_Threads,
+            [this](const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) {
+                return verify_chunk(_Idx, _Engine, _Buf);
+            });
+        if (!_Authentic) {
+            return false;
+        }
+
+        const bool _Result = _Process_chunks(_Threads,
+            [this](const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) {
+                return decrypt_chunk(_Idx, _Engine, _Buf);
+            });
+        return _Result && complete_decryption();
+    }
+
+    bool chunked_encryption_engine::_Recover_chunk(const uint64_t _Idx, const byte_t* const _Fingerprints,
+        encryption_engine* const _Engine, byte_t* const _Buf, byte_t* const _Keystream) noexcept {
+        chunk_record& _Record = _Myrecords[static_cast<size_t>(_Idx)];
+        const uint64_t _Off   = _Chunk_offset(_Idx);
+        const size_t _Count   = chunk_size_at(_Idx);
+        if (_Myfile.read_at(_Off, _Buf, _Count) != _Count) {
+            return false;
+        }
+
+        // Note: Encrypting zeros yields the keystream of the chunk. A unit that does not match its
+        //       fingerprint still holds the plaintext, XOR-ing it with the keystream yields the ciphertext.
+        //       The tag of the reconstructed chunk is checked before anything is written.
+        ::memset(_Keystream, 0, _Count);
+        authentication_tag _Unused;
+        if (!_Engine->setup_encryption(_Mykey, _Record.chunk_iv)
+            || !_Engine->encrypt(_Keystream, _Count, _Keystream) || !_Engine->complete_encryption(_Unused)) {
+            return false;
+        }
+
+        for (size_t _Unit = 0; _Unit * chunk_journal::unit_size < _Count; ++_Unit) {
+            const size_t _First  = _Unit * chunk_journal::unit_size;
+            const size_t _Length = _Min(_Count - _First, chunk_journal::unit_size);
+            const size_t _Prefix = _Min(_Length, chunk_journal::fingerprint_size);
+            if (::memcmp(_Buf + _First, _Fingerprints + _Unit * chunk_journal::fingerprint_size, _Prefix) != 0) {
+                for (size_t _Pos = _First; _Pos < _First + _Length; ++_Pos) { // not overwritten yet
+                    _Buf[_Pos] ^= _Keystream[_Pos];
+                }
+            }
+        }
+
+        const bool _Authentic = _Engine->setup_decryption(_Mykey, _Record.chunk_iv)
+            && _Engine->decrypt(_Buf, _Count, _Keystream) && _Engine->complete_decryption(_Record.tag);
+        _Scrub_memory(_Keystream, _Count); // holds the plaintext
+        return _Authentic && _Myfile.write_at(_Off, byte_string_view{_Buf, _Count});
+    }
+
+    bool chunked_encryption_engine::_Resume_journal(chunk_journal& _Journal, const key& _Key, const salt& _Salt,
+        const uint64_t _Plaintext_size, encryption_engine* const _Engine, uint64_t& _Next) {
+        const uint64_t _Size = _Myfile.size();
+        if (::memcmp(_Mymeta.get_salt().get(), _Salt.get(), salt::size) != 0 || _Size < _Plaintext_size) {
+            return false; // another salt means another key, a smaller file means another file
+        }
+
+        _Mysize  = _Plaintext_size;
+        _Mytable = 0;
+        _Mykey   = _Key;
+        _Myrecords.clear();
+        _Myrecords.resize(static_cast<size_t>((_Mysize + _Mychunk - 1) / _Mychunk));
+        chunk_journal_entry _Entry;
+        chunk_journal_entry _Last;
+        while (_Journal.next_entry(_Entry)) {
+            for (size_t _Pos = 0; _Pos < _Entry.records.size(); ++_Pos) {
+                _Myrecords[static_cast<size_t>(_Entry.first + _Pos)] = _Entry.records[_Pos];
+            }
+
+            _Last = ::std::move(_Entry);
+        }
+
+        _Next = _Last.first + _Last.records.size();
+        if (!_Journal.truncate()) { // drop a torn entry, the next entry is appended after the last valid one
+            return false;
+        }
+
+        if (_Size > _Plaintext_size) { // the trailer has been partially written, it is written again
+            if (_Next != _Myrecords.size() || !_Myfile.resize(_Plaintext_size)) {
+                return false;
+            }
+        }
+
+        if (!_Last.records.empty()) { // the chunks of the last entry may have been partially overwritten
+            ::std::vector<byte_t> _Buf(_Mychunk);
+            ::std::vector<byte_t> _Keystream(_Mychunk);
+            const byte_t* _Fingerprints = _Last.fingerprints.data();
+            for (uint64_t _Idx = _Last.first; _Idx < _Next; ++_Idx) {
+                if (!_Recover_chunk(_Idx, _Fingerprints, _Engine, _Buf.data(), _Keystream.data())) {
+                    return false;
+                }
+
+                _Fingerprints += _Journal.units(_Idx) * chunk_journal::fingerprint_size;
+            }
+
+            if (!_Myfile.flush()) {
+                return false;
+            }
+        }
+
+        _Myleaves.clear();
+        if (_Mytree) { // the leaves of the journaled chunks are not stored anywhere
+            _Myleaves.resize(_Myrecords.size());
+            for (uint64_t _Idx = 0; _Idx < _Next; ++_Idx) {
+                _Myleaves[static_cast<size_t>(_Idx)] = _Merkle_leaf(_Idx, _Myrecords[static_cast<size_t>(_Idx)]);
+            }
+        }
+
+        return true;
+    }
+
+    bool chunked_encryption_engine::_Process_journaled(
+        chunk_journal& _Journal, const uint64_t _Next, const size_t _Threads, const size_t _Batch) {
+        const uint64_t _Count = chunk_count();
+        if (_Next >= _Count) { // nothing left to encrypt
+            return true;
+        }
+
+        const uint64_t _Requested = static_cast<uint64_t>(_Threads != 0 ? _Threads : 1);
+        const size_t _Workers     = static_cast<size_t>(_Min(_Min(_Requested, static_cast<uint64_t>(_Batch)), _Count));
+        ::std::vector<::std::unique_ptr<encryption_engine>> _Engines(_Workers);
+        for (::std::unique_ptr<encryption_engine>& _Engine : _Engines) {
+            _Engine.reset(make_encryption_engine(_Myid));
+            if (!_Engine) {
+                return false;
+            }
+        }
+
+        // Note: A batch is encrypted in memory, journaled, written back and flushed. Only then can
+        //       the next batch be journaled, so at most one entry is ever partially applied.
+        ::std::unique_ptr<_Task_scheduler> _Scheduler;
+        ::std::vector<stage_stats> _Stats(_Workers); // passed to the calling thread once the chunks are done
+        if (_Workers > 1) {
+            _Scheduler = ::std::make_unique<_Task_scheduler>(_Workers);
+        }
+
+        const auto _Parallel = [&](const uint64_t _Size, const auto& _Func) {
+            if (!_Scheduler) { // no need to use any threads
+                for (uint64_t _Pos = 0; _Pos < _Size; ++_Pos) {
+                    if (!_Func(_Pos, 0)) {
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+            ::std::atomic<bool> _Success{true};
+            _Scheduler->_Submit_range(0, _Size, ::std::make_shared<const _Task_scheduler::_Range_task>(
+                [&](const uint64_t _Pos, const size_t _Worker) {
+                    _Stage_snapshot _Snapshot(_Stats[_Worker]);
+                    if (_Success.load(::std::memory_order_relaxed) && !_Func(_Pos, _Worker)) {
+                        _Success = false;
+                    }
+                }));
+            _Scheduler->_Wait();
+            return _Success.load();
+        };
+
+        ::std::vector<byte_t> _Bufs(_Batch * _Mychunk);
+        ::std::vector<size_t> _Offsets(_Batch); // the offsets of the fingerprints of every chunk
+        chunk_journal_entry _Entry;
+        bool _Success = true;
+        for (uint64_t _First = _Next; _First < _Count && _Success; _First += _Batch) {
+            const size_t _Size = static_cast<size_t>(_Min(_Count - _First, static_cast<uint64_t>(_Batch)));
+            size_t _Units      = 0;
+            for (size_t _Pos = 0; _Pos < _Size; ++_Pos) {
+                _Offsets[_Pos] = _Units * chunk_journal::fingerprint_size;
+                _Units        += _Journal.units(_First + _Pos);
+            }
+
+            _Entry.first = _First;
+            _Entry.records.resize(_Size);
+            _Entry.fingerprints.resize(_Units * chunk_journal::fingerprint_size);
+            _Success = _Parallel(_Size, [&](const uint64_t _Pos, const size_t _Worker) {
+                const uint64_t _Idx = _First + _Pos;
+                const size_t _Bytes = chunk_size_at(_Idx);
+                byte_t* const _Buf  = _Bufs.data() + static_cast<size_t>(_Pos) * _Mychunk;
+                if (!_Encrypt_in_memory(_Idx, _Bytes, _Engines[_Worker].get(), _Buf)) {
+                    return false;
+                }
+
+                _Entry.records[static_cast<size_t>(_Pos)] = _Myrecords[static_cast<size_t>(_Idx)];
+                _Fingerprint_units(_Buf, _Bytes, _Entry.fingerprints.data() + _Offsets[static_cast<size_t>(_Pos)]);
+                return true;
+            });
+            if (!_Success || !_Journal.append(_Entry)) { // nothing has been overwritten yet
+                _Success = false;
+                break;
+            }
+
+            _Success = _Parallel(_Size, [&](const uint64_t _Pos, size_t) {
+                const uint64_t _Idx = _First + _Pos;
+                _Stage_timer _Timer(stage::write, chunk_size_at(_Idx));
+                return _Myfile.write_at(_Chunk_offset(_Idx),
+                    byte_string_view{_Bufs.data() + static_cast<size_t>(_Pos) * _Mychunk, chunk_size_at(_Idx)});
+            }) && _Myfile.flush();
+        }
+
+        _Scrub_memory(_Bufs.data(), _Bufs.size());
+        for (const stage_stats& _Worker_stats : _Stats) { // a snapshot taken by the caller covers the workers too
+            _Thread_stage_stats() += _Worker_stats;
+        }
+
+        return _Success;
+    }
+
+    bool chunked_encryption_engine::encrypt_journaled(const key& _Key, const salt& _Salt,
+        const path& _Journal, const size_t _Threads, const size_t _Batch) {
+        if (_Mychunk == 0 || _Mychunk > max_chunk_size || _Mychunk % chunk_journal::unit_size != 0
+            || _Batch == 0 || !_Key.valid()) {
+            return false;
+        }
+
+        const ::std::unique_ptr<encryption_engine> _Engine(make_encryption_engine(_Myid));
+        chunk_journal _Log(_Journal);
+        if (!_Engine || !_Log.is_open()) {
+            return false;
+        }
+
+        uint64_t _Next           = 0;
+        uint64_t _Plaintext_size = 0;
+        if (_Log.load_header(_Myid, _Mychunk, _Plaintext_size, _Mymeta)) { // an interrupted encryption
+            if (!_Resume_journal(_Log, _Key, _Salt, _Plaintext_size, _Engine.get(), _Next)) {
+                return false;
+            }
+        } else if (_Log.has_entries()) { // a damaged journal, the file cannot be recovered automatically
+            return false;
+        } else { // a new journal or a torn header, nothing has been overwritten yet
+            if (!begin_encryption(_Key, _Salt) || !_Log.begin(_Myid, _Mychunk, _Mysize, _Mymeta)) {
+                return false;
+            }
+        }
+
+        // Note: Completing the encryption twice with the same table IV is safe, the table is the same,
+        //       so an interruption after this point only causes the trailer to be written again.
+        if (!_Process_journaled(_Log, _Next, _Threads, _Batch) || !complete_encryption(_Engine.get())
+            || !_Myfile.flush()) {
+            return false;
+        }
+
+        return _Log.remove();
+    }
+} // namespace fcrypt
\ No newline at end of file
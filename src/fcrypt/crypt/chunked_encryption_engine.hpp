@@ -0,0 +1,265 @@
+// chunked_encryption_engine.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_CHUNKED_ENCRYPTION_ENGINE_HPP_
+#define _FCRYPT_CRYPT_CHUNKED_ENCRYPTION_ENGINE_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/file_encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fcrypt {
+    // Note: The chunked format splits the file into fixed-size chunks that are encrypted independently,
+    //       each with its own IV and tag, so the chunks can be processed in any order and in parallel.
+    //       The layout is as follows:
+    //
+    //       [chunk 0] ... [chunk N-1] [sealed chunk table] [footer]
+    //
+    //       The chunk table stores the plaintext size, the chunk size, the chunk count and one record
+    //       (IV and tag) per chunk. It is encrypted with the IV stored in the footer's metadata, whose
+    //       tag authenticates the whole table. The footer is stored in plain text and consists of
+    //       the metadata, the chunk size, the table size, the format version and a magic number.
+    //
+    //       An append decrypts and reseals only the last partial chunk, adds new chunks and rewrites
+    //       the table and the footer, so its cost depends on the number of appended bytes only.
+    //       A range write re-encrypts only the chunks it touches, each with a fresh IV, and reseals
+    //       the table. Both save the bytes they overwrite (the touched chunks and the old trailer)
+    //       in a rollback journal first (see chunk_journal.hpp), so the old table remains recoverable
+    //       until the new chunks and the new table are durable. An interrupted or failed change is
+    //       undone, by the change itself or by the next append, range write or recover().
+    //
+    //       Version 2 adds an optional Merkle tree over the chunk records and changes the trailer:
+    //
+    //       [chunk 0] ... [chunk N-1] [records] [tree nodes] [sealed root] [footer]
+    //
+    //       The records and the tree nodes are stored in plain text (IVs and tags are not secret),
+    //       only the root block (plaintext size, chunk size, chunk count and root) is sealed. A range
+    //       can therefore be verified by opening the root block and reading one authentication path
+    //       per chunk instead of the whole table. The leaves are hashed as the chunks are encrypted,
+    //       so building the tree does not require any extra I/O.
+
+    class chunk_journal;
+    class chunk_rollback_journal;
+
+    struct chunk_record { // describes a single encrypted chunk
+        iv chunk_iv;
+        authentication_tag tag;
+    };
+
+    using merkle_digest = _Secure_buffer<32>; // SHA-256
+
+    class chunked_encryption_engine { // encrypts the file as independent chunks
+    public:
+        explicit chunked_encryption_engine(file& _File, const encryption_engine::id _Id,
+            const size_t _Chunk_size = default_chunk_size, const bool _Merkle_tree = false) noexcept;
+        ~chunked_encryption_engine() noexcept;
+
+        chunked_encryption_engine(const chunked_encryption_engine&) = delete;
+        chunked_encryption_engine& operator=(const chunked_encryption_engine&) = delete;
+
+        static constexpr size_t default_chunk_size = 1048576; // 1 MiB
+        static constexpr size_t max_chunk_size     = 67108864; // 64 MiB
+        static constexpr size_t record_size        = iv::size + authentication_tag::size;
+        static constexpr size_t table_header_size  = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t);
+        static constexpr size_t footer_size        = metadata::size
+            + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint64_t);
+        static constexpr size_t root_block_size    = table_header_size + merkle_digest::size;
+        static constexpr size_t default_batch      = 16; // the number of chunks per journal entry
+        static constexpr uint8_t version           = 1;
+        static constexpr uint8_t merkle_version    = 2; // the format with a Merkle tree
+        static constexpr uint64_t magic            = 0x4843'5450'5952'4346; // "FCRYPTCH"
+
+        // checks if the file is stored in the chunked format
+        static bool is_chunked(file& _File) noexcept;
+
+        // returns the chunk size
+        size_t chunk_size() const noexcept;
+
+        // returns the number of chunks
+        uint64_t chunk_count() const noexcept;
+
+        // returns the plaintext size
+        uint64_t plaintext_size() const noexcept;
+
+        // returns the size of the chunk at the specified index
+        size_t chunk_size_at(const uint64_t _Idx) const noexcept;
+
+        // returns the associated metadata (engine ID, table IV, table tag and salt)
+        metadata& get_metadata() noexcept;
+
+        // returns the chunk records
+        const ::std::vector<chunk_record>& records() const noexcept;
+
+        // checks if the file has (or will have) a Merkle tree
+        bool has_merkle_tree() const noexcept;
+
+        // sets the observer notified before decrypt_chunk() writes a chunk back (nullptr disables it)
+        void set_write_observer(write_observer* const _Observer) noexcept;
+
+        // returns the Merkle root (valid after the tree has been built or opened)
+        const merkle_digest& merkle_root() const noexcept;
+
+        // tries to prepare the encryption of the whole file
+        bool begin_encryption(const key& _Key, const salt& _Salt);
+
+        // tries to encrypt the chunk in place, _Buf must hold at least chunk_size() bytes
+        bool encrypt_chunk(const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) noexcept;
+
+        // tries to seal the chunk table and append it together with the footer
+        bool complete_encryption(encryption_engine* const _Engine);
+
+        // tries to read the footer (its salt is required to derive the key)
+        bool load_footer() noexcept;
+
+        // tries to open and verify the chunk table
+        bool begin_decryption(const key& _Key, encryption_engine* const _Engine);
+
+        // tries to verify the chunk's tag without modifying the file, _Buf must hold at least chunk_size() bytes
+        bool verify_chunk(const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) noexcept;
+
+        // tries to decrypt the chunk in place, the chunk is written back only if its tag matches
+        bool decrypt_chunk(const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Buf) noexcept;
+
+        // tries to open and verify the Merkle root without reading the chunk records,
+        // two copies of the file can then be compared by their roots alone
+        bool open_merkle_root(const key& _Key, encryption_engine* const _Engine);
+
+        // tries to verify _Count chunks starting at _First without modifying the file, each record
+        // is checked against the Merkle root, _Buf must hold at least chunk_size() bytes
+        // (a file without a tree falls back to the verification of the whole table)
+        bool verify_range(const key& _Key, const uint64_t _First, const uint64_t _Count,
+            encryption_engine* const _Engine, byte_t* const _Buf);
+
+        // tries to remove the chunk table and the footer
+        bool complete_decryption() noexcept;
+
+        // tries to undo an append or a range write interrupted while it used the rollback journal _Journal
+        // (does nothing if there is no such journal)
+        bool recover(const path& _Journal);
+
+        // tries to append _Bytes to the encrypted file, only the last partial chunk is re-encrypted,
+        // the change is undone if it fails (_Journal is the rollback journal, which is removed on success)
+        bool append(const key& _Key, const byte_string_view _Bytes,
+            encryption_engine* const _Engine, const path& _Journal);
+
+        // tries to overwrite the plaintext starting at _Off, only the affected chunks are re-encrypted
+        // (the range may extend the file, but it must start within the plaintext or at its end),
+        // the change is undone if it fails (_Journal is the rollback journal, which is removed on success)
+        bool write_range(const key& _Key, const uint64_t _Off, const byte_string_view _Bytes,
+            encryption_engine* const _Engine, const path& _Journal);
+
+        // tries to encrypt the whole file using _Threads threads, the chunk records are kept in memory
+        // until the table is written, so an interrupted encryption cannot be recovered
+        // (use encrypt_journaled() if the file must survive an interruption)
+        bool encrypt(const key& _Key, const salt& _Salt, const size_t _Threads = 1);
+
+        // tries to decrypt the whole file using _Threads threads, every chunk is verified
+        // before any plaintext is written, so a damaged file remains fully encrypted
+        bool decrypt(const key& _Key, const size_t _Threads = 1);
+
+        // tries to encrypt the whole file with a checkpoint after every _Batch chunks, an interrupted
+        // encryption continues from the last checkpoint when called again with the same key, salt and
+        // journal (see chunk_journal.hpp), the chunk size must be a multiple of chunk_journal::unit_size
+        // and the journal is deleted on success
+        bool encrypt_journaled(const key& _Key, const salt& _Salt, const path& _Journal,
+            const size_t _Threads = 1, const size_t _Batch = default_batch);
+
+    private:
+        // returns the offset of the chunk at the specified index
+        uint64_t _Chunk_offset(const uint64_t _Idx) const noexcept;
+
+        // stores the footer that follows a trailer of the specified size
+        void _Store_footer(byte_t* const _Footer, const uint64_t _Table_size) noexcept;
+
+        // serializes the chunk table
+        ::std::vector<byte_t> _Serialize_table() const;
+
+        // tries to deserialize the chunk table
+        bool _Deserialize_table(const byte_t* const _Bytes, const size_t _Size);
+
+        // returns the number of stored tree nodes (all levels except the root)
+        static uint64_t _Tree_nodes(uint64_t _Count) noexcept;
+
+        // returns the trailer size (without the footer) of the version 2 format
+        static uint64_t _Trailer_size(const uint64_t _Count) noexcept;
+
+        // builds all tree levels from the leaves, stores every level except the root in _Nodes
+        void _Build_tree(::std::vector<byte_t>& _Nodes);
+
+        // tries to seal the root block and write the version 2 trailer together with the footer
+        bool _Complete_tree(encryption_engine* const _Engine);
+
+        // tries to read the plain records and to check them against the opened root
+        bool _Load_records();
+
+        // tries to read the record and check its authentication path against the root
+        bool _Verify_record(const uint64_t _Idx, chunk_record& _Record) noexcept;
+
+        // tries to read, decrypt and verify the chunk
+        bool _Open_chunk(
+            const uint64_t _Idx, const size_t _Count, encryption_engine* const _Engine, byte_t* const _Buf) noexcept;
+
+        // tries to encrypt the chunk with a fresh IV and write it
+        bool _Seal_chunk(
+            const uint64_t _Idx, const size_t _Count, encryption_engine* const _Engine, byte_t* const _Buf) noexcept;
+
+        // tries to append _Bytes after the last chunk and reseal the table
+        bool _Extend(const byte_string_view _Bytes, encryption_engine* const _Engine);
+
+        // tries to seal the changed table with a new IV and write it together with the footer
+        bool _Reseal_table(encryption_engine* const _Engine);
+
+        // tries to make the change durable and remove the rollback journal, undoes the change if it has failed
+        bool _Commit(chunk_rollback_journal& _Log, const bool _Success);
+
+        // tries to read and encrypt the chunk without writing it back
+        bool _Encrypt_in_memory(
+            const uint64_t _Idx, const size_t _Count, encryption_engine* const _Engine, byte_t* const _Buf) noexcept;
+
+        // tries to load the journaled records and to restore the chunks of the last entry,
+        // returns the index of the first chunk that has not been journaled yet
+        bool _Resume_journal(chunk_journal& _Journal, const key& _Key, const salt& _Salt,
+            const uint64_t _Plaintext_size, encryption_engine* const _Engine, uint64_t& _Next);
+
+        // tries to restore the ciphertext of a chunk that may have been partially overwritten,
+        // _Buf and _Keystream must hold at least chunk_size() bytes
+        bool _Recover_chunk(const uint64_t _Idx, const byte_t* const _Fingerprints,
+            encryption_engine* const _Engine, byte_t* const _Buf, byte_t* const _Keystream) noexcept;
+
+        // tries to encrypt the chunks starting at _Next in journaled batches
+        bool _Process_journaled(
+            chunk_journal& _Journal, const uint64_t _Next, const size_t _Threads, const size_t _Batch);
+
+        // runs _Func for every chunk, sequentially or on a task scheduler
+        template <class _Fn>
+        bool _Process_chunks(const size_t _Threads, _Fn _Func);
+
+        file& _Myfile;
+        encryption_engine::id _Myid;
+        size_t _Mychunk;
+        uint64_t _Mysize; // the plaintext size
+        uint64_t _Mytable; // the sealed table size
+        metadata _Mymeta;
+        key _Mykey;
+        ::std::vector<chunk_record> _Myrecords;
+        ::std::vector<merkle_digest> _Myleaves; // the leaf hashes, only used with a Merkle tree
+        merkle_digest _Myroot;
+        bool _Mytree; // true if the file has (or will have) a Merkle tree
+        write_observer* _Mywriter;
+    };
+
+    // returns the leaf hash of the chunk record at the specified index
+    merkle_digest _Merkle_leaf(const uint64_t _Idx, const chunk_record& _Record) noexcept;
+
+    // returns the hash of the inner node with the specified children
+    merkle_digest _Merkle_parent(const merkle_digest& _Left, const merkle_digest& _Right) noexcept;
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_CHUNKED_ENCRYPTION_ENGINE_HPP_
\ No newline at end of file
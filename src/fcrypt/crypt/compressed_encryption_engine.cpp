@@ -0,0 +1,504 @@
+// compressed_encryption_engine.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/compressed_encryption_engine.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+#include <fcrypt/details/task_scheduler.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+
+namespace fcrypt {
+    // Note: The chunk index contains the plaintext size (offset 0), the chunk size (offset 8) and
+    //       the chunk count (offset 12), followed by the entries. An entry contains the offset of
+    //       the stored chunk (offset 0), its size (offset 8), its flags (offset 12), its IV (offset 13)
+    //       and its tag (offset 25). All integers are stored in little-endian.
+
+    static constexpr uint8_t _Flag_compressed = 0x01;
+
+    struct compressed_encryption_engine::_Worker_state { // engines and codecs are not thread-safe
+        ::std::unique_ptr<encryption_engine> _Engine;
+        chunk_compressor _Codec;
+    };
+
+    template <class _Fn>
+    static bool _Run_parallel(_Task_scheduler* const _Scheduler, const uint64_t _Count, const _Fn& _Func) {
+        if (!_Scheduler) { // no need to use any threads
+            for (uint64_t _Pos = 0; _Pos < _Count; ++_Pos) {
+                if (!_Func(_Pos, 0)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        ::std::atomic<bool> _Success{true};
+        _Scheduler->_Submit_range(0, _Count, ::std::make_shared<const _Task_scheduler::_Range_task>(
+            [&](const uint64_t _Pos, const size_t _Worker) {
+                if (_Success.load(::std::memory_order_relaxed) && !_Func(_Pos, _Worker)) {
+                    _Success = false;
+                }
+            }));
+        _Scheduler->_Wait();
+        return _Success.load();
+    }
+
+    compressed_encryption_engine::compressed_encryption_engine(
+        file& _File, const encryption_engine::id _Id, const size_t _Chunk_size) noexcept
+        : _Myfile(_File), _Myid(_Id), _Mychunk(_Chunk_size), _Mysize(0), _Mystored(0), _Myindex(0),
+        _Mymeta(), _Mykey(), _Mychunks() {}
+
+    compressed_encryption_engine::~compressed_encryption_engine() noexcept {}
+
+    bool compressed_encryption_engine::is_compressed(file& _File) noexcept {
+        const uint64_t _Size = _File.size();
+        if (_Size < footer_size) { // the file cannot be smaller than the footer
+            return false;
+        }
+
+        byte_t _Bytes[sizeof(uint64_t)] = {0};
+        if (_File.read_at(_Size - sizeof(uint64_t), _Bytes, sizeof(uint64_t)) != sizeof(uint64_t)) {
+            return false;
+        }
+
+        return _Load_little_endian<uint64_t>(_Bytes) == magic;
+    }
+
+    size_t compressed_encryption_engine::chunk_size() const noexcept {
+        return _Mychunk;
+    }
+
+    uint64_t compressed_encryption_engine::chunk_count() const noexcept {
+        return static_cast<uint64_t>(_Mychunks.size());
+    }
+
+    uint64_t compressed_encryption_engine::plaintext_size() const noexcept {
+        return _Mysize;
+    }
+
+    uint64_t compressed_encryption_engine::stored_size() const noexcept {
+        return _Mystored;
+    }
+
+    size_t compressed_encryption_engine::chunk_size_at(const uint64_t _Idx) const noexcept {
+        const uint64_t _Off = _Idx * static_cast<uint64_t>(_Mychunk);
+        if (_Off >= _Mysize) { // out of bounds
+            return 0;
+        }
+
+        return static_cast<size_t>(_Min(_Mysize - _Off, static_cast<uint64_t>(_Mychunk)));
+    }
+
+    metadata& compressed_encryption_engine::get_metadata() noexcept {
+        return _Mymeta;
+    }
+
+    const ::std::vector<compressed_chunk>& compressed_encryption_engine::chunks() const noexcept {
+        return _Mychunks;
+    }
+
+    void compressed_encryption_engine::_Store_footer(byte_t* const _Footer, const uint64_t _Index_size) noexcept {
+        _Mymeta.save(_Footer, metadata::size);
+        _Store_little_endian(_Footer + metadata::size, static_cast<uint32_t>(_Mychunk));
+        _Store_little_endian(_Footer + metadata::size + 4, _Index_size);
+        _Footer[metadata::size + 12] = version;
+        _Store_little_endian(_Footer + metadata::size + 13, magic);
+    }
+
+    ::std::vector<byte_t> compressed_encryption_engine::_Serialize_index() const {
+        ::std::vector<byte_t> _Bytes(index_header_size + _Mychunks.size() * entry_size);
+        byte_t* _Ptr = _Bytes.data();
+        _Store_little_endian(_Ptr, _Mysize);
+        _Store_little_endian(_Ptr + 8, static_cast<uint32_t>(_Mychunk));
+        _Store_little_endian(_Ptr + 12, static_cast<uint64_t>(_Mychunks.size()));
+        _Ptr += index_header_size;
+        for (const compressed_chunk& _Chunk : _Mychunks) {
+            _Store_little_endian(_Ptr, _Chunk.offset);
+            _Store_little_endian(_Ptr + 8, _Chunk.stored_size);
+            _Ptr[12] = _Chunk.compressed ? _Flag_compressed : 0;
+            ::memcpy(_Ptr + 13, _Chunk.chunk_iv.get(), iv::size);
+            ::memcpy(_Ptr + 13 + iv::size, _Chunk.tag.get(), authentication_tag::size);
+            _Ptr += entry_size;
+        }
+
+        return _Bytes;
+    }
+
+    bool compressed_encryption_engine::_Deserialize_index(const byte_t* const _Bytes, const size_t _Size) {
+        if (_Size < index_header_size) {
+            return false;
+        }
+
+        const uint64_t _Plaintext = _Load_little_endian<uint64_t>(_Bytes);
+        const uint32_t _Chunk     = _Load_little_endian<uint32_t>(_Bytes + 8);
+        const uint64_t _Count     = _Load_little_endian<uint64_t>(_Bytes + 12);
+        if (_Chunk != _Mychunk || _Count != (_Size - index_header_size) / entry_size
+            || (_Size - index_header_size) % entry_size != 0) { // must match the authenticated footer
+            return false;
+        }
+
+        if (_Count != (_Plaintext + _Mychunk - 1) / _Mychunk) {
+            return false;
+        }
+
+        _Mysize = _Plaintext;
+        _Mychunks.resize(static_cast<size_t>(_Count));
+        const byte_t* _Ptr = _Bytes + index_header_size;
+        uint64_t _End      = 0;
+        for (uint64_t _Idx = 0; _Idx < _Count; ++_Idx, _Ptr += entry_size) {
+            compressed_chunk& _Entry = _Mychunks[static_cast<size_t>(_Idx)];
+            _Entry.offset            = _Load_little_endian<uint64_t>(_Ptr);
+            _Entry.stored_size       = _Load_little_endian<uint32_t>(_Ptr + 8);
+            _Entry.compressed        = (_Ptr[12] & _Flag_compressed) != 0;
+            ::memcpy(_Entry.chunk_iv.get(), _Ptr + 13, iv::size);
+            ::memcpy(_Entry.tag.get(), _Ptr + 13 + iv::size, authentication_tag::size);
+            const size_t _Plain_size = chunk_size_at(_Idx);
+            if (_Entry.offset != _End || _Ptr[12] > _Flag_compressed || _Entry.stored_size > _Plain_size
+                || (!_Entry.compressed && _Entry.stored_size != _Plain_size)) { // the chunks are packed
+                return false;
+            }
+
+            _End += _Entry.stored_size;
+        }
+
+        return _End == _Mystored;
+    }
+
+    bool compressed_encryption_engine::_Seal_chunk(const uint64_t _Idx, _Worker_state& _State,
+        byte_t* const _Plain, byte_t* const _Packed, const bool _Try_compress, const byte_t*& _Stored) noexcept {
+        const size_t _Count = chunk_size_at(_Idx);
+        if (_Myfile.read_at(_Idx * static_cast<uint64_t>(_Mychunk), _Plain, _Count) != _Count) {
+            return false;
+        }
+
+        compressed_chunk& _Entry = _Mychunks[static_cast<size_t>(_Idx)];
+        byte_t* _Payload         = _Plain;
+        size_t _Payload_size     = _Count;
+        if (_Try_compress && is_compressible(_Plain, _Count)) { // must save at least 1/8 to be stored
+            _Stage_timer _Timer(stage::compress, _Count);
+            size_t _Compressed = 0;
+            if (_State._Codec.compress(_Plain, _Count, _Packed, _Count - _Count / 8, _Compressed)) {
+                _Payload      = _Packed;
+                _Payload_size = _Compressed;
+            }
+        }
+
+        _Entry.stored_size = static_cast<uint32_t>(_Payload_size);
+        _Entry.compressed  = _Payload != _Plain;
+        _Entry.chunk_iv    = iv::generate(); // every chunk must get its own IV
+        _Stage_timer _Timer(stage::cipher, _Payload_size);
+        if (!_State._Engine->setup_encryption(_Mykey, _Entry.chunk_iv)
+            || !_State._Engine->encrypt(_Payload, _Payload_size, _Payload)
+            || !_State._Engine->complete_encryption(_Entry.tag)) {
+            return false;
+        }
+
+        _Stored = _Payload;
+        return true;
+    }
+
+    bool compressed_encryption_engine::_Complete_encryption(encryption_engine* const _Engine, const uint64_t _End) {
+        ::std::vector<byte_t> _Bytes = _Serialize_index();
+        const size_t _Index_size     = _Bytes.size();
+        if (!_Engine->setup_encryption(_Mykey, _Mymeta.get_iv())) {
+            return false;
+        }
+
+        if (!_Engine->encrypt(_Bytes.data(), _Index_size, _Bytes.data())
+            || !_Engine->complete_encryption(_Mymeta.get_tag())) {
+            return false;
+        }
+
+        _Bytes.resize(_Index_size + footer_size); // the footer is written together with the index
+        _Store_footer(_Bytes.data() + _Index_size, static_cast<uint64_t>(_Index_size));
+        if (!_Myfile.write_at(_End, byte_string_view{_Bytes.data(), _Bytes.size()})
+            || !_Myfile.resize(_End + _Bytes.size())) { // drop the plaintext that follows the trailer
+            return false;
+        }
+
+        _Mystored = _End;
+        _Myindex  = static_cast<uint64_t>(_Index_size);
+        return true;
+    }
+
+    bool compressed_encryption_engine::encrypt(const key& _Key, const salt& _Salt, const size_t _Threads) {
+        if (_Mychunk == 0 || _Mychunk > max_chunk_size || !_Key.valid()) {
+            return false;
+        }
+
+        _Mysize  = _Myfile.size();
+        _Mystored = 0;
+        _Myindex = 0;
+        _Mykey   = _Key;
+        _Mymeta.generate(); // the metadata's IV is used for the chunk index
+        _Mymeta.get_salt()                 = _Salt;
+        _Mymeta.get_encryption_engine_id() = _Myid;
+        _Mychunks.clear();
+        _Mychunks.resize(static_cast<size_t>((_Mysize + _Mychunk - 1) / _Mychunk));
+        const uint64_t _Count     = chunk_count();
+        const uint64_t _Requested = static_cast<uint64_t>(_Threads != 0 ? _Threads : 1);
+        const size_t _Workers     = static_cast<size_t>(_Min(_Requested, (::std::max)(_Count, uint64_t{1})));
+        ::std::unique_ptr<_Worker_state[]> _States = ::std::make_unique<_Worker_state[]>(_Workers);
+        for (size_t _Worker = 0; _Worker < _Workers; ++_Worker) {
+            _States[_Worker]._Engine.reset(make_encryption_engine(_Myid));
+            if (!_States[_Worker]._Engine || !_States[_Worker]._Codec.is_open()) {
+                return false;
+            }
+        }
+
+        // Note: A file that starts with the signature of a compressed format is compressed already,
+        //       so none of its chunks is worth the attempt.
+        byte_t _Head[16] = {0};
+        const size_t _Head_size = static_cast<size_t>(_Min(_Mysize, static_cast<uint64_t>(sizeof(_Head))));
+        if (_Myfile.read_at(0, _Head, _Head_size) != _Head_size) {
+            return false;
+        }
+
+        const bool _Try_compress = !has_compressed_signature(_Head, _Head_size);
+        const size_t _Batch      = _Workers * batch_factor;
+        ::std::unique_ptr<_Task_scheduler> _Scheduler;
+        if (_Workers > 1) {
+            _Scheduler = ::std::make_unique<_Task_scheduler>(_Workers);
+        }
+
+        ::std::vector<byte_t> _Plain(_Count != 0 ? _Batch * _Mychunk : 0);
+        ::std::vector<byte_t> _Packed(_Plain.size());
+        ::std::vector<const byte_t*> _Stored(_Batch);
+        uint64_t _End = 0; // the end of the packed chunks
+        bool _Success = true;
+        for (uint64_t _First = 0; _First < _Count && _Success; _First += _Batch) {
+            const size_t _Size = static_cast<size_t>(_Min(_Count - _First, static_cast<uint64_t>(_Batch)));
+            _Success = _Run_parallel(_Scheduler.get(), _Size, [&](const uint64_t _Pos, const size_t _Worker) {
+                const size_t _Slot = static_cast<size_t>(_Pos) * _Mychunk;
+                return _Seal_chunk(_First + _Pos, _States[_Worker], _Plain.data() + _Slot,
+                    _Packed.data() + _Slot, _Try_compress, _Stored[static_cast<size_t>(_Pos)]);
+            });
+            for (size_t _Pos = 0; _Pos < _Size && _Success; ++_Pos) { // the whole batch has been read
+                compressed_chunk& _Entry = _Mychunks[static_cast<size_t>(_First) + _Pos];
+                _Entry.offset            = _End;
+                _Stage_timer _Timer(stage::write, _Entry.stored_size);
+                _Success = _Myfile.write_at(_End, byte_string_view{_Stored[_Pos], _Entry.stored_size});
+                _End    += _Entry.stored_size;
+            }
+        }
+
+        _Scrub_memory(_Plain.data(), _Plain.size());
+        _Scrub_memory(_Packed.data(), _Packed.size());
+        return _Success && _Complete_encryption(_States[0]._Engine.get(), _End);
+    }
+
+    bool compressed_encryption_engine::load_footer() noexcept {
+        const uint64_t _Size = _Myfile.size();
+        if (_Size < footer_size) { // the file cannot be smaller than the footer
+            return false;
+        }
+
+        byte_t _Footer[footer_size] = {0};
+        if (_Myfile.read_at(_Size - footer_size, _Footer, footer_size) != footer_size) {
+            return false;
+        }
+
+        if (_Footer[metadata::size + 12] != version
+            || _Load_little_endian<uint64_t>(_Footer + metadata::size + 13) != magic) { // unknown format
+            return false;
+        }
+
+        const uint32_t _Chunk = _Load_little_endian<uint32_t>(_Footer + metadata::size);
+        const uint64_t _Index = _Load_little_endian<uint64_t>(_Footer + metadata::size + 4);
+        if (_Chunk == 0 || _Chunk > max_chunk_size || _Index > _Size - footer_size
+            || _Index < index_header_size || (_Index - index_header_size) % entry_size != 0) {
+            return false;
+        }
+
+        _Mymeta.extract(_Footer, metadata::size);
+        _Mychunk  = _Chunk;
+        _Myindex  = _Index;
+        _Mystored = _Size - footer_size - _Index;
+        return true;
+    }
+
+    bool compressed_encryption_engine::begin_decryption(const key& _Key, encryption_engine* const _Engine) {
+        if (_Myindex == 0 && !load_footer()) {
+            return false;
+        }
+
+        if (!_Key.valid() || _Mymeta.get_encryption_engine_id() != _Myid) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Bytes(static_cast<size_t>(_Myindex));
+        if (_Myfile.read_at(_Mystored, _Bytes.data(), _Bytes.size()) != _Bytes.size()) {
+            return false;
+        }
+
+        if (!_Engine->setup_decryption(_Key, _Mymeta.get_iv())) {
+            return false;
+        }
+
+        if (!_Engine->decrypt(_Bytes.data(), _Bytes.size(), _Bytes.data())
+            || !_Engine->complete_decryption(_Mymeta.get_tag())) { // the index has been modified
+            return false;
+        }
+
+        _Mykey = _Key;
+        return _Deserialize_index(_Bytes.data(), _Bytes.size());
+    }
+
+    bool compressed_encryption_engine::_Decrypt_chunk(
+        const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Packed) noexcept {
+        compressed_chunk& _Entry = _Mychunks[static_cast<size_t>(_Idx)];
+        const size_t _Size       = _Entry.stored_size;
+        {
+            _Stage_timer _Timer(stage::read, _Size);
+            if (_Myfile.read_at(_Entry.offset, _Packed, _Size) != _Size) {
+                return false;
+            }
+        }
+
+        _Stage_timer _Timer(stage::cipher, _Size);
+        if (!_Engine->setup_decryption(_Mykey, _Entry.chunk_iv) || !_Engine->decrypt(_Packed, _Size, _Packed)
+            || !_Engine->complete_decryption(_Entry.tag)) {
+            _Scrub_memory(_Packed, _Size); // never leave unauthenticated plaintext behind
+            return false;
+        }
+
+        return true;
+    }
+
+    bool compressed_encryption_engine::_Open_chunk(const uint64_t _Idx, encryption_engine* const _Engine,
+        chunk_compressor& _Codec, byte_t* const _Packed, byte_t* const _Plain, const byte_t*& _Plaintext) noexcept {
+        if (!_Decrypt_chunk(_Idx, _Engine, _Packed)) {
+            return false;
+        }
+
+        const compressed_chunk& _Entry = _Mychunks[static_cast<size_t>(_Idx)];
+        if (!_Entry.compressed) { // stored as is
+            _Plaintext = _Packed;
+            return true;
+        }
+
+        const size_t _Count = chunk_size_at(_Idx);
+        _Stage_timer _Timer(stage::compress, _Count);
+        if (!_Codec.decompress(_Packed, _Entry.stored_size, _Plain, _Count)) {
+            return false;
+        }
+
+        _Plaintext = _Plain;
+        return true;
+    }
+
+    bool compressed_encryption_engine::read_range(
+        const uint64_t _Off, byte_t* const _Buf, const size_t _Count, encryption_engine* const _Engine) {
+        if (!_Mykey.valid() || _Off > _Mysize || _Count > _Mysize - _Off) { // the index must be open
+            return false;
+        }
+
+        if (_Count == 0) { // nothing to read, do nothing
+            return true;
+        }
+
+        chunk_compressor _Codec;
+        if (!_Codec.is_open()) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Packed(_Mychunk);
+        ::std::vector<byte_t> _Plain(_Mychunk);
+        const uint64_t _First = _Off / _Mychunk;
+        const uint64_t _Last  = (_Off + _Count - 1) / _Mychunk;
+        bool _Success         = true;
+        for (uint64_t _Idx = _First; _Idx <= _Last && _Success; ++_Idx) {
+            const byte_t* _Plaintext = nullptr;
+            _Success                 = _Open_chunk(_Idx, _Engine, _Codec, _Packed.data(), _Plain.data(), _Plaintext);
+            if (_Success) { // copy the part of the chunk that overlaps the range
+                const uint64_t _Chunk_off = _Idx * static_cast<uint64_t>(_Mychunk);
+                const uint64_t _From      = (::std::max)(_Off, _Chunk_off);
+                const uint64_t _To        = _Min(_Off + _Count, _Chunk_off + chunk_size_at(_Idx));
+                ::memcpy(_Buf + (_From - _Off), _Plaintext + (_From - _Chunk_off), static_cast<size_t>(_To - _From));
+            }
+        }
+
+        _Scrub_memory(_Packed.data(), _Packed.size());
+        _Scrub_memory(_Plain.data(), _Plain.size());
+        return _Success;
+    }
+
+    bool compressed_encryption_engine::decrypt(const key& _Key, const size_t _Threads) {
+        if (_Myindex == 0 && !load_footer()) {
+            return false;
+        }
+
+        const uint64_t _Requested = static_cast<uint64_t>(_Threads != 0 ? _Threads : 1);
+        const uint64_t _Estimate  = (_Mystored + _Mychunk - 1) / _Mychunk; // the index has not been opened yet
+        const size_t _Workers     = static_cast<size_t>(_Min(_Requested, (::std::max)(_Estimate, uint64_t{1})));
+        ::std::unique_ptr<_Worker_state[]> _States = ::std::make_unique<_Worker_state[]>(_Workers);
+        for (size_t _Worker = 0; _Worker < _Workers; ++_Worker) {
+            _States[_Worker]._Engine.reset(make_encryption_engine(_Myid));
+            if (!_States[_Worker]._Engine || !_States[_Worker]._Codec.is_open()) {
+                return false;
+            }
+        }
+
+        if (!begin_decryption(_Key, _States[0]._Engine.get())) {
+            return false;
+        }
+
+        const uint64_t _Count = chunk_count();
+        const size_t _Batch   = _Workers * batch_factor;
+        ::std::unique_ptr<_Task_scheduler> _Scheduler;
+        if (_Workers > 1) {
+            _Scheduler = ::std::make_unique<_Task_scheduler>(_Workers);
+        }
+
+        // Note: The expansion overwrites the stored chunks, so a chunk that fails its tag must be found
+        //       before anything is written. The verification reads only the stored (compressed) bytes.
+        ::std::vector<byte_t> _Packed(_Count != 0 ? _Batch * _Mychunk : 0);
+        bool _Success = _Run_parallel(_Scheduler.get(), _Count, [&](const uint64_t _Idx, const size_t _Worker) {
+            byte_t* const _Slot = _Packed.data() + _Worker * _Mychunk;
+            const bool _Result  = _Decrypt_chunk(_Idx, _States[_Worker]._Engine.get(), _Slot);
+            _Scrub_memory(_Slot, _Mychunks[static_cast<size_t>(_Idx)].stored_size);
+            return _Result;
+        });
+        if (!_Success) {
+            return false;
+        }
+
+        if (_Myfile.size() < _Mysize && !_Myfile.resize(_Mysize)) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Plain(_Packed.size());
+        ::std::vector<const byte_t*> _Plaintexts(_Batch);
+        for (uint64_t _Last = _Count; _Last > 0 && _Success;) { // from the last batch to the first one
+            const size_t _Size    = static_cast<size_t>(_Min(_Last, static_cast<uint64_t>(_Batch)));
+            const uint64_t _First = _Last - _Size;
+            _Success = _Run_parallel(_Scheduler.get(), _Size, [&](const uint64_t _Pos, const size_t _Worker) {
+                const size_t _Slot = static_cast<size_t>(_Pos) * _Mychunk;
+                return _Open_chunk(_First + _Pos, _States[_Worker]._Engine.get(), _States[_Worker]._Codec,
+                    _Packed.data() + _Slot, _Plain.data() + _Slot, _Plaintexts[static_cast<size_t>(_Pos)]);
+            });
+            for (size_t _Pos = 0; _Pos < _Size && _Success; ++_Pos) { // the whole batch has been read
+                const uint64_t _Idx = _First + _Pos;
+                _Stage_timer _Timer(stage::write, chunk_size_at(_Idx));
+                _Success = _Myfile.write_at(_Idx * static_cast<uint64_t>(_Mychunk),
+                    byte_string_view{_Plaintexts[_Pos], chunk_size_at(_Idx)});
+            }
+
+            _Last = _First;
+        }
+
+        _Scrub_memory(_Packed.data(), _Packed.size());
+        _Scrub_memory(_Plain.data(), _Plain.size());
+        if (!_Success || !_Myfile.resize(_Mysize)) {
+            return false;
+        }
+
+        _Myindex  = 0;
+        _Mystored = 0;
+        return true;
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,147 @@
+// compressed_encryption_engine.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_COMPRESSED_ENCRYPTION_ENGINE_HPP_
+#define _FCRYPT_CRYPT_COMPRESSED_ENCRYPTION_ENGINE_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/compression.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/file_encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace fcrypt {
+    // Note: The compressed format is the chunked format with a compression stage in front of the cipher.
+    //       Every chunk is compressed (see compression.hpp) and then encrypted with its own IV and tag.
+    //       A chunk that does not shrink by at least 1/8 is stored uncompressed. The stored chunks have
+    //       different sizes, so they are packed one after another and located through an index:
+    //
+    //       [stored chunk 0] ... [stored chunk N-1] [sealed chunk index] [footer]
+    //
+    //       The chunk index stores the plaintext size, the chunk size, the chunk count and one entry
+    //       per chunk (offset, stored size, flags, IV and tag). It is sealed like the chunk table of the
+    //       chunked format, and the footer has the same layout, but its own magic number. Any range can
+    //       be read by opening the index and decrypting only the chunks it touches.
+    //
+    //       The file is encrypted in place in batches. A batch is read, compressed and encrypted in
+    //       parallel, and then packed behind the previous batch. A stored chunk is never larger than
+    //       its plaintext, so the packed data never overtakes the data that has not been read yet.
+    //       The decryption first verifies every chunk without modifying the file, and then expands
+    //       the chunks in place from the last batch to the first one for the same reason. Neither
+    //       operation survives an interruption.
+
+    struct compressed_chunk { // describes a single stored chunk
+        uint64_t offset = 0; // the offset of the stored chunk
+        uint32_t stored_size = 0;
+        bool compressed = false;
+        iv chunk_iv;
+        authentication_tag tag;
+    };
+
+    class compressed_encryption_engine { // compresses and encrypts the file as independent chunks
+    public:
+        explicit compressed_encryption_engine(
+            file& _File, const encryption_engine::id _Id, const size_t _Chunk_size = default_chunk_size) noexcept;
+        ~compressed_encryption_engine() noexcept;
+
+        compressed_encryption_engine(const compressed_encryption_engine&) = delete;
+        compressed_encryption_engine& operator=(const compressed_encryption_engine&) = delete;
+
+        static constexpr size_t default_chunk_size = 1048576; // 1 MiB
+        static constexpr size_t max_chunk_size     = 67108864; // 64 MiB
+        static constexpr size_t batch_factor       = 4; // the number of chunks per thread in a batch
+        static constexpr size_t index_header_size  = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint64_t);
+        static constexpr size_t entry_size         = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(uint8_t)
+            + iv::size + authentication_tag::size;
+        static constexpr size_t footer_size        = metadata::size
+            + sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint64_t);
+        static constexpr uint8_t version           = 1;
+        static constexpr uint64_t magic            = 0x5A43'5450'5952'4346; // "FCRYPTCZ"
+
+        // checks if the file is stored in the compressed format
+        static bool is_compressed(file& _File) noexcept;
+
+        // returns the chunk size
+        size_t chunk_size() const noexcept;
+
+        // returns the number of chunks
+        uint64_t chunk_count() const noexcept;
+
+        // returns the plaintext size
+        uint64_t plaintext_size() const noexcept;
+
+        // returns the total size of the stored chunks
+        uint64_t stored_size() const noexcept;
+
+        // returns the size of the chunk at the specified index
+        size_t chunk_size_at(const uint64_t _Idx) const noexcept;
+
+        // returns the associated metadata (engine ID, index IV, index tag and salt)
+        metadata& get_metadata() noexcept;
+
+        // returns the chunk index
+        const ::std::vector<compressed_chunk>& chunks() const noexcept;
+
+        // tries to compress and encrypt the whole file using _Threads threads
+        bool encrypt(const key& _Key, const salt& _Salt, const size_t _Threads = 1);
+
+        // tries to read the footer (its salt is required to derive the key)
+        bool load_footer() noexcept;
+
+        // tries to open and verify the chunk index
+        bool begin_decryption(const key& _Key, encryption_engine* const _Engine);
+
+        // tries to decrypt _Count bytes of the plaintext starting at _Off without modifying the file,
+        // only the chunks that overlap the range are read
+        bool read_range(const uint64_t _Off, byte_t* const _Buf, const size_t _Count, encryption_engine* const _Engine);
+
+        // tries to decrypt and decompress the whole file using _Threads threads
+        bool decrypt(const key& _Key, const size_t _Threads = 1);
+
+    private:
+        struct _Worker_state;
+
+        // stores the footer that follows an index of the specified size
+        void _Store_footer(byte_t* const _Footer, const uint64_t _Index_size) noexcept;
+
+        // serializes the chunk index
+        ::std::vector<byte_t> _Serialize_index() const;
+
+        // tries to deserialize the chunk index, the chunks must be packed without gaps
+        bool _Deserialize_index(const byte_t* const _Bytes, const size_t _Size);
+
+        // tries to compress (if worth it) and encrypt the chunk, _Plain and _Packed must hold chunk_size()
+        // bytes, the stored chunk is left in _Plain or in _Packed
+        bool _Seal_chunk(const uint64_t _Idx, _Worker_state& _State, byte_t* const _Plain,
+            byte_t* const _Packed, const bool _Try_compress, const byte_t*& _Stored) noexcept;
+
+        // tries to read and decrypt the stored chunk into _Packed (which must hold chunk_size() bytes)
+        bool _Decrypt_chunk(const uint64_t _Idx, encryption_engine* const _Engine, byte_t* const _Packed) noexcept;
+
+        // tries to read, decrypt and decompress the chunk, _Packed and _Plain must hold chunk_size() bytes,
+        // the plaintext is left in _Plain or in _Packed
+        bool _Open_chunk(const uint64_t _Idx, encryption_engine* const _Engine, chunk_compressor& _Codec,
+            byte_t* const _Packed, byte_t* const _Plain, const byte_t*& _Plaintext) noexcept;
+
+        // tries to seal the chunk index and write it together with the footer at the end of the stored chunks
+        bool _Complete_encryption(encryption_engine* const _Engine, const uint64_t _End);
+
+        file& _Myfile;
+        encryption_engine::id _Myid;
+        size_t _Mychunk;
+        uint64_t _Mysize; // the plaintext size
+        uint64_t _Mystored; // the total size of the stored chunks
+        uint64_t _Myindex; // the sealed index size
+        metadata _Mymeta;
+        key _Mykey;
+        ::std::vector<compressed_chunk> _Mychunks;
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_COMPRESSED_ENCRYPTION_ENGINE_HPP_
\ No newline at end of file
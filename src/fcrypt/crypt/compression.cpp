@@ -0,0 +1,139 @@
+// compression.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/compression.hpp>
+#include <compressapi.h>
+#include <cmath>
+#include <cstring>
+
+namespace fcrypt {
+    chunk_compressor::chunk_compressor() noexcept : _Mycompressor(nullptr), _Mydecompressor(nullptr) {
+        COMPRESSOR_HANDLE _Compressor     = nullptr;
+        DECOMPRESSOR_HANDLE _Decompressor = nullptr;
+        if (::CreateCompressor(COMPRESS_ALGORITHM_XPRESS, nullptr, &_Compressor)) {
+            _Mycompressor = _Compressor;
+        }
+
+        if (::CreateDecompressor(COMPRESS_ALGORITHM_XPRESS, nullptr, &_Decompressor)) {
+            _Mydecompressor = _Decompressor;
+        }
+    }
+
+    chunk_compressor::~chunk_compressor() noexcept {
+        if (_Mycompressor) {
+            ::CloseCompressor(static_cast<COMPRESSOR_HANDLE>(_Mycompressor));
+        }
+
+        if (_Mydecompressor) {
+            ::CloseDecompressor(static_cast<DECOMPRESSOR_HANDLE>(_Mydecompressor));
+        }
+    }
+
+    bool chunk_compressor::is_open() const noexcept {
+        return _Mycompressor != nullptr && _Mydecompressor != nullptr;
+    }
+
+    bool chunk_compressor::compress(const byte_t* const _Data, const size_t _Size,
+        byte_t* const _Buf, const size_t _Capacity, size_t& _Compressed) noexcept {
+        SIZE_T _Written = 0;
+        if (!_Mycompressor || !::Compress(static_cast<COMPRESSOR_HANDLE>(_Mycompressor),
+            _Data, _Size, _Buf, _Capacity, &_Written)) { // usually ERROR_INSUFFICIENT_BUFFER
+            return false;
+        }
+
+        _Compressed = static_cast<size_t>(_Written);
+        return true;
+    }
+
+    bool chunk_compressor::decompress(const byte_t* const _Data, const size_t _Size,
+        byte_t* const _Buf, const size_t _Expected) noexcept {
+        SIZE_T _Written = 0;
+        if (!_Mydecompressor || !::Decompress(static_cast<DECOMPRESSOR_HANDLE>(_Mydecompressor),
+            _Data, _Size, _Buf, _Expected, &_Written)) {
+            return false;
+        }
+
+        return static_cast<size_t>(_Written) == _Expected;
+    }
+
+    bool has_compressed_signature(const byte_t* const _Data, const size_t _Size) noexcept {
+        struct _Signature {
+            const char* _Bytes;
+            size_t _Size;
+            size_t _Offset;
+        };
+
+        static constexpr _Signature _Signatures[] = {
+            {"\x1F\x8B", 2, 0}, // gzip
+            {"PK\x03\x04", 4, 0}, // zip (and docx, xlsx, jar, ...)
+            {"\x28\xB5\x2F\xFD", 4, 0}, // zstd
+            {"\xFD" "7zXZ\x00", 6, 0}, // xz
+            {"BZh", 3, 0}, // bzip2
+            {"7z\xBC\xAF\x27\x1C", 6, 0}, // 7z
+            {"Rar!\x1A\x07", 6, 0}, // rar
+            {"\x04\x22\x4D\x18", 4, 0}, // lz4
+            {"\x89PNG", 4, 0}, // png
+            {"\xFF\xD8\xFF", 3, 0}, // jpeg
+            {"WEBP", 4, 8}, // webp (after the RIFF header)
+            {"ftyp", 4, 4}, // mp4, mov, heic
+            {"\x1A\x45\xDF\xA3", 4, 0}, // mkv, webm
+            {"ID3", 3, 0}, // mp3
+            {"OggS", 4, 0} // ogg
+        };
+
+        for (const _Signature& _Sig : _Signatures) {
+            if (_Size >= _Sig._Offset + _Sig._Size && ::memcmp(_Data + _Sig._Offset, _Sig._Bytes, _Sig._Size) == 0) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    double sample_entropy(const byte_t* const _Data, const size_t _Size) noexcept {
+        // Note: 16 windows of 256 bytes are enough to tell text and tables from random data,
+        //       and they cost far less than compressing the chunk.
+        constexpr size_t _Windows     = 16;
+        constexpr size_t _Window_size = 256;
+        size_t _Counts[256]           = {0};
+        size_t _Total                 = 0;
+        if (_Size <= _Windows * _Window_size) { // small data is sampled as a whole
+            for (size_t _Pos = 0; _Pos < _Size; ++_Pos) {
+                ++_Counts[_Data[_Pos]];
+            }
+
+            _Total = _Size;
+        } else {
+            const size_t _Step = (_Size - _Window_size) / (_Windows - 1);
+            for (size_t _Window = 0; _Window < _Windows; ++_Window) {
+                const byte_t* const _First = _Data + _Window * _Step;
+                for (size_t _Pos = 0; _Pos < _Window_size; ++_Pos) {
+                    ++_Counts[_First[_Pos]];
+                }
+            }
+
+            _Total = _Windows * _Window_size;
+        }
+
+        if (_Total == 0) {
+            return 0.0;
+        }
+
+        double _Entropy = 0.0;
+        for (const size_t _Count : _Counts) {
+            if (_Count != 0) {
+                const double _Probability = static_cast<double>(_Count) / static_cast<double>(_Total);
+                _Entropy                 -= _Probability * ::std::log2(_Probability);
+            }
+        }
+
+        return _Entropy;
+    }
+
+    bool is_compressible(const byte_t* const _Data, const size_t _Size) noexcept {
+        constexpr size_t _Min_size = 64; // smaller data cannot save enough to pay for the check
+        return _Size >= _Min_size && sample_entropy(_Data, _Size) < max_compressible_entropy;
+    }
+} // namespace fcrypt
\ No newline at end of file
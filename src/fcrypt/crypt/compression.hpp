@@ -0,0 +1,55 @@
+// compression.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_COMPRESSION_HPP_
+#define _FCRYPT_CRYPT_COMPRESSION_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <cstddef>
+
+namespace fcrypt {
+    // Note: The chunks are compressed with XPRESS from the Windows Compression API, which favors speed
+    //       over ratio, so compressing a chunk costs less than encrypting it. The application must be
+    //       linked with Cabinet.lib. Compressing data that is already compressed or encrypted wastes time,
+    //       so every chunk is checked first: a file that starts with the signature of a known compressed
+    //       format is stored as is, and so is every chunk whose sampled byte entropy is close to 8 bits.
+
+    class chunk_compressor { // compresses and decompresses chunks, not thread-safe
+    public:
+        chunk_compressor() noexcept;
+        ~chunk_compressor() noexcept;
+
+        chunk_compressor(const chunk_compressor&) = delete;
+        chunk_compressor& operator=(const chunk_compressor&) = delete;
+
+        // checks if the compressor and the decompressor have been created
+        bool is_open() const noexcept;
+
+        // tries to compress _Size bytes into at most _Capacity bytes, fails if the result does not fit
+        bool compress(const byte_t* const _Data, const size_t _Size,
+            byte_t* const _Buf, const size_t _Capacity, size_t& _Compressed) noexcept;
+
+        // tries to decompress _Size bytes, the result must have exactly _Expected bytes
+        bool decompress(const byte_t* const _Data, const size_t _Size,
+            byte_t* const _Buf, const size_t _Expected) noexcept;
+
+    private:
+        void* _Mycompressor; // COMPRESSOR_HANDLE, kept as a pointer to avoid <compressapi.h> here
+        void* _Mydecompressor; // DECOMPRESSOR_HANDLE
+    };
+
+    inline constexpr double max_compressible_entropy = 7.5; // in bits per byte
+
+    // checks if the data starts with the signature of a known compressed format (archives, images, video)
+    bool has_compressed_signature(const byte_t* const _Data, const size_t _Size) noexcept;
+
+    // estimates the entropy of the data from evenly spaced samples (in bits per byte)
+    double sample_entropy(const byte_t* const _Data, const size_t _Size) noexcept;
+
+    // checks if the data is worth compressing
+    bool is_compressible(const byte_t* const _Data, const size_t _Size) noexcept;
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_COMPRESSION_HPP_
\ No newline at end of file
@@ -0,0 +1,412 @@
+// container.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/container.hpp>
+#include <cstring>
+#include <limits>
+
+namespace fcrypt {
+    container_writer::container_writer(const path& _Target, const encryption_engine::id _Id)
+        : _Myfile(_Target, open_mode::create_always), _Mypath(_Target), _Myid(_Id),
+        _Myeng(make_encryption_engine(_Id)), _Mykey(), _Mymeta(), _Myentries(), _Mynames(), _Mybuf(), _Myused(0),
+        _Myoff(0), _Myok(false) {}
+
+    container_writer::~container_writer() noexcept {
+        if (!_Mybuf.empty()) {
+            _Scrub_memory(_Mybuf.data(), _Mybuf.size());
+        }
+    }
+
+    bool container_writer::is_open() const noexcept {
+        return _Myfile.is_open();
+    }
+
+    bool container_writer::begin(const key& _Key, const salt& _Salt) {
+        if (!_Myfile.is_open() || !_Myeng || !_Key.valid()) {
+            return false;
+        }
+
+        _Mykey = _Key;
+        _Mymeta.generate(); // the metadata's IV is used for the index
+        _Mymeta.get_salt()                 = _Salt;
+        _Mymeta.get_encryption_engine_id() = _Myid;
+        _Myentries.clear();
+        _Mynames.clear();
+        _Mybuf.resize(buffer_size);
+        _Myused = 0;
+        _Myoff  = 0;
+        _Myok   = true;
+        return true;
+    }
+
+    container_entry* container_writer::_Begin_entry(const ::std::wstring& _Name, const uint64_t _Size) {
+        if (!_Myok || _Name.empty() || _Name.size() > (::std::numeric_limits<uint16_t>::max)()) {
+            return nullptr;
+        }
+
+        if (_Mynames.find(_Name) != _Mynames.end()) { // names must be unique
+            return nullptr;
+        }
+
+        container_entry& _Entry = _Myentries.emplace_back();
+        _Entry.name             = _Name;
+        _Entry.offset           = _Myoff + _Myused;
+        _Entry.size             = _Size;
+        _Entry.entry_iv         = iv::generate(); // every member must get its own IV
+        _Mynames.emplace(_Name, _Myentries.size() - 1);
+        if (!_Myeng->setup_encryption(_Mykey, _Entry.entry_iv)) {
+            _Myok = false;
+            return nullptr;
+        }
+
+        return ::std::addressof(_Entry);
+    }
+
+    bool container_writer::_Complete_entry(container_entry& _Entry) noexcept {
+        if (!_Myeng->complete_encryption(_Entry.tag)) {
+            _Myok = false;
+            return false;
+        }
+
+        return true;
+    }
+
+    bool container_writer::_Flush() noexcept {
+        if (_Myused == 0) { // nothing to write, do nothing
+            return true;
+        }
+
+        if (!_Myfile.write(byte_string_view{_Mybuf.data(), _Myused})) {
+            _Myok = false;
+            return false;
+        }
+
+#ifdef _M_X64
+        _Myoff += _Myused;
+#else // ^^^ _M_X64 ^^^ / vvv _M_IX86 vvv
+        _Myoff += static_cast<uint64_t>(_Myused);
+#endif // _M_X64
+        _Myused = 0;
+        return true;
+    }
+
+    bool container_writer::_Append(const byte_t* const _Data, size_t _Size) noexcept {
+        const byte_t* _Ptr = _Data;
+        while (_Size > 0) {
+            if (_Myused == _Mybuf.size() && !_Flush()) {
+                return false;
+            }
+
+            const size_t _Count = _Min(_Size, _Mybuf.size() - _Myused);
+            if (!_Myeng->encrypt(_Ptr, _Count, _Mybuf.data() + _Myused)) {
+                _Myok = false;
+                return false;
+            }
+
+            _Myused += _Count;
+            _Ptr    += _Count;
+            _Size   -= _Count;
+        }
+
+        return true;
+    }
+
+    bool container_writer::add(const ::std::wstring& _Name, const byte_string_view _Bytes) {
+        container_entry* const _Entry = _Begin_entry(_Name, static_cast<uint64_t>(_Bytes.size()));
+        if (!_Entry) {
+            return false;
+        }
+
+        return _Append(_Bytes.data(), _Bytes.size()) && _Complete_entry(*_Entry);
+    }
+
+    bool container_writer::add_file(const ::std::wstring& _Name, const path& _Source) {
+        file _File(_Source);
+        if (!_File.is_open()) {
+            return false;
+        }
+
+        uint64_t _Rest                = _File.size();
+        container_entry* const _Entry = _Begin_entry(_Name, _Rest);
+        if (!_Entry) {
+            return false;
+        }
+
+        while (_Rest > 0) { // read the file directly into the buffer and encrypt it in place
+            if (_Myused == _Mybuf.size() && !_Flush()) {
+                return false;
+            }
+
+            const size_t _Count =
+                static_cast<size_t>(_Min(_Rest, static_cast<uint64_t>(_Mybuf.size() - _Myused)));
+            byte_t* const _Dest = _Mybuf.data() + _Myused;
+            if (_File.read(_Dest, _Count) != _Count || !_Myeng->encrypt(_Dest, _Count, _Dest)) {
+                _Myok = false; // the member has been partially written
+                return false;
+            }
+
+            _Myused += _Count;
+            _Rest   -= _Count;
+        }
+
+        return _Complete_entry(*_Entry);
+    }
+
+    bool container_writer::add_directory(const path& _Root) {
+        namespace _Fs = ::std::filesystem;
+        ::std::error_code _Ec;
+        _Fs::recursive_directory_iterator _Iter(_Root, _Fs::directory_options::skip_permission_denied, _Ec);
+        for (const _Fs::recursive_directory_iterator _End; !_Ec && _Iter != _End; _Iter.increment(_Ec)) {
+            if (!_Iter->is_regular_file(_Ec)) {
+                continue;
+            }
+
+            const path& _Target = _Iter->path();
+            ::std::error_code _Same_ec; // an error means that the paths cannot be compared, not a failure
+            if (_Fs::equivalent(_Target, _Mypath, _Same_ec)) { // the container must not contain itself
+                continue;
+            }
+
+            if (!add_file(_Target.lexically_relative(_Root).generic_wstring(), _Target)) {
+                return false;
+            }
+        }
+
+        return !_Ec;
+    }
+
+    ::std::vector<byte_t> container_writer::_Serialize_index() const {
+        size_t _Size = sizeof(uint64_t);
+        for (const container_entry& _Entry : _Myentries) {
+            _Size += container_reader::entry_size + _Entry.name.size() * sizeof(uint16_t);
+        }
+
+        ::std::vector<byte_t> _Bytes(_Size);
+        byte_t* _Ptr = _Bytes.data();
+        _Store_little_endian(_Ptr, static_cast<uint64_t>(_Myentries.size()));
+        _Ptr += sizeof(uint64_t);
+        for (const container_entry& _Entry : _Myentries) {
+            _Store_little_endian(_Ptr, static_cast<uint16_t>(_Entry.name.size()));
+            _Store_little_endian(_Ptr + 2, _Entry.offset);
+            _Store_little_endian(_Ptr + 10, _Entry.size);
+            ::memcpy(_Ptr + 18, _Entry.entry_iv.get(), iv::size);
+            ::memcpy(_Ptr + 18 + iv::size, _Entry.tag.get(), authentication_tag::size);
+            _Ptr += container_reader::entry_size;
+            for (const wchar_t _Ch : _Entry.name) { // names are stored as UTF-16
+                _Store_little_endian(_Ptr, static_cast<uint16_t>(_Ch));
+                _Ptr += sizeof(uint16_t);
+            }
+        }
+
+        return _Bytes;
+    }
+
+    bool container_writer::complete() {
+        if (!_Myok || !_Flush()) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Bytes = _Serialize_index();
+        const size_t _Index_size     = _Bytes.size();
+        if (!_Myeng->setup_encryption(_Mykey, _Mymeta.get_iv())) {
+            return false;
+        }
+
+        if (!_Myeng->encrypt(_Bytes.data(), _Index_size, _Bytes.data())
+            || !_Myeng->complete_encryption(_Mymeta.get_tag())) {
+            return false;
+        }
+
+        // Note: The footer is written together with the index, so packing is a single sequential stream.
+        _Bytes.resize(_Index_size + container_reader::footer_size);
+        byte_t* const _Footer = _Bytes.data() + _Index_size;
+        _Mymeta.save(_Footer, metadata::size);
+        _Store_little_endian(_Footer + metadata::size, static_cast<uint64_t>(_Index_size));
+        _Footer[metadata::size + 8] = container_reader::version;
+        _Store_little_endian(_Footer + metadata::size + 9, container_reader::magic);
+        _Myok = false; // the container cannot be extended anymore
+        return _Myfile.write(byte_string_view{_Bytes.data(), _Bytes.size()});
+    }
+
+    container_reader::container_reader(const path& _Source, const encryption_engine::id _Id)
+        : _Myfile(_Source), _Myid(_Id), _Myeng(make_encryption_engine(_Id)), _Mykey(), _Mymeta(),
+        _Mydata(0), _Myindex(0), _Myentries(), _Mynames() {}
+
+    container_reader::~container_reader() noexcept {}
+
+    bool container_reader::is_container(file& _File) noexcept {
+        const uint64_t _Size = _File.size();
+        if (_Size < footer_size) { // the file cannot be smaller than the footer
+            return false;
+        }
+
+        byte_t _Bytes[sizeof(uint64_t)] = {0};
+        if (_File.read_at(_Size - sizeof(uint64_t), _Bytes, sizeof(uint64_t)) != sizeof(uint64_t)) {
+            return false;
+        }
+
+        return _Load_little_endian<uint64_t>(_Bytes) == magic;
+    }
+
+    bool container_reader::is_open() const noexcept {
+        return _Myfile.is_open();
+    }
+
+    bool container_reader::load_footer() noexcept {
+        const uint64_t _Size = _Myfile.size();
+        if (_Size < footer_size) { // the file cannot be smaller than the footer
+            return false;
+        }
+
+        byte_t _Footer[footer_size] = {0};
+        if (_Myfile.read_at(_Size - footer_size, _Footer, footer_size) != footer_size) {
+            return false;
+        }
+
+        if (_Footer[metadata::size + 8] != version
+            || _Load_little_endian<uint64_t>(_Footer + metadata::size + 9) != magic) { // unknown format
+            return false;
+        }
+
+        const uint64_t _Index = _Load_little_endian<uint64_t>(_Footer + metadata::size);
+        if (_Index < sizeof(uint64_t) || _Index > _Size - footer_size) {
+            return false;
+        }
+
+        _Mymeta.extract(_Footer, metadata::size);
+        _Myindex = _Index;
+        _Mydata  = _Size - footer_size - _Index;
+        return true;
+    }
+
+    metadata& container_reader::get_metadata() noexcept {
+        return _Mymeta;
+    }
+
+    bool container_reader::_Deserialize_index(const byte_t* const _Bytes, const size_t _Size) {
+        const byte_t* _Ptr       = _Bytes;
+        const byte_t* const _End = _Bytes + _Size;
+        const uint64_t _Count    = _Load_little_endian<uint64_t>(_Ptr);
+        _Ptr += sizeof(uint64_t);
+        if (_Count > (_Size - sizeof(uint64_t)) / entry_size) { // the index is too small
+            return false;
+        }
+
+        _Myentries.clear();
+        _Mynames.clear();
+        _Myentries.resize(static_cast<size_t>(_Count));
+        for (container_entry& _Entry : _Myentries) {
+            if (static_cast<size_t>(_End - _Ptr) < entry_size) {
+                return false;
+            }
+
+            const size_t _Length = _Load_little_endian<uint16_t>(_Ptr);
+            _Entry.offset        = _Load_little_endian<uint64_t>(_Ptr + 2);
+            _Entry.size          = _Load_little_endian<uint64_t>(_Ptr + 10);
+            _Entry.entry_iv.set(byte_string_view{_Ptr + 18, iv::size});
+            _Entry.tag.set(byte_string_view{_Ptr + 18 + iv::size, authentication_tag::size});
+            _Ptr += entry_size;
+            if (static_cast<size_t>(_End - _Ptr) < _Length * sizeof(uint16_t)) {
+                return false;
+            }
+
+            if (_Entry.offset > _Mydata || _Entry.size > _Mydata - _Entry.offset) { // out of bounds
+                return false;
+            }
+
+            _Entry.name.resize(_Length);
+            for (wchar_t& _Ch : _Entry.name) {
+                _Ch   = static_cast<wchar_t>(_Load_little_endian<uint16_t>(_Ptr));
+                _Ptr += sizeof(uint16_t);
+            }
+
+            if (!_Mynames.emplace(_Entry.name, _Mynames.size()).second) { // names must be unique
+                return false;
+            }
+        }
+
+        return _Ptr == _End;
+    }
+
+    bool container_reader::load_index(const key& _Key) {
+        if (_Myindex == 0 && !load_footer()) {
+            return false;
+        }
+
+        if (!_Myeng || !_Key.valid() || _Mymeta.get_encryption_engine_id() != _Myid) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Bytes(static_cast<size_t>(_Myindex));
+        if (_Myfile.read_at(_Mydata, _Bytes.data(), _Bytes.size()) != _Bytes.size()) {
+            return false;
+        }
+
+        if (!_Myeng->setup_decryption(_Key, _Mymeta.get_iv())) {
+            return false;
+        }
+
+        if (!_Myeng->decrypt(_Bytes.data(), _Bytes.size(), _Bytes.data())
+            || !_Myeng->complete_decryption(_Mymeta.get_tag())) { // the index has been modified
+            return false;
+        }
+
+        _Mykey = _Key;
+        return _Deserialize_index(_Bytes.data(), _Bytes.size());
+    }
+
+    const ::std::vector<container_entry>& container_reader::entries() const noexcept {
+        return _Myentries;
+    }
+
+    const container_entry* container_reader::find(const ::std::wstring& _Name) const noexcept {
+        const auto _Iter = _Mynames.find(_Name);
+        return _Iter != _Mynames.end() ? ::std::addressof(_Myentries[_Iter->second]) : nullptr;
+    }
+
+    bool container_reader::extract(const ::std::wstring& _Name, ::std::vector<byte_t>& _Buf) {
+        const container_entry* const _Entry = find(_Name);
+        if (!_Entry || _Entry->size > (::std::numeric_limits<size_t>::max)()) {
+            return false;
+        }
+
+        const size_t _Size = static_cast<size_t>(_Entry->size);
+        ::std::vector<byte_t> _Bytes(_Size);
+        if (_Myfile.read_at(_Entry->offset, _Bytes.data(), _Size) != _Size) {
+            return false;
+        }
+
+        if (!_Myeng->setup_decryption(_Mykey, _Entry->entry_iv)) {
+            return false;
+        }
+
+        bool _Success = true;
+        for (size_t _Off = 0; _Off < _Size && _Success; _Off += container_writer::buffer_size) {
+            byte_t* const _Ptr = _Bytes.data() + _Off;
+            _Success           = _Myeng->decrypt(_Ptr, _Min(_Size - _Off, container_writer::buffer_size), _Ptr);
+        }
+
+        authentication_tag _Tag = _Entry->tag;
+        if (!_Success || !_Myeng->complete_decryption(_Tag)) {
+            _Scrub_memory(_Bytes.data(), _Size); // never leave unauthenticated plaintext behind
+            return false;
+        }
+
+        _Buf = ::std::move(_Bytes);
+        return true;
+    }
+
+    bool container_reader::extract_to(const ::std::wstring& _Name, const path& _Target) {
+        ::std::vector<byte_t> _Bytes;
+        if (!extract(_Name, _Bytes)) {
+            return false;
+        }
+
+        file _File(_Target, open_mode::create_always);
+        const bool _Result = _File.is_open() && _File.write(byte_string_view{_Bytes.data(), _Bytes.size()});
+        _Scrub_memory(_Bytes.data(), _Bytes.size());
+        return _Result;
+    }
+} // namespace fcrypt
\ No newline at end of file
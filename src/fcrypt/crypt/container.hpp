@@ -0,0 +1,158 @@
+// container.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_CONTAINER_HPP_
+#define _FCRYPT_CRYPT_CONTAINER_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/file_encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fcrypt {
+    // Note: A container packs many files into a single encrypted archive. The layout is as follows:
+    //
+    //       [member 0] ... [member N-1] [sealed index] [footer]
+    //
+    //       Every member is encrypted with the container's key and its own IV. The index stores
+    //       the name, offset, size, IV and tag of every member. It is encrypted with the IV stored
+    //       in the footer's metadata, whose tag authenticates the whole index. The footer is stored
+    //       in plain text and consists of the metadata, the index size, the format version and
+    //       a magic number. Members are written sequentially through a single buffer, and a member
+    //       is extracted with one ranged read once the index has been loaded.
+
+    struct container_entry { // describes a single member of the container
+        ::std::wstring name;
+        uint64_t offset = 0;
+        uint64_t size   = 0;
+        iv entry_iv;
+        authentication_tag tag;
+    };
+
+    class container_writer { // packs files into a new container
+    public:
+        explicit container_writer(const path& _Target, const encryption_engine::id _Id);
+        ~container_writer() noexcept;
+
+        container_writer(const container_writer&) = delete;
+        container_writer& operator=(const container_writer&) = delete;
+
+        static constexpr size_t buffer_size = 1048576; // 1 MiB, the size of a single write
+
+        // checks if the container has been created
+        bool is_open() const noexcept;
+
+        // tries to prepare the container, every member is encrypted with _Key
+        bool begin(const key& _Key, const salt& _Salt);
+
+        // tries to append the bytes as a new member
+        bool add(const ::std::wstring& _Name, const byte_string_view _Bytes);
+
+        // tries to append the file as a new member
+        bool add_file(const ::std::wstring& _Name, const path& _Source);
+
+        // tries to append all regular files in the tree, the members are named by their relative paths
+        // (the container itself is skipped if it is written into the tree)
+        bool add_directory(const path& _Root);
+
+        // tries to seal the index and append it together with the footer
+        bool complete();
+
+    private:
+        // tries to start a new member
+        container_entry* _Begin_entry(const ::std::wstring& _Name, const uint64_t _Size);
+
+        // tries to finish the member
+        bool _Complete_entry(container_entry& _Entry) noexcept;
+
+        // serializes the index
+        ::std::vector<byte_t> _Serialize_index() const;
+
+        // tries to encrypt the bytes and append them to the buffer
+        bool _Append(const byte_t* const _Data, size_t _Size) noexcept;
+
+        // tries to write the buffer to the container
+        bool _Flush() noexcept;
+
+        file _Myfile;
+        path _Mypath;
+        encryption_engine::id _Myid;
+        ::std::unique_ptr<encryption_engine> _Myeng;
+        key _Mykey;
+        metadata _Mymeta;
+        ::std::vector<container_entry> _Myentries;
+        ::std::unordered_map<::std::wstring, size_t> _Mynames;
+        ::std::vector<byte_t> _Mybuf;
+        size_t _Myused; // the number of bytes in the buffer
+        uint64_t _Myoff; // the container offset of the first byte in the buffer
+        bool _Myok; // false after any failure, such a container cannot be completed
+    };
+
+    class container_reader { // extracts members from an existing container
+    public:
+        explicit container_reader(const path& _Source, const encryption_engine::id _Id);
+        ~container_reader() noexcept;
+
+        container_reader(const container_reader&) = delete;
+        container_reader& operator=(const container_reader&) = delete;
+
+        static constexpr size_t entry_size  = sizeof(uint16_t) // the fixed part of an index entry
+            + 2 * sizeof(uint64_t) + iv::size + authentication_tag::size;
+        static constexpr size_t footer_size = metadata::size + sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint64_t);
+        static constexpr uint8_t version    = 1;
+        static constexpr uint64_t magic     = 0x5443'5450'5952'4346; // "FCRYPTCT"
+
+        // checks if the file is a container
+        static bool is_container(file& _File) noexcept;
+
+        // checks if the container has been opened
+        bool is_open() const noexcept;
+
+        // tries to read the footer (its salt is required to derive the key)
+        bool load_footer() noexcept;
+
+        // returns the associated metadata (engine ID, index IV, index tag and salt)
+        metadata& get_metadata() noexcept;
+
+        // tries to open and verify the index
+        bool load_index(const key& _Key);
+
+        // returns all members
+        const ::std::vector<container_entry>& entries() const noexcept;
+
+        // returns the member with the specified name or nullptr
+        const container_entry* find(const ::std::wstring& _Name) const noexcept;
+
+        // tries to extract the member, _Buf receives the plaintext only if the tag matches
+        bool extract(const ::std::wstring& _Name, ::std::vector<byte_t>& _Buf);
+
+        // tries to extract the member to a new file
+        bool extract_to(const ::std::wstring& _Name, const path& _Target);
+
+    private:
+        // tries to deserialize the index
+        bool _Deserialize_index(const byte_t* const _Bytes, const size_t _Size);
+
+        file _Myfile;
+        path _Mypath;
+        encryption_engine::id _Myid;
+        ::std::unique_ptr<encryption_engine> _Myeng;
+        key _Mykey;
+        metadata _Mymeta;
+        uint64_t _Mydata; // the size of the members area
+        uint64_t _Myindex; // the sealed index size
+        ::std::vector<container_entry> _Myentries;
+        ::std::unordered_map<::std::wstring, size_t> _Mynames;
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_CONTAINER_HPP_
\ No newline at end of file
@@ -0,0 +1,1245 @@
+// directory_encryption_engine.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/directory_encryption_engine.hpp>
+#include <fcrypt/crypt/batch_encryption_engine.hpp>
+#include <fcrypt/crypt/chunked_encryption_engine.hpp>
+#include <fcrypt/crypt/metrics.hpp>
+#include <fcrypt/details/task_scheduler.hpp>
+#include <openssl/evp.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+namespace fcrypt {
+    _Key_cache::_Key_cache(const ::std::wstring& _Password) : _Mypass(_Password), _Mymtx(), _Myentries() {}
+
+    _Key_cache::~_Key_cache() noexcept {}
+
+    key _Key_cache::_Get(const salt& _Salt) {
+        // Note: The key is derived outside the lock, so keys for different salts are derived in parallel.
+        //       Workers that need a salt that is being derived wait for that single derivation.
+        ::std::shared_future<key> _Key;
+        ::std::promise<key> _Promise;
+        bool _Derive = false;
+        {
+            ::std::lock_guard _Guard(_Mymtx);
+            for (const _Entry& _Cached : _Myentries) {
+                if (::memcmp(_Cached._Salt.get(), _Salt.get(), salt::size) == 0) {
+                    _Key = _Cached._Key;
+                    break;
+                }
+            }
+
+            if (!_Key.valid()) { // the first worker that needs the salt derives the key
+                _Entry& _New = _Myentries.emplace_back();
+                _New._Salt   = _Salt;
+                _New._Key    = _Promise.get_future().share();
+                _Key         = _New._Key;
+                _Derive      = true;
+            }
+        }
+
+        if (_Derive) {
+            try {
+                _Promise.set_value(derive_key(_Mypass, _Salt));
+            } catch (...) { // the waiting workers must not wait forever
+                _Promise.set_exception(::std::current_exception());
+                throw;
+            }
+        }
+
+        return _Key.get();
+    }
+
+    directory_encryption_engine::directory_encryption_engine(const path& _Root,
+        const encryption_engine::id _Id, const size_t _Threads, const io_mode _Mode)
+        : _Myroot(_Root), _Myid(_Id),
+        _Mythreads(_Threads != 0 ? _Threads : (::std::max)(::std::thread::hardware_concurrency(), 1u)),
+        _Mymode(_Mode), _Myjournals(), _Mychunked(0), _Mystats() {}
+
+    directory_encryption_engine::~directory_encryption_engine() noexcept {}
+
+    size_t directory_encryption_engine::threads() const noexcept {
+        return _Mythreads;
+    }
+
+    void directory_encryption_engine::enable_chunked(const path& _Journals, const uint64_t _Threshold) {
+        _Myjournals = _Journals;
+        _Mychunked  = _Threshold;
+    }
+
+    const stage_stats& directory_encryption_engine::stats() const noexcept {
+        return _Mystats;
+    }
+
+    class _State_writer : public write_observer { // records the state of a file before it is changed
+    public:
+        explicit _State_writer(job_journal& _Journal, const job_file_state& _State) noexcept
+            : _Myjournal(_Journal), _Mystate(_State) {}
+
+        // tries to record the state before the first byte is changed
+        bool _Begin() const {
+            return _Myjournal.record_states(&_Mystate, 1);
+        }
+
+        // records the following writes as the restoration of the first _End bytes
+        void _Begin_undo(const uint64_t _End) noexcept {
+            _Mystate.change = file_change::undo;
+            _Mystate.end    = _End;
+        }
+
+        bool on_write(const uint64_t _Off, const byte_t* const _Data, const size_t _Size) noexcept override {
+            job_file_state _State = _Mystate; // the chunks of a chunked file are written in parallel
+            _State.offset         = _Off;
+            _State.length         = _Size;
+            _State.fingerprint    = job_journal::fingerprint(_Off, _Data, _Size);
+            try {
+                return _Myjournal.record_states(&_State, 1);
+            } catch (...) {
+                return false;
+            }
+        }
+
+    private:
+        job_journal& _Myjournal;
+        job_file_state _Mystate;
+    };
+
+    class _Batch_state_writer : public batch_write_observer { // records the states of a group of small files
+    public:
+        explicit _Batch_state_writer(job_journal& _Journal, const ::std::vector<size_t>& _Indices) noexcept
+            : _Myjournal(_Journal), _Myindices(_Indices) {}
+
+        bool on_write(const batch_write* const _Writes, const size_t _Count) noexcept override {
+            try {
+                job_file_state _States[batch_encryption_engine::lanes];
+                for (size_t _Pos = 0; _Pos < _Count; ++_Pos) { // the file and its metadata are written at once
+                    const batch_write& _Write = _Writes[_Pos];
+                    job_file_state& _State    = _States[_Pos];
+                    _State.index              = _Myindices[_Write.file];
+                    _State.size               = _Write.size;
+                    _State.file_iv            = *_Write.file_iv;
+                    _State.length             = _Write.size;
+                    _State.fingerprint        = job_journal::fingerprint(0, _Write.data, _Write.size);
+                }
+
+                return _Myjournal.record_states(_States, _Count);
+            } catch (...) {
+                return false;
+            }
+        }
+
+    private:
+        job_journal& _Myjournal;
+        const ::std::vector<size_t>& _Myindices; // the indices of the batched files
+    };
+
+    struct directory_encryption_engine::_Job_state {
+        struct _Worker_state { // engines are not thread-safe, every worker owns its own
+            ::std::unique_ptr<encryption_engine> _Engine;
+            ::std::unique_ptr<batch_encryption_engine> _Batch; // created on first use
+            ::std::vector<byte_t> _Buf; // the chunk buffer, allocated on first use
+            stage_stats _Stats; // collected by the tasks that ran on this worker
+        };
+
+        struct _Chunked_file { // the state shared by all chunk tasks of a single file
+            ::std::unique_ptr<file> _File;
+            ::std::unique_ptr<_State_writer> _Writer; // records every chunk, only if the job is journaled
+            ::std::unique_ptr<chunked_encryption_engine> _Engine;
+            ::std::vector<bool> _Done; // the chunks written by the interrupted run
+            ::std::atomic<uint64_t> _Remaining{0};
+            ::std::atomic<bool> _Success{true};
+            size_t _Idx = 0;
+        };
+
+        ::std::vector<file_result>& _Results;
+        const bool _Encrypt;
+        const key* _Key = nullptr; // only for the encryption
+        const salt* _Salt = nullptr; // only for the encryption
+        _Key_cache* _Cache = nullptr; // for the decryption, or for the recorded files during the encryption
+        manifest* _Manifest = nullptr;
+        job_journal* _Journal = nullptr;
+        bool _Resumed = false; // true if the journal describes an interrupted run of this job
+        const ::std::vector<_File_stat>* _Stats = nullptr; // the sizes reported to the metrics registry
+        metrics_registry* const _Metrics        = get_metrics_registry(); // nullptr if none is installed
+        ::std::vector<content_digest> _Digests; // only if the manifest is used for the encryption
+        ::std::vector<_Worker_state> _States;
+        _Task_scheduler _Scheduler;
+
+        explicit _Job_state(::std::vector<file_result>& _Files, const bool _Encryption, const size_t _Threads)
+            : _Results(_Files), _Encrypt(_Encryption), _States(_Threads), _Scheduler(_Threads) {}
+
+        ~_Job_state() noexcept {
+            for (_Worker_state& _State : _States) {
+                if (!_State._Buf.empty()) {
+                    _Scrub_memory(_State._Buf.data(), _State._Buf.size());
+                }
+            }
+        }
+
+        void _Finish(const size_t _Idx, const bool _Success) {
+            _Results[_Idx].success = _Success;
+            if (_Success && _Journal) { // a failure to record is not fatal, the file is checked again
+                _Journal->record(_Idx);
+            }
+
+            if (_Metrics) { // reported as soon as the file is done, a long job shows its progress
+                _Metrics->add_file(_Encrypt, _Success, false, (*_Stats)[_Idx]._Size);
+            }
+        }
+
+        void _Skip(const size_t _Idx) noexcept {
+            _Results[_Idx].success = true;
+            _Results[_Idx].skipped = true;
+            if (_Metrics) {
+                _Metrics->add_file(_Encrypt, true, true, (*_Stats)[_Idx]._Size);
+            }
+        }
+    };
+
+    directory_encryption_engine::_File_stat directory_encryption_engine::_Stat_file(const path& _Target) noexcept {
+        ::std::error_code _Ec;
+        _File_stat _Stat;
+        const uint64_t _Size = ::std::filesystem::file_size(_Target, _Ec);
+        _Stat._Size          = _Ec ? 0 : _Size; // the real size is checked again when the file is opened
+        const auto _Time     = ::std::filesystem::last_write_time(_Target, _Ec);
+        _Stat._Mtime         = _Ec ? 0 : static_cast<int64_t>(_Time.time_since_epoch().count());
+        return _Stat;
+    }
+
+    bool directory_encryption_engine::_Collect_files(
+        ::std::vector<file_result>& _Files, ::std::vector<_File_stat>& _Stats) const {
+        namespace _Fs = ::std::filesystem;
+        ::std::error_code _Ec;
+        _Fs::recursive_directory_iterator _Iter(_Myroot, _Fs::directory_options::skip_permission_denied, _Ec);
+        if (_Ec) { // the root cannot be listed
+            return false;
+        }
+
+        // Note: An entry whose type cannot be determined (e.g. a broken reparse point) is reported
+        //       as a failed file instead of ending the walk. An error of the iterator itself leaves
+        //       the rest of the tree unknown, so the whole job fails rather than process a part of it.
+        for (const _Fs::recursive_directory_iterator _End; _Iter != _End; _Iter.increment(_Ec)) {
+            if (_Ec) {
+                return false;
+            }
+
+            const bool _Regular = _Iter->is_regular_file(_Ec);
+            if (_Ec) {
+                _Ec.clear();
+                _File_stat _Stat;
+                _Stat._Unreadable = true;
+                _Files.push_back(file_result{_Iter->path(), false, false});
+                _Stats.push_back(_Stat);
+            } else if (_Regular) {
+                _Files.push_back(file_result{_Iter->path(), false, false});
+                _Stats.push_back(_Stat_file(_Iter->path()));
+            }
+        }
+
+        return !_Ec;
+    }
+
+    void directory_encryption_engine::_Sort_files(
+        ::std::vector<file_result>& _Files, ::std::vector<_File_stat>& _Stats) {
+        ::std::vector<size_t> _Order(_Files.size());
+        for (size_t _Idx = 0; _Idx < _Order.size(); ++_Idx) {
+            _Order[_Idx] = _Idx;
+        }
+
+        ::std::sort(_Order.begin(), _Order.end(), [&_Files](const size_t _Left, const size_t _Right) {
+            return _Files[_Left].target < _Files[_Right].target;
+        });
+        ::std::vector<file_result> _Sorted_files;
+        ::std::vector<_File_stat> _Sorted_stats;
+        _Sorted_files.reserve(_Files.size());
+        _Sorted_stats.reserve(_Stats.size());
+        for (const size_t _Idx : _Order) {
+            _Sorted_files.push_back(::std::move(_Files[_Idx]));
+            _Sorted_stats.push_back(_Stats[_Idx]);
+        }
+
+        _Files = ::std::move(_Sorted_files);
+        _Stats = ::std::move(_Sorted_stats);
+    }
+
+    bool directory_encryption_engine::_Describe_job(const job_journal& _Journal, const bool _Encrypt,
+        const ::std::vector<file_result>& _Files, job_description& _Job) const {
+        ::EVP_MD_CTX* const _Ctx = ::EVP_MD_CTX_new();
+        if (!_Ctx) {
+            return false;
+        }
+
+        // Note: Every path is prefixed with its length, so that no two trees share a digest.
+        bool _Success = ::EVP_DigestInit_ex(_Ctx, ::EVP_sha256(), nullptr) != 0;
+        for (size_t _Idx = 0; _Idx < _Files.size() && _Success; ++_Idx) {
+            const path::string_type& _Native = _Files[_Idx].target.native();
+            const uint64_t _Bytes            = _Native.size() * sizeof(path::value_type);
+            byte_t _Length[sizeof(uint64_t)];
+            _Store_little_endian(_Length, _Bytes);
+            _Success = ::EVP_DigestUpdate(_Ctx, _Length, sizeof(_Length)) != 0
+                && ::EVP_DigestUpdate(_Ctx, _Native.data(), static_cast<size_t>(_Bytes)) != 0;
+        }
+
+        _Success = _Success && ::EVP_DigestFinal_ex(_Ctx, _Job.tree.get(), nullptr) != 0;
+        ::EVP_MD_CTX_free(_Ctx);
+        if (!_Success) {
+            return false;
+        }
+
+        _Job.encrypt   = _Encrypt;
+        _Job.engine_id = _Myid;
+        _Job.items     = _Files.size();
+        if (!_Journal.has_job()) { // a new job
+            return true;
+        }
+
+        const job_description& _Recorded = _Journal.job();
+        if (_Recorded.encrypt != _Encrypt || _Recorded.engine_id != _Myid || _Recorded.items != _Job.items
+            || ::memcmp(_Recorded.tree.get(), _Job.tree.get(), job_digest::size) != 0) {
+            return false;
+        }
+
+        _Job.job_salt  = _Recorded.job_salt;
+        _Job.key_check = _Recorded.key_check;
+        return true;
+    }
+
+    bool directory_encryption_engine::_Is_sealed(const path& _Target, const salt& _Salt) const {
+        file _File(_Target);
+        if (!_File.is_open()) {
+            return false;
+        }
+
+        const auto _Matches = [this, &_Salt](metadata& _Meta) noexcept {
+            return _Meta.get_encryption_engine_id() == _Myid
+                && ::memcmp(_Meta.get_salt().get(), _Salt.get(), salt::size) == 0;
+        };
+        if (chunked_encryption_engine::is_chunked(_File)) {
+            chunked_encryption_engine _Engine(_File, _Myid);
+            return _Engine.load_footer() && _Matches(_Engine.get_metadata());
+        }
+
+        metadata _Meta;
+        return _Meta.read(_File) && _Matches(_Meta);
+    }
+
+    bool directory_encryption_engine::_Is_encrypted(_Job_state& _Job, const size_t _Idx, const size_t _Worker) {
+        // Note: A trailer has no magic number, so only its tag tells an encrypted file from a plaintext
+        //       file that happens to end with the engine's ID. Only the files recorded in the manifest are
+        //       checked, the others have never been encrypted by a job that kept this manifest.
+        manifest_record _Record;
+        if (!_Job._Manifest || !_Job._Manifest->find(_Job._Results[_Idx].target, _Record)) {
+            return false;
+        }
+
+        file _File(_Job._Results[_Idx].target);
+        if (!_File.is_open()) {
+            return false;
+        }
+
+        encryption_engine* const _Engine = _Job._States[_Worker]._Engine.get();
+        bool _Authentic                  = false;
+        if (chunked_encryption_engine::is_chunked(_File)) {
+            chunked_encryption_engine _Chunked(_File, _Myid);
+            if (_Chunked.load_footer() && _Chunked.get_metadata().get_encryption_engine_id() == _Myid) {
+                const key _Key = _Job._Cache->_Get(_Chunked.get_metadata().get_salt());
+                _Authentic     = _Key.valid() && _Chunked.begin_decryption(_Key, _Engine);
+            }
+        } else {
+            metadata _Meta;
+            if (_Meta.read(_File) && _Meta.get_encryption_engine_id() == _Myid) {
+                const key _Key = _Job._Cache->_Get(_Meta.get_salt());
+                file_encryption_engine _Checker(_File, _Engine, _Mymode);
+                _Authentic = _Key.valid()
+                    && _Checker.verify(_Key, _Meta.get_iv(), _Meta.get_tag(), _File.size() - metadata::size);
+            }
+        }
+
+        if (_Authentic && !_Job._Digests.empty()) { // the record is refreshed with the digest it already has
+            _Job._Digests[_Idx] = _Record.digest;
+        }
+
+        return _Authentic;
+    }
+
+    class _Keystream { // applies the keystream of a file (or of a chunk at _Base) to any of its regions
+    public:
+        explicit _Keystream(encryption_engine* const _Engine, const key& _Key, const iv& _Iv, const uint64_t _Base = 0)
+            : _Myeng(_Engine), _Mykey(_Key), _Myiv(_Iv), _Mybase(_Base), _Mypos(_Restart), _Myscratch(65536) {}
+
+        ~_Keystream() noexcept {
+            _Scrub_memory(_Myscratch.data(), _Myscratch.size());
+        }
+
+        _Keystream(const _Keystream&) = delete;
+        _Keystream& operator=(const _Keystream&) = delete;
+
+        // tries to XOR the region with the keystream, the keystream restarts if the region precedes the last one
+        bool _Apply(const uint64_t _Off, byte_t* const _Data, const size_t _Size) noexcept {
+            // Note: The engines are stream-based (AES-GCM uses CTR mode), so encrypting any bytes advances
+            //       the keystream, the bytes before the region are skipped by encrypting a scratch buffer.
+            if (_Off < _Mybase) { // the region precedes the keystream
+                return false;
+            }
+
+            if (_Off < _Mypos) {
+                if (!_Myeng->setup_encryption(_Mykey, _Myiv)) {
+                    return false;
+                }
+
+                _Mypos = _Mybase;
+            }
+
+            const uint64_t _Scratch = _Myscratch.size();
+            while (_Mypos < _Off) {
+                const size_t _Count = static_cast<size_t>(_Min(_Off - _Mypos, _Scratch));
+                if (!_Myeng->encrypt(_Myscratch.data(), _Count, _Myscratch.data())) {
+                    return false;
+                }
+
+                _Mypos += _Count;
+            }
+
+            if (_Size != 0 && !_Myeng->encrypt(_Data, _Size, _Data)) {
+                return false;
+            }
+
+            _Mypos += _Size;
+            return true;
+        }
+
+        // tries to compute the tag of the bytes applied since the keystream started from the beginning
+        bool _Complete(authentication_tag& _Tag) noexcept {
+            _Mypos = _Restart;
+            return _Myeng->complete_encryption(_Tag);
+        }
+
+    private:
+        static constexpr uint64_t _Restart = static_cast<uint64_t>(-1); // the keystream must start again
+
+        encryption_engine* _Myeng;
+        const key& _Mykey;
+        const iv& _Myiv;
+        uint64_t _Mybase; // the offset of the first byte of the keystream
+        uint64_t _Mypos; // the offset of the next byte of the keystream
+        ::std::vector<byte_t> _Myscratch;
+    };
+
+    static bool _Record_state(job_journal* const _Journal, const job_file_state& _State) {
+        return !_Journal || _Journal->record_states(&_State, 1); // nothing is recorded without a journal
+    }
+
+    static bool _Has_trailer(file& _File, const job_file_state& _State, const salt& _Salt,
+        const encryption_engine::id _Id) noexcept {
+        metadata _Meta;
+        return _File.size() == _State.size + metadata::size && _Meta.read(_File)
+            && _Meta.get_encryption_engine_id() == _Id
+            && ::memcmp(_Meta.get_iv().get(), _State.file_iv.get(), iv::size) == 0
+            && ::memcmp(_Meta.get_salt().get(), _Salt.get(), salt::size) == 0;
+    }
+
+    static bool _Find_written(file& _File, const job_file_state& _State, _Keystream& _Stream, uint64_t& _Written) {
+        // Note: Every unit of the region holds either its old or its new bytes, and the new bytes of a unit
+        //       are its old bytes XOR the keystream. The written units form a prefix of the region, so every
+        //       possible number of written units is checked against the recorded fingerprint, there must be
+        //       exactly one that matches.
+        constexpr size_t _Unit = job_journal::unit_size;
+        if (_State.length > chunked_encryption_engine::max_chunk_size) { // larger than any region or chunk
+            return false;
+        }
+
+        const size_t _Length = static_cast<size_t>(_State.length);
+        ::std::vector<byte_t> _Current(_Length);
+        if (_File.read_at(_State.offset, _Current.data(), _Length) != _Length) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Other = _Current;
+        bool _Success = _Stream._Apply(_State.offset, _Other.data(), _Length);
+        uint64_t _Sum = job_journal::fingerprint(_State.offset, _Other.data(), _Length); // no unit written
+        size_t _Matches = 0;
+        for (size_t _Pos = 0; _Success; _Pos += _Unit) {
+            if (_Sum == _State.fingerprint) {
+                _Written = _Min(static_cast<uint64_t>(_Pos), _State.length);
+                ++_Matches;
+            }
+
+            if (_Pos >= _Length) {
+                break;
+            }
+
+            const uint64_t _Off = _State.offset + _Pos;
+            const size_t _Size  = _Min(_Length - _Pos, _Unit);
+            _Sum += job_journal::fingerprint(_Off, _Current.data() + _Pos, _Size)
+                  - job_journal::fingerprint(_Off, _Other.data() + _Pos, _Size);
+        }
+
+        _Scrub_memory(_Current.data(), _Current.size());
+        _Scrub_memory(_Other.data(), _Other.size());
+        return _Success && _Matches == 1;
+    }
+
+    static bool _Recover_chunk(chunked_encryption_engine& _Chunked, file& _File, const job_file_state& _State,
+        const key& _Key, encryption_engine* const _Engine, bool& _Written_chunk) {
+        // Note: A chunk is written at once, so its written units form a prefix as well. A partially written
+        //       chunk is completed, its ciphertext is reconstructed and verified before the plaintext is written.
+        const uint64_t _Chunk = _State.offset / _Chunked.chunk_size();
+        if (_State.offset % _Chunked.chunk_size() != 0 || _Chunk >= _Chunked.chunk_count()
+            || _State.length != _Chunked.chunk_size_at(_Chunk)) {
+            return false;
+        }
+
+        const chunk_record& _Record = _Chunked.records()[static_cast<size_t>(_Chunk)];
+        _Keystream _Stream(_Engine, _Key, _Record.chunk_iv, _State.offset);
+        uint64_t _Written = 0;
+        if (!_Find_written(_File, _State, _Stream, _Written)) {
+            return false;
+        }
+
+        _Written_chunk = _Written != 0;
+        if (_Written == 0 || _Written == _State.length) { // still encrypted, or already decrypted
+            return true;
+        }
+
+        const size_t _Length = static_cast<size_t>(_State.length);
+        ::std::vector<byte_t> _Buf(_Length);
+        authentication_tag _Tag = _Record.tag;
+        const bool _Success     = _File.read_at(_State.offset, _Buf.data(), _Length) == _Length
+            && _Stream._Apply(_State.offset, _Buf.data(), static_cast<size_t>(_Written)) // encrypts the prefix again
+            && _Engine->setup_decryption(_Key, _Record.chunk_iv)
+            && _Engine->decrypt(_Buf.data(), _Length, _Buf.data()) && _Engine->complete_decryption(_Tag)
+            && _File.write_at(_State.offset, byte_string_view{_Buf.data(), _Length});
+        _Scrub_memory(_Buf.data(), _Buf.size());
+        return _Success;
+    }
+
+    static bool _Is_decrypted(file& _File, const job_file_state& _State, _Keystream& _Stream) {
+        // Note: Encrypting the plaintext again gives the original ciphertext, so its tag must match.
+        const uint64_t _Region_size = file_encryption_engine::region_size;
+        ::std::vector<byte_t> _Region(static_cast<size_t>(_Min(_State.size, _Region_size)));
+        bool _Success = _Stream._Apply(0, nullptr, 0); // the tag covers the keystream from the beginning
+        for (uint64_t _Off = 0; _Off < _State.size && _Success; _Off += _Region_size) {
+            const size_t _Count = static_cast<size_t>(_Min(_State.size - _Off, _Region_size));
+            _Success = _File.read_at(_Off, _Region.data(), _Count) == _Count
+                && _Stream._Apply(_Off, _Region.data(), _Count);
+        }
+
+        _Scrub_memory(_Region.data(), _Region.size());
+        authentication_tag _Tag;
+        return _Success && _Stream._Complete(_Tag)
+            && ::memcmp(_Tag.get(), _State.tag.get(), authentication_tag::size) == 0;
+    }
+
+    static bool _Undo_change(job_journal& _Journal, file& _File, const job_file_state& _State,
+        _Keystream& _Stream, const uint64_t _First, const uint64_t _Last) {
+        // Note: The changed bytes are restored region by region, and every region is recorded before
+        //       it is written, so an interrupted recovery is recovered again by the next run.
+        constexpr uint64_t _Region_size = file_encryption_engine::region_size;
+        job_file_state _Undo = _State;
+        _Undo.change         = file_change::undo;
+        _Undo.end            = _Last;
+        ::std::vector<byte_t> _Region(static_cast<size_t>(_Min(_Last - _First, _Region_size)));
+        bool _Success = true;
+        for (uint64_t _Off = _First; _Off < _Last && _Success;) {
+            const size_t _Count = static_cast<size_t>(_Min(_Last, (_Off / _Region_size + 1) * _Region_size) - _Off);
+            _Success = _File.read_at(_Off, _Region.data(), _Count) == _Count
+                && _Stream._Apply(_Off, _Region.data(), _Count);
+            if (_Success) {
+                _Undo.offset      = _Off;
+                _Undo.length      = _Count;
+                _Undo.fingerprint = job_journal::fingerprint(_Off, _Region.data(), _Count);
+                _Success          = _Journal.record_states(&_Undo, 1)
+                    && _File.write_at(_Off, byte_string_view{_Region.data(), _Count});
+            }
+
+            _Off += _Count;
+        }
+
+        _Scrub_memory(_Region.data(), _Region.size());
+        return _Success;
+    }
+
+    static bool _Restore_size(file& _File, const job_file_state& _State, const bool _Encrypt,
+        const encryption_engine::id _Id) noexcept {
+        const uint64_t _Size = _File.size();
+        if (_Encrypt) { // a torn metadata is removed
+            return _Size == _State.size || (_Size > _State.size && _File.resize(_State.size));
+        }
+
+        if (_Size == _State.size + metadata::size) { // the metadata has not been removed yet
+            return true;
+        }
+
+        if (_Size != _State.size) {
+            return false;
+        }
+
+        metadata _Meta; // the decryption needs the removed metadata again
+        _Meta.get_encryption_engine_id() = _Id;
+        _Meta.get_iv()                   = _State.file_iv;
+        _Meta.get_tag()                  = _State.tag;
+        _Meta.get_salt()                 = _State.file_salt;
+        return _Meta.save(_File);
+    }
+
+    directory_encryption_engine::_Recovery directory_encryption_engine::_Recover_file(
+        _Job_state& _Job, const size_t _Idx, const size_t _Worker) {
+        ::std::vector<job_file_state> _States;
+        if (!_Job._Resumed || !_Job._Journal->find_states(_Idx, _States)) { // never changed by the interrupted run
+            return _Recovery::unchanged;
+        }
+
+        const job_file_state& _State = _States.front(); // only the chunks of a chunked file have more states
+        const path& _Target          = _Job._Results[_Idx].target;
+        if (_State.change == file_change::chunked && _Job._Encrypt) { // an unsealed file resumes its chunk journal
+            return _Is_sealed(_Target, *_Job._Salt) ? _Recovery::finished : _Recovery::unchanged;
+        }
+
+        file _File(_Target);
+        if (!_File.is_open()) {
+            return _Recovery::failed;
+        }
+
+        if (_State.change == file_change::chunked) { // the footer is removed only after every chunk is written
+            if (chunked_encryption_engine::is_chunked(_File)) { // the written chunks are recovered by the decryption
+                return _Recovery::unchanged;
+            }
+
+            return _File.size() == _State.size ? _Recovery::finished : _Recovery::failed;
+        }
+
+        if (_Job._Encrypt && _Has_trailer(_File, _State, *_Job._Salt, _Myid)) { // the metadata is written last
+            return _Recovery::finished;
+        }
+
+        const key _Key = _Job._Encrypt ? *_Job._Key : _Job._Cache->_Get(_State.file_salt);
+        if (!_Key.valid()) {
+            return _Recovery::failed;
+        }
+
+        _Keystream _Stream(_Job._States[_Worker]._Engine.get(), _Key, _State.file_iv);
+        uint64_t _Written = 0;
+        if (!_Find_written(_File, _State, _Stream, _Written)) {
+            return _Recovery::failed;
+        }
+
+        // Note: Every byte before the region has been changed (forward), or every byte after the region
+        //       up to the end of the change is still changed (undo).
+        const uint64_t _Boundary = _State.offset + _Written;
+        const uint64_t _First    = _State.change == file_change::forward ? 0 : _Boundary;
+        const uint64_t _Last     = _State.change == file_change::forward ? _Boundary : _State.end;
+        if (_First > _Last) {
+            return _Recovery::failed;
+        }
+
+        if (!_Job._Encrypt && _State.change == file_change::forward && _Last == _State.size
+            && _File.size() == _State.size && _Is_decrypted(_File, _State, _Stream)) {
+            return _Recovery::finished;
+        }
+
+        if (!_Undo_change(*_Job._Journal, _File, _State, _Stream, _First, _Last)
+            || !_Restore_size(_File, _State, _Job._Encrypt, _Myid)) {
+            return _Recovery::failed;
+        }
+
+        return _Recovery::unchanged;
+    }
+
+    void directory_encryption_engine::_Close_journal(_Job_state& _Job) {
+        for (const file_result& _Result : _Job._Results) {
+            if (!_Result.success) { // the next run retries the failed files
+                _Job._Journal->compact();
+                return;
+            }
+        }
+
+        _Job._Journal->remove();
+    }
+
+    void directory_encryption_engine::_Run(_Job_state& _Job, const ::std::vector<_File_stat>& _Stats) {
+        _Job._Stats = &_Stats;
+        for (_Job_state::_Worker_state& _State : _Job._States) {
+            _State._Engine.reset(make_encryption_engine(_Myid));
+            if (!_State._Engine) { // nothing can be processed
+                return;
+            }
+        }
+
+        // Note: The decryption cannot use batch_encryption_engine, because every file may have its own
+        //       salt, but grouping still reduces the number of tasks for trees with many small files.
+        const uint64_t _Max_small = _Job._Encrypt
+            ? batch_encryption_engine::max_file_size : batch_encryption_engine::max_file_size + metadata::size;
+        ::std::vector<size_t> _Group;
+        for (size_t _Idx = 0; _Idx < _Job._Results.size(); ++_Idx) {
+            const uint64_t _Size = _Stats[_Idx]._Size;
+            if (_Stats[_Idx]._Unreadable) { // reported, but never touched
+                _Job._Finish(_Idx, false);
+                continue;
+            }
+
+            if (_Job._Resumed && _Job._Journal->is_finished(_Idx)) { // processed by the interrupted run
+                _Job._Skip(_Idx);
+                continue;
+            }
+
+            if (_Job._Encrypt && _Job._Manifest
+                && _Job._Manifest->is_unchanged(_Job._Results[_Idx].target, _Size, _Stats[_Idx]._Mtime)) {
+                _Job._Skip(_Idx); // already encrypted and not modified since
+                continue;
+            }
+
+            if (_Size > _Max_small) { // large files are scheduled separately
+                _Job._Scheduler._Submit([this, &_Job, _Idx, _Size](const size_t _Worker) {
+                    _Stage_snapshot _Snapshot(_Job._States[_Worker]._Stats);
+                    _Process_file(_Job, _Idx, _Size, _Worker);
+                });
+                continue;
+            }
+
+            _Group.push_back(_Idx);
+            if (_Group.size() == batch_encryption_engine::lanes) {
+                _Job._Scheduler._Submit([this, &_Job, _Group](const size_t _Worker) {
+                    _Stage_snapshot _Snapshot(_Job._States[_Worker]._Stats);
+                    _Process_group(_Job, _Group, _Worker);
+                });
+                _Group.clear();
+            }
+        }
+
+        if (!_Group.empty()) {
+            _Job._Scheduler._Submit([this, &_Job, _Group](const size_t _Worker) {
+                _Stage_snapshot _Snapshot(_Job._States[_Worker]._Stats);
+                _Process_group(_Job, _Group, _Worker);
+            });
+        }
+
+        _Job._Scheduler._Wait();
+        for (const _Job_state::_Worker_state& _State : _Job._States) {
+            _Mystats += _State._Stats;
+        }
+    }
+
+    void directory_encryption_engine::_Record_digest(_Job_state& _Job, const size_t _Idx) {
+        if (_Job._Digests.empty()) { // the manifest is not used
+            return;
+        }
+
+        // Note: This is an additional pass over the plaintext, used only for the files that are not
+        //       encrypted by file_encryption_engine (batched and chunked files). A failure is not fatal,
+        //       the file is still encrypted and recorded, only its digest remains empty.
+        file _File(_Job._Results[_Idx].target);
+        if (_File.is_open()) {
+            compute_digest(_File, _Job._Digests[_Idx]);
+        }
+    }
+
+    void directory_encryption_engine::_Update_manifest(_Job_state& _Job) {
+        for (size_t _Idx = 0; _Idx < _Job._Results.size(); ++_Idx) {
+            const file_result& _Result = _Job._Results[_Idx];
+            manifest_record _Record;
+            if (_Result.skipped) { // the record is still valid, unless the interrupted run could not update it
+                const bool _Recorded = _Job._Resumed && _Job._Journal->is_finished(_Idx);
+                if (!_Recorded || (_Job._Encrypt && _Job._Manifest->find(_Result.target, _Record))) {
+                    continue;
+                }
+            }
+
+            if (_Job._Encrypt && _Result.success) { // record the state of the encrypted file
+                const _File_stat _Stat = _Stat_file(_Result.target);
+                _Record.size   = _Stat._Size;
+                _Record.mtime  = _Stat._Mtime;
+                _Record.digest = _Job._Digests[_Idx];
+                _Job._Manifest->update(_Result.target, _Record);
+            } else if (!_Job._Encrypt && _Result.success) { // the file must be encrypted again next time
+                _Job._Manifest->erase(_Result.target);
+            }
+        }
+
+        _Job._Manifest->flush();
+    }
+
+    void directory_encryption_engine::_Process_group(
+        _Job_state& _Job, const ::std::vector<size_t>& _Group, const size_t _Worker) {
+        if (!_Job._Encrypt) {
+            for (const size_t _Idx : _Group) {
+                _Process_file(_Job, _Idx, 0, _Worker);
+            }
+
+            return;
+        }
+
+        _Job_state::_Worker_state& _State = _Job._States[_Worker];
+        if (!_State._Batch) {
+            _State._Batch = ::std::make_unique<batch_encryption_engine>(_Myid);
+        }
+
+        ::std::vector<path> _Files;
+        ::std::vector<size_t> _Pending; // the files that have not been encrypted by the interrupted run
+        _Files.reserve(_Group.size());
+        _Pending.reserve(_Group.size());
+        for (const size_t _Idx : _Group) {
+            const _Recovery _Recovered = _Recover_file(_Job, _Idx, _Worker);
+            if (_Recovered != _Recovery::unchanged) {
+                _Job._Finish(_Idx, _Recovered == _Recovery::finished);
+                continue;
+            }
+
+            if (_Is_encrypted(_Job, _Idx, _Worker)) { // changed since the last run, but still encrypted
+                _Job._Finish(_Idx, true);
+                continue;
+            }
+
+            _Files.push_back(_Job._Results[_Idx].target);
+            _Pending.push_back(_Idx);
+            _Record_digest(_Job, _Idx);
+        }
+
+        if (_Files.empty()) {
+            return;
+        }
+
+        ::std::unique_ptr<_Batch_state_writer> _Writer; // the states are recorded only if the job is journaled
+        if (_Job._Journal) {
+            _Writer = ::std::make_unique<_Batch_state_writer>(*_Job._Journal, _Pending);
+        }
+
+        const ::std::vector<bool> _Results = _State._Batch->encrypt(_Files, *_Job._Key, *_Job._Salt, _Writer.get());
+        for (size_t _Pos = 0; _Pos < _Pending.size(); ++_Pos) {
+            _Job._Finish(_Pending[_Pos], _Results[_Pos]);
+        }
+    }
+
+    void directory_encryption_engine::_Process_file(
+        _Job_state& _Job, const size_t _Idx, const uint64_t _Size, const size_t _Worker) {
+        file_result& _Result       = _Job._Results[_Idx];
+        encryption_engine* _Engine = _Job._States[_Worker]._Engine.get();
+        const _Recovery _Recovered = _Recover_file(_Job, _Idx, _Worker);
+        if (_Recovered != _Recovery::unchanged) {
+            _Job._Finish(_Idx, _Recovered == _Recovery::finished);
+            return;
+        }
+
+        if (_Job._Encrypt) {
+            if (_Is_encrypted(_Job, _Idx, _Worker)) { // changed since the last run, but still encrypted
+                _Job._Finish(_Idx, true);
+                return;
+            }
+
+            if (_Mychunked != 0 && _Size >= _Mychunked) {
+                job_file_state _State; // the chunk journal records the progress of the file itself
+                _State.index  = _Idx;
+                _State.change = file_change::chunked;
+                _State.size   = _Size;
+                _Record_digest(_Job, _Idx); // the chunks are encrypted by separate threads
+                _Job._Finish(_Idx, _Record_state(_Job._Journal, _State)
+                    && _Encrypt_chunked(_Result.target, *_Job._Key, *_Job._Salt));
+            } else { // the digest is computed while the file is encrypted
+                content_digest* const _Digest = _Job._Digests.empty() ? nullptr : &_Job._Digests[_Idx];
+                _Job._Finish(_Idx, _Encrypt_file(_Job, _Idx, _Engine, _Digest));
+            }
+
+            return;
+        }
+
+        ::std::unique_ptr<file> _File = ::std::make_unique<file>(_Result.target);
+        if (!_File->is_open()) {
+            _Job._Finish(_Idx, false);
+            return;
+        }
+
+        if (chunked_encryption_engine::is_chunked(*_File)) { // the result is reported by the last chunk task
+            if (!_Decrypt_chunked(_Job, _Idx, ::std::move(_File), _Worker)) {
+                _Job._Finish(_Idx, false);
+            }
+        } else {
+            _Job._Finish(_Idx, _Decrypt_file(_Job, _Idx, *_File, _Engine));
+        }
+    }
+
+    path directory_encryption_engine::_Chunk_journal_path(const path& _Target) const {
+        // Note: The journal is named after the digest of the file's path, so every run finds the journal
+        //       of the same file, whatever the order of the files and whether the job is journaled.
+        const path::string_type& _Native = _Target.native();
+        byte_t _Digest[32];
+        ::EVP_Digest(_Native.data(), _Native.size() * sizeof(path::value_type),
+            _Digest, nullptr, ::EVP_sha256(), nullptr);
+        constexpr wchar_t _Digits[] = L"0123456789abcdef";
+        ::std::wstring _Name;
+        for (size_t _Idx = 0; _Idx < 16; ++_Idx) {
+            _Name.push_back(_Digits[_Digest[_Idx] >> 4]);
+            _Name.push_back(_Digits[_Digest[_Idx] & 0x0F]);
+        }
+
+        return _Myjournals / (_Name + L".chunks");
+    }
+
+    bool directory_encryption_engine::_Encrypt_chunked(const path& _Target, const key& _Key, const salt& _Salt) {
+        file _File(_Target);
+        if (!_File.is_open()) {
+            return false;
+        }
+
+        // Note: The chunks are encrypted by threads of the chunked engine, because its journal requires
+        //       the batches to be written in order. The worker that runs this task waits for them,
+        //       their statistics are added to the worker's own, so the snapshot of the task covers them.
+        chunked_encryption_engine _Engine(_File, _Myid);
+        return _Engine.encrypt_journaled(_Key, _Salt, _Chunk_journal_path(_Target), _Mythreads);
+    }
+
+    bool directory_encryption_engine::_Decrypt_chunked(
+        _Job_state& _Job, const size_t _Idx, ::std::unique_ptr<file>&& _File, const size_t _Worker) {
+        using _Chunked_file = _Job_state::_Chunked_file;
+        const ::std::shared_ptr<_Chunked_file> _State = ::std::make_shared<_Chunked_file>();
+        _State->_Idx    = _Idx;
+        _State->_File   = ::std::move(_File);
+        _State->_Engine = ::std::make_unique<chunked_encryption_engine>(*_State->_File, _Myid);
+        chunked_encryption_engine& _Engine = *_State->_Engine;
+        if (!_Engine.load_footer() || _Engine.get_metadata().get_encryption_engine_id() != _Myid) {
+            return false;
+        }
+
+        const key _Key = _Job._Cache->_Get(_Engine.get_metadata().get_salt());
+        if (!_Key.valid() || !_Engine.begin_decryption(_Key, _Job._States[_Worker]._Engine.get())) {
+            return false;
+        }
+
+        // Note: The chunks written by the interrupted run are neither verified nor written again,
+        //       a partially written chunk is completed first. Every chunk is recorded before it is written.
+        ::std::vector<job_file_state> _Written;
+        if (_Job._Resumed) {
+            _Job._Journal->find_states(_Idx, _Written);
+        }
+
+        _State->_Done.assign(static_cast<size_t>(_Engine.chunk_count()), false);
+        for (const job_file_state& _Chunk_state : _Written) {
+            bool _Done = false;
+            if (_Chunk_state.change != file_change::chunked || (_Chunk_state.length != 0
+                && !_Recover_chunk(_Engine, *_State->_File, _Chunk_state, _Key, _Job._States[_Worker]._Engine.get(),
+                    _Done))) {
+                return false;
+            }
+
+            if (_Done) {
+                _State->_Done[static_cast<size_t>(_Chunk_state.offset / _Engine.chunk_size())] = true;
+            }
+        }
+
+        if (_Job._Journal) {
+            job_file_state _File_state;
+            _File_state.index  = _Idx;
+            _File_state.change = file_change::chunked;
+            _File_state.size   = _Engine.plaintext_size();
+            _State->_Writer    = ::std::make_unique<_State_writer>(*_Job._Journal, _File_state);
+            if (_Written.empty() && !_State->_Writer->_Begin()) { // recorded before the first chunk is written
+                return false;
+            }
+
+            _Engine.set_write_observer(_State->_Writer.get());
+        }
+
+        const uint64_t _Count = _Engine.chunk_count();
+        if (_Count == 0) { // only the table and the footer must be removed
+            _Job._Finish(_Idx, _Engine.complete_decryption());
+            return true;
+        }
+
+        // Note: The first pass verifies every chunk without writing anything, the second pass decrypts
+        //       the chunks again and writes them back. A damaged chunk therefore leaves the whole file
+        //       encrypted instead of a mix of plaintext and ciphertext.
+        const auto _Write = ::std::make_shared<const _Task_scheduler::_Range_task>(
+            [&_Job, _State](const uint64_t _Chunk, const size_t _Worker) {
+                _Job_state::_Worker_state& _Current = _Job._States[_Worker];
+                chunked_encryption_engine& _Engine     = *_State->_Engine;
+                _Stage_snapshot _Snapshot(_Current._Stats);
+                try {
+                    if (_State->_Success.load(::std::memory_order_relaxed) && !_State->_Done[_Chunk]) {
+                        if (_Current._Buf.size() < _Engine.chunk_size()) {
+                            _Current._Buf.resize(_Engine.chunk_size());
+                        }
+
+                        if (!_Engine.decrypt_chunk(_Chunk, _Current._Engine.get(), _Current._Buf.data())) {
+                            _State->_Success = false;
+                        }
+                    }
+
+                    if (_State->_Remaining.fetch_sub(1) == 1) { // the last chunk removes the table
+                        _Job._Finish(_State->_Idx, _State->_Success && _Engine.complete_decryption());
+                        _State->_Engine.reset();
+                        _State->_File.reset();
+                    }
+                } catch (...) {
+                    _State->_Success = false;
+                    if (_State->_Remaining.fetch_sub(1) == 1) {
+                        _Job._Finish(_State->_Idx, false);
+                    }
+                }
+            });
+        _State->_Remaining = _Count;
+        _Job._Scheduler._Submit_range(0, _Count, ::std::make_shared<const _Task_scheduler::_Range_task>(
+            [&_Job, _State, _Write, _Count](const uint64_t _Chunk, const size_t _Worker) {
+                _Job_state::_Worker_state& _Current = _Job._States[_Worker];
+                chunked_encryption_engine& _Engine     = *_State->_Engine;
+                _Stage_snapshot _Snapshot(_Current._Stats);
+                try {
+                    if (_State->_Success.load(::std::memory_order_relaxed) && !_State->_Done[_Chunk]) {
+                        if (_Current._Buf.size() < _Engine.chunk_size()) {
+                            _Current._Buf.resize(_Engine.chunk_size());
+                        }
+
+                        if (!_Engine.verify_chunk(_Chunk, _Current._Engine.get(), _Current._Buf.data())) {
+                            _State->_Success = false;
+                        }
+                    }
+
+                    if (_State->_Remaining.fetch_sub(1) != 1) { // not the last chunk
+                        return;
+                    }
+
+                    if (_State->_Success) { // every chunk is authentic, the last one starts the second pass
+                        _State->_Remaining = _Count;
+                        _Job._Scheduler._Submit_range(0, _Count, _Write);
+                    } else {
+                        _Job._Finish(_State->_Idx, false);
+                        _State->_Engine.reset();
+                        _State->_File.reset();
+                    }
+                } catch (...) {
+                    _State->_Success = false;
+                    if (_State->_Remaining.fetch_sub(1) == 1) {
+                        _Job._Finish(_State->_Idx, false);
+                    }
+                }
+            }));
+        return true;
+    }
+
+    static bool _Rollback_file(file_encryption_engine& _File_engine, _State_writer* const _Writer,
+        const key& _Key, const iv& _Iv) noexcept {
+        if (_Writer) { // an interrupted restoration is completed by the next run
+            _Writer->_Begin_undo(_File_engine.processed());
+        }
+
+        return _File_engine.rollback(_Key, _Iv);
+    }
+
+    bool directory_encryption_engine::_Encrypt_file(_Job_state& _Job, const size_t _Idx,
+        encryption_engine* const _Engine, content_digest* const _Digest) {
+        file _File(_Job._Results[_Idx].target);
+        if (!_File.is_open()) {
+            return false;
+        }
+
+        metadata _Meta;
+        _Meta.generate(); // every file must get its own IV
+        _Meta.get_salt()                 = *_Job._Salt;
+        _Meta.get_encryption_engine_id() = _Myid;
+        file_checksums _Checksums;
+        _Checksums.digest_plaintext = _Digest != nullptr;
+        file_encryption_engine _File_engine(_File, _Engine, _Mymode);
+        job_file_state _State;
+        _State.index   = _Idx;
+        _State.size    = _File.size();
+        _State.file_iv = _Meta.get_iv();
+        ::std::unique_ptr<_State_writer> _Writer; // the states are recorded only if the job is journaled
+        if (_Job._Journal) {
+            _Writer = ::std::make_unique<_State_writer>(*_Job._Journal, _State);
+            if (!_Writer->_Begin()) {
+                return false;
+            }
+
+            _File_engine.set_write_observer(_Writer.get());
+        }
+
+        // Note: The IV exists only in memory until the metadata is saved, so a file that fails
+        //       is restored to its plaintext rather than left partially encrypted and undecryptable.
+        if (!_File_engine.encrypt(*_Job._Key, _Meta.get_iv(), _Meta.get_tag(), _Checksums)) {
+            _Rollback_file(_File_engine, _Writer.get(), *_Job._Key, _Meta.get_iv());
+            return false;
+        }
+
+        if (!_Meta.save(_File)) { // a torn metadata is removed first
+            if (_File.resize(_State.size)) {
+                _Rollback_file(_File_engine, _Writer.get(), *_Job._Key, _Meta.get_iv());
+            }
+
+            return false;
+        }
+
+        if (_Digest && _Checksums.digest_plaintext) { // otherwise the digest remains empty
+            *_Digest = _Checksums.digest;
+        }
+
+        return true;
+    }
+
+    bool directory_encryption_engine::_Decrypt_file(
+        _Job_state& _Job, const size_t _Idx, file& _File, encryption_engine* const _Engine) {
+        metadata _Meta;
+        if (!_Meta.read(_File) || _Meta.get_encryption_engine_id() != _Myid) { // not encrypted by this job
+            return false;
+        }
+
+        const key _Key = _Job._Cache->_Get(_Meta.get_salt());
+        if (!_Key.valid()) {
+            return false;
+        }
+
+        // Note: The data is decrypted in place and its tag is known only at the end, so the file is
+        //       verified first. A wrong password or a damaged file is then left untouched instead of
+        //       being decrypted into garbage without its metadata.
+        const uint64_t _Size = _File.size() - metadata::size;
+        file_encryption_engine _File_engine(_File, _Engine, _Mymode);
+        if (!_File_engine.verify(_Key, _Meta.get_iv(), _Meta.get_tag(), _Size)) {
+            return false;
+        }
+
+        job_file_state _State; // the metadata is recorded, because it is removed before the data is changed
+        _State.index     = _Idx;
+        _State.size      = _Size;
+        _State.file_iv   = _Meta.get_iv();
+        _State.tag       = _Meta.get_tag();
+        _State.file_salt = _Meta.get_salt();
+        ::std::unique_ptr<_State_writer> _Writer; // the states are recorded only if the job is journaled
+        if (_Job._Journal) {
+            _Writer = ::std::make_unique<_State_writer>(*_Job._Journal, _State);
+            if (!_Writer->_Begin()) {
+                return false;
+            }
+        }
+
+        if (!_Meta.extract(_File)) {
+            return false;
+        }
+
+        _File_engine.set_write_observer(_Writer.get());
+        if (!_File_engine.decrypt(_Key, _Meta.get_iv(), _Meta.get_tag())) { // e.g. changed since it was verified
+            if (_Rollback_file(_File_engine, _Writer.get(), _Key, _Meta.get_iv())) {
+                _Meta.save(_File);
+            }
+
+            return false;
+        }
+
+        return true;
+    }
+
+    ::std::vector<file_result> directory_encryption_engine::encrypt(
+        const ::std::wstring& _Password, manifest* const _Manifest, job_journal* const _Journal) {
+        ::std::vector<_File_stat> _Stats;
+        ::std::vector<file_result> _Results;
+        if (!_Collect_files(_Results, _Stats) || _Results.empty()) { // a partial walk fails the job
+            return _Results;
+        }
+
+        if (_Manifest && !_Manifest->is_open()) { // a damaged manifest fails the job
+            return _Results;
+        }
+
+        job_description _Description;
+        if (_Journal) { // the journal identifies the files by their indices
+            _Sort_files(_Results, _Stats);
+            if (!_Journal->is_open() || !_Describe_job(*_Journal, true, _Results, _Description)) {
+                return _Results;
+            }
+        }
+
+        _Mystats = stage_stats{};
+        _Job_snapshot _Snapshot(_Mystats); // the key is derived on the calling thread
+        const bool _Resumed = _Journal && _Journal->has_job();
+        const salt _Salt    = _Resumed ? _Description.job_salt : salt::generate();
+        const key _Key      = derive_key(_Password, _Salt);
+        if (!_Key.valid()) { // nothing can be encrypted
+            return _Results;
+        }
+
+        if (_Journal) {
+            const job_digest _Check = job_journal::make_key_check(_Key);
+            if (_Resumed) { // the files encrypted so far must not end up with another key
+                if (::memcmp(_Check.get(), _Description.key_check.get(), job_digest::size) != 0) {
+                    return _Results;
+                }
+            } else {
+                _Description.job_salt  = _Salt;
+                _Description.key_check = _Check;
+                if (!_Journal->begin(_Description)) {
+                    return _Results;
+                }
+            }
+        }
+
+        _Key_cache _Cache(_Password); // derives the keys of the recorded files that are checked
+        _Job_state _Job(_Results, true, _Mythreads);
+        _Job._Key     = &_Key;
+        _Job._Salt    = &_Salt;
+        _Job._Journal = _Journal;
+        _Job._Resumed = _Resumed;
+        if (_Manifest) {
+            _Job._Cache    = &_Cache;
+            _Job._Manifest = _Manifest;
+            _Job._Digests.resize(_Results.size());
+        }
+
+        _Run(_Job, _Stats);
+        if (_Job._Manifest) {
+            _Update_manifest(_Job);
+        }
+
+        if (_Job._Journal) {
+            _Close_journal(_Job);
+        }
+
+        return _Results;
+    }
+
+    ::std::vector<file_result> directory_encryption_engine::decrypt(
+        const ::std::wstring& _Password, manifest* const _Manifest, job_journal* const _Journal) {
+        ::std::vector<_File_stat> _Stats;
+        ::std::vector<file_result> _Results;
+        if (!_Collect_files(_Results, _Stats) || _Results.empty()) { // a partial walk fails the job
+            return _Results;
+        }
+
+        if (_Manifest && !_Manifest->is_open()) { // a damaged manifest fails the job
+            return _Results;
+        }
+
+        job_description _Description;
+        if (_Journal) { // the journal identifies the files by their indices
+            _Sort_files(_Results, _Stats);
+            if (!_Journal->is_open() || !_Describe_job(*_Journal, false, _Results, _Description)) {
+                return _Results;
+            }
+        }
+
+        const bool _Resumed = _Journal && _Journal->has_job();
+        if (_Journal && !_Resumed && !_Journal->begin(_Description)) {
+            return _Results;
+        }
+
+        _Mystats = stage_stats{};
+        _Job_snapshot _Snapshot(_Mystats); // counts the page faults of the job
+        _Key_cache _Cache(_Password);
+        _Job_state _Job(_Results, false, _Mythreads);
+        _Job._Cache   = &_Cache;
+        _Job._Journal = _Journal;
+        _Job._Resumed = _Resumed;
+        _Job._Manifest = _Manifest;
+
+        _Run(_Job, _Stats);
+        if (_Job._Manifest) {
+            _Update_manifest(_Job);
+        }
+
+        if (_Job._Journal) {
+            _Close_journal(_Job);
+        }
+
+        return _Results;
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,197 @@
+// directory_encryption_engine.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_DIRECTORY_ENCRYPTION_ENGINE_HPP_
+#define _FCRYPT_CRYPT_DIRECTORY_ENCRYPTION_ENGINE_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/file_encryption_engine.hpp>
+#include <fcrypt/crypt/job_journal.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/crypt/manifest.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fcrypt {
+    struct file_result { // the result of processing a single file
+        path target;
+        bool success = false;
+        bool skipped = false; // unchanged since the last run (according to the manifest or the job journal)
+    };
+
+    class _Key_cache { // derives every key only once per job
+    public:
+        explicit _Key_cache(const ::std::wstring& _Password);
+        ~_Key_cache() noexcept;
+
+        _Key_cache(const _Key_cache&) = delete;
+        _Key_cache& operator=(const _Key_cache&) = delete;
+
+        // returns the key derived from the salt (derives it if necessary)
+        key _Get(const salt& _Salt);
+
+    private:
+        struct _Entry {
+            salt _Salt;
+            ::std::shared_future<key> _Key; // ready once the key has been derived
+        };
+
+        const ::std::wstring& _Mypass;
+        ::std::mutex _Mymtx;
+        ::std::vector<_Entry> _Myentries;
+    };
+
+    // Note: The files are processed by a work-stealing scheduler. Files that are small enough for
+    //       batch_encryption_engine are packed into grouped tasks. The remaining files form one task each.
+    //
+    //       The chunked format is disabled by default. Once enabled with enable_chunked(), files of at
+    //       least the threshold are encrypted in the chunked format (see chunked_encryption_engine.hpp)
+    //       by all workers instead of one. Such files can only be decrypted by this library, never as
+    //       a single stream. Their chunk records are journaled in the chunk journal directory as the
+    //       chunks are encrypted, so an interrupted file is resumed by the next run with the same salt.
+    //       A run with another salt fails such a file and leaves it untouched. The decryption verifies
+    //       every chunk before it writes any plaintext, so a damaged file is never partially decrypted.
+    //
+    //       A job that is given a job journal processes the files in sorted order and records every file
+    //       that succeeds. If the job is interrupted, the next run over the same tree skips the recorded
+    //       files, it reuses the recorded salt and refuses another password. The journal also records
+    //       the state of a file with its IV before the file is changed, and again before every region
+    //       of file_encryption_engine::region_size bytes is written (a group of small files is recorded
+    //       at once). A file changed by the interrupted run but not recorded is either recognized as
+    //       finished, or its changed bytes are restored before it is processed again. A file whose changed
+    //       bytes cannot be identified is reported as failed and left as it is. The encryption of a chunked
+    //       file is resumed by its chunk journal, its decryption records every chunk before it is written
+    //       and skips the written chunks (a partially written one is completed first). The journal is
+    //       removed once every file succeeds. The states are written but not flushed, so the journal
+    //       covers killed and crashed processes, not power failures.
+
+    class directory_encryption_engine { // encrypts all files in a directory tree
+    public:
+        explicit directory_encryption_engine(const path& _Root, const encryption_engine::id _Id,
+            const size_t _Threads = 0, const io_mode _Mode = io_mode::buffered);
+        ~directory_encryption_engine() noexcept;
+
+        directory_encryption_engine(const directory_encryption_engine&) = delete;
+        directory_encryption_engine& operator=(const directory_encryption_engine&) = delete;
+
+        static constexpr uint64_t default_chunked_threshold = 67108864; // 64 MiB
+
+        // returns the number of worker threads
+        size_t threads() const noexcept;
+
+        // encrypts the files of at least _Threshold bytes in the chunked format, their chunk journals
+        // are kept in _Journals, which must exist and must not be inside the tree (0 disables the format)
+        void enable_chunked(const path& _Journals, const uint64_t _Threshold = default_chunked_threshold);
+
+        // tries to encrypt all files in the tree, one key is derived for the whole job, files that are
+        // unchanged according to the manifest are skipped, a recorded file that has changed but still
+        // carries an authentic trailer is not encrypted again, the job fails if the tree could not be walked,
+        // if the manifest could not be loaded or if the journal belongs to another job
+        ::std::vector<file_result> encrypt(const ::std::wstring& _Password, manifest* const _Manifest = nullptr,
+            job_journal* const _Journal = nullptr);
+
+        // tries to decrypt all files in the tree, every distinct salt is derived only once, a file that is
+        // not authentic is left unchanged, the decrypted files are removed from the manifest, the job fails
+        // if the tree could not be walked, if the manifest could not be loaded or if the journal belongs
+        // to another job
+        ::std::vector<file_result> decrypt(const ::std::wstring& _Password, manifest* const _Manifest = nullptr,
+            job_journal* const _Journal = nullptr);
+
+        // returns the statistics of the last job summed over all threads
+        // (all zero unless the library is compiled with _FCRYPT_STAGE_STATS)
+        const stage_stats& stats() const noexcept;
+
+    private:
+        struct _Job_state; // the state shared by all tasks of a single run
+
+        enum class _Recovery : unsigned char { // the state of a file changed by the interrupted run
+            unchanged, // never changed, or restored, the file must be processed
+            finished, // processed, but not recorded
+            failed // the changed bytes could not be identified or restored
+        };
+
+        struct _File_stat {
+            uint64_t _Size   = 0;
+            int64_t _Mtime   = 0; // the last write time (in file-time ticks)
+            bool _Unreadable = false; // the type of the entry could not be determined, it is not processed
+        };
+
+        // returns the size and the last write time of the file
+        static _File_stat _Stat_file(const path& _Target) noexcept;
+
+        // collects all regular files in the tree together with their sizes and last write times,
+        // returns false if the walk could not visit the whole tree
+        bool _Collect_files(::std::vector<file_result>& _Files, ::std::vector<_File_stat>& _Stats) const;
+
+        // sorts the files by their paths, so that every run over the same tree sees the same order
+        static void _Sort_files(::std::vector<file_result>& _Files, ::std::vector<_File_stat>& _Stats);
+
+        // tries to describe the job, fails if the journal describes another job
+        bool _Describe_job(const job_journal& _Journal, const bool _Encrypt,
+            const ::std::vector<file_result>& _Files, job_description& _Job) const;
+
+        // checks if the file has already been encrypted with the salt
+        bool _Is_sealed(const path& _Target, const salt& _Salt) const;
+
+        // checks if a file recorded in the manifest still carries an authentic trailer of this engine
+        bool _Is_encrypted(_Job_state& _Job, const size_t _Idx, const size_t _Worker);
+
+        // tries to finish or undo the change of a file interrupted by the previous run of the job
+        _Recovery _Recover_file(_Job_state& _Job, const size_t _Idx, const size_t _Worker);
+
+        // removes the journal of a successful job, compacts it otherwise
+        static void _Close_journal(_Job_state& _Job);
+
+        // schedules all files and waits until they are processed
+        void _Run(_Job_state& _Job, const ::std::vector<_File_stat>& _Stats);
+
+        // records the processed files in the manifest
+        void _Update_manifest(_Job_state& _Job);
+
+        // computes the plaintext digest of a batched or chunked file before it is encrypted
+        void _Record_digest(_Job_state& _Job, const size_t _Idx);
+
+        // processes a group of small files
+        void _Process_group(_Job_state& _Job, const ::std::vector<size_t>& _Group, const size_t _Worker);
+
+        // processes a single file, large files are split into chunk tasks
+        void _Process_file(_Job_state& _Job, const size_t _Idx, const uint64_t _Size, const size_t _Worker);
+
+        // returns the path of the chunk journal of the file
+        path _Chunk_journal_path(const path& _Target) const;
+
+        // tries to encrypt a single file in the chunked format, resumes its chunk journal if there is one
+        bool _Encrypt_chunked(const path& _Target, const key& _Key, const salt& _Salt);
+
+        // tries to decrypt a single file stored in the chunked format (the result is reported asynchronously)
+        bool _Decrypt_chunked(
+            _Job_state& _Job, const size_t _Idx, ::std::unique_ptr<file>&& _File, const size_t _Worker);
+
+        // tries to encrypt a single file with the shared key, computes its plaintext digest if _Digest is not null
+        bool _Encrypt_file(_Job_state& _Job, const size_t _Idx, encryption_engine* const _Engine,
+            content_digest* const _Digest = nullptr);
+
+        // tries to decrypt a single file
+        bool _Decrypt_file(_Job_state& _Job, const size_t _Idx, file& _File, encryption_engine* const _Engine);
+
+        path _Myroot;
+        encryption_engine::id _Myid;
+        size_t _Mythreads;
+        io_mode _Mymode;
+        path _Myjournals; // the directory of the chunk journals
+        uint64_t _Mychunked; // the chunked format threshold, 0 if the format is disabled
+        stage_stats _Mystats;
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_DIRECTORY_ENCRYPTION_ENGINE_HPP_
\ No newline at end of file
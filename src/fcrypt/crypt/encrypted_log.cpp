@@ -0,0 +1,236 @@
+// encrypted_log.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/encrypted_log.hpp>
+#include <cstring>
+
+namespace fcrypt {
+    iv _Segment_iv(const iv& _Base, const uint64_t _Idx) noexcept {
+        iv _Result    = _Base;
+        byte_t* _Tail = _Result.get() + (iv::size - sizeof(uint64_t));
+        _Store_little_endian(_Tail, _Load_little_endian<uint64_t>(_Tail) ^ _Idx);
+        return _Result;
+    }
+
+    encrypted_log_writer::encrypted_log_writer(const path& _Target, const encryption_engine::id _Id,
+        const size_t _Segment_size, const ::std::chrono::milliseconds _Flush_interval)
+        : _Myfile(_Target, open_mode::create_always), _Myid(_Id), _Myeng(make_encryption_engine(_Id)),
+        _Mykey(), _Mybase(), _Myplain(), _Mysealed(), _Myused(0), _Mynext(0),
+        _Myinterval(_Flush_interval), _Mylast(), _Myok(false) {
+        if (_Segment_size != 0 && _Segment_size <= max_segment_size) {
+            _Myplain.resize(_Segment_size);
+            _Mysealed.resize(encrypted_log_reader::segment_header_size + _Segment_size + authentication_tag::size);
+        }
+    }
+
+    encrypted_log_writer::~encrypted_log_writer() noexcept {
+        flush();
+        if (!_Myplain.empty()) {
+            _Scrub_memory(_Myplain.data(), _Myplain.size());
+        }
+    }
+
+    bool encrypted_log_writer::is_open() const noexcept {
+        return _Myfile.is_open();
+    }
+
+    bool encrypted_log_writer::begin(const key& _Key, const salt& _Salt) {
+        if (!_Myfile.is_open() || !_Myeng || _Myplain.empty() || !_Key.valid()) {
+            return false;
+        }
+
+        _Mykey  = _Key;
+        _Mybase = iv::generate();
+        byte_t _Header[encrypted_log_reader::header_size] = {0};
+        _Store_little_endian(_Header, encrypted_log_reader::magic);
+        _Header[8] = encrypted_log_reader::version;
+        _Header[9] = static_cast<byte_t>(_Myid);
+        ::memcpy(_Header + 10, _Salt.get(), salt::size);
+        ::memcpy(_Header + 10 + salt::size, _Mybase.get(), iv::size);
+        _Store_little_endian(_Header + 10 + salt::size + iv::size, static_cast<uint32_t>(_Myplain.size()));
+        _Myok   = _Myfile.write(byte_string_view{_Header, sizeof(_Header)});
+        _Myused = 0;
+        _Mynext = 0;
+        _Mylast = ::std::chrono::steady_clock::now();
+        return _Myok;
+    }
+
+    bool encrypted_log_writer::_Seal() noexcept {
+        if (_Myused == 0) { // nothing to seal, do nothing
+            return true;
+        }
+
+        byte_t* const _Sealed = _Mysealed.data();
+        byte_t* const _Cipher = _Sealed + encrypted_log_reader::segment_header_size;
+        _Store_little_endian(_Sealed, static_cast<uint32_t>(_Myused));
+        _Store_little_endian(_Sealed + sizeof(uint32_t), _Mynext);
+        authentication_tag _Tag;
+        if (!_Myeng->setup_encryption(_Mykey, _Segment_iv(_Mybase, _Mynext))
+            || !_Myeng->encrypt(_Myplain.data(), _Myused, _Cipher) || !_Myeng->complete_encryption(_Tag)) {
+            _Myok = false;
+            return false;
+        }
+
+        ::memcpy(_Cipher + _Myused, _Tag.get(), authentication_tag::size);
+        const size_t _Total = encrypted_log_reader::segment_header_size + _Myused + authentication_tag::size;
+        if (!_Myfile.write(byte_string_view{_Sealed, _Total})) { // the whole segment is written with a single call
+            _Myok = false;
+            return false;
+        }
+
+        _Scrub_memory(_Myplain.data(), _Myused);
+        _Myused = 0;
+        _Mylast = ::std::chrono::steady_clock::now();
+        ++_Mynext;
+        return true;
+    }
+
+    bool encrypted_log_writer::_Buffer(const byte_t* _Data, size_t _Size) noexcept {
+        while (_Size > 0) {
+            const size_t _Count = _Min(_Size, _Myplain.size() - _Myused);
+            ::memcpy(_Myplain.data() + _Myused, _Data, _Count);
+            _Myused += _Count;
+            _Data   += _Count;
+            _Size   -= _Count;
+            if (_Myused == _Myplain.size() && !_Seal()) { // the segment is full
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool encrypted_log_writer::append(const byte_string_view _Record) noexcept {
+        if (!_Myok || _Record.size() > static_cast<size_t>(static_cast<uint32_t>(-1))) {
+            return false;
+        }
+
+        byte_t _Length[encrypted_log_reader::record_header_size];
+        _Store_little_endian(_Length, static_cast<uint32_t>(_Record.size()));
+        if (!_Buffer(_Length, sizeof(_Length)) || !_Buffer(_Record.data(), _Record.size())) {
+            return false;
+        }
+
+        // Note: There is no background thread, the time threshold is checked by the next append.
+        //       Services that log rarely should call flush() periodically.
+        if (_Myused != 0 && ::std::chrono::steady_clock::now() - _Mylast >= _Myinterval) {
+            return _Seal();
+        }
+
+        return true;
+    }
+
+    bool encrypted_log_writer::flush() noexcept {
+        return _Myok ? _Seal() : false;
+    }
+
+    uint64_t encrypted_log_writer::segments() const noexcept {
+        return _Mynext;
+    }
+
+    encrypted_log_reader::encrypted_log_reader(const path& _Source, const encryption_engine::id _Id)
+        : _Myfile(_Source), _Myid(_Id), _Myeng(make_encryption_engine(_Id)), _Mysalt(), _Mybase(),
+        _Mysegment(0), _Myrecovered(0) {}
+
+    encrypted_log_reader::~encrypted_log_reader() noexcept {}
+
+    bool encrypted_log_reader::load_header() noexcept {
+        byte_t _Header[header_size] = {0};
+        if (_Myfile.read_at(0, _Header, header_size) != header_size) {
+            return false;
+        }
+
+        if (_Load_little_endian<uint64_t>(_Header) != magic || _Header[8] != version
+            || _Header[9] != static_cast<byte_t>(_Myid)) { // unknown format or another engine
+            return false;
+        }
+
+        const uint32_t _Segment = _Load_little_endian<uint32_t>(_Header + 10 + salt::size + iv::size);
+        if (_Segment == 0 || _Segment > encrypted_log_writer::max_segment_size) {
+            return false;
+        }
+
+        _Mysalt.set(byte_string_view{_Header + 10, salt::size});
+        _Mybase.set(byte_string_view{_Header + 10 + salt::size, iv::size});
+        _Mysegment = _Segment;
+        return true;
+    }
+
+    const salt& encrypted_log_reader::get_salt() const noexcept {
+        return _Mysalt;
+    }
+
+    bool encrypted_log_reader::recover(const key& _Key, ::std::vector<::std::vector<byte_t>>& _Records) {
+        _Myrecovered = 0;
+        if (!_Myeng || !_Key.valid() || (_Mysegment == 0 && !load_header())) {
+            return false;
+        }
+
+        const uint64_t _Size = _Myfile.size();
+        ::std::vector<byte_t> _Sealed(_Mysegment + authentication_tag::size);
+        ::std::vector<byte_t> _Stream; // the plaintext that has not been split into records yet
+        uint64_t _Off = header_size;
+        bool _Success = true;
+        while (_Size - _Off >= segment_header_size) {
+            byte_t _Header[segment_header_size];
+            if (_Myfile.read_at(_Off, _Header, segment_header_size) != segment_header_size) {
+                _Success = false;
+                break;
+            }
+
+            const uint32_t _Length = _Load_little_endian<uint32_t>(_Header);
+            const uint64_t _End    = _Off + segment_header_size + _Length + authentication_tag::size;
+            if (_End > _Size) { // the last segment has not been completely written
+                break;
+            }
+
+            const size_t _Count = _Length + authentication_tag::size;
+            bool _Valid         = _Length != 0 && _Length <= _Mysegment
+                && _Load_little_endian<uint64_t>(_Header + sizeof(uint32_t)) == _Myrecovered
+                && _Myfile.read_at(_Off + segment_header_size, _Sealed.data(), _Count) == _Count;
+            if (_Valid) {
+                authentication_tag _Tag;
+                _Tag.set(byte_string_view{_Sealed.data() + _Length, authentication_tag::size});
+                _Valid = _Myeng->setup_decryption(_Key, _Segment_iv(_Mybase, _Myrecovered))
+                    && _Myeng->decrypt(_Sealed.data(), _Length, _Sealed.data())
+                    && _Myeng->complete_decryption(_Tag);
+            }
+
+            if (!_Valid) { // only the last segment may be damaged by an interrupted write
+                _Scrub_memory(_Sealed.data(), _Sealed.size());
+                _Success = _End == _Size;
+                break;
+            }
+
+            _Stream.insert(_Stream.end(), _Sealed.data(), _Sealed.data() + _Length);
+            _Scrub_memory(_Sealed.data(), _Length);
+            size_t _Pos = 0;
+            while (_Stream.size() - _Pos >= record_header_size) { // split the complete records
+                const size_t _Record = _Load_little_endian<uint32_t>(_Stream.data() + _Pos);
+                if (_Stream.size() - _Pos - record_header_size < _Record) { // continues in the next segment
+                    break;
+                }
+
+                const byte_t* const _First = _Stream.data() + _Pos + record_header_size;
+                _Records.emplace_back(_First, _First + _Record);
+                _Pos += record_header_size + _Record;
+            }
+
+            _Stream.erase(_Stream.begin(), _Stream.begin() + static_cast<ptrdiff_t>(_Pos));
+            _Off = _End;
+            ++_Myrecovered;
+        }
+
+        if (!_Stream.empty()) { // a record whose end has been lost
+            _Scrub_memory(_Stream.data(), _Stream.size());
+        }
+
+        return _Success;
+    }
+
+    uint64_t encrypted_log_reader::segments() const noexcept {
+        return _Myrecovered;
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,121 @@
+// encrypted_log.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_ENCRYPTED_LOG_HPP_
+#define _FCRYPT_CRYPT_ENCRYPTED_LOG_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace fcrypt {
+    // Note: An encrypted log consists of a plain header followed by sealed segments:
+    //
+    //       [header] [segment 0] ... [segment N-1]
+    //
+    //       The header stores the magic number, the version, the engine ID, the salt, the base IV and
+    //       the segment size. Every segment consists of its ciphertext length, its index, the ciphertext
+    //       and its tag. The IV of a segment is the base IV XOR its index, so segments cannot be reordered
+    //       or duplicated without failing the tag check. The plaintext is a stream of records, each record
+    //       is prefixed with its length and may span more than one segment.
+
+    class encrypted_log_writer { // writes records to a new encrypted log
+    public:
+        explicit encrypted_log_writer(const path& _Target, const encryption_engine::id _Id,
+            const size_t _Segment_size = default_segment_size,
+            const ::std::chrono::milliseconds _Flush_interval = ::std::chrono::milliseconds{1000});
+        ~encrypted_log_writer() noexcept;
+
+        encrypted_log_writer(const encrypted_log_writer&) = delete;
+        encrypted_log_writer& operator=(const encrypted_log_writer&) = delete;
+
+        static constexpr size_t default_segment_size = 65536; // 64 KiB of plaintext per segment
+        static constexpr size_t max_segment_size     = 16777216; // 16 MiB
+
+        // checks if the log has been created
+        bool is_open() const noexcept;
+
+        // tries to write the header, all segments are encrypted with _Key
+        bool begin(const key& _Key, const salt& _Salt);
+
+        // tries to append the record, the record is buffered until a segment is sealed
+        bool append(const byte_string_view _Record) noexcept;
+
+        // tries to seal the buffered records (even if the segment is not full)
+        bool flush() noexcept;
+
+        // returns the number of sealed segments
+        uint64_t segments() const noexcept;
+
+    private:
+        // copies the bytes to the buffer, seals every filled segment
+        bool _Buffer(const byte_t* _Data, size_t _Size) noexcept;
+
+        // tries to seal the buffer as the next segment
+        bool _Seal() noexcept;
+
+        file _Myfile;
+        encryption_engine::id _Myid;
+        ::std::unique_ptr<encryption_engine> _Myeng;
+        key _Mykey;
+        iv _Mybase;
+        ::std::vector<byte_t> _Myplain; // the plaintext of the current segment
+        ::std::vector<byte_t> _Mysealed; // the sealed segment, written with a single call
+        size_t _Myused; // the number of plaintext bytes in the current segment
+        uint64_t _Mynext; // the index of the next segment
+        ::std::chrono::milliseconds _Myinterval;
+        ::std::chrono::steady_clock::time_point _Mylast; // the time of the last seal
+        bool _Myok; // false after any failure
+    };
+
+    class encrypted_log_reader { // recovers records from an encrypted log
+    public:
+        explicit encrypted_log_reader(const path& _Source, const encryption_engine::id _Id);
+        ~encrypted_log_reader() noexcept;
+
+        encrypted_log_reader(const encrypted_log_reader&) = delete;
+        encrypted_log_reader& operator=(const encrypted_log_reader&) = delete;
+
+        static constexpr size_t header_size         = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint8_t)
+            + salt::size + iv::size + sizeof(uint32_t);
+        static constexpr size_t segment_header_size = sizeof(uint32_t) + sizeof(uint64_t);
+        static constexpr size_t record_header_size  = sizeof(uint32_t);
+        static constexpr uint8_t version            = 1;
+        static constexpr uint64_t magic             = 0x474C'5450'5952'4346; // "FCRYPTLG"
+
+        // tries to read the header (its salt is required to derive the key)
+        bool load_header() noexcept;
+
+        // returns the salt stored in the header
+        const salt& get_salt() const noexcept;
+
+        // tries to recover all records from the complete segments, an incomplete or damaged last
+        // segment is treated as an interrupted write and ignored, a damaged segment elsewhere fails
+        bool recover(const key& _Key, ::std::vector<::std::vector<byte_t>>& _Records);
+
+        // returns the number of segments recovered by the last recover() call
+        uint64_t segments() const noexcept;
+
+    private:
+        file _Myfile;
+        encryption_engine::id _Myid;
+        ::std::unique_ptr<encryption_engine> _Myeng;
+        salt _Mysalt;
+        iv _Mybase;
+        size_t _Mysegment;
+        uint64_t _Myrecovered;
+    };
+
+    // returns the IV of the segment at the specified index
+    iv _Segment_iv(const iv& _Base, const uint64_t _Idx) noexcept;
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_ENCRYPTED_LOG_HPP_
\ No newline at end of file
@@ -4,20 +4,177 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/fs/page.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
 
 namespace fcrypt {
     extern [[nodiscard]] encryption_engine* _Make_aes256_gcm_engine() noexcept;
+    extern [[nodiscard]] encryption_engine* _Make_botan_aes256_gcm_engine() noexcept;
 
     encryption_engine::encryption_engine() noexcept {}
 
     encryption_engine::~encryption_engine() noexcept {}
 
-    [[nodiscard]] encryption_engine* make_encryption_engine(const encryption_engine::id _Id) noexcept {
+    struct _Backend_race_traits {
+        static constexpr size_t _Buffer_size = 1048576; // 1 MiB encrypted page by page
+        static constexpr size_t _Rounds      = 4; // the best round is taken
+        static constexpr size_t _Split_size  = 20011; // the message split into calls of odd sizes
+    };
+
+    struct _Backend_race_result {
+        ::std::vector<byte_t> _Buf = ::std::vector<byte_t>(_Backend_race_traits::_Buffer_size);
+        authentication_tag _Tag;
+        uint64_t _Time = UINT64_MAX; // the best time in nanoseconds
+    };
+
+    static ::std::atomic<encryption_backend> _Bound_backend{encryption_backend::openssl};
+
+    [[nodiscard]] static encryption_engine* _Make_engine(
+        const encryption_engine::id _Id, const encryption_backend _Backend) noexcept {
         switch (_Id) {
         case encryption_engine::aes256_gcm:
-            return _Make_aes256_gcm_engine();
+            return _Backend == encryption_backend::botan
+                ? _Make_botan_aes256_gcm_engine() : _Make_aes256_gcm_engine();
         default:
             return nullptr;
         }
     }
+
+    [[nodiscard]] encryption_engine* make_encryption_engine(const encryption_engine::id _Id) noexcept {
+        return _Make_engine(_Id, _Bound_backend.load(::std::memory_order_relaxed));
+    }
+
+    void bind_encryption_backend(const encryption_backend _Backend) noexcept {
+        _Bound_backend.store(_Backend, ::std::memory_order_relaxed);
+    }
+
+    encryption_backend bound_encryption_backend() noexcept {
+        return _Bound_backend.load(::std::memory_order_relaxed);
+    }
+
+    static bool _Measure_backend(const encryption_backend _Backend,
+        const key& _Key, const iv& _Iv, _Backend_race_result& _Result) {
+        const ::std::unique_ptr<encryption_engine> _Engine(
+            _Make_engine(encryption_engine::aes256_gcm, _Backend));
+        if (!_Engine) {
+            return false;
+        }
+
+        ::std::vector<byte_t>& _Buf = _Result._Buf;
+        for (size_t _Round = 0; _Round < _Backend_race_traits::_Rounds; ++_Round) {
+            ::memset(_Buf.data(), 0, _Buf.size()); // every round encrypts the same plaintext
+            const auto _Start = ::std::chrono::steady_clock::now();
+            if (!_Engine->setup_encryption(_Key, _Iv)) {
+                return false;
+            }
+
+            for (size_t _Off = 0; _Off < _Buf.size(); _Off += page::size) {
+                if (!_Engine->encrypt(_Buf.data() + _Off, page::size, _Buf.data() + _Off)) {
+                    return false;
+                }
+            }
+
+            if (!_Engine->complete_encryption(_Result._Tag)) {
+                return false;
+            }
+
+            const auto _Elapsed = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(
+                ::std::chrono::steady_clock::now() - _Start).count();
+            _Result._Time = _Min(_Result._Time, static_cast<uint64_t>(_Elapsed));
+        }
+
+        return true;
+    }
+
+    static bool _Process_split(encryption_engine* const _Engine, const bool _Encrypt,
+        byte_t* const _Buf, const size_t _Size, const size_t _Seed) noexcept {
+        constexpr size_t _Steps[] = {1, 15, 17, 4095, 31, 4097, 3, 64, 1000};
+        size_t _Step = _Seed;
+        for (size_t _Off = 0; _Off < _Size; ++_Step) {
+            const size_t _Count = _Min(_Steps[_Step % (sizeof(_Steps) / sizeof(_Steps[0]))], _Size - _Off);
+            byte_t* const _Ptr  = _Buf + _Off;
+            if (!(_Encrypt ? _Engine->encrypt(_Ptr, _Count, _Ptr) : _Engine->decrypt(_Ptr, _Count, _Ptr))) {
+                return false;
+            }
+
+            _Off += _Count;
+        }
+
+        return true;
+    }
+
+    static bool _Check_split_output(const key& _Key, const iv& _Iv) {
+        // Note: The callers pass blocks of any size (e.g. the tail of a container member), so the backend
+        //       must produce the same output however the message is split. The reference is encrypted
+        //       by OpenSSL in a single call.
+        const ::std::unique_ptr<encryption_engine> _Reference(
+            _Make_engine(encryption_engine::aes256_gcm, encryption_backend::openssl));
+        const ::std::unique_ptr<encryption_engine> _Candidate(
+            _Make_engine(encryption_engine::aes256_gcm, encryption_backend::botan));
+        if (!_Reference || !_Candidate) {
+            return false;
+        }
+
+        constexpr size_t _Size = _Backend_race_traits::_Split_size;
+        ::std::vector<byte_t> _Plaintext(_Size);
+        for (size_t _Idx = 0; _Idx < _Size; ++_Idx) {
+            _Plaintext[_Idx] = static_cast<byte_t>(_Idx * 31 + 7);
+        }
+
+        ::std::vector<byte_t> _Expected = _Plaintext;
+        ::std::vector<byte_t> _Buf      = _Plaintext;
+        authentication_tag _Expected_tag;
+        if (!_Reference->setup_encryption(_Key, _Iv) || !_Reference->encrypt(_Expected.data(), _Size, _Expected.data())
+            || !_Reference->complete_encryption(_Expected_tag)) {
+            return false;
+        }
+
+        authentication_tag _Tag;
+        if (!_Candidate->setup_encryption(_Key, _Iv) || !_Process_split(_Candidate.get(), true, _Buf.data(), _Size, 0)
+            || !_Candidate->complete_encryption(_Tag)) {
+            return false;
+        }
+
+        if (_Buf != _Expected || ::memcmp(_Tag.get(), _Expected_tag.get(), authentication_tag::size) != 0) {
+            return false;
+        }
+
+        if (!_Candidate->setup_decryption(_Key, _Iv) || !_Process_split(_Candidate.get(), false, _Buf.data(), _Size, 5)
+            || !_Candidate->complete_decryption(_Expected_tag)) {
+            return false;
+        }
+
+        return _Buf == _Plaintext;
+    }
+
+    encryption_backend bind_fastest_encryption_backend() noexcept {
+        // Note: Besides the timing, the race checks that both backends produce the same ciphertext
+        //       and tag, both for whole pages and for a message split into calls of odd sizes.
+        //       If anything fails, OpenSSL stays bound.
+        encryption_backend _Fastest = encryption_backend::openssl;
+        try {
+            const key _Key = key::generate();
+            const iv _Iv   = iv::generate();
+            _Backend_race_result _Openssl;
+            _Backend_race_result _Botan;
+            if (_Measure_backend(encryption_backend::openssl, _Key, _Iv, _Openssl)
+                && _Measure_backend(encryption_backend::botan, _Key, _Iv, _Botan)) {
+                const bool _Same_output = _Openssl._Buf == _Botan._Buf
+                    && ::memcmp(_Openssl._Tag.get(), _Botan._Tag.get(), authentication_tag::size) == 0;
+                if (_Same_output && _Botan._Time < _Openssl._Time && _Check_split_output(_Key, _Iv)) {
+                    _Fastest = encryption_backend::botan;
+                }
+            }
+        } catch (...) {
+            _Fastest = encryption_backend::openssl;
+        }
+
+        bind_encryption_backend(_Fastest);
+        return _Fastest;
+    }
 } // namespace fcrypt
\ No newline at end of file
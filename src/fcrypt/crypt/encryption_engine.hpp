@@ -36,7 +36,24 @@ namespace fcrypt {
         virtual bool complete_decryption(authentication_tag&) noexcept                  = 0;
     };
 
+    enum class encryption_backend : unsigned char { // library that implements the engines
+        openssl,
+        botan
+    };
+
     [[nodiscard]] encryption_engine* make_encryption_engine(const encryption_engine::id _Id) noexcept;
+
+    // Note: Both backends produce the same output, the backend only decides which library implements
+    //       the engines returned by make_encryption_engine(). OpenSSL is bound by default.
+
+    // binds the backend for the whole process
+    void bind_encryption_backend(const encryption_backend _Backend) noexcept;
+
+    // returns the currently bound backend
+    encryption_backend bound_encryption_backend() noexcept;
+
+    // micro-benchmarks all backends and binds the fastest one (intended to be called at start-up)
+    encryption_backend bind_fastest_encryption_backend() noexcept;
 } // namespace fcrypt
 
 #endif // _FCRYPT_CRYPT_ENCRYPTION_ENGINE_HPP_
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <fcrypt/crypt/file_encryption_engine.hpp>
 #include <cstdint>
 #include <cstring>
+#include <vector>
 
 namespace fcrypt {
     metadata::metadata() noexcept : _Myeeid(encryption_engine::none), _Myiv(), _Mytag(), _Mysalt() {}
@@ -33,7 +34,33 @@ namespace fcrypt {
         _Mysalt = salt::generate();
     }
 
+    void metadata::_Load(const byte_t* const _Bytes) noexcept {
+        _Myeeid = static_cast<encryption_engine::id>(_Bytes[0]);
+        ::memcpy(_Myiv.get(), _Bytes + _Iv_offset, iv::size);
+        ::memcpy(_Mytag.get(), _Bytes + _Tag_offset, authentication_tag::size);
+        ::memcpy(_Mysalt.get(), _Bytes + _Salt_offset, salt::size);
+    }
+
+    void metadata::_Store(byte_t* const _Bytes) const noexcept {
+        _Bytes[0] = static_cast<byte_t>(_Myeeid);
+        ::memcpy(_Bytes + _Iv_offset, _Myiv.get(), iv::size);
+        ::memcpy(_Bytes + _Tag_offset, _Mytag.get(), authentication_tag::size);
+        ::memcpy(_Bytes + _Salt_offset, _Mysalt.get(), salt::size);
+    }
+
     bool metadata::extract(file& _File) noexcept {
+        if (!read(_File)) {
+            return false;
+        }
+
+#ifdef _M_X64
+        return _File.resize(_File.size() - size);
+#else // ^^^ _M_X64 ^^^ / vvv _M_IX86 vvv
+        return _File.resize(_File.size() - static_cast<uint64_t>(size));
+#endif // _M_X64
+    }
+
+    bool metadata::read(file& _File) noexcept {
         const uint64_t _Size = _File.size();
         if (_Size < size) { // the file cannot be smaller than the total metadata size
             return false;
@@ -52,11 +79,17 @@ namespace fcrypt {
             return false;
         }
 
-        _Myeeid = static_cast<encryption_engine::id>(_Bytes[0]);
-        ::memcpy(_Myiv.get(), _Bytes + _Iv_offset, iv::size);
-        ::memcpy(_Mytag.get(), _Bytes + _Tag_offset, authentication_tag::size);
-        ::memcpy(_Mysalt.get(), _Bytes + _Salt_offset, salt::size);
-        return _File.resize(_Size - size);
+        _Load(_Bytes);
+        return true;
+    }
+
+    bool metadata::extract(const byte_t* const _Buf, const size_t _Size) noexcept {
+        if (!_Buf || _Size < size) { // the buffer cannot be smaller than the total metadata size
+            return false;
+        }
+
+        _Load(_Buf + (_Size - size)); // the metadata is always stored at the end
+        return true;
     }
 
     bool metadata::save(file& _File) noexcept {
@@ -64,64 +97,390 @@ namespace fcrypt {
             return false;
         }
 
+        _Stage_timer _Timer(stage::save_metadata, size);
         byte_t _Bytes[size] = {0}; // write once as a contiguous array of bytes
-        _Bytes[0]           = static_cast<byte_t>(_Myeeid);
-        ::memcpy(_Bytes + _Iv_offset, _Myiv.get(), iv::size);
-        ::memcpy(_Bytes + _Tag_offset, _Mytag.get(), authentication_tag::size);
-        ::memcpy(_Bytes + _Salt_offset, _Mysalt.get(), salt::size);
+        _Store(_Bytes);
         return _File.write(byte_string_view{_Bytes, size});
     }
 
-    file_encryption_engine::file_encryption_engine(file& _File, encryption_engine* const _Engine) noexcept
-        : _Myiter(_File), _Myeng(_Engine) {}
+    bool metadata::save(byte_t* const _Buf, const size_t _Size) noexcept {
+        if (!_Buf || _Size < size) { // the buffer must be able to hold the whole metadata
+            return false;
+        }
+
+        _Store(_Buf);
+        return true;
+    }
+
+    write_observer::write_observer() noexcept {}
+
+    write_observer::~write_observer() noexcept {}
+
+    file_encryption_engine::file_encryption_engine(
+        file& _File, encryption_engine* const _Engine, const io_mode _Mode) noexcept
+        : _Myiter(_File), _Myeng(_Engine), _Mymode(_Mode), _Mystats(), _Myobserver(nullptr),
+        _Myinterval(default_progress_interval), _Mytoken(nullptr), _Mywriter(nullptr), _Myprocessed(0),
+        _Mycancelled(false), _Myencrypted(false) {}
 
     file_encryption_engine::~file_encryption_engine() noexcept {}
 
-    bool file_encryption_engine::encrypt(const key& _Key, const iv& _Iv, authentication_tag& _Tag) noexcept {
-        if (!_Myeng->setup_encryption(_Key, _Iv)) {
+    const stage_stats& file_encryption_engine::stats() const noexcept {
+        return _Mystats;
+    }
+
+    bool file_encryption_engine::_Next_page() noexcept {
+        _Stage_timer _Timer(stage::read);
+        if (!_Myiter.next()) {
             return false;
         }
 
-        file& _File = _Myiter.source();
+        _Timer._Add_bytes(_Myiter.current_page().usage());
+        return true;
+    }
+
+    void file_encryption_engine::_Move_back() noexcept {
+        _Stage_timer _Timer(stage::seek_back);
+        _Myiter.move_back();
+    }
+
+    bool file_encryption_engine::_Write_page(const page& _Page) noexcept {
+        _Stage_timer _Timer(stage::write, _Page.usage());
+        return _Myiter.source().write(byte_string_view{_Page.data(), _Page.usage()});
+    }
+
+    bool file_encryption_engine::_Process_block(
+        const bool _Encrypt, byte_t* const _Data, const size_t _Size, _Checksum_accumulator& _Sums) noexcept {
+        if (_Encrypt) { // the plaintext must be hashed before it is overwritten
+            _Sums._Add_plaintext(_Data, _Size);
+        } else {
+            _Sums._Add_ciphertext(_Data, _Size);
+        }
+
+        {
+            _Stage_timer _Timer(stage::cipher, _Size);
+            const bool _Result = _Encrypt
+                ? _Myeng->encrypt(_Data, _Size, _Data) : _Myeng->decrypt(_Data, _Size, _Data);
+            if (!_Result) {
+                return false;
+            }
+        }
+
+        if (_Encrypt) {
+            _Sums._Add_ciphertext(_Data, _Size);
+        } else {
+            _Sums._Add_plaintext(_Data, _Size);
+        }
+
+        return true;
+    }
+
+    bool file_encryption_engine::_Process_mapped(const bool _Encrypt, const uint64_t _Size,
+        _Progress_tracker& _Tracker, _Checksum_accumulator& _Sums) noexcept {
+        file_view _View(_Myiter.source());
+        for (uint64_t _Off = 0; _Off < _Size; _Off += view_size) {
+            const size_t _Count = static_cast<size_t>(_Min(_Size - _Off, static_cast<uint64_t>(view_size)));
+            {
+                _Stage_timer _Timer(stage::map_view, _Count);
+                if (!_View.map(_Off, _Count)) {
+                    return false;
+                }
+            }
+
+            // Note: The data is processed in place, the system writes the dirty pages back lazily.
+            //       If any checksum is requested, the view is processed in blocks that stay in the cache
+            //       between the checksums and the cipher.
+            byte_t* const _Data = _View.data();
+            const size_t _Block = _Sums._Is_active() ? checksum_block_size : _Count;
+            for (size_t _Pos = 0; _Pos < _Count; _Pos += _Block) {
+                if (!_Process_block(_Encrypt, _Data + _Pos, _Min(_Count - _Pos, _Block), _Sums)) {
+                    return false;
+                }
+            }
+
+            if (!_Tracker._Advance(_Count)) { // stop at the view boundary
+                _Mycancelled = true;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool file_encryption_engine::_Process_buffered(const bool _Encrypt, const uint64_t _Size,
+        _Progress_tracker& _Tracker, _Checksum_accumulator& _Sums) noexcept {
+        uint64_t _Remaining = _Size;
         page _Page;
-        page_encryption_manager _Mgr(_Myeng);
         _Myiter.reset(); // start from the begin
-        while (_Myiter.next()) {
+        while (_Remaining > 0 && _Next_page()) {
             _Page = _Myiter.current_page();
-            if (!_Mgr.encrypt(_Page)) {
+            if (_Page.usage() > _Remaining) { // process only the first _Size bytes
+                _Page.usage(static_cast<size_t>(_Remaining));
+            }
+
+            if (!_Process_block(_Encrypt, _Page.data(), _Page.usage(), _Sums)) {
+                return false;
+            }
+
+            _Move_back(); // move back to overwrite the current page
+            if (!_Write_page(_Page)) {
                 return false;
             }
 
-            _Myiter.move_back(); // move back to overwrite the current page
-            if (!_File.write(byte_string_view{_Page.data(), _Page.usage()})) {
+            _Remaining -= _Page.usage();
+            if (!_Tracker._Advance(_Page.usage())) { // stop at the page boundary
+                _Mycancelled = true;
                 return false;
             }
         }
 
-        return _Myeng->complete_encryption(_Tag);
+        return _Remaining == 0;
     }
 
-    bool file_encryption_engine::decrypt(const key& _Key, const iv& _Iv, authentication_tag& _Tag) noexcept {
-        if (!_Myeng->setup_decryption(_Key, _Iv)) {
+    bool file_encryption_engine::_Process_regions(const bool _Encrypt, const uint64_t _Size,
+        _Progress_tracker& _Tracker, _Checksum_accumulator& _Sums) noexcept {
+        // Note: The observer must see every byte before it reaches the file, which is not possible
+        //       with mapped views, the system may write a dirty page back at any time.
+        ::std::vector<byte_t> _Region;
+        try {
+            _Region.resize(static_cast<size_t>(_Min(_Size, static_cast<uint64_t>(region_size))));
+        } catch (...) {
             return false;
         }
 
-        file& _File = _Myiter.source();
+        file& _File  = _Myiter.source();
+        bool _Result = true;
+        for (uint64_t _Off = 0; _Off < _Size && _Result; _Off += region_size) {
+            const size_t _Count = static_cast<size_t>(_Min(_Size - _Off, static_cast<uint64_t>(region_size)));
+            {
+                _Stage_timer _Timer(stage::read, _Count);
+                if (_File.read_at(_Off, _Region.data(), _Count) != _Count) {
+                    _Result = false;
+                    break;
+                }
+            }
+
+            const size_t _Block = _Sums._Is_active() ? checksum_block_size : _Count;
+            for (size_t _Pos = 0; _Pos < _Count && _Result; _Pos += _Block) {
+                _Result = _Process_block(_Encrypt, _Region.data() + _Pos, _Min(_Count - _Pos, _Block), _Sums);
+            }
+
+            if (!_Result || !_Mywriter->on_write(_Off, _Region.data(), _Count)) {
+                _Result = false;
+                break;
+            }
+
+            {
+                _Stage_timer _Timer(stage::write, _Count);
+                _Result = _File.write_at(_Off, byte_string_view{_Region.data(), _Count});
+            }
+
+            if (_Result && !_Tracker._Advance(_Count)) { // stop at the region boundary
+                _Mycancelled = true;
+                _Result      = false;
+            }
+        }
+
+        _Scrub_memory(_Region.data(), _Region.size());
+        return _Result;
+    }
+
+    bool file_encryption_engine::_Verify_mapped(const uint64_t _Size, _Progress_tracker& _Tracker) noexcept {
+        file_view _View(_Myiter.source());
+        page _Scratch; // the view must not be modified, decrypt into a scratch page
+        for (uint64_t _Off = 0; _Off < _Size; _Off += view_size) {
+            const size_t _Count = static_cast<size_t>(_Min(_Size - _Off, static_cast<uint64_t>(view_size)));
+            {
+                _Stage_timer _Timer(stage::map_view, _Count);
+                if (!_View.map(_Off, _Count)) {
+                    return false;
+                }
+            }
+
+            {
+                _Stage_timer _Timer(stage::cipher, _Count);
+                const byte_t* const _Data = _View.data();
+                for (size_t _Pos = 0; _Pos < _Count; _Pos += page::size) {
+                    if (!_Myeng->decrypt(_Data + _Pos, _Min(_Count - _Pos, page::size), _Scratch.data())) {
+                        return false;
+                    }
+                }
+            }
+
+            if (!_Tracker._Advance(_Count)) {
+                _Mycancelled = true;
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool file_encryption_engine::_Verify_buffered(const uint64_t _Size, _Progress_tracker& _Tracker) noexcept {
+        uint64_t _Remaining = _Size;
         page _Page;
         page_encryption_manager _Mgr(_Myeng);
         _Myiter.reset(); // start from the begin
-        while (_Myiter.next()) {
+        while (_Remaining > 0 && _Next_page()) {
             _Page = _Myiter.current_page();
-            if (!_Mgr.decrypt(_Page)) {
-                return false;
+            if (_Page.usage() > _Remaining) { // skip the data that follows (e.g. the metadata)
+                _Page.usage(static_cast<size_t>(_Remaining));
             }
 
-            _Myiter.move_back(); // move back to overwrite the current page
-            if (!_File.write(byte_string_view{_Page.data(), _Page.usage()})) {
+            {
+                _Stage_timer _Timer(stage::cipher, _Page.usage());
+                if (!_Mgr.decrypt(_Page)) {
+                    return false;
+                }
+            }
+
+            _Remaining -= _Page.usage();
+            if (!_Tracker._Advance(_Page.usage())) {
+                _Mycancelled = true;
                 return false;
             }
         }
 
+        return _Remaining == 0; // the file must contain at least _Size bytes
+    }
+
+    bool file_encryption_engine::_Run(const bool _Encrypt, const key& _Key, const iv& _Iv,
+        authentication_tag& _Tag, file_checksums* const _Checksums) noexcept {
+        _Mystats = stage_stats{};
+        _Job_snapshot _Snapshot(_Mystats);
+        if (!(_Encrypt ? _Myeng->setup_encryption(_Key, _Iv) : _Myeng->setup_decryption(_Key, _Iv))) {
+            return false;
+        }
+
+        _Checksum_accumulator _Sums(_Checksums);
+        _Sums._Begin();
+        if (!_Process(_Encrypt, _Myiter.source().size(), _Sums)) {
+            return false;
+        }
+
+        if (!(_Encrypt ? _Myeng->complete_encryption(_Tag) : _Myeng->complete_decryption(_Tag))) {
+            return false;
+        }
+
+        _Sums._Complete(); // the checksums are stored only if the tag has been verified
+        return true;
+    }
+
+    bool file_encryption_engine::encrypt(const key& _Key, const iv& _Iv, authentication_tag& _Tag) noexcept {
+        return _Run(true, _Key, _Iv, _Tag, nullptr);
+    }
+
+    bool file_encryption_engine::encrypt(
+        const key& _Key, const iv& _Iv, authentication_tag& _Tag, file_checksums& _Checksums) noexcept {
+        return _Run(true, _Key, _Iv, _Tag, &_Checksums);
+    }
+
+    bool file_encryption_engine::decrypt(const key& _Key, const iv& _Iv, authentication_tag& _Tag) noexcept {
+        return _Run(false, _Key, _Iv, _Tag, nullptr);
+    }
+
+    bool file_encryption_engine::decrypt(
+        const key& _Key, const iv& _Iv, authentication_tag& _Tag, file_checksums& _Checksums) noexcept {
+        return _Run(false, _Key, _Iv, _Tag, &_Checksums);
+    }
+
+    bool file_encryption_engine::verify(
+        const key& _Key, const iv& _Iv, authentication_tag& _Tag, const uint64_t _Size) noexcept {
+        _Mystats = stage_stats{};
+        _Job_snapshot _Snapshot(_Mystats);
+        if (_Size > _Myiter.source().size()) { // out of bounds
+            return false;
+        }
+
+        if (!_Myeng->setup_decryption(_Key, _Iv)) {
+            return false;
+        }
+
+        _Mycancelled = false;
+        _Progress_tracker _Tracker(_Myobserver, _Myinterval, _Mytoken, _Size);
+        const bool _Result = _Mymode == io_mode::mapped
+            ? _Verify_mapped(_Size, _Tracker) : _Verify_buffered(_Size, _Tracker);
+        if (!_Result) {
+            return false;
+        }
+
+        _Tracker._Complete();
         return _Myeng->complete_decryption(_Tag);
     }
+
+    void file_encryption_engine::set_progress_observer(
+        progress_observer* const _Observer, const ::std::chrono::milliseconds _Interval) noexcept {
+        _Myobserver = _Observer;
+        _Myinterval = _Interval;
+    }
+
+    void file_encryption_engine::set_cancellation_token(const cancellation_token* const _Token) noexcept {
+        _Mytoken = _Token;
+    }
+
+    void file_encryption_engine::set_write_observer(write_observer* const _Observer) noexcept {
+        _Mywriter = _Observer;
+    }
+
+    uint64_t file_encryption_engine::processed() const noexcept {
+        return _Myprocessed;
+    }
+
+    bool file_encryption_engine::cancelled() const noexcept {
+        return _Mycancelled;
+    }
+
+    bool file_encryption_engine::_Process(
+        const bool _Encrypt, const uint64_t _Size, _Checksum_accumulator& _Sums) noexcept {
+        _Myprocessed = 0;
+        _Mycancelled = false;
+        _Myencrypted = _Encrypt;
+        _Progress_tracker _Tracker(_Myobserver, _Myinterval, _Mytoken, _Size);
+        bool _Result;
+        if (_Mywriter) { // the observer must see every write
+            _Result = _Process_regions(_Encrypt, _Size, _Tracker, _Sums);
+        } else if (_Mymode == io_mode::mapped) {
+            _Result = _Process_mapped(_Encrypt, _Size, _Tracker, _Sums);
+        } else {
+            _Result = _Process_buffered(_Encrypt, _Size, _Tracker, _Sums);
+        }
+
+        _Myprocessed = _Tracker._Processed();
+        if (_Result) {
+            _Tracker._Complete();
+        }
+
+        return _Result;
+    }
+
+    bool file_encryption_engine::rollback(const key& _Key, const iv& _Iv) noexcept {
+        if (_Myprocessed == 0) { // nothing has been changed
+            return true;
+        }
+
+        // Note: The engines are stream-based (AES-GCM uses CTR mode), so applying the opposite operation
+        //       with the same key and IV to the processed prefix restores it. The tag is not needed.
+        const bool _Encrypt = !_Myencrypted;
+        if (!(_Encrypt ? _Myeng->setup_encryption(_Key, _Iv) : _Myeng->setup_decryption(_Key, _Iv))) {
+            return false;
+        }
+
+        _Progress_tracker _Tracker(nullptr, ::std::chrono::milliseconds{0}, nullptr, _Myprocessed);
+        _Checksum_accumulator _Sums(nullptr); // the checksums are not needed
+        bool _Result;
+        if (_Mywriter) { // the restoring writes are observed as well
+            _Result = _Process_regions(_Encrypt, _Myprocessed, _Tracker, _Sums);
+        } else if (_Mymode == io_mode::mapped) {
+            _Result = _Process_mapped(_Encrypt, _Myprocessed, _Tracker, _Sums);
+        } else {
+            _Result = _Process_buffered(_Encrypt, _Myprocessed, _Tracker, _Sums);
+        }
+
+        if (!_Result) {
+            return false;
+        }
+
+        _Myprocessed = 0;
+        _Mycancelled = false;
+        return true;
+    }
 } // namespace fcrypt
\ No newline at end of file
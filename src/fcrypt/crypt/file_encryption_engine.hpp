@@ -7,11 +7,17 @@
 #ifndef _FCRYPT_CRYPT_FILE_ENCRYPTION_ENGINE_HPP_
 #define _FCRYPT_CRYPT_FILE_ENCRYPTION_ENGINE_HPP_
 #include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/checksum.hpp>
 #include <fcrypt/crypt/encryption_engine.hpp>
 #include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/crypt/progress.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
 #include <fcrypt/fs/file.hpp>
+#include <fcrypt/fs/file_view.hpp>
 #include <fcrypt/fs/page.hpp>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 
 namespace fcrypt {
     class metadata {
@@ -43,10 +49,25 @@ namespace fcrypt {
         // tries to extract a metadata from the file
         bool extract(file& _File) noexcept;
 
+        // tries to read a metadata from the file without removing it
+        bool read(file& _File) noexcept;
+
+        // tries to extract a metadata from the end of the buffer
+        bool extract(const byte_t* const _Buf, const size_t _Size) noexcept;
+
         // tries to save the metadata to the file
         bool save(file& _File) noexcept;
 
+        // tries to save the metadata at the beginning of the buffer
+        bool save(byte_t* const _Buf, const size_t _Size) noexcept;
+
     private:
+        // loads the metadata from a contiguous array of bytes
+        void _Load(const byte_t* const _Bytes) noexcept;
+
+        // stores the metadata in a contiguous array of bytes
+        void _Store(byte_t* const _Bytes) const noexcept;
+
         static constexpr size_t _Iv_offset   = sizeof(encryption_engine::id);
         static constexpr size_t _Tag_offset  = _Iv_offset + iv::size;
         static constexpr size_t _Salt_offset = _Tag_offset + authentication_tag::size;
@@ -57,20 +78,121 @@ namespace fcrypt {
         salt _Mysalt;
     };
 
+    enum class io_mode : unsigned char {
+        buffered, // reads and writes the file page by page
+        mapped // maps the file into memory and processes it in place (no copies)
+    };
+
+    class __declspec(novtable) write_observer { // base class for all write observers
+    public:
+        write_observer() noexcept;
+        virtual ~write_observer() noexcept;
+
+        // called before _Data overwrites the file at _Off, nothing is written if it returns false
+        virtual bool on_write(const uint64_t _Off, const byte_t* const _Data, const size_t _Size) noexcept = 0;
+    };
+
     class file_encryption_engine {
     public:
-        explicit file_encryption_engine(file& _File, encryption_engine* const _Engine) noexcept;
+        explicit file_encryption_engine(file& _File, encryption_engine* const _Engine,
+            const io_mode _Mode = io_mode::buffered) noexcept;
         ~file_encryption_engine() noexcept;
 
+        static constexpr size_t view_size = 64 * file_view::granularity; // 4 MiB per mapped view
+        static constexpr size_t checksum_block_size = 65536; // a view is split into blocks that fit the cache
+        static constexpr size_t region_size = 1048576; // the bytes written at once while a write observer is set
+        static constexpr ::std::chrono::milliseconds default_progress_interval{500};
+
         // tries to encrypt the file
         bool encrypt(const key& _Key, const iv& _Iv, authentication_tag& _Tag) noexcept;
 
+        // tries to encrypt the file, computes the requested checksums in the same pass
+        bool encrypt(const key& _Key, const iv& _Iv, authentication_tag& _Tag, file_checksums& _Checksums) noexcept;
+
         // tries to decrypt the file
         bool decrypt(const key& _Key, const iv& _Iv, authentication_tag& _Tag) noexcept;
 
+        // tries to decrypt the file, computes the requested checksums in the same pass
+        bool decrypt(const key& _Key, const iv& _Iv, authentication_tag& _Tag, file_checksums& _Checksums) noexcept;
+
+        // checks the tag of the first _Size bytes of the file, nothing is written
+        bool verify(const key& _Key, const iv& _Iv, authentication_tag& _Tag, const uint64_t _Size) noexcept;
+
+        // returns the statistics of the last encrypt(), decrypt() or verify() call
+        // (all zero unless the library is compiled with _FCRYPT_STAGE_STATS)
+        const stage_stats& stats() const noexcept;
+
+        // sets the observer that receives the progress of every following call (nullptr disables it)
+        void set_progress_observer(progress_observer* const _Observer,
+            const ::std::chrono::milliseconds _Interval = default_progress_interval) noexcept;
+
+        // sets the token checked between blocks, a cancelled call stops at a block boundary
+        void set_cancellation_token(const cancellation_token* const _Token) noexcept;
+
+        // sets the observer notified before every write of the following encrypt() and decrypt() calls,
+        // the file is then processed in regions of region_size bytes in either mode (nullptr disables it)
+        void set_write_observer(write_observer* const _Observer) noexcept;
+
+        // returns the number of bytes changed by the last encrypt() or decrypt() call
+        uint64_t processed() const noexcept;
+
+        // checks if the last call has been cancelled
+        bool cancelled() const noexcept;
+
+        // tries to restore the bytes processed by the last (cancelled or failed) encrypt() or decrypt() call,
+        // _Key and _Iv must be the ones passed to that call, the write observer sees the restoring writes
+        bool rollback(const key& _Key, const iv& _Iv) noexcept;
+
     private:
+        // tries to encrypt/decrypt the whole file with the requested checksums (if any)
+        bool _Run(const bool _Encrypt, const key& _Key, const iv& _Iv,
+            authentication_tag& _Tag, file_checksums* const _Checksums) noexcept;
+
+        // tries to encrypt/decrypt the first _Size bytes and records the progress
+        bool _Process(const bool _Encrypt, const uint64_t _Size, _Checksum_accumulator& _Sums) noexcept;
+
+        // tries to encrypt/decrypt the block in place, the plaintext and the ciphertext are passed to _Sums
+        bool _Process_block(
+            const bool _Encrypt, byte_t* const _Data, const size_t _Size, _Checksum_accumulator& _Sums) noexcept;
+
+        // tries to encrypt/decrypt the first _Size bytes page by page
+        bool _Process_buffered(const bool _Encrypt, const uint64_t _Size,
+            _Progress_tracker& _Tracker, _Checksum_accumulator& _Sums) noexcept;
+
+        // tries to encrypt/decrypt the first _Size bytes region by region, notifies the write observer
+        bool _Process_regions(const bool _Encrypt, const uint64_t _Size,
+            _Progress_tracker& _Tracker, _Checksum_accumulator& _Sums) noexcept;
+
+        // tries to read the next page
+        bool _Next_page() noexcept;
+
+        // moves back to the beginning of the current page
+        void _Move_back() noexcept;
+
+        // tries to write the page at the current position
+        bool _Write_page(const page& _Page) noexcept;
+
+        // tries to encrypt/decrypt the first _Size bytes through mapped views
+        bool _Process_mapped(const bool _Encrypt, const uint64_t _Size,
+            _Progress_tracker& _Tracker, _Checksum_accumulator& _Sums) noexcept;
+
+        // tries to decrypt the first _Size bytes of the file through mapped views, discards the output
+        bool _Verify_mapped(const uint64_t _Size, _Progress_tracker& _Tracker) noexcept;
+
+        // tries to decrypt the first _Size bytes of the file page by page, discards the output
+        bool _Verify_buffered(const uint64_t _Size, _Progress_tracker& _Tracker) noexcept;
+
         page_iterator _Myiter;
         encryption_engine* _Myeng;
+        io_mode _Mymode;
+        stage_stats _Mystats;
+        progress_observer* _Myobserver;
+        ::std::chrono::milliseconds _Myinterval;
+        const cancellation_token* _Mytoken;
+        write_observer* _Mywriter;
+        uint64_t _Myprocessed; // the number of bytes changed by the last encrypt() or decrypt() call
+        bool _Mycancelled; // true if the last call has been cancelled
+        bool _Myencrypted; // true if the last call was encrypt()
     };
 } // namespace fcrypt
 
@@ -0,0 +1,545 @@
+// job_journal.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/job_journal.hpp>
+#include <fcrypt/fs/fault_injection.hpp>
+#include <openssl/evp.h>
+#include <cstring>
+#include <filesystem>
+#include <iterator>
+#include <system_error>
+
+namespace fcrypt {
+    // Note: The log header contains the magic number (offset 0), the version (offset 8), the direction
+    //       (offset 9), the engine ID (offset 10), the number of files (offset 11), the tree digest
+    //       (offset 19), the salt (offset 51), the key check (offset 67) and the digest of the preceding
+    //       bytes (offset 99). A group contains its kind (offset 0), the number of entries (offset 1),
+    //       the entries (offset 5) and the digest of the preceding bytes. An entry is either the index
+    //       of a processed file, or a file state, which contains the index (offset 0), the change
+    //       (offset 8), the size (offset 9), the IV (offset 17), the tag (offset 29), the salt (offset 45),
+    //       the offset of the region (offset 61), its length (offset 69), its fingerprint (offset 77)
+    //       and the end of the change (offset 85). The bitmap file contains the magic number (offset 0),
+    //       the version (offset 8), the number of files (offset 9), the tree digest (offset 17), the bitmap
+    //       (offset 49), the number of states and the states that follow the bitmap, and the digest
+    //       of the preceding bytes. All integers are stored in little-endian.
+
+    static constexpr size_t _Bitmap_header_size = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint64_t)
+        + job_journal::digest_size;
+    static constexpr size_t _Group_header_size  = sizeof(uint8_t) + sizeof(uint32_t);
+    static constexpr uint8_t _Finished_group    = 0; // the indices of the processed files
+    static constexpr uint8_t _State_group       = 1; // the states of the files that are about to be changed
+
+    static size_t _Entry_size(const uint8_t _Kind) noexcept {
+        switch (_Kind) {
+        case _Finished_group:
+            return sizeof(uint64_t);
+        case _State_group:
+            return job_journal::state_size;
+        default: // unknown kind
+            return 0;
+        }
+    }
+
+    static void _Store_state(byte_t* const _Bytes, const job_file_state& _State) noexcept {
+        _Store_little_endian(_Bytes, _State.index);
+        _Bytes[8] = static_cast<byte_t>(_State.change);
+        _Store_little_endian(_Bytes + 9, _State.size);
+        ::memcpy(_Bytes + 17, _State.file_iv.get(), iv::size);
+        ::memcpy(_Bytes + 29, _State.tag.get(), authentication_tag::size);
+        ::memcpy(_Bytes + 45, _State.file_salt.get(), salt::size);
+        _Store_little_endian(_Bytes + 61, _State.offset);
+        _Store_little_endian(_Bytes + 69, _State.length);
+        _Store_little_endian(_Bytes + 77, _State.fingerprint);
+        _Store_little_endian(_Bytes + 85, _State.end);
+    }
+
+    static bool _Load_state(const byte_t* const _Bytes, job_file_state& _State) noexcept {
+        if (_Bytes[8] > static_cast<byte_t>(file_change::chunked)) { // unknown change
+            return false;
+        }
+
+        _State.index  = _Load_little_endian<uint64_t>(_Bytes);
+        _State.change = static_cast<file_change>(_Bytes[8]);
+        _State.size   = _Load_little_endian<uint64_t>(_Bytes + 9);
+        _State.file_iv.set(byte_string_view{_Bytes + 17, iv::size});
+        _State.tag.set(byte_string_view{_Bytes + 29, authentication_tag::size});
+        _State.file_salt.set(byte_string_view{_Bytes + 45, salt::size});
+        _State.offset      = _Load_little_endian<uint64_t>(_Bytes + 61);
+        _State.length      = _Load_little_endian<uint64_t>(_Bytes + 69);
+        _State.fingerprint = _Load_little_endian<uint64_t>(_Bytes + 77);
+        _State.end         = _Load_little_endian<uint64_t>(_Bytes + 85);
+        return true;
+    }
+
+    static ::std::pair<uint64_t, uint64_t> _State_key(const job_file_state& _State) noexcept {
+        return {_State.index, _State.change == file_change::chunked ? _State.offset : 0}; // one per chunk
+    }
+
+    static uint64_t _Mix_unit(const uint64_t _Value, const uint64_t _Unit) noexcept {
+        uint64_t _Hash = _Value ^ (_Unit * 0x9E37'79B9'7F4A'7C15); // the finalizer of SplitMix64
+        _Hash          = (_Hash ^ (_Hash >> 30)) * 0xBF58'476D'1CE4'E5B9;
+        _Hash          = (_Hash ^ (_Hash >> 27)) * 0x94D0'49BB'1331'11EB;
+        return _Hash ^ (_Hash >> 31);
+    }
+
+    static bool _Check_digest(const byte_t* const _Bytes, const size_t _Size) noexcept {
+        byte_t _Digest[job_journal::digest_size];
+        return ::EVP_Digest(_Bytes, _Size, _Digest, nullptr, ::EVP_sha256(), nullptr) != 0
+            && ::memcmp(_Digest, _Bytes + _Size, job_journal::digest_size) == 0;
+    }
+
+    static bool _Store_digest(byte_t* const _Bytes, const size_t _Size) noexcept {
+        return ::EVP_Digest(_Bytes, _Size, _Bytes + _Size, nullptr, ::EVP_sha256(), nullptr) != 0;
+    }
+
+    job_journal::job_journal(const path& _Target)
+        : _Myfile(_Target, open_mode::open_always), _Mypath(_Target), _Mybitmap_path(_Target), _Myjob(),
+        _Myhas_job(false), _Mybits(), _Mywords(0), _Myfinished(0), _Mymtx(), _Mypending(), _Mystates(),
+        _Mylast(::std::chrono::steady_clock::now()), _Myoff(header_size), _Mylogged(0) {
+        _Mybitmap_path += L".bitmap";
+        if (_Myfile.is_open() && !_Load()) { // unusable journal, the job must not guess what has been done
+            _Myfile.close();
+        }
+    }
+
+    job_journal::~job_journal() noexcept {
+        try {
+            commit();
+        } catch (...) {
+            // the recorded files will be checked again
+        }
+    }
+
+    job_digest job_journal::make_key_check(const key& _Key) {
+        static constexpr char _Label[] = "fcrypt job journal key check";
+        byte_t _Bytes[sizeof(_Label) + key::size];
+        ::memcpy(_Bytes, _Label, sizeof(_Label));
+        ::memcpy(_Bytes + sizeof(_Label), _Key.get(), key::size);
+        job_digest _Check;
+        if (::EVP_Digest(_Bytes, sizeof(_Bytes), _Check.get(), nullptr, ::EVP_sha256(), nullptr) == 0) {
+            _Check = job_digest{}; // an empty check never matches
+        }
+
+        _Scrub_memory(_Bytes, sizeof(_Bytes));
+        return _Check;
+    }
+
+    uint64_t job_journal::fingerprint(const uint64_t _Off, const byte_t* const _Data, const size_t _Size) noexcept {
+        // Note: A unit is written either entirely or not at all, and its old and new bytes differ
+        //       by the keystream, so the first bytes of every unit are enough to tell them apart.
+        //       The fingerprints of the units are summed, which lets the directory engine check every
+        //       possible number of written units in a single pass over the region.
+        uint64_t _Sum = 0;
+        for (size_t _Pos = 0; _Pos < _Size; _Pos += unit_size) {
+            byte_t _First[sizeof(uint64_t)] = {0};
+            ::memcpy(_First, _Data + _Pos, _Min(_Size - _Pos, sizeof(uint64_t)));
+            _Sum += _Mix_unit(_Load_little_endian<uint64_t>(_First), (_Off + _Pos) / unit_size);
+        }
+
+        return _Sum;
+    }
+
+    bool job_journal::is_open() const noexcept {
+        return _Myfile.is_open();
+    }
+
+    bool job_journal::has_job() const noexcept {
+        return _Myhas_job;
+    }
+
+    const job_description& job_journal::job() const noexcept {
+        return _Myjob;
+    }
+
+    uint64_t job_journal::finished() const noexcept {
+        return _Myfinished.load(::std::memory_order_relaxed);
+    }
+
+    void job_journal::_Reset_bits() {
+        _Mywords = static_cast<size_t>((_Myjob.items + 63) / 64);
+        _Mybits  = ::std::make_unique<::std::atomic<uint64_t>[]>(_Mywords);
+        for (size_t _Word = 0; _Word < _Mywords; ++_Word) {
+            _Mybits[_Word].store(0, ::std::memory_order_relaxed);
+        }
+
+        _Myfinished = 0;
+    }
+
+    bool job_journal::_Set_bit(const uint64_t _Idx) noexcept {
+        const uint64_t _Mask = uint64_t{1} << (_Idx % 64);
+        if ((_Mybits[static_cast<size_t>(_Idx / 64)].fetch_or(_Mask, ::std::memory_order_relaxed) & _Mask) != 0) {
+            return false;
+        }
+
+        _Myfinished.fetch_add(1, ::std::memory_order_relaxed);
+        return true;
+    }
+
+    bool job_journal::is_finished(const uint64_t _Idx) const noexcept {
+        if (_Idx >= _Myjob.items) {
+            return false;
+        }
+
+        const uint64_t _Mask = uint64_t{1} << (_Idx % 64);
+        return (_Mybits[static_cast<size_t>(_Idx / 64)].load(::std::memory_order_relaxed) & _Mask) != 0;
+    }
+
+    bool job_journal::_Load() {
+        const uint64_t _Size = _Myfile.size();
+        if (_Size == 0) { // a new journal
+            return true;
+        }
+
+        byte_t _Header[header_size];
+        if (_Size < header_size || _Myfile.read_at(0, _Header, header_size) != header_size) {
+            return false;
+        }
+
+        if (_Load_little_endian<uint64_t>(_Header) != magic || _Header[8] != version || _Header[9] > 1
+            || !_Check_digest(_Header, header_size - digest_size)) {
+            return false;
+        }
+
+        _Myjob.encrypt   = _Header[9] != 0;
+        _Myjob.engine_id = static_cast<encryption_engine::id>(_Header[10]);
+        _Myjob.items     = _Load_little_endian<uint64_t>(_Header + 11);
+        _Myjob.tree.set(byte_string_view{_Header + 19, digest_size});
+        _Myjob.job_salt.set(byte_string_view{_Header + 51, salt::size});
+        _Myjob.key_check.set(byte_string_view{_Header + 67, digest_size});
+        _Reset_bits();
+        if (!_Load_bitmap()) {
+            return false;
+        }
+
+        // Note: The groups are read until the first torn or damaged one, which is then truncated,
+        //       so the next group is appended after the last valid one.
+        ::std::vector<byte_t> _Group;
+        byte_t _Group_header[_Group_header_size];
+        while (_Size - _Myoff >= _Group_header_size
+            && _Myfile.read_at(_Myoff, _Group_header, _Group_header_size) == _Group_header_size) {
+            const size_t _Entry   = _Entry_size(_Group_header[0]);
+            const uint32_t _Count = _Load_little_endian<uint32_t>(_Group_header + 1);
+            const size_t _Body    = _Group_header_size + static_cast<size_t>(_Count) * _Entry;
+            if (_Entry == 0 || _Count == 0 || _Count > group_size || _Size - _Myoff < _Body + digest_size) {
+                break;
+            }
+
+            _Group.resize(_Body + digest_size);
+            if (_Myfile.read_at(_Myoff, _Group.data(), _Group.size()) != _Group.size()
+                || !_Check_digest(_Group.data(), _Body)) {
+                break;
+            }
+
+            _Apply_group(_Group.data());
+            _Myoff    += _Group.size();
+            _Mylogged += _Count;
+        }
+
+        for (auto _Iter = _Mystates.begin(); _Iter != _Mystates.end();) { // only the unrecorded files are kept
+            _Iter = is_finished(_Iter->first.first) ? _Mystates.erase(_Iter) : ::std::next(_Iter);
+        }
+
+        _Myhas_job = true;
+        return _Myoff == _Size || (_Myfile.resize(_Myoff) && _Myfile.flush());
+    }
+
+    void job_journal::_Apply_group(const byte_t* const _Group) {
+        const uint32_t _Count = _Load_little_endian<uint32_t>(_Group + 1);
+        const byte_t* _Entry  = _Group + _Group_header_size;
+        for (uint32_t _Pos = 0; _Pos < _Count; ++_Pos) {
+            if (_Group[0] == _Finished_group) {
+                const uint64_t _Idx = _Load_little_endian<uint64_t>(_Entry);
+                if (_Idx < _Myjob.items) {
+                    _Set_bit(_Idx);
+                }
+
+                _Entry += sizeof(uint64_t);
+            } else {
+                job_file_state _State;
+                if (_Load_state(_Entry, _State) && _State.index < _Myjob.items) { // the last state wins
+                    _Mystates[_State_key(_State)] = _State;
+                }
+
+                _Entry += state_size;
+            }
+        }
+    }
+
+    bool job_journal::_Load_bitmap() {
+        ::std::error_code _Ec;
+        if (!::std::filesystem::exists(_Mybitmap_path, _Ec)) { // not compacted yet
+            return !_Ec;
+        }
+
+        file _Bitmap(_Mybitmap_path);
+        const size_t _Bits_end = _Bitmap_header_size + _Mywords * sizeof(uint64_t);
+        const uint64_t _Size   = _Bitmap.size();
+        if (!_Bitmap.is_open() || _Size < _Bits_end + sizeof(uint64_t) + digest_size) {
+            return false;
+        }
+
+        ::std::vector<byte_t> _Bytes(static_cast<size_t>(_Size));
+        const uint64_t _States = _Bitmap.read_at(0, _Bytes.data(), _Bytes.size()) == _Bytes.size()
+            ? _Load_little_endian<uint64_t>(_Bytes.data() + _Bits_end) : 0;
+        const uint64_t _Room   = (_Size - _Bits_end - sizeof(uint64_t) - digest_size) / state_size;
+        const size_t _Body     = _Bits_end + sizeof(uint64_t) + static_cast<size_t>(_Min(_States, _Room)) * state_size;
+        if (_States > _Room || _Size != _Body + digest_size || !_Check_digest(_Bytes.data(), _Body)) {
+            return false;
+        }
+
+        if (_Load_little_endian<uint64_t>(_Bytes.data()) != bitmap_magic || _Bytes[8] != version
+            || _Load_little_endian<uint64_t>(_Bytes.data() + 9) != _Myjob.items
+            || ::memcmp(_Bytes.data() + 17, _Myjob.tree.get(), digest_size) != 0) { // belongs to another job
+            return false;
+        }
+
+        for (size_t _Word = 0; _Word < _Mywords; ++_Word) {
+            const uint64_t _Bits = _Load_little_endian<uint64_t>(
+                _Bytes.data() + _Bitmap_header_size + _Word * sizeof(uint64_t));
+            for (uint64_t _Rest = _Bits; _Rest != 0; _Rest &= _Rest - 1) { // count the set bits
+                _Myfinished.fetch_add(1, ::std::memory_order_relaxed);
+            }
+
+            _Mybits[_Word].store(_Bits, ::std::memory_order_relaxed);
+        }
+
+        const byte_t* _Entry = _Bytes.data() + _Bits_end + sizeof(uint64_t);
+        for (uint64_t _Pos = 0; _Pos < _States; ++_Pos, _Entry += state_size) {
+            job_file_state _State;
+            if (!_Load_state(_Entry, _State) || _State.index >= _Myjob.items) {
+                return false;
+            }
+
+            _Mystates[_State_key(_State)] = _State;
+        }
+
+        return true;
+    }
+
+    bool job_journal::begin(const job_description& _Job) {
+        if (!_Myfile.is_open()) {
+            return false;
+        }
+
+        byte_t _Header[header_size] = {0};
+        _Store_little_endian(_Header, magic);
+        _Header[8]  = version;
+        _Header[9]  = _Job.encrypt ? 1 : 0;
+        _Header[10] = static_cast<byte_t>(_Job.engine_id);
+        _Store_little_endian(_Header + 11, _Job.items);
+        ::memcpy(_Header + 19, _Job.tree.get(), digest_size);
+        ::memcpy(_Header + 51, _Job.job_salt.get(), salt::size);
+        ::memcpy(_Header + 67, _Job.key_check.get(), digest_size);
+        if (!_Store_digest(_Header, header_size - digest_size)) {
+            return false;
+        }
+
+        ::std::lock_guard _Guard(_Mymtx);
+        ::std::error_code _Ec;
+        ::std::filesystem::remove(_Mybitmap_path, _Ec); // belongs to the previous job
+        if (_Ec || !_Myfile.resize(0) || !_Myfile.write_at(0, byte_string_view{_Header, header_size})
+            || !_Myfile.flush()) {
+            return false;
+        }
+
+        _Myjob = _Job;
+        _Reset_bits();
+        _Mypending.clear();
+        _Mystates.clear();
+        _Mylast    = ::std::chrono::steady_clock::now();
+        _Myoff     = header_size;
+        _Mylogged  = 0;
+        _Myhas_job = true;
+        return true;
+    }
+
+    bool job_journal::record(const uint64_t _Idx) {
+        if (!_Myhas_job || _Idx >= _Myjob.items) {
+            return false;
+        }
+
+        if (!_Set_bit(_Idx)) { // already recorded
+            return true;
+        }
+
+        if (_Fault_due(fault_site::journal_record)) { // simulates a process killed before the group is written
+            _Inject_fault();
+        }
+
+        {
+            ::std::lock_guard _Guard(_Mymtx);
+            _Mystates.erase(_Mystates.lower_bound({_Idx, 0}), _Mystates.lower_bound({_Idx + 1, 0}));
+            _Mypending.push_back(_Idx);
+            if (_Mypending.size() < group_size && ::std::chrono::steady_clock::now() - _Mylast < group_interval) {
+                return true; // flushed with the rest of the group
+            }
+
+            if (!_Write_group() || (_Mylogged >= compact_interval && !_Compact())) {
+                return false;
+            }
+        }
+
+        return _Myfile.flush(); // the other workers keep recording while the group is being flushed
+    }
+
+    bool job_journal::record_states(const job_file_state* const _States, const size_t _Count) {
+        if (!_Myhas_job || _Count == 0 || _Count > group_size) {
+            return false;
+        }
+
+        const size_t _Body = _Group_header_size + _Count * state_size;
+        ::std::vector<byte_t> _Group(_Body + digest_size);
+        _Group[0] = _State_group;
+        _Store_little_endian(_Group.data() + 1, static_cast<uint32_t>(_Count));
+        for (size_t _Pos = 0; _Pos < _Count; ++_Pos) {
+            if (_States[_Pos].index >= _Myjob.items) {
+                return false;
+            }
+
+            _Store_state(_Group.data() + _Group_header_size + _Pos * state_size, _States[_Pos]);
+        }
+
+        if (!_Store_digest(_Group.data(), _Body)) {
+            return false;
+        }
+
+        // Note: The group is written at once, so the files may be changed as soon as it returns.
+        //       Only the compaction flushes it, the states are needed only if the process is killed.
+        ::std::lock_guard _Guard(_Mymtx);
+        if (!_Myfile.write_at(_Myoff, byte_string_view{_Group.data(), _Group.size()})) {
+            return false;
+        }
+
+        _Myoff    += _Group.size();
+        _Mylogged += _Count;
+        for (size_t _Pos = 0; _Pos < _Count; ++_Pos) {
+            _Mystates[_State_key(_States[_Pos])] = _States[_Pos];
+        }
+
+        return _Mylogged < compact_interval || _Compact();
+    }
+
+    bool job_journal::find_states(const uint64_t _Idx, ::std::vector<job_file_state>& _States) {
+        _States.clear();
+        ::std::lock_guard _Guard(_Mymtx);
+        const auto _Last = _Mystates.lower_bound({_Idx + 1, 0});
+        for (auto _Iter = _Mystates.lower_bound({_Idx, 0}); _Iter != _Last; ++_Iter) {
+            _States.push_back(_Iter->second);
+        }
+
+        return !_States.empty();
+    }
+
+    bool job_journal::_Write_group() {
+        if (_Mypending.empty()) {
+            return true;
+        }
+
+        const size_t _Body = _Group_header_size + _Mypending.size() * sizeof(uint64_t);
+        ::std::vector<byte_t> _Group(_Body + digest_size);
+        _Group[0] = _Finished_group;
+        _Store_little_endian(_Group.data() + 1, static_cast<uint32_t>(_Mypending.size()));
+        for (size_t _Pos = 0; _Pos < _Mypending.size(); ++_Pos) {
+            _Store_little_endian(_Group.data() + _Group_header_size + _Pos * sizeof(uint64_t), _Mypending[_Pos]);
+        }
+
+        if (!_Store_digest(_Group.data(), _Body)
+            || !_Myfile.write_at(_Myoff, byte_string_view{_Group.data(), _Group.size()})) {
+            return false;
+        }
+
+        _Myoff    += _Group.size();
+        _Mylogged += _Mypending.size();
+        _Mypending.clear();
+        _Mylast = ::std::chrono::steady_clock::now();
+        return true;
+    }
+
+    bool job_journal::_Compact() {
+        // Note: The bitmap is written to a temporary file that replaces the previous bitmap, and only then
+        //       is the log truncated. A crash in between leaves groups that are already in the bitmap,
+        //       which are simply applied again. The pending files and the states are in the bitmap as well.
+        const size_t _Bits_end = _Bitmap_header_size + _Mywords * sizeof(uint64_t);
+        const size_t _Body     = _Bits_end + sizeof(uint64_t) + _Mystates.size() * state_size;
+        ::std::vector<byte_t> _Bytes(_Body + digest_size);
+        _Store_little_endian(_Bytes.data(), bitmap_magic);
+        _Bytes[8] = version;
+        _Store_little_endian(_Bytes.data() + 9, _Myjob.items);
+        ::memcpy(_Bytes.data() + 17, _Myjob.tree.get(), digest_size);
+        for (size_t _Word = 0; _Word < _Mywords; ++_Word) {
+            _Store_little_endian(_Bytes.data() + _Bitmap_header_size + _Word * sizeof(uint64_t),
+                _Mybits[_Word].load(::std::memory_order_relaxed));
+        }
+
+        _Store_little_endian(_Bytes.data() + _Bits_end, static_cast<uint64_t>(_Mystates.size()));
+        byte_t* _Entry = _Bytes.data() + _Bits_end + sizeof(uint64_t);
+        for (const auto& _Pair : _Mystates) {
+            _Store_state(_Entry, _Pair.second);
+            _Entry += state_size;
+        }
+
+        if (!_Store_digest(_Bytes.data(), _Body)) {
+            return false;
+        }
+
+        path _Temp  = _Mybitmap_path;
+        _Temp      += L".tmp";
+        {
+            file _Output(_Temp, open_mode::create_always);
+            if (!_Output.is_open() || !_Output.write(byte_string_view{_Bytes.data(), _Bytes.size()})
+                || !_Output.flush()) {
+                return false;
+            }
+        }
+
+        ::std::error_code _Ec;
+        ::std::filesystem::rename(_Temp, _Mybitmap_path, _Ec);
+        if (_Ec || !_Myfile.resize(header_size) || !_Myfile.flush()) {
+            return false;
+        }
+
+        _Mypending.clear();
+        _Mylast   = ::std::chrono::steady_clock::now();
+        _Myoff    = header_size;
+        _Mylogged = 0;
+        return true;
+    }
+
+    bool job_journal::commit() {
+        if (!_Myhas_job || !_Myfile.is_open()) {
+            return false;
+        }
+
+        {
+            ::std::lock_guard _Guard(_Mymtx);
+            if (!_Write_group()) {
+                return false;
+            }
+        }
+
+        return _Myfile.flush();
+    }
+
+    bool job_journal::compact() {
+        if (!_Myhas_job || !_Myfile.is_open()) {
+            return false;
+        }
+
+        ::std::lock_guard _Guard(_Mymtx);
+        return _Compact();
+    }
+
+    bool job_journal::remove() noexcept {
+        _Myfile.close();
+        _Myhas_job = false;
+        ::std::error_code _Ec;
+        ::std::filesystem::remove(_Mybitmap_path, _Ec);
+        if (_Ec) {
+            return false;
+        }
+
+        return ::std::filesystem::remove(_Mypath, _Ec) && !_Ec;
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,179 @@
+// job_journal.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_JOB_JOURNAL_HPP_
+#define _FCRYPT_CRYPT_JOB_JOURNAL_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace fcrypt {
+    using job_digest = _Secure_buffer<32>; // SHA-256
+
+    struct job_description { // identifies a directory job
+        bool encrypt = false;
+        encryption_engine::id engine_id = encryption_engine::aes256_gcm;
+        uint64_t items = 0; // the number of files
+        job_digest tree; // the digest of the sorted paths of all files
+        salt job_salt; // only for the encryption
+        job_digest key_check; // only for the encryption, tells whether the resumed job uses the same key
+    };
+
+    enum class file_change : unsigned char { // describes how a file is being changed
+        forward, // every byte before the region has been changed
+        undo, // the change is being undone, every byte after the region up to the end is still changed
+        chunked // the file is processed by the chunked engine, every chunk written by the decryption is recorded
+    };
+
+    struct job_file_state { // the state of a file, recorded before the file is changed
+        uint64_t index = 0; // the index of the file
+        file_change change = file_change::forward;
+        uint64_t size = 0; // the number of data bytes (without the metadata)
+        iv file_iv;
+        authentication_tag tag; // only for the decryption, the metadata is removed before the data is changed
+        salt file_salt; // only for the decryption
+        uint64_t offset = 0; // the region (or the chunk) that is about to be written
+        uint64_t length = 0; // 0 if nothing is about to be written
+        uint64_t fingerprint = 0; // the fingerprint of the bytes that are about to be written
+        uint64_t end = 0; // the end of the changed bytes (only for file_change::undo)
+    };
+
+    // Note: The job journal lets an interrupted directory job skip the files it has already processed.
+    //       A file is identified by its index in the sorted list of files, so a lookup is a single bit test.
+    //       The journal consists of two files, an append-only log and a compacted bitmap:
+    //
+    //       <target>:        [header] [group 0] ... [group N-1]
+    //       <target>.bitmap: [header] [bitmap] [states] [digest]
+    //
+    //       The log header describes the job, a group stores the indices of the files processed
+    //       successfully since the previous group and its digest. The groups are written and flushed
+    //       once per group_size files or group_interval, whichever comes first, so a single flush is
+    //       shared by thousands of files. After compact_interval entries the bitmap replaces the log's
+    //       groups, so the log never grows beyond a few megabytes and loading it stays cheap.
+    //
+    //       A crash loses at most the files processed since the last flush. The directory engine checks
+    //       such files again before it processes them (see directory_encryption_engine.hpp).
+    //
+    //       Files are changed in place, so the journal also records the state of every file before
+    //       the file is changed, and again before every region that is written (see job_file_state).
+    //       A state group is written at once, before the file is changed, but it is not flushed, since
+    //       the journal covers killed processes, which never lose a completed write. A file's last state
+    //       is kept until the file is recorded, except for the chunks of a chunked file, which are written
+    //       in parallel, so the last state of every chunk is kept. The bitmap keeps the states as well.
+
+    class job_journal { // records the progress of a directory job
+    public:
+        explicit job_journal(const path& _Target);
+        ~job_journal() noexcept;
+
+        job_journal(const job_journal&) = delete;
+        job_journal& operator=(const job_journal&) = delete;
+
+        static constexpr size_t digest_size        = 32; // SHA-256
+        static constexpr size_t header_size        = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint8_t)
+            + sizeof(uint8_t) + sizeof(uint64_t) + digest_size + salt::size + digest_size + digest_size;
+        static constexpr size_t state_size         = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(uint64_t)
+            + iv::size + authentication_tag::size + salt::size + 4 * sizeof(uint64_t);
+        static constexpr size_t unit_size          = 512; // the smallest unit written atomically
+        static constexpr size_t group_size         = 4096; // the maximum number of entries per group
+        static constexpr uint64_t compact_interval = 1048576; // the number of files between two bitmaps
+        static constexpr ::std::chrono::milliseconds group_interval{1000};
+        static constexpr uint8_t version           = 2;
+        static constexpr uint64_t magic            = 0x4A4A'5450'5952'4346; // "FCRYPTJJ"
+        static constexpr uint64_t bitmap_magic     = 0x424A'5450'5952'4346; // "FCRYPTJB"
+
+        // computes the value stored to check the key of a resumed job (the key cannot be derived from it)
+        static job_digest make_key_check(const key& _Key);
+
+        // computes the fingerprint of the bytes that are about to be written at _Off (a multiple of unit_size)
+        static uint64_t fingerprint(const uint64_t _Off, const byte_t* const _Data, const size_t _Size) noexcept;
+
+        // checks if the journal has been loaded
+        bool is_open() const noexcept;
+
+        // checks if the journal describes an interrupted job
+        bool has_job() const noexcept;
+
+        // returns the description of the interrupted job
+        const job_description& job() const noexcept;
+
+        // returns the number of files processed successfully
+        uint64_t finished() const noexcept;
+
+        // tries to start recording a new job, discards the previous one
+        bool begin(const job_description& _Job);
+
+        // checks if the file has been processed successfully
+        bool is_finished(const uint64_t _Idx) const noexcept;
+
+        // records that the file has been processed successfully, flushes the group if it is full or old
+        bool record(const uint64_t _Idx);
+
+        // tries to write the states of the files before they are changed
+        bool record_states(const job_file_state* const _States, const size_t _Count);
+
+        // tries to find the last states of a file that has not been recorded yet (one per written chunk)
+        bool find_states(const uint64_t _Idx, ::std::vector<job_file_state>& _States);
+
+        // tries to write and flush all recorded files
+        bool commit();
+
+        // tries to replace the log's groups with the bitmap
+        bool compact();
+
+        // tries to close and delete the journal
+        bool remove() noexcept;
+
+    private:
+        // tries to load the header, the bitmap and the valid groups
+        bool _Load();
+
+        // tries to load the bitmap
+        bool _Load_bitmap();
+
+        // tries to allocate an empty bitmap
+        void _Reset_bits();
+
+        // marks the file as processed, returns false if it has been marked already
+        bool _Set_bit(const uint64_t _Idx) noexcept;
+
+        // applies a valid group read from the log
+        void _Apply_group(const byte_t* const _Group);
+
+        // tries to write the pending group, it is flushed by the caller (the lock must be held)
+        bool _Write_group();
+
+        // tries to write the bitmap and truncate the log (the lock must be held)
+        bool _Compact();
+
+        file _Myfile;
+        path _Mypath;
+        path _Mybitmap_path;
+        job_description _Myjob;
+        bool _Myhas_job;
+        ::std::unique_ptr<::std::atomic<uint64_t>[]> _Mybits;
+        size_t _Mywords;
+        ::std::atomic<uint64_t> _Myfinished;
+        ::std::mutex _Mymtx;
+        ::std::vector<uint64_t> _Mypending; // the files recorded since the last group
+        ::std::map<::std::pair<uint64_t, uint64_t>, job_file_state> _Mystates; // by the file and the chunk offset
+        ::std::chrono::steady_clock::time_point _Mylast; // the time of the last flush
+        uint64_t _Myoff; // the end of the last valid group
+        uint64_t _Mylogged; // the number of entries stored in the log's groups
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_JOB_JOURNAL_HPP_
\ No newline at end of file
@@ -4,7 +4,10 @@
 // SPDX-License-Identifier: Apache-2.0
 
 #include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/crypt/metrics.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
 #include <botan/argon2.h>
+#include <chrono>
 #include <cstddef>
 
 namespace fcrypt {
@@ -12,7 +15,10 @@ namespace fcrypt {
         // Note: The _Password (2-byte element string) is converted to _Narrow (1-byte element string)
         //       using memcpy() because we do not require specific encoding for _Password. The purpose
         //       is to pass a 1-byte element string to the argon2() fucntion.
+        _Stage_timer _Timer(stage::derive_key);
+        const auto _Start = ::std::chrono::steady_clock::now();
         key _Result;
+        bool _Success = true;
         ::std::string _Narrow(_Password.size() * sizeof(wchar_t), '\0');
         ::memcpy(_Narrow.data(), _Password.c_str(), _Narrow.size());
         try {
@@ -21,9 +27,15 @@ namespace fcrypt {
                     _Argon2id_traits::_Variant, _Argon2id_traits::_Parallelism,
                         _Argon2id_traits::_Memory_amount, _Argon2id_traits::_Iterations);
         } catch (...) {
-            return key{};
+            _Success = false;
         }
 
-        return _Result;
+        metrics_registry* const _Metrics = get_metrics_registry();
+        if (_Metrics) { // the latency is reported even without the statistics enabled
+            _Metrics->observe_kdf(static_cast<uint64_t>(::std::chrono::duration_cast<::std::chrono::nanoseconds>(
+                ::std::chrono::steady_clock::now() - _Start).count()), _Success);
+        }
+
+        return _Success ? _Result : key{};
     }
 } // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,302 @@
+// manifest.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/manifest.hpp>
+#include <openssl/evp.h>
+#include <cstring>
+#include <vector>
+
+namespace fcrypt {
+    bool compute_digest(file& _File, content_digest& _Digest) {
+        ::EVP_MD_CTX* const _Ctx = ::EVP_MD_CTX_new();
+        if (!_Ctx) {
+            return false;
+        }
+
+        bool _Success = ::EVP_DigestInit_ex(_Ctx, ::EVP_sha256(), nullptr) != 0;
+        if (_Success) {
+            constexpr size_t _Buf_size = 1048576; // 1 MiB
+            ::std::vector<byte_t> _Buf(_Buf_size);
+            const uint64_t _Size = _File.size();
+            for (uint64_t _Off = 0; _Off < _Size && _Success; _Off += _Buf_size) {
+                const size_t _Count = static_cast<size_t>(_Min(_Size - _Off, static_cast<uint64_t>(_Buf_size)));
+                _Success            = _File.read_at(_Off, _Buf.data(), _Count) == _Count
+                    && ::EVP_DigestUpdate(_Ctx, _Buf.data(), _Count) != 0;
+            }
+
+            _Scrub_memory(_Buf.data(), _Buf.size());
+        }
+
+        if (_Success) {
+            _Success = ::EVP_DigestFinal_ex(_Ctx, _Digest.get(), nullptr) != 0;
+        }
+
+        ::EVP_MD_CTX_free(_Ctx);
+        return _Success;
+    }
+
+    // Note: The header contains the magic number (offset 0), the version (offset 8), the capacity
+    //       (offset 16), the number of used slots (offset 24) and the number of deleted slots (offset 32).
+    //       A slot contains the state (offset 0), the key (offset 8), the size (offset 40), the last
+    //       write time (offset 48) and the digest (offset 56). All integers are stored in little-endian.
+
+    manifest::manifest(const path& _Target)
+        : _Mypath(_Target), _Myfile(::std::make_unique<file>(_Target, open_mode::open_always)), _Myview(),
+        _Mycapacity(0), _Mycount(0), _Mydeleted(0) {
+        if (_Myfile->is_open() && !_Load()) { // unusable manifest, the file is left as it is
+            _Myview.reset();
+            _Myfile->close();
+        }
+    }
+
+    manifest::~manifest() noexcept {
+        flush();
+    }
+
+    bool manifest::_Initialize() {
+        _Myview.reset();
+        if (!_Myfile->resize(0) || !_Myfile->resize(header_size + min_capacity * slot_size)) {
+            return false;
+        }
+
+        if (!_Map(min_capacity)) {
+            return false;
+        }
+
+        byte_t* const _Header = _Myview->data();
+        _Store_little_endian(_Header, magic);
+        _Header[8] = version;
+        _Mycount   = 0;
+        _Mydeleted = 0;
+        _Store_little_endian(_Header + 16, min_capacity);
+        _Store_counters();
+        return true;
+    }
+
+    bool manifest::_Load() {
+        const uint64_t _Size = _Myfile->size();
+        if (_Size == 0) { // a new manifest
+            return _Initialize();
+        }
+
+        // Note: A damaged or unknown manifest is never replaced with an empty one. The files it describes
+        //       are already encrypted, and an empty manifest would let them be encrypted again.
+        byte_t _Header[header_size] = {0};
+        if (_Size < header_size || _Myfile->read_at(0, _Header, header_size) != header_size) {
+            return false;
+        }
+
+        const uint64_t _Capacity = _Load_little_endian<uint64_t>(_Header + 16);
+        if (_Load_little_endian<uint64_t>(_Header) != magic || _Header[8] != version) { // unknown format
+            return false;
+        }
+
+        if (_Capacity < min_capacity || (_Capacity & (_Capacity - 1)) != 0
+            || _Capacity > (_Size - header_size) / slot_size || _Size != header_size + _Capacity * slot_size) {
+            return false;
+        }
+
+        _Mycount   = _Load_little_endian<uint64_t>(_Header + 24);
+        _Mydeleted = _Load_little_endian<uint64_t>(_Header + 32);
+        if (_Mycount + _Mydeleted >= _Capacity) {
+            return false;
+        }
+
+        return _Map(_Capacity);
+    }
+
+    bool manifest::_Map(const uint64_t _Capacity) {
+        const uint64_t _Size = header_size + _Capacity * slot_size;
+        if (_Size > static_cast<uint64_t>(static_cast<size_t>(-1))) { // the table must fit in the address space
+            return false;
+        }
+
+        _Myview.reset(); // the mapping object must be recreated whenever the file size changes
+        _Myview = ::std::make_unique<file_view>(*_Myfile);
+        if (!_Myview->map(0, static_cast<size_t>(_Size))) {
+            _Myview.reset();
+            return false;
+        }
+
+        _Mycapacity = _Capacity;
+        return true;
+    }
+
+    bool manifest::_Rehash(const uint64_t _New_capacity) {
+        // Note: The new table is built in a temporary file that replaces the manifest, the slots of the mapped
+        //       table are never cleared. A process killed during the rehash (its dirty pages are still written)
+        //       therefore leaves either the old or the new table, never one with missing records.
+        const uint64_t _Mask = _New_capacity - 1;
+        ::std::vector<byte_t> _Table(static_cast<size_t>(header_size + _New_capacity * slot_size));
+        ::memcpy(_Table.data(), _Myview->data(), header_size); // the magic number and the version
+        for (uint64_t _Old = 0; _Old < _Mycapacity; ++_Old) {
+            const byte_t* const _Current = _Slot(_Old);
+            if (_Current[0] != _Used) { // the new table has no deleted slots
+                continue;
+            }
+
+            uint64_t _Idx = _Load_little_endian<uint64_t>(_Current + 8) & _Mask;
+            while (_Table[static_cast<size_t>(header_size + _Idx * slot_size)] != _Empty) {
+                _Idx = (_Idx + 1) & _Mask;
+            }
+
+            ::memcpy(_Table.data() + header_size + _Idx * slot_size, _Current, slot_size);
+        }
+
+        _Store_little_endian(_Table.data() + 16, _New_capacity);
+        _Store_little_endian(_Table.data() + 24, _Mycount);
+        _Store_little_endian(_Table.data() + 32, uint64_t{0});
+        path _Temp  = _Mypath;
+        _Temp      += L".tmp";
+        {
+            file _Output(_Temp, open_mode::create_always);
+            if (!_Output.is_open() || !_Output.write(byte_string_view{_Table.data(), _Table.size()})
+                || !_Output.flush()) {
+                return false;
+            }
+        }
+
+        _Myview.reset(); // the manifest cannot be replaced while it is open
+        _Myfile->close();
+        ::std::error_code _Ec;
+        ::std::filesystem::rename(_Temp, _Mypath, _Ec);
+        if (_Ec) { // the old table is left as it is
+            return false;
+        }
+
+        _Myfile = ::std::make_unique<file>(_Mypath);
+        if (!_Myfile->is_open() || !_Map(_New_capacity)) {
+            return false;
+        }
+
+        _Mydeleted = 0;
+        return true;
+    }
+
+    manifest::_Slot_key manifest::_Make_key(const path& _Target) {
+        const ::std::wstring _Str = _Target.lexically_normal().generic_wstring();
+        ::std::vector<byte_t> _Bytes(_Str.size() * sizeof(uint16_t));
+        for (size_t _Idx = 0; _Idx < _Str.size(); ++_Idx) { // hash UTF-16 on every platform
+            _Store_little_endian(_Bytes.data() + _Idx * sizeof(uint16_t), static_cast<uint16_t>(_Str[_Idx]));
+        }
+
+        _Slot_key _Key;
+        ::EVP_Digest(_Bytes.data(), _Bytes.size(), _Key.get(), nullptr, ::EVP_sha256(), nullptr);
+        return _Key;
+    }
+
+    byte_t* manifest::_Slot(const uint64_t _Idx) const noexcept {
+        return _Myview->data() + header_size + static_cast<size_t>(_Idx * slot_size);
+    }
+
+    byte_t* manifest::_Find_slot(const _Slot_key& _Key) const noexcept {
+        if (!_Myview) {
+            return nullptr;
+        }
+
+        const uint64_t _Mask = _Mycapacity - 1;
+        uint64_t _Idx        = _Load_little_endian<uint64_t>(_Key.get()) & _Mask;
+        for (uint64_t _Probe = 0; _Probe < _Mycapacity; ++_Probe, _Idx = (_Idx + 1) & _Mask) {
+            byte_t* const _Current = _Slot(_Idx);
+            if (_Current[0] == _Empty) { // the end of the probe sequence
+                return nullptr;
+            }
+
+            if (_Current[0] == _Used && ::memcmp(_Current + 8, _Key.get(), _Slot_key::size) == 0) {
+                return _Current;
+            }
+        }
+
+        return nullptr;
+    }
+
+    void manifest::_Store_counters() noexcept {
+        byte_t* const _Header = _Myview->data();
+        _Store_little_endian(_Header + 24, _Mycount);
+        _Store_little_endian(_Header + 32, _Mydeleted);
+    }
+
+    bool manifest::is_open() const noexcept {
+        return _Myview != nullptr;
+    }
+
+    uint64_t manifest::size() const noexcept {
+        return _Mycount;
+    }
+
+    bool manifest::find(const path& _Target, manifest_record& _Record) const {
+        const byte_t* const _Current = _Find_slot(_Make_key(_Target));
+        if (!_Current) {
+            return false;
+        }
+
+        _Record.size  = _Load_little_endian<uint64_t>(_Current + 40);
+        _Record.mtime = static_cast<int64_t>(_Load_little_endian<uint64_t>(_Current + 48));
+        _Record.digest.set(byte_string_view{_Current + 56, content_digest::size});
+        return true;
+    }
+
+    bool manifest::is_unchanged(const path& _Target, const uint64_t _Size, const int64_t _Mtime) const {
+        const byte_t* const _Current = _Find_slot(_Make_key(_Target));
+        return _Current && _Load_little_endian<uint64_t>(_Current + 40) == _Size
+            && static_cast<int64_t>(_Load_little_endian<uint64_t>(_Current + 48)) == _Mtime;
+    }
+
+    bool manifest::update(const path& _Target, const manifest_record& _Record) {
+        if (!_Myview) {
+            return false;
+        }
+
+        const _Slot_key _Key = _Make_key(_Target);
+        byte_t* _Current     = _Find_slot(_Key);
+        if (!_Current) { // a new record, keep the load factor at most 1/2
+            if ((_Mycount + _Mydeleted + 1) * 2 > _Mycapacity) {
+                const uint64_t _New_capacity = (_Mycount + 1) * 4 > _Mycapacity ? _Mycapacity * 2 : _Mycapacity;
+                if (!_Rehash(_New_capacity)) {
+                    _Myview.reset();
+                    return false;
+                }
+            }
+
+            const uint64_t _Mask = _Mycapacity - 1;
+            uint64_t _Idx        = _Load_little_endian<uint64_t>(_Key.get()) & _Mask;
+            while (_Slot(_Idx)[0] == _Used) {
+                _Idx = (_Idx + 1) & _Mask;
+            }
+
+            _Current = _Slot(_Idx);
+            if (_Current[0] == _Deleted) {
+                --_Mydeleted;
+            }
+
+            ++_Mycount;
+            ::memcpy(_Current + 8, _Key.get(), _Slot_key::size);
+            _Current[0] = _Used;
+            _Store_counters();
+        }
+
+        _Store_little_endian(_Current + 40, _Record.size);
+        _Store_little_endian(_Current + 48, static_cast<uint64_t>(_Record.mtime));
+        ::memcpy(_Current + 56, _Record.digest.get(), content_digest::size);
+        return true;
+    }
+
+    bool manifest::erase(const path& _Target) {
+        byte_t* const _Current = _Find_slot(_Make_key(_Target));
+        if (!_Current) {
+            return false;
+        }
+
+        _Current[0] = _Deleted; // keeps the probe sequences of other keys intact
+        --_Mycount;
+        ++_Mydeleted;
+        _Store_counters();
+        return true;
+    }
+
+    bool manifest::flush() noexcept {
+        return _Myview ? _Myview->flush() : false;
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,111 @@
+// manifest.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_MANIFEST_HPP_
+#define _FCRYPT_CRYPT_MANIFEST_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/checksum.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <fcrypt/fs/file_view.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace fcrypt {
+    // tries to compute the digest of the whole file
+    bool compute_digest(file& _File, content_digest& _Digest);
+
+    struct manifest_record { // the state of a file recorded after it has been processed
+        uint64_t size = 0;
+        int64_t mtime = 0; // the last write time (in file-time ticks)
+        content_digest digest; // the plaintext digest
+    };
+
+    // Note: The manifest is a persistent hash table with open addressing (linear probing). The file
+    //       consists of a header followed by fixed-size slots and is mapped into memory, so a lookup
+    //       touches a single slot in most cases and nothing has to be parsed when it is loaded.
+    //       A slot is keyed by the SHA-256 of the normalized path, which also gives a uniform hash.
+    //       A damaged manifest is never reset, the directory job fails until it is repaired or deleted.
+    //       A growing table is rebuilt in a temporary file, so an interrupted rehash loses no records.
+
+    class manifest { // records the processed files to skip the unchanged ones later
+    public:
+        explicit manifest(const path& _Target);
+        ~manifest() noexcept;
+
+        manifest(const manifest&) = delete;
+        manifest& operator=(const manifest&) = delete;
+
+        static constexpr size_t header_size    = 64;
+        static constexpr size_t slot_size      = 96;
+        static constexpr uint64_t min_capacity = 1024; // must be a power of two
+        static constexpr uint8_t version       = 1;
+        static constexpr uint64_t magic        = 0x464D'5450'5952'4346; // "FCRYPTMF"
+
+        // checks if the manifest has been loaded (a damaged manifest is not loaded and not modified)
+        bool is_open() const noexcept;
+
+        // returns the number of records
+        uint64_t size() const noexcept;
+
+        // tries to find the record of the file
+        bool find(const path& _Target, manifest_record& _Record) const;
+
+        // checks if the file has the recorded size and last write time
+        bool is_unchanged(const path& _Target, const uint64_t _Size, const int64_t _Mtime) const;
+
+        // tries to insert or replace the record of the file
+        bool update(const path& _Target, const manifest_record& _Record);
+
+        // tries to remove the record of the file
+        bool erase(const path& _Target);
+
+        // tries to write all changes to the disk
+        bool flush() noexcept;
+
+    private:
+        using _Slot_key = _Secure_buffer<32>;
+
+        enum _Slot_state : unsigned char {
+            _Empty   = 0,
+            _Used    = 1,
+            _Deleted = 2
+        };
+
+        // tries to initialize an empty manifest
+        bool _Initialize();
+
+        // tries to load an existing manifest or to initialize a new (empty) one, fails if the manifest is damaged
+        bool _Load();
+
+        // tries to map the header and all slots
+        bool _Map(const uint64_t _Capacity);
+
+        // tries to rebuild the table with the specified capacity in a file that replaces the manifest
+        bool _Rehash(const uint64_t _New_capacity);
+
+        // computes the key of the file
+        static _Slot_key _Make_key(const path& _Target);
+
+        // returns the slot at the specified index
+        byte_t* _Slot(const uint64_t _Idx) const noexcept;
+
+        // returns the slot that stores the key or nullptr
+        byte_t* _Find_slot(const _Slot_key& _Key) const noexcept;
+
+        // updates the counters stored in the header
+        void _Store_counters() noexcept;
+
+        path _Mypath;
+        ::std::unique_ptr<file> _Myfile; // reopened whenever the table is replaced
+        ::std::unique_ptr<file_view> _Myview;
+        uint64_t _Mycapacity;
+        uint64_t _Mycount; // the number of used slots
+        uint64_t _Mydeleted; // the number of deleted slots
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_MANIFEST_HPP_
\ No newline at end of file
@@ -0,0 +1,294 @@
+// metrics.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/metrics.hpp>
+#include <WinSock2.h>
+#include <cstdio>
+
+namespace fcrypt {
+    static size_t _Thread_shard() noexcept {
+        static ::std::atomic<size_t> _Next{0};
+        static thread_local const size_t _Shard =
+            _Next.fetch_add(1, ::std::memory_order_relaxed) % _Sharded_counter::shard_count;
+        return _Shard;
+    }
+
+    _Sharded_counter::_Sharded_counter() noexcept : _Myshards() {}
+
+    _Sharded_counter::~_Sharded_counter() noexcept {}
+
+    void _Sharded_counter::_Add(const uint64_t _Value) noexcept {
+        _Myshards[_Thread_shard()]._Value.fetch_add(_Value, ::std::memory_order_relaxed);
+    }
+
+    uint64_t _Sharded_counter::_Value() const noexcept {
+        uint64_t _Sum = 0;
+        for (const _Shard& _Current : _Myshards) {
+            _Sum += _Current._Value.load(::std::memory_order_relaxed);
+        }
+
+        return _Sum;
+    }
+
+    _Latency_histogram::_Latency_histogram() noexcept : _Mybuckets(), _Mysum() {}
+
+    _Latency_histogram::~_Latency_histogram() noexcept {}
+
+    uint64_t _Latency_histogram::_Upper_bound(const size_t _Bucket) noexcept {
+        // Note: The buckets cover single cipher calls (microseconds) as well as key derivations (seconds).
+        static constexpr uint64_t _Bounds[bucket_count - 1] = {1'000, 5'000, 25'000, 100'000, 500'000, 2'500'000,
+            10'000'000, 50'000'000, 250'000'000, 1'000'000'000, 5'000'000'000, 25'000'000'000};
+        return _Bucket < bucket_count - 1 ? _Bounds[_Bucket] : static_cast<uint64_t>(-1);
+    }
+
+    void _Latency_histogram::_Observe(const uint64_t _Nanoseconds) noexcept {
+        size_t _Bucket = 0;
+        while (_Bucket < bucket_count - 1 && _Nanoseconds > _Upper_bound(_Bucket)) {
+            ++_Bucket;
+        }
+
+        _Mybuckets[_Bucket]._Add(1);
+        _Mysum._Add(_Nanoseconds);
+    }
+
+    void _Latency_histogram::_Format(
+        ::std::string& _Text, const char* const _Name, const ::std::string& _Labels) const {
+        // Note: Prometheus expects cumulative buckets, so every bucket also counts the smaller ones.
+        //       Another thread may observe a latency meanwhile, so the sum may be slightly inconsistent
+        //       with the count, which is acceptable for monitoring.
+        const ::std::string _Prefix = _Labels.empty() ? ::std::string{} : _Labels + ',';
+        char _Buf[64];
+        uint64_t _Count = 0;
+        for (size_t _Bucket = 0; _Bucket < bucket_count; ++_Bucket) {
+            _Count += _Mybuckets[_Bucket]._Value();
+            if (_Bucket < bucket_count - 1) {
+                ::snprintf(_Buf, sizeof(_Buf), "%g", static_cast<double>(_Upper_bound(_Bucket)) / 1e9);
+            } else {
+                ::snprintf(_Buf, sizeof(_Buf), "+Inf");
+            }
+
+            _Text += ::std::string{_Name} + "_bucket{" + _Prefix + "le=\"" + _Buf + "\"} "
+                + ::std::to_string(_Count) + '\n';
+        }
+
+        ::snprintf(_Buf, sizeof(_Buf), "%.9f", static_cast<double>(_Mysum._Value()) / 1e9);
+        const ::std::string _Suffix = _Labels.empty() ? ::std::string{} : '{' + _Labels + '}';
+        _Text += ::std::string{_Name} + "_sum" + _Suffix + ' ' + _Buf + '\n';
+        _Text += ::std::string{_Name} + "_count" + _Suffix + ' ' + ::std::to_string(_Count) + '\n';
+    }
+
+    metrics_registry::metrics_registry() noexcept
+        : _Myfiles(), _Mybytes(), _Mykdf_failures(), _Mykdf(), _Mystages() {}
+
+    metrics_registry::~metrics_registry() noexcept {}
+
+    void metrics_registry::add_file(
+        const bool _Encrypt, const bool _Success, const bool _Skipped, const uint64_t _Bytes) noexcept {
+        const size_t _Operation = _Encrypt ? 1 : 0;
+        if (_Skipped) { // unchanged since the last run, nothing has been processed
+            _Myfiles[_Operation][_Result_skipped]._Add(1);
+        } else if (_Success) {
+            _Myfiles[_Operation][_Result_success]._Add(1);
+            _Mybytes[_Operation]._Add(_Bytes);
+        } else {
+            _Myfiles[_Operation][_Result_failure]._Add(1);
+        }
+    }
+
+    void metrics_registry::observe_kdf(const uint64_t _Nanoseconds, const bool _Success) noexcept {
+        _Mykdf._Observe(_Nanoseconds);
+        if (!_Success) {
+            _Mykdf_failures._Add(1);
+        }
+    }
+
+    void metrics_registry::observe_stage(const stage _Stage, const uint64_t _Nanoseconds) noexcept {
+        const size_t _Idx = static_cast<size_t>(_Stage);
+        if (_Idx < stage_stats::stage_count) {
+            _Mystages[_Idx]._Observe(_Nanoseconds);
+        }
+    }
+
+    ::std::string metrics_registry::format() const {
+        static constexpr const char* _Operations[] = {"decrypt", "encrypt"};
+        static constexpr const char* _Results[]    = {"success", "failure", "skipped"};
+        ::std::string _Text;
+        _Text += "# HELP fcrypt_files_total The number of files processed by directory jobs.\n"
+                 "# TYPE fcrypt_files_total counter\n";
+        for (size_t _Operation = 0; _Operation < 2; ++_Operation) {
+            for (size_t _Res = 0; _Res < _Result_count; ++_Res) {
+                _Text += ::std::string{"fcrypt_files_total{operation=\""} + _Operations[_Operation]
+                    + "\",result=\"" + _Results[_Res] + "\"} " + ::std::to_string(_Myfiles[_Operation][_Res]._Value())
+                    + '\n';
+            }
+        }
+
+        _Text += "# HELP fcrypt_bytes_total The number of bytes in files successfully processed by directory jobs.\n"
+                 "# TYPE fcrypt_bytes_total counter\n";
+        for (size_t _Operation = 0; _Operation < 2; ++_Operation) {
+            _Text += ::std::string{"fcrypt_bytes_total{operation=\""} + _Operations[_Operation] + "\"} "
+                + ::std::to_string(_Mybytes[_Operation]._Value()) + '\n';
+        }
+
+        _Text += "# HELP fcrypt_kdf_failures_total The number of failed key derivations.\n"
+                 "# TYPE fcrypt_kdf_failures_total counter\n"
+                 "fcrypt_kdf_failures_total " + ::std::to_string(_Mykdf_failures._Value()) + '\n';
+        _Text += "# HELP fcrypt_kdf_duration_seconds The duration of key derivations.\n"
+                 "# TYPE fcrypt_kdf_duration_seconds histogram\n";
+        _Mykdf._Format(_Text, "fcrypt_kdf_duration_seconds", ::std::string{});
+        if (stage_stats_enabled()) { // the stages are timed only with the statistics enabled
+            _Text += "# HELP fcrypt_stage_duration_seconds The duration of single calls of every stage.\n"
+                     "# TYPE fcrypt_stage_duration_seconds histogram\n";
+            for (size_t _Idx = 0; _Idx < stage_stats::stage_count; ++_Idx) {
+                _Mystages[_Idx]._Format(_Text, "fcrypt_stage_duration_seconds",
+                    ::std::string{"stage=\""} + stage_name(static_cast<stage>(_Idx)) + '"');
+            }
+        }
+
+        return _Text;
+    }
+
+    bool metrics_registry::write(const path& _Target) const {
+        // Note: The metrics are written to a temporary file that replaces the target, so a collector
+        //       that reads the target never sees a partially written file.
+        const ::std::string _Text = format();
+        path _Temp                = _Target;
+        _Temp                    += L".tmp";
+        {
+            file _Output(_Temp, open_mode::create_always);
+            if (!_Output.is_open()
+                || !_Output.write(byte_string_view{reinterpret_cast<const byte_t*>(_Text.data()), _Text.size()})) {
+                return false;
+            }
+        }
+
+        ::std::error_code _Ec;
+        ::std::filesystem::rename(_Temp, _Target, _Ec);
+        return !_Ec;
+    }
+
+    static ::std::atomic<metrics_registry*> _Installed_registry{nullptr};
+
+    void set_metrics_registry(metrics_registry* const _Registry) noexcept {
+        _Installed_registry.store(_Registry, ::std::memory_order_release);
+    }
+
+    metrics_registry* get_metrics_registry() noexcept {
+        return _Installed_registry.load(::std::memory_order_acquire);
+    }
+
+#ifdef _FCRYPT_STAGE_STATS
+    void _Observe_stage_latency(const stage _Stage, const uint64_t _Nanoseconds) noexcept {
+        metrics_registry* const _Registry = get_metrics_registry();
+        if (_Registry) {
+            _Registry->observe_stage(_Stage, _Nanoseconds);
+        }
+    }
+#endif // _FCRYPT_STAGE_STATS
+
+    metrics_endpoint::metrics_endpoint(const metrics_registry& _Registry) noexcept
+        : _Myregistry(_Registry), _Mysocket(static_cast<uintptr_t>(INVALID_SOCKET)), _Mythread(), _Mystarted(false) {}
+
+    metrics_endpoint::~metrics_endpoint() noexcept {
+        stop();
+    }
+
+    bool metrics_endpoint::start(const uint16_t _Port) {
+        if (_Mystarted) { // already running
+            return false;
+        }
+
+        WSADATA _Data;
+        if (::WSAStartup(MAKEWORD(2, 2), &_Data) != 0) {
+            return false;
+        }
+
+        _Mystarted           = true;
+        const SOCKET _Socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (_Socket == INVALID_SOCKET) {
+            stop();
+            return false;
+        }
+
+        sockaddr_in _Addr     = {};
+        _Addr.sin_family      = AF_INET;
+        _Addr.sin_port        = ::htons(_Port);
+        _Addr.sin_addr.s_addr = ::htonl(INADDR_LOOPBACK); // never exposed outside the machine
+        _Mysocket             = static_cast<uintptr_t>(_Socket);
+        if (::bind(_Socket, reinterpret_cast<const sockaddr*>(&_Addr), sizeof(_Addr)) == SOCKET_ERROR
+            || ::listen(_Socket, SOMAXCONN) == SOCKET_ERROR) {
+            stop();
+            return false;
+        }
+
+        try {
+            _Mythread = ::std::thread(&metrics_endpoint::_Serve, this);
+        } catch (...) {
+            stop();
+            return false;
+        }
+
+        return true;
+    }
+
+    void metrics_endpoint::stop() noexcept {
+        if (_Mysocket != static_cast<uintptr_t>(INVALID_SOCKET)) {
+            ::closesocket(static_cast<SOCKET>(_Mysocket)); // accept() fails and the serving thread ends
+        }
+
+        if (_Mythread.joinable()) {
+            _Mythread.join();
+        }
+
+        _Mysocket = static_cast<uintptr_t>(INVALID_SOCKET);
+        if (_Mystarted) {
+            ::WSACleanup();
+            _Mystarted = false;
+        }
+    }
+
+    bool metrics_endpoint::is_running() const noexcept {
+        return _Mythread.joinable();
+    }
+
+    void metrics_endpoint::_Serve() noexcept {
+        const SOCKET _Listener = static_cast<SOCKET>(_Mysocket);
+        for (;;) {
+            const SOCKET _Client = ::accept(_Listener, nullptr, nullptr);
+            if (_Client == INVALID_SOCKET) { // the socket has been closed
+                break;
+            }
+
+            // Note: The request is not parsed, every request is answered with the metrics. A client that
+            //       sends nothing cannot block the endpoint for longer than the receive timeout.
+            const DWORD _Timeout = 1000;
+            ::setsockopt(_Client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char*>(&_Timeout), sizeof(_Timeout));
+            char _Request[4096];
+            if (::recv(_Client, _Request, static_cast<int>(sizeof(_Request)), 0) > 0) {
+                try {
+                    const ::std::string _Body     = _Myregistry.format();
+                    const ::std::string _Response = "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                        "Content-Length: " + ::std::to_string(_Body.size()) + "\r\n"
+                        "Connection: close\r\n\r\n" + _Body;
+                    size_t _Sent = 0;
+                    while (_Sent < _Response.size()) {
+                        const int _Count = ::send(_Client, _Response.data() + _Sent,
+                            static_cast<int>(_Min(_Response.size() - _Sent, size_t{65536})), 0);
+                        if (_Count <= 0) {
+                            break;
+                        }
+
+                        _Sent += static_cast<size_t>(_Count);
+                    }
+                } catch (...) { // out of memory, drop the connection
+                }
+            }
+
+            ::shutdown(_Client, SD_SEND);
+            ::closesocket(_Client);
+        }
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,143 @@
+// metrics.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_METRICS_HPP_
+#define _FCRYPT_CRYPT_METRICS_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+namespace fcrypt {
+    // Note: The library reports to the registry installed by set_metrics_registry(), so batch runs and
+    //       resident services can be scraped without instrumenting their own code. Every counter is split
+    //       into shards (one cache line each), a thread always updates the same shard, so concurrent
+    //       workers do not contend for a single cache line. The shards are summed only when the metrics
+    //       are formatted. The per-stage latencies are reported only if the library is compiled with
+    //       _FCRYPT_STAGE_STATS defined, the other metrics are always reported. metrics_endpoint uses
+    //       Winsock, so the application must be linked with Ws2_32.lib.
+
+    class _Sharded_counter { // a counter that can be incremented by many threads without contention
+    public:
+        static constexpr size_t shard_count = 16;
+
+        _Sharded_counter() noexcept;
+        ~_Sharded_counter() noexcept;
+
+        _Sharded_counter(const _Sharded_counter&) = delete;
+        _Sharded_counter& operator=(const _Sharded_counter&) = delete;
+
+        // adds the value to the shard of the calling thread
+        void _Add(const uint64_t _Value) noexcept;
+
+        // returns the sum of all shards
+        uint64_t _Value() const noexcept;
+
+    private:
+        struct alignas(64) _Shard {
+            ::std::atomic<uint64_t> _Value{0};
+        };
+
+        _Shard _Myshards[shard_count];
+    };
+
+    class _Latency_histogram { // counts observed latencies in fixed buckets
+    public:
+        static constexpr size_t bucket_count = 13; // the last bucket has no upper bound (+Inf)
+
+        _Latency_histogram() noexcept;
+        ~_Latency_histogram() noexcept;
+
+        _Latency_histogram(const _Latency_histogram&) = delete;
+        _Latency_histogram& operator=(const _Latency_histogram&) = delete;
+
+        // returns the upper bound of the bucket (in nanoseconds), the last bucket has no upper bound
+        static uint64_t _Upper_bound(const size_t _Bucket) noexcept;
+
+        // records the latency (in nanoseconds)
+        void _Observe(const uint64_t _Nanoseconds) noexcept;
+
+        // appends the histogram in the Prometheus text format
+        void _Format(::std::string& _Text, const char* const _Name, const ::std::string& _Labels) const;
+
+    private:
+        _Sharded_counter _Mybuckets[bucket_count];
+        _Sharded_counter _Mysum; // in nanoseconds
+    };
+
+    class metrics_registry { // collects the metrics reported by the library
+    public:
+        metrics_registry() noexcept;
+        ~metrics_registry() noexcept;
+
+        metrics_registry(const metrics_registry&) = delete;
+        metrics_registry& operator=(const metrics_registry&) = delete;
+
+        // records a file processed by a directory job
+        void add_file(const bool _Encrypt, const bool _Success, const bool _Skipped, const uint64_t _Bytes) noexcept;
+
+        // records a key derivation
+        void observe_kdf(const uint64_t _Nanoseconds, const bool _Success) noexcept;
+
+        // records a single call of the stage
+        void observe_stage(const stage _Stage, const uint64_t _Nanoseconds) noexcept;
+
+        // returns the metrics in the Prometheus text exposition format (version 0.0.4)
+        ::std::string format() const;
+
+        // tries to write the metrics to the file (e.g. for the node exporter's textfile collector)
+        bool write(const path& _Target) const;
+
+    private:
+        enum _Result : unsigned char { _Result_success, _Result_failure, _Result_skipped, _Result_count };
+
+        _Sharded_counter _Myfiles[2][_Result_count]; // [decrypt/encrypt][result]
+        _Sharded_counter _Mybytes[2]; // [decrypt/encrypt]
+        _Sharded_counter _Mykdf_failures;
+        _Latency_histogram _Mykdf;
+        _Latency_histogram _Mystages[stage_stats::stage_count];
+    };
+
+    // installs the registry used by the library (nullptr disables the metrics),
+    // the registry must outlive every job that runs while it is installed
+    void set_metrics_registry(metrics_registry* const _Registry) noexcept;
+
+    // returns the installed registry or nullptr
+    metrics_registry* get_metrics_registry() noexcept;
+
+    class metrics_endpoint { // serves the metrics over HTTP on the loopback interface
+    public:
+        explicit metrics_endpoint(const metrics_registry& _Registry) noexcept;
+        ~metrics_endpoint() noexcept;
+
+        metrics_endpoint(const metrics_endpoint&) = delete;
+        metrics_endpoint& operator=(const metrics_endpoint&) = delete;
+
+        // tries to listen on 127.0.0.1:_Port, every request is answered with the current metrics
+        bool start(const uint16_t _Port);
+
+        // stops listening and waits for the serving thread
+        void stop() noexcept;
+
+        // checks if the endpoint is listening
+        bool is_running() const noexcept;
+
+    private:
+        // accepts connections until the socket is closed
+        void _Serve() noexcept;
+
+        const metrics_registry& _Myregistry;
+        uintptr_t _Mysocket; // the listening SOCKET, kept as an integer to avoid <WinSock2.h> here
+        ::std::thread _Mythread;
+        bool _Mystarted; // true if WSAStartup() succeeded
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_METRICS_HPP_
\ No newline at end of file
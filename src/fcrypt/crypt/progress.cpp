@@ -0,0 +1,84 @@
+// progress.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/progress.hpp>
+
+namespace fcrypt {
+    progress_observer::progress_observer() noexcept {}
+
+    progress_observer::~progress_observer() noexcept {}
+
+    cancellation_token::cancellation_token() noexcept : _Mycancelled(false) {}
+
+    cancellation_token::~cancellation_token() noexcept {}
+
+    void cancellation_token::cancel() noexcept {
+        _Mycancelled.store(true, ::std::memory_order_relaxed);
+    }
+
+    bool cancellation_token::is_cancelled() const noexcept {
+        return _Mycancelled.load(::std::memory_order_relaxed);
+    }
+
+    void cancellation_token::reset() noexcept {
+        _Mycancelled.store(false, ::std::memory_order_relaxed);
+    }
+
+    _Progress_tracker::_Progress_tracker(progress_observer* const _Observer,
+        const ::std::chrono::milliseconds _Interval, const cancellation_token* const _Token,
+        const uint64_t _Total) noexcept
+        : _Myobserver(_Observer), _Mytoken(_Token), _Myinterval(_Interval), _Mytotal(_Total), _Myprocessed(0),
+        _Mychecked(0), _Myreported(0), _Mystart(_Observer ? _Clock::now() : _Clock::time_point{}), _Mylast(_Mystart) {}
+
+    _Progress_tracker::~_Progress_tracker() noexcept {}
+
+    void _Progress_tracker::_Report(const _Clock::time_point _Now) noexcept {
+        using ::std::chrono::duration;
+        using ::std::chrono::duration_cast;
+        using ::std::chrono::milliseconds;
+        progress_info _Info;
+        _Info.processed      = _Myprocessed;
+        _Info.total          = _Mytotal;
+        _Info.elapsed        = duration_cast<milliseconds>(_Now - _Mystart);
+        const double _Recent = duration<double>(_Now - _Mylast).count();
+        if (_Recent > 0.0) {
+            _Info.throughput = static_cast<double>(_Myprocessed - _Myreported) / _Recent;
+        }
+
+        const double _Total = duration<double>(_Now - _Mystart).count();
+        if (_Total > 0.0 && _Myprocessed > 0 && _Myprocessed < _Mytotal) {
+            const double _Average   = static_cast<double>(_Myprocessed) / _Total;
+            const double _Remaining = static_cast<double>(_Mytotal - _Myprocessed) / _Average;
+            _Info.eta               = milliseconds{static_cast<int64_t>(_Remaining * 1000.0)};
+        }
+
+        _Myobserver->on_progress(_Info);
+        _Myreported = _Myprocessed;
+        _Mylast     = _Now;
+    }
+
+    bool _Progress_tracker::_Advance(const uint64_t _Bytes) noexcept {
+        _Myprocessed += _Bytes;
+        if (_Myobserver && _Myprocessed - _Mychecked >= check_interval) {
+            _Mychecked      = _Myprocessed;
+            const auto _Now = _Clock::now();
+            if (_Now - _Mylast >= _Myinterval) {
+                _Report(_Now);
+            }
+        }
+
+        return !_Mytoken || !_Mytoken->is_cancelled();
+    }
+
+    void _Progress_tracker::_Complete() noexcept {
+        if (_Myobserver) {
+            _Report(_Clock::now());
+        }
+    }
+
+    uint64_t _Progress_tracker::_Processed() const noexcept {
+        return _Myprocessed;
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,91 @@
+// progress.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_PROGRESS_HPP_
+#define _FCRYPT_CRYPT_PROGRESS_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace fcrypt {
+    struct progress_info { // the state of a running job
+        uint64_t processed = 0; // the number of bytes processed so far
+        uint64_t total     = 0; // the number of bytes to be processed
+        double throughput  = 0.0; // the throughput since the last report (in bytes per second)
+        ::std::chrono::milliseconds elapsed{0}; // the time since the job started
+        ::std::chrono::milliseconds eta{0}; // the estimated remaining time (based on the average throughput)
+    };
+
+    class __declspec(novtable) progress_observer { // base class for all progress observers
+    public:
+        progress_observer() noexcept;
+        virtual ~progress_observer() noexcept;
+
+        // called from the thread that runs the job, must return quickly
+        virtual void on_progress(const progress_info& _Info) noexcept = 0;
+    };
+
+    class cancellation_token { // requests a job to stop at the next block boundary
+    public:
+        cancellation_token() noexcept;
+        ~cancellation_token() noexcept;
+
+        cancellation_token(const cancellation_token&) = delete;
+        cancellation_token& operator=(const cancellation_token&) = delete;
+
+        // requests the cancellation (may be called from any thread)
+        void cancel() noexcept;
+
+        // checks if the cancellation has been requested
+        bool is_cancelled() const noexcept;
+
+        // clears the request, so the token can be used for another job
+        void reset() noexcept;
+
+    private:
+        ::std::atomic<bool> _Mycancelled;
+    };
+
+    class _Progress_tracker { // reports the progress of a single job and checks its cancellation
+    public:
+        explicit _Progress_tracker(progress_observer* const _Observer, const ::std::chrono::milliseconds _Interval,
+            const cancellation_token* const _Token, const uint64_t _Total) noexcept;
+        ~_Progress_tracker() noexcept;
+
+        _Progress_tracker(const _Progress_tracker&) = delete;
+        _Progress_tracker& operator=(const _Progress_tracker&) = delete;
+
+        static constexpr uint64_t check_interval = 1048576; // the clock is read at most once per 1 MiB
+
+        // adds the processed bytes, returns false if the job has been cancelled
+        bool _Advance(const uint64_t _Bytes) noexcept;
+
+        // reports the final state (even if the interval has not elapsed yet)
+        void _Complete() noexcept;
+
+        // returns the number of processed bytes
+        uint64_t _Processed() const noexcept;
+
+    private:
+        using _Clock = ::std::chrono::steady_clock;
+
+        // reports the current state to the observer
+        void _Report(const _Clock::time_point _Now) noexcept;
+
+        progress_observer* _Myobserver;
+        const cancellation_token* _Mytoken;
+        ::std::chrono::milliseconds _Myinterval;
+        uint64_t _Mytotal;
+        uint64_t _Myprocessed;
+        uint64_t _Mychecked; // the number of processed bytes when the clock was read last time
+        uint64_t _Myreported; // the number of processed bytes at the last report
+        _Clock::time_point _Mystart;
+        _Clock::time_point _Mylast; // the time of the last report
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_PROGRESS_HPP_
\ No newline at end of file
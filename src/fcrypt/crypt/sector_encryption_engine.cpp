@@ -0,0 +1,173 @@
+// sector_encryption_engine.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/sector_encryption_engine.hpp>
+#include <fcrypt/details/botan_aes256_xts.hpp>
+#include <fcrypt/details/task_scheduler.hpp>
+#include <atomic>
+#include <cstring>
+
+namespace fcrypt {
+    sector_encryption_engine::sector_encryption_engine(file& _File) noexcept
+        : _Myfile(_File), _Mycipher(), _Mybuf() {}
+
+    sector_encryption_engine::~sector_encryption_engine() noexcept {
+        if (!_Mybuf.empty()) {
+            _Scrub_memory(_Mybuf.data(), _Mybuf.size());
+        }
+    }
+
+    bool sector_encryption_engine::setup(const key& _Key) noexcept {
+        if (!_Mycipher) {
+            _Mycipher = ::std::make_unique<_Botan_aes256_xts>();
+        }
+
+        return _Mycipher->_Set_key(_Key);
+    }
+
+    uint64_t sector_encryption_engine::sector_count() const noexcept {
+        return _Myfile.size() / sector_size;
+    }
+
+    bool sector_encryption_engine::read_sectors(
+        const uint64_t _First, byte_t* const _Buf, const size_t _Count) noexcept {
+        if (!_Mycipher || _Count == 0) {
+            return false;
+        }
+
+        const size_t _Bytes = _Count * sector_size;
+        if (_Myfile.read_sectors(_First, _Buf, _Count) != _Bytes) {
+            return false;
+        }
+
+        for (size_t _Idx = 0; _Idx < _Count; ++_Idx) {
+            if (!_Mycipher->_Decrypt_sector(_First + _Idx, _Buf + _Idx * sector_size, sector_size)) {
+                _Scrub_memory(_Buf, _Bytes);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool sector_encryption_engine::write_sectors(
+        const uint64_t _First, const byte_t* const _Data, const size_t _Count) noexcept {
+        if (!_Mycipher || _Count == 0) {
+            return false;
+        }
+
+        if (_Mybuf.empty()) {
+            try {
+                _Mybuf.resize(batch_size * sector_size);
+            } catch (...) {
+                return false;
+            }
+        }
+
+        for (size_t _Done = 0; _Done < _Count;) { // encrypt a copy, the caller's data remains untouched
+            const size_t _Batch = _Min(batch_size, _Count - _Done);
+            ::memcpy(_Mybuf.data(), _Data + _Done * sector_size, _Batch * sector_size);
+            for (size_t _Idx = 0; _Idx < _Batch; ++_Idx) {
+                const uint64_t _Sector = _First + _Done + _Idx;
+                if (!_Mycipher->_Encrypt_sector(_Sector, _Mybuf.data() + _Idx * sector_size, sector_size)) {
+                    return false;
+                }
+            }
+
+            if (!_Myfile.write_sectors(_First + _Done, byte_string_view{_Mybuf.data(), _Batch * sector_size})) {
+                return false;
+            }
+
+            _Done += _Batch;
+        }
+
+        return true;
+    }
+
+    bool sector_encryption_engine::_Process_file(const key& _Key, const size_t _Threads, const bool _Encrypt) {
+        const uint64_t _Size = _Myfile.size();
+        if (_Size % sector_size != 0) { // XTS cannot process a partial sector without size expansion
+            return false;
+        }
+
+        const uint64_t _Sectors = _Size / sector_size;
+        const uint64_t _Batches = (_Sectors + batch_size - 1) / batch_size;
+        if (_Batches == 0) { // nothing to process, do nothing
+            return true;
+        }
+
+        struct _Worker_state { // every worker needs its own cipher and buffer
+            _Botan_aes256_xts _Cipher;
+            ::std::vector<byte_t> _Buf;
+        };
+
+        const uint64_t _Requested = static_cast<uint64_t>(_Threads != 0 ? _Threads : 1);
+        const size_t _Workers     = static_cast<size_t>(_Min(_Requested, _Batches));
+        ::std::vector<::std::unique_ptr<_Worker_state>> _States(_Workers);
+        for (::std::unique_ptr<_Worker_state>& _State : _States) {
+            _State = ::std::make_unique<_Worker_state>();
+            if (!_State->_Cipher._Set_key(_Key)) {
+                return false;
+            }
+
+            _State->_Buf.resize(batch_size * sector_size);
+        }
+
+        ::std::atomic<bool> _Success{true};
+        const auto _Process_batch = [&](const uint64_t _Batch, const size_t _Worker) noexcept {
+            _Worker_state& _State = *_States[_Worker];
+            const uint64_t _First = _Batch * batch_size;
+            const size_t _Count   = static_cast<size_t>(_Min(static_cast<uint64_t>(batch_size), _Sectors - _First));
+            const size_t _Bytes   = _Count * sector_size;
+            if (_Myfile.read_sectors(_First, _State._Buf.data(), _Count) != _Bytes) {
+                _Success = false;
+                return;
+            }
+
+            for (size_t _Idx = 0; _Idx < _Count; ++_Idx) {
+                byte_t* const _Sector = _State._Buf.data() + _Idx * sector_size;
+                const bool _Result    = _Encrypt ? _State._Cipher._Encrypt_sector(_First + _Idx, _Sector, sector_size)
+                                                 : _State._Cipher._Decrypt_sector(_First + _Idx, _Sector, sector_size);
+                if (!_Result) {
+                    _Success = false;
+                    return;
+                }
+            }
+
+            if (!_Myfile.write_sectors(_First, byte_string_view{_State._Buf.data(), _Bytes})) {
+                _Success = false;
+            }
+        };
+
+        if (_Workers == 1) { // no need to start any threads
+            for (uint64_t _Batch = 0; _Batch < _Batches && _Success; ++_Batch) {
+                _Process_batch(_Batch, 0);
+            }
+        } else {
+            _Task_scheduler _Scheduler(_Workers);
+            _Scheduler._Submit_range(0, _Batches, ::std::make_shared<const _Task_scheduler::_Range_task>(
+                [&](const uint64_t _Batch, const size_t _Worker) {
+                    if (_Success.load(::std::memory_order_relaxed)) {
+                        _Process_batch(_Batch, _Worker);
+                    }
+                }));
+            _Scheduler._Wait();
+        }
+
+        for (::std::unique_ptr<_Worker_state>& _State : _States) {
+            _Scrub_memory(_State->_Buf.data(), _State->_Buf.size());
+        }
+
+        return _Success;
+    }
+
+    bool sector_encryption_engine::encrypt(const key& _Key, const size_t _Threads) {
+        return _Process_file(_Key, _Threads, true);
+    }
+
+    bool sector_encryption_engine::decrypt(const key& _Key, const size_t _Threads) {
+        return _Process_file(_Key, _Threads, false);
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,65 @@
+// sector_encryption_engine.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_SECTOR_ENCRYPTION_ENGINE_HPP_
+#define _FCRYPT_CRYPT_SECTOR_ENCRYPTION_ENGINE_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace fcrypt {
+    class _Botan_aes256_xts;
+
+    // Note: The sector engine encrypts the file with AES-256-XTS, every sector is encrypted
+    //       independently with its number as the tweak. The ciphertext has the same size as
+    //       the plaintext and there is no metadata, so any sector can be read or written without
+    //       touching the others. XTS provides confidentiality only, it cannot detect modifications.
+    //       The file size must be a multiple of the sector size, which holds for disk images.
+
+    class sector_encryption_engine { // encrypts the file at sector granularity
+    public:
+        explicit sector_encryption_engine(file& _File) noexcept;
+        ~sector_encryption_engine() noexcept;
+
+        sector_encryption_engine(const sector_encryption_engine&) = delete;
+        sector_encryption_engine& operator=(const sector_encryption_engine&) = delete;
+
+        static constexpr size_t sector_size = file::sector_size;
+        static constexpr size_t batch_size  = 256; // the number of sectors processed at once (1 MiB)
+
+        // tries to prepare the engine, the XTS keys are expanded from _Key
+        bool setup(const key& _Key) noexcept;
+
+        // returns the number of sectors in the file
+        uint64_t sector_count() const noexcept;
+
+        // tries to read and decrypt _Count sectors starting at the sector _First
+        bool read_sectors(const uint64_t _First, byte_t* const _Buf, const size_t _Count) noexcept;
+
+        // tries to encrypt and write _Count sectors starting at the sector _First
+        bool write_sectors(const uint64_t _First, const byte_t* const _Data, const size_t _Count) noexcept;
+
+        // tries to encrypt the whole file in place using _Threads threads
+        bool encrypt(const key& _Key, const size_t _Threads = 1);
+
+        // tries to decrypt the whole file in place using _Threads threads
+        bool decrypt(const key& _Key, const size_t _Threads = 1);
+
+    private:
+        // tries to transform the whole file in place, every worker has its own cipher
+        bool _Process_file(const key& _Key, const size_t _Threads, const bool _Encrypt);
+
+        file& _Myfile;
+        ::std::unique_ptr<_Botan_aes256_xts> _Mycipher;
+        ::std::vector<byte_t> _Mybuf; // the scratch buffer for write_sectors()
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_SECTOR_ENCRYPTION_ENGINE_HPP_
\ No newline at end of file
@@ -0,0 +1,205 @@
+// stage_stats.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/stage_stats.hpp>
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+#include <Psapi.h>
+#endif // _FCRYPT_HARDWARE_COUNTERS
+
+namespace fcrypt {
+    stage_stats& stage_stats::operator+=(const stage_stats& _Other) noexcept {
+        for (size_t _Idx = 0; _Idx < stage_count; ++_Idx) {
+            calls[_Idx]       += _Other.calls[_Idx];
+            bytes[_Idx]       += _Other.bytes[_Idx];
+            nanoseconds[_Idx] += _Other.nanoseconds[_Idx];
+            cycles[_Idx]       += _Other.cycles[_Idx];
+            instructions[_Idx] += _Other.instructions[_Idx];
+            cache_misses[_Idx] += _Other.cache_misses[_Idx];
+        }
+
+        page_faults += _Other.page_faults;
+        return *this;
+    }
+
+    stage_stats& stage_stats::operator-=(const stage_stats& _Other) noexcept {
+        for (size_t _Idx = 0; _Idx < stage_count; ++_Idx) {
+            calls[_Idx]       -= _Other.calls[_Idx];
+            bytes[_Idx]       -= _Other.bytes[_Idx];
+            nanoseconds[_Idx] -= _Other.nanoseconds[_Idx];
+            cycles[_Idx]       -= _Other.cycles[_Idx];
+            instructions[_Idx] -= _Other.instructions[_Idx];
+            cache_misses[_Idx] -= _Other.cache_misses[_Idx];
+        }
+
+        page_faults -= _Other.page_faults;
+        return *this;
+    }
+
+    uint64_t stage_stats::calls_of(const stage _Stage) const noexcept {
+        return calls[static_cast<size_t>(_Stage)];
+    }
+
+    uint64_t stage_stats::bytes_of(const stage _Stage) const noexcept {
+        return bytes[static_cast<size_t>(_Stage)];
+    }
+
+    uint64_t stage_stats::nanoseconds_of(const stage _Stage) const noexcept {
+        return nanoseconds[static_cast<size_t>(_Stage)];
+    }
+
+    uint64_t stage_stats::cycles_of(const stage _Stage) const noexcept {
+        return cycles[static_cast<size_t>(_Stage)];
+    }
+
+    uint64_t stage_stats::instructions_of(const stage _Stage) const noexcept {
+        return instructions[static_cast<size_t>(_Stage)];
+    }
+
+    uint64_t stage_stats::cache_misses_of(const stage _Stage) const noexcept {
+        return cache_misses[static_cast<size_t>(_Stage)];
+    }
+
+    double stage_stats::cycles_per_byte(const stage _Stage) const noexcept {
+        const size_t _Idx = static_cast<size_t>(_Stage);
+        return bytes[_Idx] != 0 ? static_cast<double>(cycles[_Idx]) / static_cast<double>(bytes[_Idx]) : 0.0;
+    }
+
+    double stage_stats::instructions_per_cycle(const stage _Stage) const noexcept {
+        const size_t _Idx = static_cast<size_t>(_Stage);
+        return cycles[_Idx] != 0 ? static_cast<double>(instructions[_Idx]) / static_cast<double>(cycles[_Idx]) : 0.0;
+    }
+
+    bool hardware_counters_available() noexcept {
+#if defined(_FCRYPT_STAGE_STATS) && defined(_FCRYPT_HARDWARE_COUNTERS)
+        static const bool _Available = [] {
+            _Hardware_sample _Sample;
+            return _Sample_hardware_counters(_Sample);
+        }();
+        return _Available;
+#else // ^^^ _FCRYPT_STAGE_STATS && _FCRYPT_HARDWARE_COUNTERS ^^^ / vvv otherwise vvv
+        return false;
+#endif // _FCRYPT_STAGE_STATS && _FCRYPT_HARDWARE_COUNTERS
+    }
+
+#ifdef _FCRYPT_STAGE_STATS
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+    class _Thread_profiling { // the profiling of the hardware counters of a single thread
+    public:
+        static constexpr DWORD64 _Instructions_counter = 0; // the counter configured to count the instructions
+        static constexpr DWORD64 _Cache_miss_counter   = 1; // the counter configured to count the cache misses
+
+        _Thread_profiling() noexcept : _Myhandle(nullptr) {
+            const DWORD64 _Counters = (DWORD64{1} << _Instructions_counter) | (DWORD64{1} << _Cache_miss_counter);
+            if (::EnableThreadProfiling(::GetCurrentThread(), 0, _Counters, &_Myhandle) != ERROR_SUCCESS) {
+                _Myhandle = nullptr; // the counters are not configured, only the cycles are sampled
+            }
+        }
+
+        ~_Thread_profiling() noexcept {
+            if (_Myhandle) {
+                ::DisableThreadProfiling(_Myhandle);
+            }
+        }
+
+        _Thread_profiling(const _Thread_profiling&) = delete;
+        _Thread_profiling& operator=(const _Thread_profiling&) = delete;
+
+        // tries to read all counters with a single call
+        bool _Read(_Hardware_sample& _Sample) noexcept {
+            if (!_Myhandle) {
+                return false;
+            }
+
+            PERFORMANCE_DATA _Data = {0};
+            _Data.Size             = sizeof(_Data);
+            _Data.Version          = PERFORMANCE_DATA_VERSION;
+            if (::ReadThreadProfilingData(_Myhandle, READ_THREAD_PROFILING_FLAG_HARDWARE_COUNTERS, &_Data)
+                    != ERROR_SUCCESS
+                || _Data.HwCountersCount <= _Cache_miss_counter) {
+                return false;
+            }
+
+            _Sample._Cycles       = static_cast<uint64_t>(_Data.CycleTime);
+            _Sample._Instructions = static_cast<uint64_t>(_Data.HwCounters[_Instructions_counter].Value);
+            _Sample._Cache_misses = static_cast<uint64_t>(_Data.HwCounters[_Cache_miss_counter].Value);
+            return true;
+        }
+
+    private:
+        HANDLE _Myhandle; // nullptr if the profiling is unavailable
+    };
+#endif // _FCRYPT_HARDWARE_COUNTERS
+
+    bool _Sample_hardware_counters(_Hardware_sample& _Sample) noexcept {
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+        static thread_local _Thread_profiling _Profiling; // enabled on the first sample of every thread
+        if (_Profiling._Read(_Sample)) {
+            return true;
+        }
+
+        ULONG64 _Cycles = 0;
+        if (!::QueryThreadCycleTime(::GetCurrentThread(), &_Cycles)) {
+            return false;
+        }
+
+        _Sample._Cycles       = static_cast<uint64_t>(_Cycles);
+        _Sample._Instructions = 0;
+        _Sample._Cache_misses = 0;
+        return true;
+#else // ^^^ _FCRYPT_HARDWARE_COUNTERS ^^^ / vvv !_FCRYPT_HARDWARE_COUNTERS vvv
+        _Sample = _Hardware_sample{}; // the counters are disabled
+        return false;
+#endif // _FCRYPT_HARDWARE_COUNTERS
+    }
+
+    bool _Sample_page_faults(uint64_t& _Faults) noexcept {
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+        PROCESS_MEMORY_COUNTERS _Counters = {0};
+        _Counters.cb                      = sizeof(_Counters);
+        if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &_Counters, sizeof(_Counters))) {
+            return false;
+        }
+
+        _Faults = static_cast<uint64_t>(_Counters.PageFaultCount);
+        return true;
+#else // ^^^ _FCRYPT_HARDWARE_COUNTERS ^^^ / vvv !_FCRYPT_HARDWARE_COUNTERS vvv
+        _Faults = 0; // the counters are disabled
+        return false;
+#endif // _FCRYPT_HARDWARE_COUNTERS
+    }
+#endif // _FCRYPT_STAGE_STATS
+
+    const char* stage_name(const stage _Stage) noexcept {
+        switch (_Stage) {
+        case stage::derive_key:
+            return "derive_key";
+        case stage::read:
+            return "read";
+        case stage::cipher:
+            return "cipher";
+        case stage::seek_back:
+            return "seek_back";
+        case stage::write:
+            return "write";
+        case stage::save_metadata:
+            return "save_metadata";
+        case stage::map_view:
+            return "map_view";
+        case stage::queue_wait:
+            return "queue_wait";
+        case stage::compress:
+            return "compress";
+        case stage::checksum:
+            return "checksum";
+        default:
+            return "unknown";
+        }
+    }
+
+    stage_stats& _Thread_stage_stats() noexcept {
+        static thread_local stage_stats _Stats;
+        return _Stats;
+    }
+} // namespace fcrypt
\ No newline at end of file
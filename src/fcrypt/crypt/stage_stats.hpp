@@ -0,0 +1,262 @@
+// stage_stats.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_STAGE_STATS_HPP_
+#define _FCRYPT_CRYPT_STAGE_STATS_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <cstddef>
+#include <cstdint>
+#ifdef _FCRYPT_STAGE_STATS
+#include <chrono>
+#endif // _FCRYPT_STAGE_STATS
+
+namespace fcrypt {
+    // Note: The statistics are collected only if the library is compiled with _FCRYPT_STAGE_STATS
+    //       defined. Otherwise _Stage_timer and _Stage_snapshot are empty, every call to them compiles
+    //       out and all statistics stay zero. The counters are thread-local, so collecting them
+    //       requires no synchronization, a snapshot taken on a thread covers only that thread.
+    //
+    //       If _FCRYPT_HARDWARE_COUNTERS is defined as well, every timed call also samples the counters
+    //       of the calling thread. The cycles come from QueryThreadCycleTime(). The retired instructions
+    //       and the cache misses come from EnableThreadProfiling() and ReadThreadProfilingData(), which
+    //       require the system to have the first two hardware counters configured for these events
+    //       (usually by a profiler). Otherwise they stay zero and the cycles are still collected.
+    //       The counters are read innermost, after the clock when a call starts and before it when
+    //       the call ends, so the clock is not counted. The page faults are counted per process, so they
+    //       are sampled once per job (_Job_snapshot) instead of once per call. If sampling fails,
+    //       the counters stay zero and only the time is collected.
+
+    enum class stage : unsigned char {
+        derive_key, // the key derivation
+        read, // reading a page
+        cipher, // encrypting or decrypting a block
+        seek_back, // moving back to overwrite the page that has just been read
+        write, // writing a page
+        save_metadata, // writing the metadata
+        map_view, // mapping a view of the file
+        queue_wait, // waiting for a task in the scheduler
+        compress, // compressing or decompressing a chunk
+        checksum // feeding a block into the content checksums
+    };
+
+    struct stage_stats { // the number of calls, bytes, nanoseconds and hardware events of every stage
+        static constexpr size_t stage_count = 10;
+
+        uint64_t calls[stage_count]        = {0};
+        uint64_t bytes[stage_count]        = {0};
+        uint64_t nanoseconds[stage_count]  = {0};
+        uint64_t cycles[stage_count]       = {0};
+        uint64_t instructions[stage_count] = {0};
+        uint64_t cache_misses[stage_count] = {0};
+        uint64_t page_faults               = 0; // the page faults of the whole process during the job
+
+        // adds the statistics
+        stage_stats& operator+=(const stage_stats& _Other) noexcept;
+
+        // subtracts the statistics (used to compute the difference between two snapshots)
+        stage_stats& operator-=(const stage_stats& _Other) noexcept;
+
+        // returns the number of calls of the stage
+        uint64_t calls_of(const stage _Stage) const noexcept;
+
+        // returns the number of bytes processed in the stage
+        uint64_t bytes_of(const stage _Stage) const noexcept;
+
+        // returns the time spent in the stage (in nanoseconds)
+        uint64_t nanoseconds_of(const stage _Stage) const noexcept;
+
+        // returns the number of CPU cycles spent in the stage
+        uint64_t cycles_of(const stage _Stage) const noexcept;
+
+        // returns the number of instructions retired in the stage
+        uint64_t instructions_of(const stage _Stage) const noexcept;
+
+        // returns the number of cache misses that occurred during the stage
+        uint64_t cache_misses_of(const stage _Stage) const noexcept;
+
+        // returns the number of CPU cycles per processed byte (0 if unknown)
+        double cycles_per_byte(const stage _Stage) const noexcept;
+
+        // returns the number of instructions retired per CPU cycle (0 if unknown)
+        double instructions_per_cycle(const stage _Stage) const noexcept;
+    };
+
+    // checks if the library has been compiled with the statistics enabled
+    constexpr bool stage_stats_enabled() noexcept {
+#ifdef _FCRYPT_STAGE_STATS
+        return true;
+#else // ^^^ _FCRYPT_STAGE_STATS ^^^ / vvv !_FCRYPT_STAGE_STATS vvv
+        return false;
+#endif // _FCRYPT_STAGE_STATS
+    }
+
+    // checks if the library has been compiled with the hardware counters enabled
+    constexpr bool hardware_counters_enabled() noexcept {
+#if defined(_FCRYPT_STAGE_STATS) && defined(_FCRYPT_HARDWARE_COUNTERS)
+        return true;
+#else // ^^^ _FCRYPT_STAGE_STATS && _FCRYPT_HARDWARE_COUNTERS ^^^ / vvv otherwise vvv
+        return false;
+#endif // _FCRYPT_STAGE_STATS && _FCRYPT_HARDWARE_COUNTERS
+    }
+
+    // checks if the hardware counters are enabled and can be sampled on this machine
+    bool hardware_counters_available() noexcept;
+
+    // returns the name of the stage (used in reports and traces)
+    const char* stage_name(const stage _Stage) noexcept;
+
+    // returns the statistics collected by the calling thread so far
+    stage_stats& _Thread_stage_stats() noexcept;
+
+#ifdef _FCRYPT_STAGE_STATS
+    struct _Hardware_sample { // the values of the hardware counters at some point
+        uint64_t _Cycles       = 0;
+        uint64_t _Instructions = 0; // 0 if thread profiling is unavailable
+        uint64_t _Cache_misses = 0; // 0 if thread profiling is unavailable
+    };
+
+    // tries to sample the hardware counters of the calling thread
+    bool _Sample_hardware_counters(_Hardware_sample& _Sample) noexcept;
+
+    // tries to sample the number of page faults of the process
+    bool _Sample_page_faults(uint64_t& _Faults) noexcept;
+
+    // records the span if tracing is active (see trace.hpp)
+    void _Trace_span(const stage _Stage, const ::std::chrono::steady_clock::time_point _Start,
+        const ::std::chrono::steady_clock::time_point _End, const uint64_t _Bytes) noexcept;
+
+    // records the latency if a metrics registry is installed (see metrics.hpp)
+    void _Observe_stage_latency(const stage _Stage, const uint64_t _Nanoseconds) noexcept;
+
+    class _Stage_timer { // measures a single call of the stage
+    public:
+        explicit _Stage_timer(const stage _Stage, const uint64_t _Bytes = 0) noexcept
+            : _Mystage(_Stage), _Mybytes(_Bytes), _Mystart(::std::chrono::steady_clock::now())
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+            , _Mysample(), _Mysampled(_Sample_hardware_counters(_Mysample)) // the last thing before the call
+#endif // _FCRYPT_HARDWARE_COUNTERS
+        {}
+
+        ~_Stage_timer() noexcept {
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+            _Hardware_sample _Sample; // the first thing after the call
+            const bool _Sampled = _Mysampled && _Sample_hardware_counters(_Sample);
+#endif // _FCRYPT_HARDWARE_COUNTERS
+            const auto _End         = ::std::chrono::steady_clock::now();
+            const uint64_t _Elapsed = static_cast<uint64_t>(
+                ::std::chrono::duration_cast<::std::chrono::nanoseconds>(_End - _Mystart).count());
+            stage_stats& _Stats     = _Thread_stage_stats();
+            const size_t _Idx       = static_cast<size_t>(_Mystage);
+            ++_Stats.calls[_Idx];
+            _Stats.bytes[_Idx]       += _Mybytes;
+            _Stats.nanoseconds[_Idx] += _Elapsed;
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+            if (_Sampled) {
+                _Stats.cycles[_Idx]       += _Sample._Cycles - _Mysample._Cycles;
+                _Stats.instructions[_Idx] += _Sample._Instructions - _Mysample._Instructions;
+                _Stats.cache_misses[_Idx] += _Sample._Cache_misses - _Mysample._Cache_misses;
+            }
+#endif // _FCRYPT_HARDWARE_COUNTERS
+            _Trace_span(_Mystage, _Mystart, _End, _Mybytes);
+            _Observe_stage_latency(_Mystage, _Elapsed);
+        }
+
+        _Stage_timer(const _Stage_timer&) = delete;
+        _Stage_timer& operator=(const _Stage_timer&) = delete;
+
+        // adds bytes that are known only after the call
+        void _Add_bytes(const uint64_t _Bytes) noexcept {
+            _Mybytes += _Bytes;
+        }
+
+    private:
+        stage _Mystage;
+        uint64_t _Mybytes;
+        ::std::chrono::steady_clock::time_point _Mystart;
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+        _Hardware_sample _Mysample;
+        bool _Mysampled; // false if the counters are unavailable
+#endif // _FCRYPT_HARDWARE_COUNTERS
+    };
+
+    class _Stage_snapshot { // adds the statistics collected by the calling thread during its lifetime
+    public:
+        explicit _Stage_snapshot(stage_stats& _Target) noexcept
+            : _Mytarget(_Target), _Mystart(_Thread_stage_stats()) {}
+
+        ~_Stage_snapshot() noexcept {
+            stage_stats _Diff = _Thread_stage_stats();
+            _Diff            -= _Mystart;
+            _Mytarget        += _Diff;
+        }
+
+        _Stage_snapshot(const _Stage_snapshot&) = delete;
+        _Stage_snapshot& operator=(const _Stage_snapshot&) = delete;
+
+    private:
+        stage_stats& _Mytarget;
+        stage_stats _Mystart;
+    };
+
+    class _Job_snapshot { // a snapshot that also counts the page faults of the process during the job
+    public:
+        explicit _Job_snapshot(stage_stats& _Target) noexcept
+            : _Mytarget(_Target), _Mysnapshot(_Target)
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+            , _Myfaults(0), _Mysampled(_Sample_page_faults(_Myfaults))
+#endif // _FCRYPT_HARDWARE_COUNTERS
+        {}
+
+        ~_Job_snapshot() noexcept {
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+            uint64_t _Faults = 0;
+            if (_Mysampled && _Sample_page_faults(_Faults)) {
+                _Mytarget.page_faults += _Faults - _Myfaults;
+            }
+#endif // _FCRYPT_HARDWARE_COUNTERS
+        }
+
+        _Job_snapshot(const _Job_snapshot&) = delete;
+        _Job_snapshot& operator=(const _Job_snapshot&) = delete;
+
+    private:
+        stage_stats& _Mytarget;
+        _Stage_snapshot _Mysnapshot;
+#ifdef _FCRYPT_HARDWARE_COUNTERS
+        uint64_t _Myfaults;
+        bool _Mysampled; // false if the page faults are unavailable
+#endif // _FCRYPT_HARDWARE_COUNTERS
+    };
+#else // ^^^ _FCRYPT_STAGE_STATS ^^^ / vvv !_FCRYPT_STAGE_STATS vvv
+    class _Stage_timer { // does nothing, the statistics are disabled
+    public:
+        explicit _Stage_timer(const stage, const uint64_t = 0) noexcept {}
+
+        _Stage_timer(const _Stage_timer&) = delete;
+        _Stage_timer& operator=(const _Stage_timer&) = delete;
+
+        void _Add_bytes(const uint64_t) noexcept {}
+    };
+
+    class _Stage_snapshot { // does nothing, the statistics are disabled
+    public:
+        explicit _Stage_snapshot(stage_stats&) noexcept {}
+
+        _Stage_snapshot(const _Stage_snapshot&) = delete;
+        _Stage_snapshot& operator=(const _Stage_snapshot&) = delete;
+    };
+
+    class _Job_snapshot { // does nothing, the statistics are disabled
+    public:
+        explicit _Job_snapshot(stage_stats&) noexcept {}
+
+        _Job_snapshot(const _Job_snapshot&) = delete;
+        _Job_snapshot& operator=(const _Job_snapshot&) = delete;
+    };
+#endif // _FCRYPT_STAGE_STATS
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_STAGE_STATS_HPP_
\ No newline at end of file
@@ -0,0 +1,185 @@
+// trace.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/crypt/trace.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace fcrypt {
+    struct _Trace_record { // a single span, the times are relative to the start of tracing
+        uint64_t _Start    = 0; // in nanoseconds
+        uint64_t _Duration = 0; // in nanoseconds
+        uint64_t _Bytes    = 0;
+        stage _Stage       = stage::derive_key;
+    };
+
+    struct _Trace_buffer { // the ring buffer of a single thread
+        explicit _Trace_buffer(const size_t _Capacity, const uint64_t _Generation)
+            : _Records(_Capacity), _Head(0), _Thread_id(::GetCurrentThreadId()), _Generation(_Generation) {}
+
+        ::std::vector<_Trace_record> _Records;
+        ::std::atomic<uint64_t> _Head; // the number of recorded spans, written only by the owner
+        DWORD _Thread_id;
+        uint64_t _Generation; // the start_tracing() call the buffer belongs to
+    };
+
+    struct _Trace_state { // the buffers of all threads that recorded at least one span
+        ::std::mutex _Mtx;
+        ::std::vector<::std::shared_ptr<_Trace_buffer>> _Buffers;
+        size_t _Capacity = default_trace_capacity; // guarded by _Mtx
+        ::std::atomic<bool> _Active{false};
+        ::std::atomic<uint64_t> _Generation{0};
+        ::std::atomic<int64_t> _Origin{0}; // the start of tracing (in nanoseconds since the clock's epoch)
+    };
+
+    static _Trace_state& _Get_trace_state() noexcept {
+        static _Trace_state _State;
+        return _State;
+    }
+
+    static thread_local ::std::shared_ptr<_Trace_buffer> _Current_buffer;
+
+    static int64_t _Nanoseconds_since_epoch(const ::std::chrono::steady_clock::time_point _Time) noexcept {
+        return ::std::chrono::duration_cast<::std::chrono::nanoseconds>(_Time.time_since_epoch()).count();
+    }
+
+    static _Trace_buffer* _Register_buffer(_Trace_state& _State, const uint64_t _Generation) noexcept {
+        try {
+            ::std::lock_guard _Guard(_State._Mtx);
+            if (_State._Generation.load(::std::memory_order_relaxed) != _Generation) { // restarted meanwhile
+                return nullptr;
+            }
+
+            _Current_buffer = ::std::make_shared<_Trace_buffer>(_State._Capacity, _Generation);
+            _State._Buffers.push_back(_Current_buffer);
+            return _Current_buffer.get();
+        } catch (...) {
+            _Current_buffer = nullptr;
+            return nullptr;
+        }
+    }
+
+    void _Trace_span(const stage _Stage, const ::std::chrono::steady_clock::time_point _Start,
+        const ::std::chrono::steady_clock::time_point _End, const uint64_t _Bytes) noexcept {
+        _Trace_state& _State = _Get_trace_state();
+        if (!_State._Active.load(::std::memory_order_acquire)) { // tracing is disabled, do nothing
+            return;
+        }
+
+        const uint64_t _Generation = _State._Generation.load(::std::memory_order_acquire);
+        _Trace_buffer* _Buffer     = _Current_buffer.get();
+        if (!_Buffer || _Buffer->_Generation != _Generation) { // the first span since tracing started
+            _Buffer = _Register_buffer(_State, _Generation);
+            if (!_Buffer) {
+                return;
+            }
+        }
+
+        // Note: Only the owning thread writes to the buffer. The record is written first and published by
+        //       the release store of the head, so a reader that loads the head sees complete records.
+        const int64_t _Origin  = _State._Origin.load(::std::memory_order_relaxed);
+        const int64_t _First   = _Nanoseconds_since_epoch(_Start) - _Origin;
+        const uint64_t _Head   = _Buffer->_Head.load(::std::memory_order_relaxed);
+        _Trace_record& _Record = _Buffer->_Records[static_cast<size_t>(_Head % _Buffer->_Records.size())];
+        _Record._Start         = _First > 0 ? static_cast<uint64_t>(_First) : 0; // started before tracing
+        _Record._Duration      = static_cast<uint64_t>(
+            ::std::chrono::duration_cast<::std::chrono::nanoseconds>(_End - _Start).count());
+        _Record._Bytes         = _Bytes;
+        _Record._Stage         = _Stage;
+        _Buffer->_Head.store(_Head + 1, ::std::memory_order_release);
+    }
+
+    bool start_tracing(const size_t _Capacity) {
+        if (!stage_stats_enabled() || _Capacity == 0) { // spans are measured only with the statistics enabled
+            return false;
+        }
+
+        _Trace_state& _State = _Get_trace_state();
+        ::std::lock_guard _Guard(_State._Mtx);
+        _State._Active.store(false, ::std::memory_order_relaxed);
+        _State._Buffers.clear(); // threads that still hold a buffer register a new one
+        _State._Capacity = _Capacity;
+        _State._Origin.store(_Nanoseconds_since_epoch(::std::chrono::steady_clock::now()), ::std::memory_order_relaxed);
+        _State._Generation.fetch_add(1, ::std::memory_order_relaxed);
+        _State._Active.store(true, ::std::memory_order_release);
+        return true;
+    }
+
+    void stop_tracing() noexcept {
+        _Get_trace_state()._Active.store(false, ::std::memory_order_release);
+    }
+
+    bool is_tracing() noexcept {
+        return _Get_trace_state()._Active.load(::std::memory_order_acquire);
+    }
+
+    uint64_t traced_spans() {
+        _Trace_state& _State = _Get_trace_state();
+        ::std::lock_guard _Guard(_State._Mtx);
+        uint64_t _Count = 0;
+        for (const ::std::shared_ptr<_Trace_buffer>& _Buffer : _State._Buffers) {
+            _Count += _Buffer->_Head.load(::std::memory_order_acquire);
+        }
+
+        return _Count;
+    }
+
+    static void _Append_microseconds(::std::string& _Json, const uint64_t _Nanoseconds) {
+        char _Buf[32];
+        const int _Length = ::snprintf(_Buf, sizeof(_Buf), "%llu.%03llu",
+            static_cast<unsigned long long>(_Nanoseconds / 1000), static_cast<unsigned long long>(_Nanoseconds % 1000));
+        _Json.append(_Buf, _Length > 0 ? static_cast<size_t>(_Length) : 0);
+    }
+
+    static void _Append_thread(::std::string& _Json, const _Trace_buffer& _Buffer) {
+        const uint64_t _Head  = _Buffer._Head.load(::std::memory_order_acquire);
+        const size_t _Size    = _Buffer._Records.size();
+        const uint64_t _Count = _Min(_Head, static_cast<uint64_t>(_Size)); // older spans have been overwritten
+        const ::std::string _Tid = ::std::to_string(_Buffer._Thread_id);
+        _Json += ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + _Tid
+            + ",\"args\":{\"name\":\"thread " + _Tid + "\"}}";
+        for (uint64_t _Idx = _Head - _Count; _Idx < _Head; ++_Idx) {
+            const _Trace_record& _Record = _Buffer._Records[static_cast<size_t>(_Idx % _Size)];
+            _Json += ",\n{\"name\":\"";
+            _Json += stage_name(_Record._Stage);
+            _Json += "\",\"cat\":\"fcrypt\",\"ph\":\"X\",\"pid\":1,\"tid\":" + _Tid + ",\"ts\":";
+            _Append_microseconds(_Json, _Record._Start);
+            _Json += ",\"dur\":";
+            _Append_microseconds(_Json, _Record._Duration);
+            if (_Record._Bytes != 0) {
+                _Json += ",\"args\":{\"bytes\":" + ::std::to_string(_Record._Bytes) + '}';
+            }
+
+            _Json += '}';
+        }
+    }
+
+    bool write_chrome_trace(const path& _Target) {
+        _Trace_state& _State = _Get_trace_state();
+        ::std::vector<::std::shared_ptr<_Trace_buffer>> _Buffers;
+        {
+            ::std::lock_guard _Guard(_State._Mtx);
+            _Buffers = _State._Buffers;
+        }
+
+        // Note: Every span is a complete event ("ph":"X") with its time and duration in microseconds,
+        //       every thread gets a metadata event with its name, so the viewer shows one track per thread.
+        ::std::string _Json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+            "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"fcrypt\"}}";
+        for (const ::std::shared_ptr<_Trace_buffer>& _Buffer : _Buffers) {
+            _Append_thread(_Json, *_Buffer);
+        }
+
+        _Json += "\n]}\n";
+        file _Output(_Target, open_mode::create_always);
+        return _Output.is_open()
+            && _Output.write(byte_string_view{reinterpret_cast<const byte_t*>(_Json.data()), _Json.size()});
+    }
+} // namespace fcrypt
\ No newline at end of file
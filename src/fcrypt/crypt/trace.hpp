@@ -0,0 +1,45 @@
+// trace.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_CRYPT_TRACE_HPP_
+#define _FCRYPT_CRYPT_TRACE_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace fcrypt {
+    // Note: Tracing records every span measured by _Stage_timer (key derivation, reads, cipher calls,
+    //       writes, scheduler waits, ...) together with the thread that ran it, so overlaps and stalls
+    //       can be inspected in a trace viewer (chrome://tracing or Perfetto). It requires the library
+    //       to be compiled with _FCRYPT_STAGE_STATS defined, otherwise start_tracing() fails.
+    //
+    //       Every thread writes to its own ring buffer, so recording a span takes no locks, the lock is
+    //       taken only once per thread to register its buffer. A full buffer overwrites its oldest spans.
+    //       The buffers outlive their threads, so spans recorded by finished workers are not lost.
+    //       The trace should be written when no job is running, spans recorded during the write may be
+    //       torn.
+
+    inline constexpr size_t default_trace_capacity = 65536; // the number of spans kept per thread
+
+    // tries to start tracing, discards the spans recorded so far
+    bool start_tracing(const size_t _Capacity = default_trace_capacity);
+
+    // stops tracing, the recorded spans are kept until the next start_tracing() call
+    void stop_tracing() noexcept;
+
+    // checks if tracing is active
+    bool is_tracing() noexcept;
+
+    // returns the number of spans recorded by all threads (including the overwritten ones)
+    uint64_t traced_spans();
+
+    // tries to write the recorded spans as Chrome trace-event JSON
+    bool write_chrome_trace(const path& _Target);
+} // namespace fcrypt
+
+#endif // _FCRYPT_CRYPT_TRACE_HPP_
\ No newline at end of file
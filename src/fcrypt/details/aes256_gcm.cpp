@@ -6,6 +6,14 @@
 #include <fcrypt/details/aes256_gcm.hpp>
 
 namespace fcrypt {
+    const EVP_CIPHER* _Aes256_gcm::_Cipher() noexcept {
+        // Note: EVP_aes_256_gcm() forces an implicit provider fetch on every EVP_*Init_ex() call,
+        //       so we fetch the cipher once per process. The provider still picks the fastest
+        //       AES-GCM kernel (VAES, AES-NI or portable) for the current CPU at run time.
+        static EVP_CIPHER* const _Fetched = ::EVP_CIPHER_fetch(nullptr, "AES-256-GCM", nullptr);
+        return _Fetched ? _Fetched : ::EVP_aes_256_gcm();
+    }
+
     _Aes256_gcm::_Aes256_gcm() noexcept : _Myctx() {}
 
     _Aes256_gcm::~_Aes256_gcm() noexcept {}
@@ -16,7 +24,7 @@ namespace fcrypt {
         }
 
         return ::EVP_EncryptInit_ex(
-            _Myctx._Get(), ::EVP_aes_256_gcm(), nullptr, _Key.get(), _Iv.get()) != 0;
+            _Myctx._Get(), _Cipher(), nullptr, _Key.get(), _Iv.get()) != 0;
     }
 
     bool _Aes256_gcm::setup_decryption(const key& _Key, const iv& _Iv) noexcept {
@@ -25,7 +33,7 @@ namespace fcrypt {
         }
 
         return ::EVP_DecryptInit_ex(
-            _Myctx._Get(), ::EVP_aes_256_gcm(), nullptr, _Key.get(), _Iv.get()) != 0;
+            _Myctx._Get(), _Cipher(), nullptr, _Key.get(), _Iv.get()) != 0;
     }
 
     bool _Aes256_gcm::encrypt(
@@ -37,6 +37,9 @@ namespace fcrypt {
         bool complete_decryption(authentication_tag& _Tag) noexcept override;
 
     private:
+        // returns the process-wide AES-256-GCM cipher implementation
+        static const EVP_CIPHER* _Cipher() noexcept;
+
         _Cipher_context _Myctx;
     };
 
@@ -0,0 +1,160 @@
+// botan_aes256_gcm.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/details/botan_aes256_gcm.hpp>
+#include <cstring>
+
+namespace fcrypt {
+    _Botan_aes256_gcm::_Botan_aes256_gcm() noexcept
+        : _Mymode(), _Myctr(), _Mytail(), _Mydir(::Botan::ENCRYPTION), _Myoff(0), _Myfinal(false) {}
+
+    _Botan_aes256_gcm::~_Botan_aes256_gcm() noexcept {}
+
+    bool _Botan_aes256_gcm::_Setup(const key& _Key, const iv& _Iv, const ::Botan::Cipher_Dir _Dir) noexcept {
+        if (!_Key.valid() || !_Iv.valid()) {
+            return false;
+        }
+
+        try {
+            if (!_Mymode || _Mydir != _Dir) { // the direction cannot be changed, create a new mode
+                _Mymode = ::Botan::AEAD_Mode::create_or_throw("AES-256/GCM", _Dir);
+                _Mydir  = _Dir;
+            }
+
+            if (!_Myctr) {
+                _Myctr = ::Botan::StreamCipher::create_or_throw("CTR-BE(AES-256,4)");
+            }
+
+            _Mymode->set_key(_Key.get(), key::size);
+            _Mymode->start(_Iv.get(), iv::size);
+
+            // Note: GCM starts the counter at IV || 1, the first keystream block masks the tag.
+            byte_t _Counter[16] = {0};
+            ::memcpy(_Counter, _Iv.get(), iv::size);
+            _Counter[15] = 1;
+            _Myctr->set_key(_Key.get(), key::size);
+            _Myctr->set_iv(_Counter, sizeof(_Counter));
+        } catch (...) {
+            return false;
+        }
+
+        _Mytail.clear();
+        _Myoff   = 0;
+        _Myfinal = false;
+        return true;
+    }
+
+    void _Botan_aes256_gcm::_Apply_keystream(byte_t* const _Buf, const size_t _Size) {
+        _Myctr->seek(16 + _Myoff); // skip the block that masks the tag
+        _Myctr->cipher1(_Buf, _Size);
+    }
+
+    bool _Botan_aes256_gcm::_Process(const byte_t* const _Data, const size_t _Size, byte_t* const _Buf) noexcept {
+        if (_Data != _Buf) { // Botan processes the data in place
+            ::memmove(_Buf, _Data, _Size);
+        }
+
+        try {
+            const size_t _Granularity = _Mymode->update_granularity();
+            size_t _Pos               = 0;
+            if (!_Mytail.empty()) { // complete the partial granule first
+                _Pos = _Min(_Granularity - _Mytail.size(), _Size);
+                _Mytail.insert(_Mytail.end(), _Buf, _Buf + _Pos); // the mode needs the input
+                _Apply_keystream(_Buf, _Pos);
+                _Myoff += _Pos;
+                if (_Mytail.size() == _Granularity) { // the output is already known, discard it
+                    _Mymode->process(_Mytail.data(), _Granularity);
+                    _Mytail.clear();
+                }
+            }
+
+            const size_t _Aligned = (_Size - _Pos) - (_Size - _Pos) % _Granularity;
+            if (_Aligned > 0) { // the fast path, nothing is buffered
+                _Mymode->process(_Buf + _Pos, _Aligned);
+                _Myoff += _Aligned;
+                _Pos   += _Aligned;
+            }
+
+            if (_Pos < _Size) { // start a new partial granule
+                _Mytail.assign(_Buf + _Pos, _Buf + _Size);
+                _Apply_keystream(_Buf + _Pos, _Size - _Pos);
+                _Myoff += _Size - _Pos;
+            }
+        } catch (...) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool _Botan_aes256_gcm::setup_encryption(const key& _Key, const iv& _Iv) noexcept {
+        return _Setup(_Key, _Iv, ::Botan::ENCRYPTION);
+    }
+
+    bool _Botan_aes256_gcm::setup_decryption(const key& _Key, const iv& _Iv) noexcept {
+        return _Setup(_Key, _Iv, ::Botan::DECRYPTION);
+    }
+
+    bool _Botan_aes256_gcm::encrypt(
+        const byte_t* const _Data, const size_t _Size, byte_t* const _Buf) noexcept {
+        if (!_Mymode || _Mydir != ::Botan::ENCRYPTION || _Myfinal) {
+            return false;
+        }
+
+        return _Process(_Data, _Size, _Buf);
+    }
+
+    bool _Botan_aes256_gcm::decrypt(
+        const byte_t* const _Data, const size_t _Size, byte_t* const _Buf) noexcept {
+        if (!_Mymode || _Mydir != ::Botan::DECRYPTION || _Myfinal) {
+            return false;
+        }
+
+        return _Process(_Data, _Size, _Buf);
+    }
+
+    bool _Botan_aes256_gcm::complete_encryption(authentication_tag& _Tag) noexcept {
+        if (!_Mymode || _Mydir != ::Botan::ENCRYPTION || _Myfinal) {
+            return false;
+        }
+
+        const size_t _Rest = _Mytail.size();
+        try { // the ciphertext of the partial granule has already been produced, only the tag is needed
+            _Mymode->finish(_Mytail);
+        } catch (...) {
+            _Scrub_memory(_Mytail.data(), _Mytail.size());
+            _Mytail.clear();
+            return false;
+        }
+
+        _Tag.set(byte_string_view{_Mytail.data() + _Rest, authentication_tag::size});
+        _Mytail.clear();
+        _Myfinal = true;
+        return true;
+    }
+
+    bool _Botan_aes256_gcm::complete_decryption(authentication_tag& _Tag) noexcept {
+        if (!_Mymode || _Mydir != ::Botan::DECRYPTION || _Myfinal) {
+            return false;
+        }
+
+        bool _Success = true;
+        try {
+            _Mytail.insert(_Mytail.end(), _Tag.get(), _Tag.get() + authentication_tag::size);
+            _Mymode->finish(_Mytail); // throws if the tag does not match
+        } catch (...) {
+            _Success = false;
+        }
+
+        _Scrub_memory(_Mytail.data(), _Mytail.size());
+        _Mytail.clear();
+        _Myfinal = true;
+        return _Success;
+    }
+
+    [[nodiscard]] encryption_engine* _Make_botan_aes256_gcm_engine() noexcept {
+        return new _Botan_aes256_gcm();
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,70 @@
+// botan_aes256_gcm.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_DETAILS_BOTAN_AES256_GCM_HPP_
+#define _FCRYPT_DETAILS_BOTAN_AES256_GCM_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <botan/aead.h>
+#include <botan/stream_cipher.h>
+#include <cstdint>
+#include <memory>
+
+namespace fcrypt {
+    class _Botan_aes256_gcm : public encryption_engine { // AES-256-GCM engine (Botan backend)
+    public:
+        _Botan_aes256_gcm() noexcept;
+        ~_Botan_aes256_gcm() noexcept;
+
+        // tries to setup the encryption process
+        bool setup_encryption(const key& _Key, const iv& _Iv) noexcept override;
+
+        // tries to setup the decryption process
+        bool setup_decryption(const key& _Key, const iv& _Iv) noexcept override;
+
+        // tries to encrypt the data
+        bool encrypt(
+            const byte_t* const _Data, const size_t _Size, byte_t* const _Buf) noexcept override;
+
+        // tries to decrypt the data
+        bool decrypt(
+            const byte_t* const _Data, const size_t _Size, byte_t* const _Buf) noexcept override;
+
+        // tries to complete the encryption process
+        bool complete_encryption(authentication_tag& _Tag) noexcept override;
+
+        // tries to complete the decryption process
+        bool complete_decryption(authentication_tag& _Tag) noexcept override;
+
+    private:
+        // Note: Botan's GCM_Mode::process() accepts only multiples of update_granularity(), the rest
+        //       of the message must be passed to finish(). OpenSSL has no such restriction, so the engine
+        //       keeps the input of a partial granule in _Mytail until it is complete and passes it to
+        //       the mode then. The output of the buffered bytes is produced immediately by a separate CTR
+        //       keystream (GCM encrypts with the same keystream), so every call produces exactly as many
+        //       bytes as it receives, whatever the sizes of the calls are.
+
+        // tries to setup the mode for the specified direction
+        bool _Setup(const key& _Key, const iv& _Iv, const ::Botan::Cipher_Dir _Dir) noexcept;
+
+        // tries to apply the keystream at the current offset to the buffer
+        void _Apply_keystream(byte_t* const _Buf, const size_t _Size);
+
+        // tries to encrypt/decrypt the data, a partial granule is kept until it is complete
+        bool _Process(const byte_t* const _Data, const size_t _Size, byte_t* const _Buf) noexcept;
+
+        ::std::unique_ptr<::Botan::AEAD_Mode> _Mymode;
+        ::std::unique_ptr<::Botan::StreamCipher> _Myctr; // keystream for a partial granule
+        ::Botan::secure_vector<uint8_t> _Mytail; // the input of a partial granule (not passed to the mode yet)
+        ::Botan::Cipher_Dir _Mydir;
+        uint64_t _Myoff; // the number of bytes processed so far
+        bool _Myfinal; // true if finish() has been called
+    };
+
+    [[nodiscard]] encryption_engine* _Make_botan_aes256_gcm_engine() noexcept;
+} // namespace fcrypt
+
+#endif // _FCRYPT_DETAILS_BOTAN_AES256_GCM_HPP_
\ No newline at end of file
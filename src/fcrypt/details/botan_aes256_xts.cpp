@@ -0,0 +1,83 @@
+// botan_aes256_xts.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/details/botan_aes256_xts.hpp>
+#include <botan/cipher_mode.h>
+#include <botan/kdf.h>
+#include <cstring>
+
+namespace fcrypt {
+    _Botan_aes256_xts::_Botan_aes256_xts() noexcept : _Myenc(), _Mydec() {}
+
+    _Botan_aes256_xts::~_Botan_aes256_xts() noexcept {}
+
+    bool _Botan_aes256_xts::_Set_key(const key& _Key) noexcept {
+        if (!_Key.valid()) {
+            return false;
+        }
+
+        try {
+            if (!_Myenc) {
+                _Myenc = ::Botan::Cipher_Mode::create_or_throw("AES-256/XTS", ::Botan::ENCRYPTION);
+                _Mydec = ::Botan::Cipher_Mode::create_or_throw("AES-256/XTS", ::Botan::DECRYPTION);
+            }
+
+            // Note: XTS requires two independent AES-256 keys. Both are expanded from the 256-bit key
+            //       with HKDF, the label separates them from the keys used by other engines.
+            static constexpr char _Label[] = "fcrypt aes256-xts";
+            const ::std::unique_ptr<::Botan::KDF> _Kdf = ::Botan::KDF::create_or_throw("HKDF(SHA-256)");
+            const ::Botan::secure_vector<uint8_t> _Expanded = _Kdf->derive_key(_Xts_key_size,
+                _Key.get(), key::size, nullptr, 0, reinterpret_cast<const uint8_t*>(_Label), sizeof(_Label) - 1);
+            _Myenc->set_key(_Expanded);
+            _Mydec->set_key(_Expanded);
+        } catch (...) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool _Botan_aes256_xts::_Process(
+        ::Botan::Cipher_Mode& _Mode, const uint64_t _Sector, byte_t* const _Buf, const size_t _Size) noexcept {
+        if (_Size < _Mode.minimum_final_size()) { // XTS cannot process less than a single block
+            return false;
+        }
+
+        // Note: The tweak is the little-endian sector number (IEEE 1619 data unit number).
+        byte_t _Tweak[16] = {0};
+        _Store_little_endian(_Tweak, _Sector);
+        try {
+            _Mode.start(_Tweak, sizeof(_Tweak));
+
+            // Note: Cipher_Mode::process() accepts only multiples of update_granularity(), and finish()
+            //       requires at least minimum_final_size() bytes, so the last granule goes to finish().
+            const size_t _Granularity = _Mode.update_granularity();
+            size_t _Aligned           = _Size - _Size % _Granularity;
+            if (_Size - _Aligned < _Mode.minimum_final_size()) { // leave enough bytes for finish()
+                _Aligned -= _Granularity;
+            }
+
+            if (_Aligned > 0) {
+                _Mode.process(_Buf, _Aligned);
+            }
+
+            ::Botan::secure_vector<uint8_t> _Tail(_Buf + _Aligned, _Buf + _Size);
+            _Mode.finish(_Tail);
+            ::memcpy(_Buf + _Aligned, _Tail.data(), _Tail.size());
+        } catch (...) {
+            return false;
+        }
+
+        return true;
+    }
+
+    bool _Botan_aes256_xts::_Encrypt_sector(const uint64_t _Sector, byte_t* const _Buf, const size_t _Size) noexcept {
+        return _Myenc ? _Process(*_Myenc, _Sector, _Buf, _Size) : false;
+    }
+
+    bool _Botan_aes256_xts::_Decrypt_sector(const uint64_t _Sector, byte_t* const _Buf, const size_t _Size) noexcept {
+        return _Mydec ? _Process(*_Mydec, _Sector, _Buf, _Size) : false;
+    }
+} // namespace fcrypt
\ No newline at end of file
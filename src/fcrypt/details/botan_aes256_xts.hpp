@@ -0,0 +1,49 @@
+// botan_aes256_xts.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_DETAILS_BOTAN_AES256_XTS_HPP_
+#define _FCRYPT_DETAILS_BOTAN_AES256_XTS_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Botan {
+    class Cipher_Mode;
+} // namespace Botan
+
+namespace fcrypt {
+    class _Botan_aes256_xts { // AES-256-XTS sector cipher (Botan backend)
+    public:
+        _Botan_aes256_xts() noexcept;
+        ~_Botan_aes256_xts() noexcept;
+
+        _Botan_aes256_xts(const _Botan_aes256_xts&) = delete;
+        _Botan_aes256_xts& operator=(const _Botan_aes256_xts&) = delete;
+
+        static constexpr size_t _Xts_key_size = 64; // two AES-256 keys
+
+        // tries to expand the key and set it for both directions
+        bool _Set_key(const key& _Key) noexcept;
+
+        // tries to encrypt the sector in place, the sector number is the tweak
+        bool _Encrypt_sector(const uint64_t _Sector, byte_t* const _Buf, const size_t _Size) noexcept;
+
+        // tries to decrypt the sector in place, the sector number is the tweak
+        bool _Decrypt_sector(const uint64_t _Sector, byte_t* const _Buf, const size_t _Size) noexcept;
+
+    private:
+        // tries to process the sector with the specified mode
+        static bool _Process(
+            ::Botan::Cipher_Mode& _Mode, const uint64_t _Sector, byte_t* const _Buf, const size_t _Size) noexcept;
+
+        ::std::unique_ptr<::Botan::Cipher_Mode> _Myenc;
+        ::std::unique_ptr<::Botan::Cipher_Mode> _Mydec;
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_DETAILS_BOTAN_AES256_XTS_HPP_
\ No newline at end of file
@@ -0,0 +1,172 @@
+// task_scheduler.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/details/task_scheduler.hpp>
+#include <fcrypt/crypt/stage_stats.hpp>
+
+namespace fcrypt {
+    struct _Worker_identity { // identifies the worker that runs on the current thread
+        const _Task_scheduler* _Owner = nullptr;
+        size_t _Idx                   = 0;
+    };
+
+    static thread_local _Worker_identity _Current_worker;
+
+    _Task_scheduler::_Task_scheduler(const size_t _Threads)
+        : _Myqueues(), _Mythreads(), _Mymtx(), _Mywork_cv(), _Mydone_cv(),
+        _Myqueued(0), _Mypending(0), _Mynext(0), _Mystop(false) {
+        const size_t _Count = _Threads != 0 ? _Threads : 1;
+        _Myqueues.reserve(_Count);
+        for (size_t _Idx = 0; _Idx < _Count; ++_Idx) {
+            _Myqueues.push_back(::std::make_unique<_Queue>());
+        }
+
+        // Note: A thread that cannot be started throws, the threads started before it must be joined
+        //       first, destroying a joinable std::thread terminates the process.
+        try {
+            _Mythreads.reserve(_Count);
+            for (size_t _Idx = 0; _Idx < _Count; ++_Idx) {
+                _Mythreads.emplace_back(&_Task_scheduler::_Run, this, _Idx);
+            }
+        } catch (...) {
+            _Stop();
+            throw;
+        }
+    }
+
+    _Task_scheduler::~_Task_scheduler() noexcept {
+        _Stop();
+    }
+
+    void _Task_scheduler::_Stop() noexcept {
+        {
+            ::std::lock_guard _Guard(_Mymtx);
+            _Mystop = true;
+        }
+
+        _Mywork_cv.notify_all();
+        for (::std::thread& _Thread : _Mythreads) {
+            if (_Thread.joinable()) {
+                _Thread.join();
+            }
+        }
+    }
+
+    size_t _Task_scheduler::_Workers() const noexcept {
+        return _Myqueues.size();
+    }
+
+    void _Task_scheduler::_Submit(_Task&& _New_task) {
+        const size_t _Idx = _Current_worker._Owner == this
+            ? _Current_worker._Idx : _Mynext.fetch_add(1, ::std::memory_order_relaxed) % _Myqueues.size();
+        _Mypending.fetch_add(1);
+        {
+            // Note: The counter is changed while holding _Mymtx, so a worker that is about to sleep
+            //       cannot miss the notification. It is changed before the push, so it never underflows.
+            ::std::lock_guard _Guard(_Mymtx);
+            _Myqueued.fetch_add(1);
+        }
+
+        {
+            _Queue& _Target = *_Myqueues[_Idx];
+            ::std::lock_guard _Guard(_Target._Mtx);
+            _Target._Tasks.push_back(::std::move(_New_task));
+        }
+
+        _Mywork_cv.notify_one();
+    }
+
+    void _Task_scheduler::_Submit_range(
+        const uint64_t _First, const uint64_t _Last, const ::std::shared_ptr<const _Range_task>& _Func) {
+        if (_First >= _Last) { // empty range, do nothing
+            return;
+        }
+
+        _Submit([this, _First, _Last, _Func](const size_t _Worker) {
+            uint64_t _End = _Last;
+            while (_End - _First > 1) { // keep the lower half, let idle workers steal the upper one
+                const uint64_t _Mid = _First + (_End - _First) / 2;
+                _Submit_range(_Mid, _End, _Func);
+                _End = _Mid;
+            }
+
+            (*_Func)(_First, _Worker);
+        });
+    }
+
+    void _Task_scheduler::_Wait() {
+        ::std::unique_lock _Lock(_Mymtx);
+        _Mydone_cv.wait(_Lock, [this] { return _Mypending.load() == 0; });
+    }
+
+    bool _Task_scheduler::_Pop(const size_t _Idx, _Task& _Result) {
+        _Queue& _Own = *_Myqueues[_Idx];
+        ::std::lock_guard _Guard(_Own._Mtx);
+        if (_Own._Tasks.empty()) {
+            return false;
+        }
+
+        _Result = ::std::move(_Own._Tasks.back());
+        _Own._Tasks.pop_back();
+        return true;
+    }
+
+    bool _Task_scheduler::_Steal(const size_t _Idx, _Task& _Result) {
+        const size_t _Count = _Myqueues.size();
+        for (size_t _Step = 1; _Step < _Count; ++_Step) { // start with the closest neighbour
+            _Queue& _Victim = *_Myqueues[(_Idx + _Step) % _Count];
+            ::std::lock_guard _Guard(_Victim._Mtx);
+            if (!_Victim._Tasks.empty()) {
+                _Result = ::std::move(_Victim._Tasks.front());
+                _Victim._Tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void _Task_scheduler::_Complete() noexcept {
+        if (_Mypending.fetch_sub(1) == 1) { // the last pending task
+            ::std::lock_guard _Guard(_Mymtx);
+            _Mydone_cv.notify_all();
+        }
+    }
+
+    void _Task_scheduler::_Run(const size_t _Idx) noexcept {
+        _Current_worker._Owner = this;
+        _Current_worker._Idx   = _Idx;
+        _Task _Next;
+        for (;;) {
+            bool _Found = false;
+            try {
+                _Found = _Pop(_Idx, _Next) || _Steal(_Idx, _Next);
+            } catch (...) {
+                _Found = false;
+            }
+
+            if (_Found) {
+                _Myqueued.fetch_sub(1);
+                try {
+                    _Next(_Idx);
+                } catch (...) { // tasks report their own failures
+                }
+
+                _Next = nullptr;
+                _Complete();
+                continue;
+            }
+
+            _Stage_timer _Timer(stage::queue_wait); // shows idle workers in the trace, destroyed after the lock
+            ::std::unique_lock _Lock(_Mymtx);
+            _Mywork_cv.wait(_Lock, [this] { return _Mystop || _Myqueued.load() != 0; });
+            if (_Mystop && _Myqueued.load() == 0) {
+                break;
+            }
+        }
+
+        _Current_worker = _Worker_identity{};
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,84 @@
+// task_scheduler.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_DETAILS_TASK_SCHEDULER_HPP_
+#define _FCRYPT_DETAILS_TASK_SCHEDULER_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fcrypt {
+    // Note: Every worker owns a deque. A worker pushes and pops its own tasks at the back (LIFO keeps
+    //       the data hot), and steals from the front of other deques when its own deque is empty (FIFO
+    //       steals the oldest, usually the largest, tasks). Tasks submitted by a worker go to its own
+    //       deque, tasks submitted by other threads are distributed round-robin.
+
+    class _Task_scheduler { // work-stealing task scheduler
+    public:
+        using _Task       = ::std::function<void(const size_t)>; // receives the index of the executing worker
+        using _Range_task = ::std::function<void(const uint64_t, const size_t)>; // receives the item index too
+
+        explicit _Task_scheduler(const size_t _Threads);
+        ~_Task_scheduler() noexcept;
+
+        _Task_scheduler(const _Task_scheduler&) = delete;
+        _Task_scheduler& operator=(const _Task_scheduler&) = delete;
+
+        // returns the number of workers
+        size_t _Workers() const noexcept;
+
+        // schedules a new task
+        void _Submit(_Task&& _New_task);
+
+        // schedules _Func for every item in [_First, _Last), the range is split lazily between the workers
+        void _Submit_range(
+            const uint64_t _First, const uint64_t _Last, const ::std::shared_ptr<const _Range_task>& _Func);
+
+        // waits until all scheduled tasks (including the tasks they scheduled) are completed
+        void _Wait();
+
+    private:
+        struct _Queue {
+            ::std::mutex _Mtx;
+            ::std::deque<_Task> _Tasks;
+        };
+
+        // stops the workers and waits until every started thread ends
+        void _Stop() noexcept;
+
+        // runs the worker loop
+        void _Run(const size_t _Idx) noexcept;
+
+        // tries to pop a task from the worker's own deque
+        bool _Pop(const size_t _Idx, _Task& _Result);
+
+        // tries to steal a task from another worker's deque
+        bool _Steal(const size_t _Idx, _Task& _Result);
+
+        // marks a task as completed
+        void _Complete() noexcept;
+
+        ::std::vector<::std::unique_ptr<_Queue>> _Myqueues;
+        ::std::vector<::std::thread> _Mythreads;
+        ::std::mutex _Mymtx; // protects the sleeping and waiting threads
+        ::std::condition_variable _Mywork_cv;
+        ::std::condition_variable _Mydone_cv;
+        ::std::atomic<size_t> _Myqueued; // the number of tasks in all deques
+        ::std::atomic<size_t> _Mypending; // the number of submitted and not yet completed tasks
+        ::std::atomic<size_t> _Mynext; // the next deque for external submissions
+        bool _Mystop;
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_DETAILS_TASK_SCHEDULER_HPP_
\ No newline at end of file
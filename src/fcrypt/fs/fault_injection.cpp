@@ -0,0 +1,60 @@
+// fault_injection.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/fs/fault_injection.hpp>
+#include <fcrypt/app/tinywin.hpp>
+#include <atomic>
+#include <cstddef>
+
+namespace fcrypt {
+#ifdef _FCRYPT_FAULT_INJECTION
+    struct _Fault_state { // the counters of every kind of site
+        static constexpr size_t _Site_count = 2;
+
+        ::std::atomic<uint64_t> _Reached[_Site_count] = {};
+        ::std::atomic<uint64_t> _Limit[_Site_count]   = {}; // 0 if the site is not armed
+    };
+
+    static _Fault_state& _Get_fault_state() noexcept {
+        static _Fault_state _State;
+        return _State;
+    }
+
+    void arm_fault(const fault_site _Site, const uint64_t _Count) noexcept {
+        _Fault_state& _State = _Get_fault_state();
+        for (size_t _Idx = 0; _Idx < _Fault_state::_Site_count; ++_Idx) {
+            _State._Limit[_Idx].store(0);
+            _State._Reached[_Idx].store(0);
+        }
+
+        _State._Limit[static_cast<size_t>(_Site)].store(_Count);
+    }
+
+    uint64_t reached_fault_sites(const fault_site _Site) noexcept {
+        return _Get_fault_state()._Reached[static_cast<size_t>(_Site)].load();
+    }
+
+    bool _Fault_due(const fault_site _Site) noexcept {
+        _Fault_state& _State  = _Get_fault_state();
+        const size_t _Idx     = static_cast<size_t>(_Site);
+        const uint64_t _Limit = _State._Limit[_Idx].load(::std::memory_order_relaxed);
+        return _State._Reached[_Idx].fetch_add(1) + 1 == _Limit; // only one thread reaches the limit
+    }
+#else // ^^^ _FCRYPT_FAULT_INJECTION ^^^ / vvv !_FCRYPT_FAULT_INJECTION vvv
+    void arm_fault(const fault_site, const uint64_t) noexcept {} // does nothing, the fault injection is disabled
+
+    uint64_t reached_fault_sites(const fault_site) noexcept {
+        return 0; // the sites are not counted
+    }
+#endif // _FCRYPT_FAULT_INJECTION
+
+    [[noreturn]] void _Inject_fault() noexcept {
+        // Note: TerminateProcess() stops all threads at once and runs no destructors or atexit handlers,
+        //       so the files are left exactly as a killed process leaves them. ExitProcess() is never
+        //       reached, it only tells the compiler that the call does not return.
+        ::TerminateProcess(::GetCurrentProcess(), fault_exit_code);
+        ::ExitProcess(fault_exit_code);
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,67 @@
+// fault_injection.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_FS_FAULT_INJECTION_HPP_
+#define _FCRYPT_FS_FAULT_INJECTION_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace fcrypt {
+    // Note: Fault injection terminates the process at a chosen point, so tests can check that every
+    //       interrupted job can be resumed. It requires the library to be compiled with
+    //       _FCRYPT_FAULT_INJECTION defined, otherwise every fault point compiles out and arm_fault()
+    //       does nothing. The sites are counted by all threads together, so the N-th site is the N-th
+    //       one reached by the process, whichever thread reaches it.
+    //
+    //       A write site is every write to a file (the journals included) and every change of its size.
+    //       The faulty write is torn: only the whole sectors of its first half are written before the
+    //       process is terminated (a sector is assumed to be written atomically), the faulty change
+    //       of the size is not made at all. A journal record site is every file recorded by a job
+    //       journal, the process is terminated after the file has been recorded in memory, before
+    //       its group is written.
+
+    enum class fault_site : unsigned char {
+        write, // a write to a file
+        journal_record // a file recorded by a job journal
+    };
+
+    inline constexpr unsigned int fault_exit_code = 0xFA17; // the exit code of the terminated process
+
+    // checks if the library has been compiled with the fault injection enabled
+    constexpr bool fault_injection_enabled() noexcept {
+#ifdef _FCRYPT_FAULT_INJECTION
+        return true;
+#else // ^^^ _FCRYPT_FAULT_INJECTION ^^^ / vvv !_FCRYPT_FAULT_INJECTION vvv
+        return false;
+#endif // _FCRYPT_FAULT_INJECTION
+    }
+
+    // resets the counters and terminates the process at the _Count-th site of the kind (0 never does)
+    void arm_fault(const fault_site _Site, const uint64_t _Count) noexcept;
+
+    // returns the number of sites of the kind reached since the last arm_fault() call
+    uint64_t reached_fault_sites(const fault_site _Site) noexcept;
+
+    // returns the number of bytes written by a torn write of _Size bytes
+    constexpr size_t _Torn_write_size(const size_t _Size) noexcept {
+        return (_Size / 2) & ~size_t{511}; // whole 512-byte sectors
+    }
+
+    // terminates the process with fault_exit_code
+    [[noreturn]] void _Inject_fault() noexcept;
+
+#ifdef _FCRYPT_FAULT_INJECTION
+    // counts the site, returns true if the process must be terminated there
+    bool _Fault_due(const fault_site _Site) noexcept;
+#else // ^^^ _FCRYPT_FAULT_INJECTION ^^^ / vvv !_FCRYPT_FAULT_INJECTION vvv
+    constexpr bool _Fault_due(const fault_site) noexcept { // does nothing, the fault injection is disabled
+        return false;
+    }
+#endif // _FCRYPT_FAULT_INJECTION
+} // namespace fcrypt
+
+#endif // _FCRYPT_FS_FAULT_INJECTION_HPP_
\ No newline at end of file
@@ -5,17 +5,31 @@
 
 #include <fcrypt/fs/file.hpp>
 #include <fcrypt/app/tinywin.hpp>
+#include <fcrypt/fs/fault_injection.hpp>
 
 namespace fcrypt {
-    file::file(const path& _Target) : _Myhandle(_Open(_Target)), _Myoff(0) {}
+    file::file(const path& _Target, const open_mode _Mode) : _Myhandle(_Open(_Target, _Mode)), _Myoff(0) {}
 
     file::~file() noexcept {
         close();
     }
 
-    [[nodiscard]] void* file::_Open(const path& _Target) {
+    [[nodiscard]] void* file::_Open(const path& _Target, const open_mode _Mode) {
+        unsigned long _Disposition;
+        switch (_Mode) {
+        case open_mode::open_always:
+            _Disposition = OPEN_ALWAYS;
+            break;
+        case open_mode::create_always:
+            _Disposition = CREATE_ALWAYS;
+            break;
+        default:
+            _Disposition = OPEN_EXISTING;
+            break;
+        }
+
         return ::CreateFileW(_Target.c_str(), GENERIC_READ | GENERIC_WRITE,
-            0, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            0, nullptr, _Disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
     }
 
     size_t file::_Read_bytes(void* const _Handle, byte_t* const _Buf, const size_t _Count) noexcept {
@@ -31,6 +45,27 @@ namespace fcrypt {
             ? _Written == _Count : false;
     }
 
+    size_t file::_Read_bytes_at(
+        void* const _Handle, const uint64_t _Off, byte_t* const _Buf, const size_t _Count) noexcept {
+        OVERLAPPED _Overlapped = {};
+        _Overlapped.Offset     = static_cast<unsigned long>(_Off);
+        _Overlapped.OffsetHigh = static_cast<unsigned long>(_Off >> 32);
+        unsigned long _Read    = 0;
+        return ::ReadFile(_Handle, _Buf, static_cast<unsigned long>(_Count), &_Read, &_Overlapped) != 0
+            ? static_cast<size_t>(_Read) : 0;
+    }
+
+    bool file::_Write_bytes_at(
+        void* const _Handle, const uint64_t _Off, const byte_string_view _Bytes) noexcept {
+        OVERLAPPED _Overlapped     = {};
+        _Overlapped.Offset         = static_cast<unsigned long>(_Off);
+        _Overlapped.OffsetHigh     = static_cast<unsigned long>(_Off >> 32);
+        const unsigned long _Count = static_cast<unsigned long>(_Bytes.size());
+        unsigned long _Written     = 0;
+        return ::WriteFile(_Handle, _Bytes.data(), _Count, &_Written, &_Overlapped) != 0
+            ? _Written == _Count : false;
+    }
+
     bool file::_Seek(void* const _Handle, const uint64_t _New_pos) noexcept {
         long _High = static_cast<long>((_New_pos & 0xFFFF'FFFF'0000'0000) >> 32);
         return ::SetFilePointer(
@@ -79,6 +114,11 @@ namespace fcrypt {
             return true;
         }
 
+        if (_Fault_due(fault_site::write)) { // simulates a process killed in the middle of the write
+            _Write_bytes(_Myhandle, _Bytes.substr(0, _Torn_write_size(_Bytes.size())));
+            _Inject_fault();
+        }
+
         if (_Write_bytes(_Myhandle, _Bytes)) {
 #ifdef _M_X64
             _Myoff += _Bytes.size();
@@ -91,6 +131,45 @@ namespace fcrypt {
         }
     }
 
+    size_t file::read_at(const uint64_t _Off, byte_t* const _Buf, const size_t _Count) noexcept {
+        if (!_Myhandle || !_Buf) {
+            return 0;
+        }
+
+        // Note: Positional I/O does not depend on the file pointer, so it can be used by many threads
+        //       at once. The system moves the file pointer anyway, so _Myoff becomes unreliable.
+        return _Count != 0 ? _Read_bytes_at(_Myhandle, _Off, _Buf, _Count) : 0;
+    }
+
+    bool file::write_at(const uint64_t _Off, const byte_string_view _Bytes) noexcept {
+        if (!_Myhandle) {
+            return false;
+        }
+
+        if (_Bytes.empty()) { // nothing to write, do nothing
+            return true;
+        }
+
+        if (_Fault_due(fault_site::write)) { // simulates a process killed in the middle of the write
+            _Write_bytes_at(_Myhandle, _Off, _Bytes.substr(0, _Torn_write_size(_Bytes.size())));
+            _Inject_fault();
+        }
+
+        return _Write_bytes_at(_Myhandle, _Off, _Bytes);
+    }
+
+    size_t file::read_sectors(const uint64_t _First, byte_t* const _Buf, const size_t _Count) noexcept {
+        return read_at(_First * sector_size, _Buf, _Count * sector_size);
+    }
+
+    bool file::write_sectors(const uint64_t _First, const byte_string_view _Bytes) noexcept {
+        if (_Bytes.size() % sector_size != 0) { // only whole sectors can be written
+            return false;
+        }
+
+        return write_at(_First * sector_size, _Bytes);
+    }
+
     bool file::seek(const uint64_t _New_pos) noexcept {
         if (!_Myhandle) {
             return false;
@@ -168,7 +247,13 @@ namespace fcrypt {
         const uint64_t _Old_size = size();
         if (_New_size == _Old_size) { // nothing will change, do nothing
             return true;
-        } else if (_New_size < _Old_size) { // try to decrease the file size
+        }
+
+        if (_Fault_due(fault_site::write)) { // simulates a process killed before the size is changed
+            _Inject_fault();
+        }
+
+        if (_New_size < _Old_size) { // try to decrease the file size
             if (!seek(_New_size)) {
                 return false;
             }
@@ -182,4 +267,16 @@ namespace fcrypt {
 
         return ::SetEndOfFile(_Myhandle) != 0;
     }
+
+    bool file::flush() noexcept {
+        if (!_Myhandle) {
+            return false;
+        }
+
+        return ::FlushFileBuffers(_Myhandle) != 0;
+    }
+
+    void* file::native_handle() const noexcept {
+        return _Myhandle;
+    }
 } // namespace fcrypt
\ No newline at end of file
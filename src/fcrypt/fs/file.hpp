@@ -16,11 +16,19 @@ namespace fcrypt {
 
     enum class move_direction : bool { backward, forward };
 
+    enum class open_mode : unsigned char { // specifies how the file is opened
+        open_existing, // opens an existing file, fails if the file does not exist
+        open_always, // opens an existing file, creates a new file if the file does not exist
+        create_always // creates a new file, truncates the file if it already exists
+    };
+
     class file {
     public:
-        explicit file(const path& _Target);
+        explicit file(const path& _Target, const open_mode _Mode = open_mode::open_existing);
         ~file() noexcept;
 
+        static constexpr size_t sector_size = 4096; // the unit of sector-level I/O
+
         // checks if any file is open
         bool is_open() const noexcept;
 
@@ -33,6 +41,18 @@ namespace fcrypt {
         // tries to write _Bytes to the file
         bool write(const byte_string_view _Bytes) noexcept;
 
+        // tries to read _Count bytes starting at _Off (the file pointer is left unspecified)
+        size_t read_at(const uint64_t _Off, byte_t* const _Buf, const size_t _Count) noexcept;
+
+        // tries to write _Bytes starting at _Off (the file pointer is left unspecified)
+        bool write_at(const uint64_t _Off, const byte_string_view _Bytes) noexcept;
+
+        // tries to read _Count sectors starting at the sector _First, returns the number of bytes read
+        size_t read_sectors(const uint64_t _First, byte_t* const _Buf, const size_t _Count) noexcept;
+
+        // tries to write whole sectors starting at the sector _First
+        bool write_sectors(const uint64_t _First, const byte_string_view _Bytes) noexcept;
+
         // tries to change the file pointer position
         bool seek(const uint64_t _New_pos) noexcept;
 
@@ -51,9 +71,15 @@ namespace fcrypt {
         // tries to resize the file
         bool resize(const uint64_t _New_size) noexcept;
 
+        // tries to flush the written data to the disk
+        bool flush() noexcept;
+
+        // returns the native file handle
+        void* native_handle() const noexcept;
+
     private:
         // tries to open a file
-        [[nodiscard]] static void* _Open(const path& _Target);
+        [[nodiscard]] static void* _Open(const path& _Target, const open_mode _Mode);
 
         // tries to read some bytes from a file
         static size_t _Read_bytes(void* const _Handle, byte_t* const _Buf, const size_t _Count) noexcept;
@@ -61,6 +87,14 @@ namespace fcrypt {
         // tries to write some bytes to a file
         static bool _Write_bytes(void* const _Handle, const byte_string_view _Bytes) noexcept;
 
+        // tries to read some bytes from a file at the specified offset
+        static size_t _Read_bytes_at(
+            void* const _Handle, const uint64_t _Off, byte_t* const _Buf, const size_t _Count) noexcept;
+
+        // tries to write some bytes to a file at the specified offset
+        static bool _Write_bytes_at(
+            void* const _Handle, const uint64_t _Off, const byte_string_view _Bytes) noexcept;
+
         // tries to change the file pointer position
         static bool _Seek(void* const _Handle, const uint64_t _New_pos) noexcept;
 
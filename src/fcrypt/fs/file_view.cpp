@@ -0,0 +1,86 @@
+// file_view.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/fs/file_view.hpp>
+#include <fcrypt/app/tinywin.hpp>
+
+namespace fcrypt {
+    file_view::file_view(file& _File) noexcept
+        : _Myfile(_File), _Mymapping(nullptr), _Myptr(nullptr), _Mysize(0) {}
+
+    file_view::~file_view() noexcept {
+        unmap();
+        _Close_mapping();
+    }
+
+    bool file_view::_Create_mapping() noexcept {
+        if (_Mymapping) { // already created, do nothing
+            return true;
+        }
+
+        // Note: The mapping object covers the whole file (zero size), views are mapped on demand.
+        _Mymapping = ::CreateFileMappingW(_Myfile.native_handle(), nullptr, PAGE_READWRITE, 0, 0, nullptr);
+        return _Mymapping != nullptr;
+    }
+
+    void file_view::_Close_mapping() noexcept {
+        if (_Mymapping) {
+            ::CloseHandle(_Mymapping);
+            _Mymapping = nullptr;
+        }
+    }
+
+    bool file_view::is_mapped() const noexcept {
+        return _Myptr != nullptr;
+    }
+
+    bool file_view::map(const uint64_t _Off, const size_t _Size) noexcept {
+        unmap(); // only one view can be mapped at a time
+        if (_Size == 0 || _Off % granularity != 0) { // empty or misaligned view
+            return false;
+        }
+
+        if (_Off + _Size > _Myfile.size()) { // out of bounds
+            return false;
+        }
+
+        if (!_Create_mapping()) {
+            return false;
+        }
+
+        _Myptr = static_cast<byte_t*>(::MapViewOfFile(_Mymapping, FILE_MAP_READ | FILE_MAP_WRITE,
+            static_cast<unsigned long>(_Off >> 32), static_cast<unsigned long>(_Off), _Size));
+        if (!_Myptr) {
+            return false;
+        }
+
+        _Mysize = _Size;
+        return true;
+    }
+
+    void file_view::unmap() noexcept {
+        if (_Myptr) {
+            ::UnmapViewOfFile(_Myptr);
+            _Myptr  = nullptr;
+            _Mysize = 0;
+        }
+    }
+
+    bool file_view::flush() noexcept {
+        return _Myptr ? ::FlushViewOfFile(_Myptr, _Mysize) != 0 : false;
+    }
+
+    byte_t* file_view::data() noexcept {
+        return _Myptr;
+    }
+
+    const byte_t* file_view::data() const noexcept {
+        return _Myptr;
+    }
+
+    size_t file_view::size() const noexcept {
+        return _Mysize;
+    }
+} // namespace fcrypt
\ No newline at end of file
@@ -0,0 +1,60 @@
+// file_view.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_FS_FILE_VIEW_HPP_
+#define _FCRYPT_FS_FILE_VIEW_HPP_
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <cstddef>
+#include <cstdint>
+
+namespace fcrypt {
+    class file_view { // maps a part of the file into memory
+    public:
+        explicit file_view(file& _File) noexcept;
+        ~file_view() noexcept;
+
+        file_view(const file_view&) = delete;
+        file_view& operator=(const file_view&) = delete;
+
+        static constexpr size_t granularity = 65536; // offsets must be a multiple of this value
+
+        // checks if any part of the file is mapped
+        bool is_mapped() const noexcept;
+
+        // tries to map _Size bytes starting at _Off
+        bool map(const uint64_t _Off, const size_t _Size) noexcept;
+
+        // unmaps the currently mapped part of the file
+        void unmap() noexcept;
+
+        // tries to write the modified pages of the view to the file
+        bool flush() noexcept;
+
+        // returns a mutable pointer to the mapped data
+        byte_t* data() noexcept;
+
+        // returns a non-mutable pointer to the mapped data
+        const byte_t* data() const noexcept;
+
+        // returns the size of the mapped data
+        size_t size() const noexcept;
+
+    private:
+        // tries to create a file mapping object
+        bool _Create_mapping() noexcept;
+
+        // closes the file mapping object
+        void _Close_mapping() noexcept;
+
+        file& _Myfile;
+        void* _Mymapping;
+        byte_t* _Myptr;
+        size_t _Mysize;
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_FS_FILE_VIEW_HPP_
\ No newline at end of file
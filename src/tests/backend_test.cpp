@@ -0,0 +1,162 @@
+// backend_test.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/container.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <tests/test_context.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cwchar>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Note: Checks that the OpenSSL and Botan engines are interchangeable: the same key and IV must give
+//       the same ciphertext and tag however the message is split into calls, and each backend must
+//       decrypt the output of the other one. The container round trip covers the callers that pass
+//       blocks of any size. Usage: backend_test [--directory <dir>], the exit code is 0 on success.
+
+namespace fcrypt {
+    // splits _Size bytes into calls of random (mostly odd) sizes
+    ::std::vector<size_t> _Random_split(::std::mt19937& _Gen, const size_t _Size) {
+        constexpr size_t _Sizes[] = {1, 3, 15, 16, 17, 63, 64, 65, 255, 4095, 4096, 4097, 65537};
+        ::std::vector<size_t> _Split;
+        for (size_t _Off = 0; _Off < _Size;) {
+            const size_t _Count = _Min(_Sizes[_Gen() % (sizeof(_Sizes) / sizeof(_Sizes[0]))], _Size - _Off);
+            _Split.push_back(_Count);
+            _Off += _Count;
+        }
+
+        return _Split;
+    }
+
+    // tries to encrypt/decrypt the buffer in place with the bound backend, in the specified calls
+    bool _Run_split(const encryption_backend _Backend, const bool _Encrypt, const key& _Key, const iv& _Iv,
+        ::std::vector<byte_t>& _Buf, const ::std::vector<size_t>& _Split, authentication_tag& _Tag) {
+        bind_encryption_backend(_Backend);
+        const ::std::unique_ptr<encryption_engine> _Engine(make_encryption_engine(encryption_engine::aes256_gcm));
+        if (!_Engine || !(_Encrypt ? _Engine->setup_encryption(_Key, _Iv) : _Engine->setup_decryption(_Key, _Iv))) {
+            return false;
+        }
+
+        size_t _Off = 0;
+        for (const size_t _Count : _Split) {
+            byte_t* const _Ptr = _Buf.data() + _Off;
+            if (!(_Encrypt ? _Engine->encrypt(_Ptr, _Count, _Ptr) : _Engine->decrypt(_Ptr, _Count, _Ptr))) {
+                return false;
+            }
+
+            _Off += _Count;
+        }
+
+        return _Encrypt ? _Engine->complete_encryption(_Tag) : _Engine->complete_decryption(_Tag);
+    }
+
+    void _Test_split_messages(_Test_context& _Context) {
+        constexpr size_t _Sizes[] = {0, 1, 15, 16, 17, 100, 4095, 4096, 4097, 65535, 1048577};
+        ::std::mt19937 _Gen(29);
+        for (const size_t _Size : _Sizes) {
+            for (int _Round = 0; _Round < 8; ++_Round) {
+                const key _Key = key::generate();
+                const iv _Iv   = iv::generate();
+                ::std::vector<byte_t> _Plaintext(_Size);
+                for (byte_t& _Byte : _Plaintext) {
+                    _Byte = static_cast<byte_t>(_Gen());
+                }
+
+                // the reference is encrypted by OpenSSL in a single call
+                ::std::vector<byte_t> _Expected = _Plaintext;
+                authentication_tag _Expected_tag;
+                const ::std::vector<size_t> _Whole(_Size != 0 ? 1 : 0, _Size);
+                _Context.check(
+                    _Run_split(encryption_backend::openssl, true, _Key, _Iv, _Expected, _Whole, _Expected_tag),
+                    "openssl encrypts the whole message");
+                for (const encryption_backend _Backend : {encryption_backend::openssl, encryption_backend::botan}) {
+                    ::std::vector<byte_t> _Buf = _Plaintext;
+                    authentication_tag _Tag;
+                    _Context.check(_Run_split(_Backend, true, _Key, _Iv, _Buf, _Random_split(_Gen, _Size), _Tag),
+                        "split encryption succeeds");
+                    _Context.check(_Buf == _Expected, "split encryption gives the same ciphertext");
+                    _Context.check(::memcmp(_Tag.get(), _Expected_tag.get(), authentication_tag::size) == 0,
+                        "split encryption gives the same tag");
+                    const encryption_backend _Other = _Backend == encryption_backend::botan
+                        ? encryption_backend::openssl : encryption_backend::botan;
+                    _Context.check(_Run_split(_Other, false, _Key, _Iv, _Buf, _Random_split(_Gen, _Size), _Tag),
+                        "the other backend verifies the tag");
+                    _Context.check(_Buf == _Plaintext, "the other backend restores the plaintext");
+                    _Buf = _Expected;
+                    authentication_tag _Bad = _Expected_tag;
+                    _Bad.get()[0] ^= 1;
+                    _Context.check(!_Run_split(_Backend, false, _Key, _Iv, _Buf, _Random_split(_Gen, _Size), _Bad),
+                        "a modified tag is rejected");
+                }
+            }
+        }
+    }
+
+    void _Test_container(_Test_context& _Context, const path& _Directory) {
+        const path _Target = _Directory / L"backend_test.container";
+        ::std::mt19937 _Gen(33);
+        ::std::vector<::std::vector<byte_t>> _Members;
+        for (const size_t _Size : {size_t{0}, size_t{1}, size_t{4097}, size_t{1048577}, size_t{3000001}}) {
+            ::std::vector<byte_t> _Bytes(_Size);
+            for (byte_t& _Byte : _Bytes) {
+                _Byte = static_cast<byte_t>(_Gen());
+            }
+
+            _Members.push_back(::std::move(_Bytes));
+        }
+
+        for (const encryption_backend _Backend : {encryption_backend::openssl, encryption_backend::botan}) {
+            bind_encryption_backend(_Backend);
+            const key _Key = key::generate();
+            {
+                container_writer _Writer(_Target, encryption_engine::aes256_gcm);
+                bool _Success = _Writer.is_open() && _Writer.begin(_Key, salt::generate());
+                for (size_t _Idx = 0; _Idx < _Members.size() && _Success; ++_Idx) {
+                    _Success = _Writer.add(::std::to_wstring(_Idx),
+                        byte_string_view{_Members[_Idx].data(), _Members[_Idx].size()});
+                }
+
+                _Context.check(_Success && _Writer.complete(), "the container is written");
+            }
+
+            container_reader _Reader(_Target, encryption_engine::aes256_gcm);
+            _Context.check(_Reader.is_open() && _Reader.load_footer() && _Reader.load_index(_Key),
+                "the container index is loaded");
+            for (size_t _Idx = 0; _Idx < _Members.size(); ++_Idx) {
+                ::std::vector<byte_t> _Buf;
+                _Context.check(_Reader.extract(::std::to_wstring(_Idx), _Buf) && _Buf == _Members[_Idx],
+                    "the member is extracted");
+            }
+        }
+
+        ::std::error_code _Code;
+        ::std::filesystem::remove(_Target, _Code);
+    }
+} // namespace fcrypt
+
+int wmain(int _Count, wchar_t** _Args) {
+    fcrypt::path _Directory = ::std::filesystem::temp_directory_path();
+    if (_Count == 3 && ::wcscmp(_Args[1], L"--directory") == 0) {
+        _Directory = _Args[2];
+    } else if (_Count != 1) {
+        ::fputws(L"usage: backend_test [--directory <dir>]\n", stderr);
+        return 1;
+    }
+
+    fcrypt::_Test_context _Context;
+    fcrypt::_Test_split_messages(_Context);
+    fcrypt::_Test_container(_Context, _Directory);
+    fcrypt::bind_encryption_backend(fcrypt::encryption_backend::openssl);
+    ::printf("%zu failed check(s)\n", _Context.failed());
+    return _Context.failed() == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,331 @@
+// fault_injection_test.cpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#include <fcrypt/app/tinywin.hpp>
+#include <fcrypt/app/utils.hpp>
+#include <fcrypt/crypt/chunked_encryption_engine.hpp>
+#include <fcrypt/crypt/directory_encryption_engine.hpp>
+#include <fcrypt/crypt/encryption_engine.hpp>
+#include <fcrypt/crypt/job_journal.hpp>
+#include <fcrypt/crypt/kdf.hpp>
+#include <fcrypt/fs/fault_injection.hpp>
+#include <fcrypt/fs/file.hpp>
+#include <tests/test_context.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cwchar>
+#include <filesystem>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Note: Checks that every interrupted operation can be resumed. The operation runs in a child process
+//       (this test started with --child), which the library terminates at the N-th fault site. The test
+//       then resumes the operation in its own process and checks that the result matches the original
+//       files byte for byte. Every site is tried if there are only a few, otherwise a sample spread evenly
+//       over all of them. The library must be compiled with _FCRYPT_FAULT_INJECTION defined.
+//       Usage: fault_injection_test [--directory <dir>], the exit code is 0 on success.
+
+namespace fcrypt {
+    struct _Scenario { // an operation that is interrupted and resumed
+        const char* name;
+        fault_site site;
+        bool (*prepare)(const path& _Directory); // creates the input
+        bool (*run)(const path& _Directory); // runs the operation, or resumes the interrupted one
+        bool (*verify)(const path& _Directory); // checks the output of the finished operation
+    };
+
+    inline constexpr size_t _Max_sampled_sites = 40; // more sites are sampled evenly
+
+    template <class _Buffer>
+    _Buffer _Fixed_buffer(const byte_t _Seed) noexcept { // the child and the test must use the same key and salt
+        byte_t _Bytes[_Buffer::size];
+        for (size_t _Idx = 0; _Idx < _Buffer::size; ++_Idx) {
+            _Bytes[_Idx] = static_cast<byte_t>(_Seed + _Idx * 7);
+        }
+
+        _Buffer _Result;
+        _Result.set(_Bytes);
+        return _Result;
+    }
+
+    ::std::vector<byte_t> _Make_content(const uint32_t _Seed, const size_t _Size) {
+        ::std::mt19937 _Gen(_Seed);
+        ::std::vector<byte_t> _Bytes(_Size);
+        for (byte_t& _Byte : _Bytes) {
+            _Byte = static_cast<byte_t>(_Gen());
+        }
+
+        return _Bytes;
+    }
+
+    bool _Write_file(const path& _Target, const ::std::vector<byte_t>& _Bytes) {
+        file _File(_Target, open_mode::create_always);
+        return _File.is_open() && _File.write(byte_string_view{_Bytes.data(), _Bytes.size()});
+    }
+
+    bool _Has_content(const path& _Target, const ::std::vector<byte_t>& _Expected) {
+        file _File(_Target);
+        if (!_File.is_open() || _File.size() != _Expected.size()) {
+            return false;
+        }
+
+        if (_Expected.empty()) { // read() reports success instead of the number of bytes for empty reads
+            return true;
+        }
+
+        ::std::vector<byte_t> _Bytes(_Expected.size());
+        return _File.read(_Bytes.data(), _Bytes.size()) == _Bytes.size() && _Bytes == _Expected;
+    }
+
+    bool _Exists(const path& _Target) {
+        ::std::error_code _Ec;
+        return ::std::filesystem::exists(_Target, _Ec);
+    }
+
+    // the chunked file, 6 chunks of the default size, the last one is partial
+    inline constexpr size_t _Chunked_size = 5 * chunked_encryption_engine::default_chunk_size + 1234;
+
+    bool _Prepare_chunked(const path& _Directory) {
+        ::std::error_code _Ec;
+        ::std::filesystem::remove(_Directory / L"chunked.journal", _Ec);
+        return _Write_file(_Directory / L"chunked.bin", _Make_content(47, _Chunked_size));
+    }
+
+    template <size_t _Threads, bool _Merkle_tree>
+    bool _Encrypt_chunked(const path& _Directory) {
+        file _File(_Directory / L"chunked.bin");
+        chunked_encryption_engine _Engine(
+            _File, encryption_engine::aes256_gcm, chunked_encryption_engine::default_chunk_size, _Merkle_tree);
+        return _File.is_open()
+            && _Engine.encrypt_journaled(_Fixed_buffer<key>(0x4B), _Fixed_buffer<salt>(0x53),
+                _Directory / L"chunked.journal", _Threads, 2); // 3 journal entries
+    }
+
+    bool _Verify_chunked(const path& _Directory) {
+        if (_Exists(_Directory / L"chunked.journal")) { // the finished encryption removes its journal
+            return false;
+        }
+
+        {
+            file _File(_Directory / L"chunked.bin");
+            chunked_encryption_engine _Engine(_File, encryption_engine::aes256_gcm);
+            if (!_File.is_open() || !_Engine.decrypt(_Fixed_buffer<key>(0x4B), 2)) {
+                return false;
+            }
+        }
+
+        return _Has_content(_Directory / L"chunked.bin", _Make_content(47, _Chunked_size));
+    }
+
+    struct _Tree_file { // a file of the directory scenarios
+        const wchar_t* name;
+        uint32_t seed;
+        size_t size;
+    };
+
+    // small files are batched, the stream files are written in several regions, the last file is chunked
+    inline constexpr _Tree_file _Tree_files[] = {{L"empty.bin", 11, 0}, {L"a/small.bin", 12, 100},
+        {L"a/sector.bin", 13, 512}, {L"a/odd.bin", 14, 4097}, {L"b/medium.bin", 15, 70000},
+        {L"b/large.bin", 16, 1048576}, {L"c/stream.bin", 17, 2621440 + 123}, {L"c/regions.bin", 18, 3145728},
+        {L"d/chunked.bin", 19, _Chunked_size}};
+    inline constexpr uint64_t _Tree_chunked_threshold = 4194304; // only the last file is chunked
+    inline constexpr wchar_t _Tree_password[]         = L"fault injection";
+
+    bool _Prepare_tree(const path& _Directory) {
+        ::std::error_code _Ec;
+        ::std::filesystem::remove_all(_Directory / L"tree", _Ec);
+        ::std::filesystem::remove_all(_Directory / L"chunks", _Ec);
+        ::std::filesystem::remove(_Directory / L"job.journal", _Ec);
+        ::std::filesystem::remove(_Directory / L"job.journal.bitmap", _Ec);
+        ::std::filesystem::create_directories(_Directory / L"chunks", _Ec); // outside the tree
+        for (const _Tree_file& _File : _Tree_files) {
+            const path _Target = _Directory / L"tree" / _File.name;
+            ::std::filesystem::create_directories(_Target.parent_path(), _Ec);
+            if (!_Write_file(_Target, _Make_content(_File.seed, _File.size))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool _Process_tree(const path& _Directory, const bool _Encrypt, const bool _Journaled) {
+        directory_encryption_engine _Engine(_Directory / L"tree", encryption_engine::aes256_gcm, 2);
+        _Engine.enable_chunked(_Directory / L"chunks", _Tree_chunked_threshold);
+        ::std::unique_ptr<job_journal> _Journal;
+        if (_Journaled) {
+            _Journal = ::std::make_unique<job_journal>(_Directory / L"job.journal");
+        }
+
+        const ::std::vector<file_result> _Results = _Encrypt
+            ? _Engine.encrypt(_Tree_password, nullptr, _Journal.get())
+            : _Engine.decrypt(_Tree_password, nullptr, _Journal.get());
+        bool _Success = _Results.size() == sizeof(_Tree_files) / sizeof(_Tree_files[0]);
+        for (const file_result& _Result : _Results) {
+            _Success = _Success && _Result.success;
+        }
+
+        return _Success;
+    }
+
+    bool _Prepare_encrypted_tree(const path& _Directory) {
+        return _Prepare_tree(_Directory) && _Process_tree(_Directory, true, false);
+    }
+
+    bool _Encrypt_tree(const path& _Directory) {
+        return _Process_tree(_Directory, true, true);
+    }
+
+    bool _Decrypt_tree(const path& _Directory) {
+        return _Process_tree(_Directory, false, true);
+    }
+
+    bool _Verify_decrypted_tree(const path& _Directory) {
+        if (_Exists(_Directory / L"job.journal") || _Exists(_Directory / L"job.journal.bitmap")) {
+            return false; // the finished job removes its journal
+        }
+
+        for (const _Tree_file& _File : _Tree_files) {
+            if (!_Has_content(_Directory / L"tree" / _File.name, _Make_content(_File.seed, _File.size))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool _Verify_encrypted_tree(const path& _Directory) {
+        // every file must have been encrypted exactly once, so a single decryption gives the original
+        return !_Exists(_Directory / L"job.journal") && _Process_tree(_Directory, false, false)
+            && _Verify_decrypted_tree(_Directory);
+    }
+
+    inline constexpr _Scenario _Scenarios[] = {
+        {"chunked encryption", fault_site::write, _Prepare_chunked, _Encrypt_chunked<1, false>, _Verify_chunked},
+        {"parallel chunked encryption", fault_site::write, _Prepare_chunked, _Encrypt_chunked<3, false>,
+            _Verify_chunked},
+        {"chunked encryption with a Merkle tree", fault_site::write, _Prepare_chunked, _Encrypt_chunked<2, true>,
+            _Verify_chunked},
+        {"journaled directory encryption", fault_site::write, _Prepare_tree, _Encrypt_tree, _Verify_encrypted_tree},
+        {"journaled directory encryption (unrecorded files)", fault_site::journal_record, _Prepare_tree,
+            _Encrypt_tree, _Verify_encrypted_tree},
+        {"journaled directory decryption", fault_site::write, _Prepare_encrypted_tree, _Decrypt_tree,
+            _Verify_decrypted_tree},
+        {"journaled directory decryption (unrecorded files)", fault_site::journal_record, _Prepare_encrypted_tree,
+            _Decrypt_tree, _Verify_decrypted_tree}};
+
+    inline constexpr size_t _Scenario_count = sizeof(_Scenarios) / sizeof(_Scenarios[0]);
+
+    // returns the sites at which the operation is interrupted
+    ::std::vector<uint64_t> _Sample_sites(const uint64_t _Total) {
+        ::std::vector<uint64_t> _Sites;
+        const uint64_t _Count = _Min(_Total, static_cast<uint64_t>(_Max_sampled_sites));
+        for (uint64_t _Idx = 0; _Idx < _Count; ++_Idx) { // the first and the last site are always included
+            _Sites.push_back(_Count > 1 ? 1 + _Idx * (_Total - 1) / (_Count - 1) : 1);
+        }
+
+        return _Sites;
+    }
+
+    // runs the scenario in a child process that is terminated at the site, returns its exit code
+    DWORD _Run_child(const path& _Self, const path& _Directory, const size_t _Scenario_idx, const uint64_t _Site) {
+        ::std::wstring _Command = L"\"" + _Self.wstring() + L"\" --child " + ::std::to_wstring(_Scenario_idx) + L' '
+            + ::std::to_wstring(_Site) + L" --directory \"" + _Directory.wstring() + L'"';
+        STARTUPINFOW _Startup        = {};
+        _Startup.cb                  = sizeof(_Startup);
+        PROCESS_INFORMATION _Process = {};
+        if (!::CreateProcessW(
+                nullptr, _Command.data(), nullptr, nullptr, FALSE, 0, nullptr, nullptr, &_Startup, &_Process)) {
+            return static_cast<DWORD>(-1);
+        }
+
+        DWORD _Code = static_cast<DWORD>(-1);
+        if (::WaitForSingleObject(_Process.hProcess, INFINITE) != WAIT_OBJECT_0
+            || !::GetExitCodeProcess(_Process.hProcess, &_Code)) {
+            _Code = static_cast<DWORD>(-1);
+        }
+
+        ::CloseHandle(_Process.hThread);
+        ::CloseHandle(_Process.hProcess);
+        return _Code;
+    }
+
+    void _Test_scenario(_Test_context& _Context, const path& _Self, const path& _Directory, const size_t _Idx) {
+        const _Scenario& _Current = _Scenarios[_Idx];
+        const bool _Prepared = _Current.prepare(_Directory);
+        arm_fault(_Current.site, 0); // only counts the sites of the operation
+        const bool _Finished  = _Prepared && _Current.run(_Directory);
+        const uint64_t _Total = reached_fault_sites(_Current.site);
+        _Context.check(_Finished && _Current.verify(_Directory), "the uninterrupted operation succeeds");
+        _Context.check(_Total != 0, "the operation reaches a fault site");
+        uint64_t _Interrupted = 0;
+        for (const uint64_t _Site : _Sample_sites(_Total)) {
+            const size_t _Failed = _Context.failed();
+            _Context.check(_Current.prepare(_Directory), "the input is created");
+            const DWORD _Code = _Run_child(_Self, _Directory, _Idx, _Site);
+            _Context.check(_Code == fault_exit_code || _Code == 0, "the child is terminated or finishes");
+            if (_Code == fault_exit_code) { // a finished operation must not be run again
+                ++_Interrupted;
+                arm_fault(_Current.site, 0);
+                _Context.check(_Current.run(_Directory), "the interrupted operation is resumed");
+            }
+
+            _Context.check(_Current.verify(_Directory), "the resumed operation gives the original files");
+            if (_Context.failed() != _Failed) {
+                ::fprintf(stderr, "  in \"%s\" interrupted at site %llu\n", _Current.name,
+                    static_cast<unsigned long long>(_Site));
+            }
+        }
+
+        _Context.check(_Interrupted != 0, "the child is terminated at least once");
+        ::printf("%s: interrupted at %llu of %llu site(s)\n", _Current.name,
+            static_cast<unsigned long long>(_Interrupted), static_cast<unsigned long long>(_Total));
+    }
+} // namespace fcrypt
+
+int wmain(int _Count, wchar_t** _Args) {
+    fcrypt::path _Directory = ::std::filesystem::temp_directory_path();
+    if (_Count == 6 && ::wcscmp(_Args[1], L"--child") == 0 && ::wcscmp(_Args[4], L"--directory") == 0) {
+        const size_t _Idx = static_cast<size_t>(::wcstoull(_Args[2], nullptr, 10));
+        if (_Idx >= fcrypt::_Scenario_count) {
+            return 1;
+        }
+
+        fcrypt::arm_fault(fcrypt::_Scenarios[_Idx].site, ::wcstoull(_Args[3], nullptr, 10));
+        return fcrypt::_Scenarios[_Idx].run(_Args[5]) ? 0 : 1;
+    }
+
+    if (_Count == 3 && ::wcscmp(_Args[1], L"--directory") == 0) {
+        _Directory = _Args[2];
+    } else if (_Count != 1) {
+        ::fputws(L"usage: fault_injection_test [--directory <dir>]\n", stderr);
+        return 1;
+    }
+
+    if (!fcrypt::fault_injection_enabled()) {
+        ::fputws(L"the library must be compiled with _FCRYPT_FAULT_INJECTION defined\n", stderr);
+        return 1;
+    }
+
+    ::std::vector<wchar_t> _Self(32768);
+    if (::GetModuleFileNameW(nullptr, _Self.data(), static_cast<DWORD>(_Self.size())) == 0) {
+        return 1;
+    }
+
+    const fcrypt::path _Work = _Directory / L"fault_injection_test"; // the child gets this directory
+    ::std::error_code _Ec;
+    ::std::filesystem::create_directories(_Work, _Ec);
+    fcrypt::_Test_context _Context;
+    for (size_t _Idx = 0; _Idx < fcrypt::_Scenario_count; ++_Idx) {
+        fcrypt::_Test_scenario(_Context, _Self.data(), _Work, _Idx);
+    }
+
+    ::std::filesystem::remove_all(_Work, _Ec);
+    ::printf("%zu failed check(s)\n", _Context.failed());
+    return _Context.failed() == 0 ? 0 : 1;
+}
\ No newline at end of file
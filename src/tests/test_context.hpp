@@ -0,0 +1,31 @@
+// test_context.hpp
+
+// Copyright (c) Mateusz Jandura. All rights reserved.
+// SPDX-License-Identifier: Apache-2.0
+
+#pragma once
+#ifndef _FCRYPT_TESTS_TEST_CONTEXT_HPP_
+#define _FCRYPT_TESTS_TEST_CONTEXT_HPP_
+#include <cstddef>
+#include <cstdio>
+
+namespace fcrypt {
+    class _Test_context { // counts the failed checks
+    public:
+        void check(const bool _Condition, const char* const _What) {
+            if (!_Condition) {
+                ::fprintf(stderr, "FAILED: %s\n", _What);
+                ++_Myfailed;
+            }
+        }
+
+        size_t failed() const noexcept {
+            return _Myfailed;
+        }
+
+    private:
+        size_t _Myfailed = 0;
+    };
+} // namespace fcrypt
+
+#endif // _FCRYPT_TESTS_TEST_CONTEXT_HPP_
\ No newline at end of file